@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include <AudioAccumulator.h>
+
+// 100ns units, as REFTIMES_PER_SEC
+#define TIME_UNITS_PER_SEC 10000000ULL
+
+AudioAccumulator::AudioAccumulator(uint32_t sampleRate, uint32_t blockAlign, uint32_t blockFrames)
+	: sampleRate(sampleRate), blockAlign(blockAlign), blockFrames(blockFrames), block((size_t)blockFrames * blockAlign) {
+}
+
+void AudioAccumulator::Start(int64_t startTime) {
+	this->startTime = startTime;
+	blockStartFrame = 0;
+	filled = 0;
+}
+
+uint8_t* AudioAccumulator::WritePointer(size_t* pBytesFree) {
+	*pBytesFree = block.size() - filled;
+	return block.data() + filled;
+}
+
+void AudioAccumulator::Commit(size_t bytes) {
+	filled += bytes;
+}
+
+size_t AudioAccumulator::Append(const uint8_t* pData, size_t bytes) {
+	size_t bytesFree = 0;
+	uint8_t* pDest = WritePointer(&bytesFree);
+	size_t taken = bytes < bytesFree ? bytes : bytesFree;
+	taken -= taken % blockAlign;
+	memcpy(pDest, pData, taken);
+	Commit(taken);
+	return taken;
+}
+
+bool AudioAccumulator::BlockReady() const {
+	return filled == block.size();
+}
+
+AudioBlock AudioAccumulator::PendingBlock() const {
+	AudioBlock pending;
+	pending.pData = block.data();
+	pending.bytes = filled;
+	pending.frames = (uint32_t)(filled / blockAlign);
+	pending.timestamp = FrameTime(blockStartFrame);
+	pending.duration = FrameTime(blockStartFrame + pending.frames) - pending.timestamp;
+	return pending;
+}
+
+void AudioAccumulator::NextBlock() {
+	blockStartFrame += filled / blockAlign;
+	filled = 0;
+}
+
+/*
+Splits the frame count into whole seconds and a remainder so the product
+cannot overflow, whatever the recording length
+*/
+int64_t AudioAccumulator::FrameTime(uint64_t frame) const {
+	uint64_t seconds = frame / sampleRate;
+	uint64_t remainder = frame % sampleRate;
+	return startTime + (int64_t)(seconds * TIME_UNITS_PER_SEC + remainder * TIME_UNITS_PER_SEC / sampleRate);
+}
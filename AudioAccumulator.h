@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// PCM frames per channel in one AAC frame
+const uint32_t AAC_FRAME_SAMPLES = 1024;
+
+typedef struct AudioBlock {
+	const uint8_t* pData;
+	size_t bytes;
+	uint32_t frames;
+	int64_t timestamp; // 100ns units
+	int64_t duration;  // 100ns units
+} AudioBlock;
+
+/*
+Coalesces PCM into fixed blocks of blockFrames frames (a multiple of
+AAC_FRAME_SAMPLES), so the encoder is fed whole AAC frames and each block
+costs a single media sample.
+Timestamps are derived from the frame count since Start, never accumulated,
+so rounding cannot drift however long the recording runs.
+*/
+class AudioAccumulator {
+public:
+	AudioAccumulator(uint32_t sampleRate, uint32_t blockAlign, uint32_t blockFrames);
+	// startTime is the timeline position of the first frame appended
+	void Start(int64_t startTime);
+	// Where the caller may copy up to *pBytesFree bytes of the pending block
+	uint8_t* WritePointer(size_t* pBytesFree);
+	// Accounts bytes copied through WritePointer, a whole number of frames
+	void Commit(size_t bytes);
+	// Copies as much of pData as fits in the pending block, returns the bytes taken
+	size_t Append(const uint8_t* pData, size_t bytes);
+	bool BlockReady() const;
+	// The pending block, complete or not (used to flush the tail)
+	AudioBlock PendingBlock() const;
+	// Starts a new block after the pending one was submitted
+	void NextBlock();
+	int64_t FrameTime(uint64_t frame) const;
+	uint64_t FramesSubmitted() const { return blockStartFrame; }
+private:
+	uint32_t sampleRate;
+	uint32_t blockAlign;
+	uint32_t blockFrames;
+	int64_t startTime = 0;
+	uint64_t blockStartFrame = 0;
+	size_t filled = 0;
+	std::vector<uint8_t> block;
+};
@@ -0,0 +1,273 @@
+#include <math.h>
+
+#include <AudioConvert.h>
+#include <CpuFeatures.h>
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+// Speaker bits, as SPEAKER_* in ksmedia.h
+#define PCM_SPEAKER_FRONT_LEFT 0x1
+#define PCM_SPEAKER_FRONT_RIGHT 0x2
+#define PCM_SPEAKER_FRONT_CENTER 0x4
+#define PCM_SPEAKER_LOW_FREQUENCY 0x8
+#define PCM_SPEAKER_BACK_LEFT 0x10
+#define PCM_SPEAKER_BACK_RIGHT 0x20
+#define PCM_SPEAKER_SIDE_LEFT 0x200
+#define PCM_SPEAKER_SIDE_RIGHT 0x400
+
+#define PCM_MINUS_3DB 0.70710678f
+#define PCM_INT16_SCALE 32768.0f
+#define PCM_INT16_MIN -32768.0f
+#define PCM_INT16_MAX 32767.0f
+// TPDF dither is the difference of the two 16-bit halves of a random word, in LSBs
+#define PCM_DITHER_SCALE (1.0f / 65536.0f)
+
+typedef void (*QuantizeFn)(const float* pSrc, int16_t* pDest, size_t count, uint32_t* pState, bool dither);
+
+static inline uint32_t XorShift(uint32_t x) {
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+static inline float DitherSample(uint32_t x) {
+	return (float)((int32_t)(x & 0xffff) - (int32_t)(x >> 16)) * PCM_DITHER_SCALE;
+}
+
+/*
+Reference quantizer. Sample i draws from dither lane i % PCM_DITHER_LANES, which
+is what the SIMD kernels do with one lane per register element
+*/
+static void QuantizeScalar(const float* pSrc, int16_t* pDest, size_t count, uint32_t* pState, bool dither) {
+	for (size_t i = 0; i < count; i++) {
+		float v = pSrc[i] * PCM_INT16_SCALE;
+		if (dither) {
+			unsigned lane = i % PCM_DITHER_LANES;
+			pState[lane] = XorShift(pState[lane]);
+			v = v + DitherSample(pState[lane]);
+		}
+		// Same operand order as maxps/minps, so NaN saturates the same way
+		v = v > PCM_INT16_MIN ? v : PCM_INT16_MIN;
+		v = v < PCM_INT16_MAX ? v : PCM_INT16_MAX;
+		pDest[i] = (int16_t)lrintf(v);
+	}
+}
+
+#if CPU_X86
+static inline __m128i XorShiftSse2(__m128i x) {
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+	return x;
+}
+
+static inline __m128 DitherSse2(__m128i x) {
+	__m128i lo = _mm_and_si128(x, _mm_set1_epi32(0xffff));
+	__m128i hi = _mm_srli_epi32(x, 16);
+	return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(lo, hi)), _mm_set1_ps(PCM_DITHER_SCALE));
+}
+
+static void QuantizeSse2(const float* pSrc, int16_t* pDest, size_t count, uint32_t* pState, bool dither) {
+	const __m128 scale = _mm_set1_ps(PCM_INT16_SCALE);
+	const __m128 lo = _mm_set1_ps(PCM_INT16_MIN);
+	const __m128 hi = _mm_set1_ps(PCM_INT16_MAX);
+	__m128i state0 = _mm_loadu_si128((const __m128i*)pState);
+	__m128i state1 = _mm_loadu_si128((const __m128i*)(pState + 4));
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 a = _mm_mul_ps(_mm_loadu_ps(pSrc + i), scale);
+		__m128 b = _mm_mul_ps(_mm_loadu_ps(pSrc + i + 4), scale);
+		if (dither) {
+			state0 = XorShiftSse2(state0);
+			state1 = XorShiftSse2(state1);
+			a = _mm_add_ps(a, DitherSse2(state0));
+			b = _mm_add_ps(b, DitherSse2(state1));
+		}
+		a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+		b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+		__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+		_mm_storeu_si128((__m128i*)(pDest + i), packed);
+	}
+
+	_mm_storeu_si128((__m128i*)pState, state0);
+	_mm_storeu_si128((__m128i*)(pState + 4), state1);
+	// i is a multiple of the lane count, so the tail starts at lane 0 as the reference does
+	QuantizeScalar(pSrc + i, pDest + i, count - i, pState, dither);
+}
+
+TARGET_AVX2 static inline __m256i XorShiftAvx2(__m256i x) {
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+	return x;
+}
+
+TARGET_AVX2 static inline __m256 DitherAvx2(__m256i x) {
+	__m256i lo = _mm256_and_si256(x, _mm256_set1_epi32(0xffff));
+	__m256i hi = _mm256_srli_epi32(x, 16);
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(lo, hi)), _mm256_set1_ps(PCM_DITHER_SCALE));
+}
+
+TARGET_AVX2 static void QuantizeAvx2(const float* pSrc, int16_t* pDest, size_t count, uint32_t* pState, bool dither) {
+	const __m256 scale = _mm256_set1_ps(PCM_INT16_SCALE);
+	const __m256 lo = _mm256_set1_ps(PCM_INT16_MIN);
+	const __m256 hi = _mm256_set1_ps(PCM_INT16_MAX);
+	__m256i state = _mm256_loadu_si256((const __m256i*)pState);
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a = _mm256_mul_ps(_mm256_loadu_ps(pSrc + i), scale);
+		__m256 b = _mm256_mul_ps(_mm256_loadu_ps(pSrc + i + 8), scale);
+		if (dither) {
+			// Each group of 8 samples advances every lane once, as in the reference
+			state = XorShiftAvx2(state);
+			a = _mm256_add_ps(a, DitherAvx2(state));
+			state = XorShiftAvx2(state);
+			b = _mm256_add_ps(b, DitherAvx2(state));
+		}
+		a = _mm256_min_ps(_mm256_max_ps(a, lo), hi);
+		b = _mm256_min_ps(_mm256_max_ps(b, lo), hi);
+		// packs works per 128-bit lane: restore a0..a7 b0..b7 order
+		__m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+		packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(pDest + i), packed);
+	}
+
+	_mm256_storeu_si256((__m256i*)pState, state);
+	QuantizeSse2(pSrc + i, pDest + i, count - i, pState, dither);
+}
+#endif
+
+static QuantizeFn GetQuantizeFn(PcmKernel kernel) {
+	switch (kernel) {
+#if CPU_X86
+	case PCM_KERNEL_AVX2:
+		return QuantizeAvx2;
+	case PCM_KERNEL_SSE2:
+		return QuantizeSse2;
+#endif
+	default:
+		return QuantizeScalar;
+	}
+}
+
+static uint32_t DefaultChannelMask(unsigned channels) {
+	switch (channels) {
+	case 1:
+		return PCM_SPEAKER_FRONT_CENTER;
+	case 2:
+		return PCM_SPEAKER_FRONT_LEFT | PCM_SPEAKER_FRONT_RIGHT;
+	case 4:
+		return PCM_SPEAKER_FRONT_LEFT | PCM_SPEAKER_FRONT_RIGHT | PCM_SPEAKER_BACK_LEFT | PCM_SPEAKER_BACK_RIGHT;
+	case 6:
+		return PCM_SPEAKER_FRONT_LEFT | PCM_SPEAKER_FRONT_RIGHT | PCM_SPEAKER_FRONT_CENTER | PCM_SPEAKER_LOW_FREQUENCY |
+			PCM_SPEAKER_BACK_LEFT | PCM_SPEAKER_BACK_RIGHT;
+	case 8:
+		return PCM_SPEAKER_FRONT_LEFT | PCM_SPEAKER_FRONT_RIGHT | PCM_SPEAKER_FRONT_CENTER | PCM_SPEAKER_LOW_FREQUENCY |
+			PCM_SPEAKER_BACK_LEFT | PCM_SPEAKER_BACK_RIGHT | PCM_SPEAKER_SIDE_LEFT | PCM_SPEAKER_SIDE_RIGHT;
+	default:
+		return 0;
+	}
+}
+
+PcmConverter::PcmConverter(unsigned inChannels, uint32_t channelMask, bool dither, PcmKernel kernel) {
+	const CpuFeatures& cpu = GetCpuFeatures();
+
+	if (kernel == PCM_KERNEL_AUTO) {
+		kernel = cpu.avx2 ? PCM_KERNEL_AVX2 : cpu.sse2 ? PCM_KERNEL_SSE2 : PCM_KERNEL_SCALAR;
+	}
+#if !CPU_X86
+	kernel = PCM_KERNEL_SCALAR;
+#endif
+
+	this->inChannels = inChannels <= PCM_MAX_CHANNELS ? inChannels : 0;
+	this->outChannels = this->inChannels > 2 ? 2 : this->inChannels;
+	this->dither = dither;
+	this->kernel = kernel;
+
+	for (unsigned lane = 0; lane < PCM_DITHER_LANES; lane++) {
+		ditherState[lane] = 0x9e3779b9u * (lane + 1);
+	}
+
+	if (this->inChannels > 2) {
+		BuildDownmix(channelMask != 0 ? channelMask : DefaultChannelMask(inChannels));
+	}
+}
+
+/*
+Channel i of the interleaved input is the i-th speaker bit set in channelMask.
+Speakers outside the mask (and LFE) do not contribute
+*/
+void PcmConverter::BuildDownmix(uint32_t channelMask) {
+	downmix.assign((size_t)outChannels * inChannels, 0.0f);
+
+	unsigned channel = 0;
+	for (uint32_t bit = 1; bit != 0 && channel < inChannels; bit <<= 1) {
+		if ((channelMask & bit) == 0) {
+			continue;
+		}
+		float left = 0.0f;
+		float right = 0.0f;
+		switch (bit) {
+		case PCM_SPEAKER_FRONT_LEFT:
+			left = 1.0f;
+			break;
+		case PCM_SPEAKER_FRONT_RIGHT:
+			right = 1.0f;
+			break;
+		case PCM_SPEAKER_FRONT_CENTER:
+			left = PCM_MINUS_3DB;
+			right = PCM_MINUS_3DB;
+			break;
+		case PCM_SPEAKER_BACK_LEFT:
+		case PCM_SPEAKER_SIDE_LEFT:
+			left = PCM_MINUS_3DB;
+			break;
+		case PCM_SPEAKER_BACK_RIGHT:
+		case PCM_SPEAKER_SIDE_RIGHT:
+			right = PCM_MINUS_3DB;
+			break;
+		}
+		downmix[channel] = left;
+		downmix[inChannels + channel] = right;
+		channel += 1;
+	}
+
+	for (unsigned out = 0; out < outChannels; out++) {
+		float sum = 0.0f;
+		for (unsigned in = 0; in < inChannels; in++) {
+			sum += downmix[out * inChannels + in];
+		}
+		for (unsigned in = 0; in < inChannels && sum > 1.0f; in++) {
+			downmix[out * inChannels + in] /= sum;
+		}
+	}
+}
+
+void PcmConverter::Convert(const float* pSrc, int16_t* pDest, size_t frames) {
+	QuantizeFn quantize = GetQuantizeFn(kernel);
+
+	if (downmix.empty()) {
+		quantize(pSrc, pDest, frames * inChannels, ditherState, dither);
+		return;
+	}
+
+	// Shared by every kernel so the mix stays bit-identical
+	mixed.resize(frames * outChannels);
+	for (size_t frame = 0; frame < frames; frame++) {
+		const float* pIn = pSrc + frame * inChannels;
+		for (unsigned out = 0; out < outChannels; out++) {
+			const float* pGains = downmix.data() + out * inChannels;
+			float acc = 0.0f;
+			for (unsigned in = 0; in < inChannels; in++) {
+				acc = acc + pGains[in] * pIn[in];
+			}
+			mixed[frame * outChannels + out] = acc;
+		}
+	}
+	quantize(mixed.data(), pDest, frames * outChannels, ditherState, dither);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+typedef enum { PCM_KERNEL_AUTO, PCM_KERNEL_SCALAR, PCM_KERNEL_SSE2, PCM_KERNEL_AVX2 } PcmKernel;
+
+// Input layouts with more channels than this are rejected
+const unsigned PCM_MAX_CHANNELS = 18;
+// Independent dither generators, one per SIMD lane
+const unsigned PCM_DITHER_LANES = 8;
+
+/*
+Converts interleaved float32 PCM, as delivered by the shared-mode mix format,
+to interleaved int16. Layouts with more than two channels are folded down to
+stereo first (centre and surrounds at -3 dB, LFE dropped, rows normalized so
+the mix cannot clip). Samples are scaled, optionally TPDF dithered, rounded
+to nearest and saturated.
+Every kernel produces bit-identical output.
+*/
+class PcmConverter {
+public:
+	/*
+	channelMask uses the WAVEFORMATEXTENSIBLE speaker bits. 0 selects the usual
+	layout for the channel count
+	*/
+	PcmConverter(unsigned inChannels, uint32_t channelMask, bool dither, PcmKernel kernel = PCM_KERNEL_AUTO);
+	bool Valid() const { return inChannels > 0; }
+	unsigned InChannels() const { return inChannels; }
+	unsigned OutChannels() const { return outChannels; }
+	PcmKernel Kernel() const { return kernel; }
+	// Converts frames frames of pSrc (inChannels wide) into pDest (outChannels wide)
+	void Convert(const float* pSrc, int16_t* pDest, size_t frames);
+private:
+	void BuildDownmix(uint32_t channelMask);
+
+	unsigned inChannels;
+	unsigned outChannels;
+	bool dither;
+	PcmKernel kernel;
+	std::vector<float> downmix;   // outChannels x inChannels gains, empty when channels pass through
+	std::vector<float> mixed;     // downmixed samples awaiting quantization
+	uint32_t ditherState[PCM_DITHER_LANES];
+};
@@ -0,0 +1,60 @@
+#include <CaptureSource.h>
+#include <PresentationClock.h>
+
+void AudioSource::WriteGapSilence(SpscRing* pRing, UINT64 qpcPosition) {
+	if (ringEndQpc == 0 || qpcPosition <= ringEndQpc + AUDIO_GAP_TOLERANCE) {
+		return;
+	}
+
+	UINT64 frames = (qpcPosition - ringEndQpc) * pwfx->nSamplesPerSec / REFTIMES_PER_SEC;
+	if (!pRing->WriteZeros((size_t)frames * pwfx->nBlockAlign)) {
+		ERR(L"Audio ring full, dropping %llu frames of silence", frames);
+	}
+}
+
+PacedAudioSource::PacedAudioSource(unsigned sampleRate, unsigned channels) {
+	format.wFormatTag = WAVE_FORMAT_PCM;
+	format.nChannels = (WORD)channels;
+	format.nSamplesPerSec = sampleRate;
+	format.wBitsPerSample = 16;
+	format.nBlockAlign = format.nChannels * format.wBitsPerSample / 8;
+	format.nAvgBytesPerSec = format.nBlockAlign * format.nSamplesPerSec;
+	format.cbSize = 0;
+
+	pwfx = &format;
+	bufferFrameCount = sampleRate * PACED_AUDIO_BUFFER_MS / 1000;
+	// Like an endpoint, the source runs from the moment it is started
+	start100ns = PresentationClock::Qpc100ns();
+}
+
+HRESULT PacedAudioSource::NextFrame(SpscRing* pRing, UINT64* pQpcPosition) {
+	int64_t elapsed = PresentationClock::Qpc100ns() - start100ns;
+	uint64_t due = (uint64_t)elapsed * format.nSamplesPerSec / REFTIMES_PER_SEC;
+
+	numFramesRead = 0;
+	if (due <= framesDelivered) {
+		return S_OK;
+	}
+	// As from an endpoint buffer, frames not fetched in time are lost
+	if (due - framesDelivered > bufferFrameCount) {
+		framesDelivered = due - bufferFrameCount;
+	}
+
+	UINT32 frames = (UINT32)(due - framesDelivered);
+	UINT64 qpcPosition = start100ns + framesDelivered * REFTIMES_PER_SEC / format.nSamplesPerSec;
+	buffer.resize((size_t)frames * format.nChannels);
+	Generate(buffer.data(), frames);
+
+	// Frames lost to an overrun leave a gap
+	WriteGapSilence(pRing, qpcPosition);
+	if (!pRing->Write(reinterpret_cast<const uint8_t*>(buffer.data()), (size_t)frames * format.nBlockAlign)) {
+		ERR(L"Audio ring full, dropping %u frames", frames);
+	}
+	if (pQpcPosition != nullptr) {
+		*pQpcPosition = qpcPosition;
+	}
+	framesDelivered = due;
+	numFramesRead = frames;
+
+	return S_OK;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <Common.h>
+#include <FrameCrop.h>
+#include <PipelineMetrics.h>
+#include <SpscRing.h>
+
+// Source of desktop frames, polled once per scheduler tick by the video capture thread
+class VideoSource {
+public:
+	virtual ~VideoSource() {}
+	/*
+	S_OK when pFrame holds a new image, S_FALSE when nothing changed since the
+	previous call, E_PENDING when a new image was captured but cannot be read
+	yet: a later call returns it. The view stays valid until the next call.
+	Sources that return images later than they captured them set pQpcPosition
+	to the QPC position (100ns units) of the capture
+	*/
+	virtual HRESULT NextFrame(FrameView* pFrame, UINT64* pQpcPosition = nullptr) = 0;
+	// Receives the timings of the backend's own steps when set
+	PipelineMetrics* pMetrics = nullptr;
+};
+
+/*
+Source of 16-bit PCM audio, polled by the audio capture thread every half
+buffer. pwfx and bufferFrameCount are set once the source is constructed
+*/
+class AudioSource {
+public:
+	virtual ~AudioSource() {}
+	/*
+	Copies every pending frame into pRing. numFramesRead receives the number
+	of frames captured by this call and, when it is not 0, pQpcPosition the
+	QPC position (100ns units) of the first of them. Frames captured after
+	ringEndQpc are preceded by silence for the gap
+	*/
+	virtual HRESULT NextFrame(SpscRing* pRing, UINT64* pQpcPosition = nullptr) = 0;
+	// 16-bit PCM format of the frames written to the ring
+	WAVEFORMATEX* pwfx = nullptr;
+	unsigned bufferFrameCount = 0;
+	UINT32 numFramesRead = 0;
+	// QPC position (100ns units) where the frames already in the ring end, 0 while unknown
+	UINT64 ringEndQpc = 0;
+	// Receives the timings of the backend's own steps when set
+	PipelineMetrics* pMetrics = nullptr;
+protected:
+	// Queues the silence between ringEndQpc and a packet captured at qpcPosition
+	void WriteGapSilence(SpscRing* pRing, UINT64 qpcPosition);
+};
+
+// Packets captured this close to the end of the ring follow it without a gap
+const UINT64 AUDIO_GAP_TOLERANCE = REFTIMES_PER_MILLISEC;
+
+// Buffer of the paced sources, which sets how often the capture thread polls them
+const unsigned PACED_AUDIO_BUFFER_MS = 20;
+
+/*
+Audio source that delivers frames at the real-time rate of its format, as an
+endpoint does: each call writes the frames due since the previous one, and
+at most a buffer of them
+*/
+class PacedAudioSource : public AudioSource {
+public:
+	PacedAudioSource(unsigned sampleRate, unsigned channels);
+	HRESULT NextFrame(SpscRing* pRing, UINT64* pQpcPosition = nullptr) override;
+protected:
+	// Fills pDest with frames interleaved frames, continuing from the previous call
+	virtual void Generate(int16_t* pDest, UINT32 frames) = 0;
+private:
+	WAVEFORMATEX format;
+	int64_t start100ns;
+	uint64_t framesDelivered = 0;
+	std::vector<int16_t> buffer;
+};
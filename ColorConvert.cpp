@@ -0,0 +1,287 @@
+#include <math.h>
+#include <string.h>
+
+#include <ColorConvert.h>
+#include <CpuFeatures.h>
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+#define COEFF_BITS 14
+// Rows per tile handed to a worker; must be even so 2x2 chroma blocks never straddle tiles
+#define CONVERT_TILE_ROWS 32
+
+typedef ColorConverter::Coefficients Coefficients;
+
+/*
+Converts two source rows (one row of chroma) starting at pixel x.
+pU is the interleaved UV row for NV12
+*/
+typedef void (*ConvertPairFn)(const uint8_t* pSrc0, const uint8_t* pSrc1, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, unsigned width, const Coefficients& c, YuvLayout layout);
+
+static inline uint8_t Clamp8(int value) {
+	return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline uint8_t Luma(const uint8_t* pPixel, const Coefficients& c) {
+	int y = c.y[0] * pPixel[0] + c.y[1] * pPixel[1] + c.y[2] * pPixel[2];
+	return Clamp8((y + (c.yOffset << COEFF_BITS) + (1 << (COEFF_BITS - 1))) >> COEFF_BITS);
+}
+
+// sB/sG/sR are sums over a 2x2 block, hence the 2 extra bits of shift
+static inline uint8_t Chroma(const int16_t* pCoeffs, int sB, int sG, int sR) {
+	int value = pCoeffs[0] * sB + pCoeffs[1] * sG + pCoeffs[2] * sR;
+	return Clamp8((value + (128 << (COEFF_BITS + 2)) + (1 << (COEFF_BITS + 1))) >> (COEFF_BITS + 2));
+}
+
+static void ConvertPairTail(const uint8_t* pSrc0, const uint8_t* pSrc1, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, unsigned x, unsigned width, const Coefficients& c, YuvLayout layout) {
+	for (; x < width; x += 2) {
+		const uint8_t* p00 = pSrc0 + x * 4;
+		const uint8_t* p01 = p00 + 4;
+		const uint8_t* p10 = pSrc1 + x * 4;
+		const uint8_t* p11 = p10 + 4;
+
+		pY0[x] = Luma(p00, c);
+		pY0[x + 1] = Luma(p01, c);
+		pY1[x] = Luma(p10, c);
+		pY1[x + 1] = Luma(p11, c);
+
+		int sB = p00[0] + p01[0] + p10[0] + p11[0];
+		int sG = p00[1] + p01[1] + p10[1] + p11[1];
+		int sR = p00[2] + p01[2] + p10[2] + p11[2];
+
+		if (layout == YUV_LAYOUT_NV12) {
+			pU[x] = Chroma(c.u, sB, sG, sR);
+			pU[x + 1] = Chroma(c.v, sB, sG, sR);
+		}
+		else {
+			pU[x / 2] = Chroma(c.u, sB, sG, sR);
+			pV[x / 2] = Chroma(c.v, sB, sG, sR);
+		}
+	}
+}
+
+static void ConvertPairScalar(const uint8_t* pSrc0, const uint8_t* pSrc1, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, unsigned width, const Coefficients& c, YuvLayout layout) {
+	ConvertPairTail(pSrc0, pSrc1, pY0, pY1, pU, pV, 0, width, c, layout);
+}
+
+#if CPU_X86
+/*
+Pixels are widened to 16 bits so _mm_madd_epi16 against [cB cG cR 0] yields
+(cB*B + cG*G, cR*R) per pixel; a horizontal add finishes the dot product.
+4 pixels per iteration
+*/
+TARGET_SSE41 static void ConvertPairSse41(const uint8_t* pSrc0, const uint8_t* pSrc1, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, unsigned width, const Coefficients& c, YuvLayout layout) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i cy = _mm_setr_epi16(c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0);
+	const __m128i cu = _mm_setr_epi16(c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0);
+	const __m128i cv = _mm_setr_epi16(c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0);
+	const __m128i yBias = _mm_set1_epi32((c.yOffset << COEFF_BITS) + (1 << (COEFF_BITS - 1)));
+	const __m128i cBias = _mm_set1_epi32((128 << (COEFF_BITS + 2)) + (1 << (COEFF_BITS + 1)));
+
+	unsigned x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i row0 = _mm_loadu_si128((const __m128i*)(pSrc0 + x * 4));
+		__m128i row1 = _mm_loadu_si128((const __m128i*)(pSrc1 + x * 4));
+		__m128i row0Lo = _mm_unpacklo_epi8(row0, zero);
+		__m128i row0Hi = _mm_unpackhi_epi8(row0, zero);
+		__m128i row1Lo = _mm_unpacklo_epi8(row1, zero);
+		__m128i row1Hi = _mm_unpackhi_epi8(row1, zero);
+
+		__m128i y0 = _mm_hadd_epi32(_mm_madd_epi16(row0Lo, cy), _mm_madd_epi16(row0Hi, cy));
+		__m128i y1 = _mm_hadd_epi32(_mm_madd_epi16(row1Lo, cy), _mm_madd_epi16(row1Hi, cy));
+		y0 = _mm_srai_epi32(_mm_add_epi32(y0, yBias), COEFF_BITS);
+		y1 = _mm_srai_epi32(_mm_add_epi32(y1, yBias), COEFF_BITS);
+		__m128i y = _mm_packus_epi16(_mm_packus_epi32(y0, y1), zero);
+
+		int luma = _mm_cvtsi128_si32(y);
+		memcpy(pY0 + x, &luma, 4);
+		luma = _mm_cvtsi128_si32(_mm_srli_si128(y, 4));
+		memcpy(pY1 + x, &luma, 4);
+
+		// Sum each 2x2 block: rows first, then the two neighbouring pixels
+		__m128i sumLo = _mm_add_epi16(row0Lo, row1Lo);
+		__m128i sumHi = _mm_add_epi16(row0Hi, row1Hi);
+		sumLo = _mm_add_epi16(sumLo, _mm_srli_si128(sumLo, 8));
+		sumHi = _mm_add_epi16(sumHi, _mm_srli_si128(sumHi, 8));
+		__m128i blocks = _mm_unpacklo_epi64(sumLo, sumHi);
+
+		// U0 U1 V0 V1
+		__m128i uv = _mm_hadd_epi32(_mm_madd_epi16(blocks, cu), _mm_madd_epi16(blocks, cv));
+		uv = _mm_srai_epi32(_mm_add_epi32(uv, cBias), COEFF_BITS + 2);
+
+		if (layout == YUV_LAYOUT_NV12) {
+			uv = _mm_shuffle_epi32(uv, _MM_SHUFFLE(3, 1, 2, 0));
+			uv = _mm_packus_epi16(_mm_packus_epi32(uv, zero), zero);
+			int chroma = _mm_cvtsi128_si32(uv);
+			memcpy(pU + x, &chroma, 4);
+		}
+		else {
+			uv = _mm_packus_epi16(_mm_packus_epi32(uv, zero), zero);
+			int chroma = _mm_cvtsi128_si32(uv);
+			memcpy(pU + x / 2, &chroma, 2);
+			memcpy(pV + x / 2, (uint8_t*)&chroma + 2, 2);
+		}
+	}
+
+	ConvertPairTail(pSrc0, pSrc1, pY0, pY1, pU, pV, x, width, c, layout);
+}
+
+/*
+Same arithmetic as the SSE4.1 kernel on 8 pixels. madd/hadd work within 128-bit
+lanes, so results are put back in pixel order with a cross-lane permute
+*/
+TARGET_AVX2 static void ConvertPairAvx2(const uint8_t* pSrc0, const uint8_t* pSrc1, uint8_t* pY0, uint8_t* pY1, uint8_t* pU, uint8_t* pV, unsigned width, const Coefficients& c, YuvLayout layout) {
+	const __m256i cy = _mm256_setr_epi16(c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0);
+	const __m256i cu = _mm256_setr_epi16(c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0);
+	const __m256i cv = _mm256_setr_epi16(c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0);
+	const __m256i yBias = _mm256_set1_epi32((c.yOffset << COEFF_BITS) + (1 << (COEFF_BITS - 1)));
+	const __m256i cBias = _mm256_set1_epi32((128 << (COEFF_BITS + 2)) + (1 << (COEFF_BITS + 1)));
+	const __m256i lumaOrder = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+	const __m256i chromaOrder = layout == YUV_LAYOUT_NV12 ?
+		_mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7) :
+		_mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	unsigned x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m256i row0 = _mm256_loadu_si256((const __m256i*)(pSrc0 + x * 4));
+		__m256i row1 = _mm256_loadu_si256((const __m256i*)(pSrc1 + x * 4));
+		__m256i row0Lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(row0));
+		__m256i row0Hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(row0, 1));
+		__m256i row1Lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(row1));
+		__m256i row1Hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(row1, 1));
+
+		__m256i y0 = _mm256_hadd_epi32(_mm256_madd_epi16(row0Lo, cy), _mm256_madd_epi16(row0Hi, cy));
+		__m256i y1 = _mm256_hadd_epi32(_mm256_madd_epi16(row1Lo, cy), _mm256_madd_epi16(row1Hi, cy));
+		y0 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_permutevar8x32_epi32(y0, lumaOrder), yBias), COEFF_BITS);
+		y1 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_permutevar8x32_epi32(y1, lumaOrder), yBias), COEFF_BITS);
+
+		__m128i luma0 = _mm_packus_epi32(_mm256_castsi256_si128(y0), _mm256_extracti128_si256(y0, 1));
+		__m128i luma1 = _mm_packus_epi32(_mm256_castsi256_si128(y1), _mm256_extracti128_si256(y1, 1));
+		__m128i luma = _mm_packus_epi16(luma0, luma1);
+		_mm_storel_epi64((__m128i*)(pY0 + x), luma);
+		_mm_storel_epi64((__m128i*)(pY1 + x), _mm_srli_si128(luma, 8));
+
+		// Lane 0 holds blocks 0 and 2, lane 1 blocks 1 and 3
+		__m256i sumLo = _mm256_add_epi16(row0Lo, row1Lo);
+		__m256i sumHi = _mm256_add_epi16(row0Hi, row1Hi);
+		sumLo = _mm256_add_epi16(sumLo, _mm256_srli_si256(sumLo, 8));
+		sumHi = _mm256_add_epi16(sumHi, _mm256_srli_si256(sumHi, 8));
+		__m256i blocks = _mm256_unpacklo_epi64(sumLo, sumHi);
+
+		// Lane 0: U0 U2 V0 V2, lane 1: U1 U3 V1 V3
+		__m256i uv = _mm256_hadd_epi32(_mm256_madd_epi16(blocks, cu), _mm256_madd_epi16(blocks, cv));
+		uv = _mm256_permutevar8x32_epi32(uv, chromaOrder);
+		uv = _mm256_srai_epi32(_mm256_add_epi32(uv, cBias), COEFF_BITS + 2);
+
+		__m128i chroma = _mm_packus_epi32(_mm256_castsi256_si128(uv), _mm256_extracti128_si256(uv, 1));
+		chroma = _mm_packus_epi16(chroma, chroma);
+		if (layout == YUV_LAYOUT_NV12) {
+			_mm_storel_epi64((__m128i*)(pU + x), chroma);
+		}
+		else {
+			int u = _mm_cvtsi128_si32(chroma);
+			int v = _mm_cvtsi128_si32(_mm_srli_si128(chroma, 4));
+			memcpy(pU + x / 2, &u, 4);
+			memcpy(pV + x / 2, &v, 4);
+		}
+	}
+
+	ConvertPairTail(pSrc0, pSrc1, pY0, pY1, pU, pV, x, width, c, layout);
+}
+#endif
+
+static void ComputeCoefficients(ColorMatrix matrix, ColorRange range, Coefficients* pCoeffs) {
+	const double scale = 1 << COEFF_BITS;
+	double kr = matrix == COLOR_MATRIX_BT709 ? 0.2126 : 0.299;
+	double kb = matrix == COLOR_MATRIX_BT709 ? 0.0722 : 0.114;
+	double yScale = range == COLOR_RANGE_FULL ? 1.0 : 219.0 / 255.0;
+	double cScale = range == COLOR_RANGE_FULL ? 1.0 : 224.0 / 255.0;
+
+	// Round B and R, then derive G so that grey maps exactly to grey (Y) and 128 (U, V)
+	pCoeffs->y[0] = (int16_t)lround(kb * yScale * scale);
+	pCoeffs->y[2] = (int16_t)lround(kr * yScale * scale);
+	pCoeffs->y[1] = (int16_t)(lround(yScale * scale) - pCoeffs->y[0] - pCoeffs->y[2]);
+	pCoeffs->y[3] = 0;
+
+	pCoeffs->u[0] = (int16_t)lround(0.5 * cScale * scale);
+	pCoeffs->u[2] = (int16_t)lround(-kr / (2.0 * (1.0 - kb)) * cScale * scale);
+	pCoeffs->u[1] = (int16_t)(-pCoeffs->u[0] - pCoeffs->u[2]);
+	pCoeffs->u[3] = 0;
+
+	pCoeffs->v[2] = (int16_t)lround(0.5 * cScale * scale);
+	pCoeffs->v[0] = (int16_t)lround(-kb / (2.0 * (1.0 - kr)) * cScale * scale);
+	pCoeffs->v[1] = (int16_t)(-pCoeffs->v[0] - pCoeffs->v[2]);
+	pCoeffs->v[3] = 0;
+
+	pCoeffs->yOffset = range == COLOR_RANGE_FULL ? 0 : 16;
+}
+
+ColorConverter::ColorConverter(ColorMatrix matrix, ColorRange range, YuvLayout layout, ThreadPool* pPool, ConvertKernel kernel) {
+	const CpuFeatures& cpu = GetCpuFeatures();
+
+	ComputeCoefficients(matrix, range, &coeffs);
+	this->layout = layout;
+	this->pPool = pPool;
+
+	if (kernel == CONVERT_KERNEL_AUTO) {
+		kernel = cpu.avx2 ? CONVERT_KERNEL_AVX2 : (cpu.sse41 ? CONVERT_KERNEL_SSE41 : CONVERT_KERNEL_SCALAR);
+	}
+	if (kernel == CONVERT_KERNEL_AVX2 && !cpu.avx2) {
+		kernel = CONVERT_KERNEL_SSE41;
+	}
+	if (kernel == CONVERT_KERNEL_SSE41 && !cpu.sse41) {
+		kernel = CONVERT_KERNEL_SCALAR;
+	}
+	this->kernel = kernel;
+}
+
+void ColorConverter::ConvertRows(const FrameView& src, const FrameRect& rect, const YuvPlanes& dest, unsigned firstRow, unsigned rowCount) {
+	ConvertPairFn convertPair = ConvertPairScalar;
+#if CPU_X86
+	if (kernel == CONVERT_KERNEL_AVX2) {
+		convertPair = ConvertPairAvx2;
+	}
+	else if (kernel == CONVERT_KERNEL_SSE41) {
+		convertPair = ConvertPairSse41;
+	}
+#endif
+
+	for (unsigned row = firstRow; row < firstRow + rowCount; row += 2) {
+		const uint8_t* pSrc0 = src.pData + (size_t)(rect.y + row) * src.pitch + (size_t)rect.x * FRAME_BYTES_PER_PIXEL;
+		const uint8_t* pSrc1 = pSrc0 + src.pitch;
+		uint8_t* pY0 = dest.pY + (size_t)row * dest.yPitch;
+		uint8_t* pY1 = pY0 + dest.yPitch;
+		uint8_t* pU = dest.pU + (size_t)(row / 2) * dest.uPitch;
+		uint8_t* pV = layout == YUV_LAYOUT_I420 ? dest.pV + (size_t)(row / 2) * dest.vPitch : nullptr;
+
+		convertPair(pSrc0, pSrc1, pY0, pY1, pU, pV, rect.width, coeffs, layout);
+	}
+}
+
+bool ColorConverter::Convert(const FrameView& src, const FrameRect& rect, const YuvPlanes& dest) {
+	if (rect.x > src.width || rect.width > src.width - rect.x ||
+		rect.y > src.height || rect.height > src.height - rect.y ||
+		(rect.width & 1) || (rect.height & 1)) {
+		return false;
+	}
+
+	unsigned tiles = (rect.height + CONVERT_TILE_ROWS - 1) / CONVERT_TILE_ROWS;
+	auto convertTile = [&](unsigned tile) {
+		unsigned firstRow = tile * CONVERT_TILE_ROWS;
+		unsigned rowCount = rect.height - firstRow < CONVERT_TILE_ROWS ? rect.height - firstRow : CONVERT_TILE_ROWS;
+		ConvertRows(src, rect, dest, firstRow, rowCount);
+	};
+
+	if (pPool != nullptr) {
+		pPool->ParallelFor(tiles, convertTile);
+	}
+	else {
+		for (unsigned tile = 0; tile < tiles; tile++) {
+			convertTile(tile);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <FrameCrop.h>
+#include <ThreadPool.h>
+
+typedef enum { COLOR_MATRIX_BT601, COLOR_MATRIX_BT709 } ColorMatrix;
+typedef enum { COLOR_RANGE_LIMITED, COLOR_RANGE_FULL } ColorRange;
+typedef enum { YUV_LAYOUT_NV12, YUV_LAYOUT_I420 } YuvLayout;
+typedef enum { CONVERT_KERNEL_AUTO, CONVERT_KERNEL_SCALAR, CONVERT_KERNEL_SSE41, CONVERT_KERNEL_AVX2 } ConvertKernel;
+
+/*
+Destination planes of a 4:2:0 frame. For NV12 pU is the interleaved UV plane and
+pV is unused
+*/
+typedef struct YuvPlanes {
+	uint8_t* pY;
+	long yPitch;
+	uint8_t* pU;
+	long uPitch;
+	uint8_t* pV;
+	long vPitch;
+} YuvPlanes;
+
+/*
+Converts BGRA frames to 4:2:0 YUV. Luma and chroma are computed with 14-bit
+fixed point coefficients; chroma is taken from the average of each 2x2 block.
+Every kernel produces bit-identical output.
+*/
+class ColorConverter {
+public:
+	ColorConverter(ColorMatrix matrix, ColorRange range, YuvLayout layout, ThreadPool* pPool = nullptr, ConvertKernel kernel = CONVERT_KERNEL_AUTO);
+	/*
+	Converts rect of src into dest. rect must fit inside src and have even dimensions.
+	Rows are split into tiles across the thread pool when one was given.
+	*/
+	bool Convert(const FrameView& src, const FrameRect& rect, const YuvPlanes& dest);
+	ConvertKernel Kernel() const { return kernel; }
+
+	// Coefficients in BGRA order, 14-bit fixed point
+	struct Coefficients {
+		int16_t y[4];
+		int16_t u[4];
+		int16_t v[4];
+		int yOffset;
+	};
+private:
+	void ConvertRows(const FrameView& src, const FrameRect& rect, const YuvPlanes& dest, unsigned firstRow, unsigned rowCount);
+
+	Coefficients coeffs;
+	YuvLayout layout;
+	ThreadPool* pPool;
+	ConvertKernel kernel;
+};
@@ -0,0 +1,69 @@
+#include <CpuFeatures.h>
+
+#if CPU_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if CPU_X86
+static void Cpuid(int leaf, int subleaf, unsigned regs[4]) {
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, leaf, subleaf);
+	for (int i = 0; i < 4; i++) {
+		regs[i] = (unsigned)r[i];
+	}
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long ReadXcr0() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#endif
+
+static CpuFeatures DetectCpuFeatures() {
+	CpuFeatures features = {};
+
+#if CPU_X86
+	unsigned regs[4];
+
+	Cpuid(0, 0, regs);
+	unsigned maxLeaf = regs[0];
+
+	Cpuid(1, 0, regs);
+	features.sse2 = (regs[3] & (1u << 26)) != 0;
+	features.ssse3 = (regs[2] & (1u << 9)) != 0;
+	features.sse41 = (regs[2] & (1u << 19)) != 0;
+	features.sse42 = (regs[2] & (1u << 20)) != 0;
+	features.pclmul = (regs[2] & (1u << 1)) != 0;
+
+	// AVX state must be enabled by the OS (OSXSAVE + XMM/YMM in XCR0)
+	bool osAvx = false;
+	if ((regs[2] & (1u << 27)) && (regs[2] & (1u << 28))) {
+		osAvx = (ReadXcr0() & 0x6) == 0x6;
+	}
+
+	if (osAvx && maxLeaf >= 7) {
+		Cpuid(7, 0, regs);
+		features.avx2 = (regs[1] & (1u << 5)) != 0;
+	}
+#endif
+
+	return features;
+}
+
+const CpuFeatures& GetCpuFeatures() {
+	static const CpuFeatures features = DetectCpuFeatures();
+	return features;
+}
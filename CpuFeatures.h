@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+Runtime detection of the x86 SIMD extensions used by the frame and audio kernels.
+Kernels compiled with TARGET_SSE41/TARGET_AVX2 must only be called when the
+matching flag below is set.
+*/
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#endif
+
+#if defined(_MSC_VER)
+// MSVC exposes every intrinsic regardless of /arch
+#define TARGET_SSE41
+#define TARGET_SSE42
+#define TARGET_AVX2
+#else
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+struct CpuFeatures {
+	bool sse2;
+	bool ssse3;
+	bool sse41;
+	bool sse42;
+	bool pclmul;
+	bool avx2;
+};
+
+// Detected once, on first call
+const CpuFeatures& GetCpuFeatures();
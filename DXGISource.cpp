@@ -1,4 +1,33 @@
 #include <DXGISource.h>
+#include <PresentationClock.h>
+
+// Staging textures of the readback ring, mapped on the immediate context
+class StagingTextureTarget : public ReadbackTarget {
+public:
+	StagingTextureTarget(ID3D11DeviceContext* pContext, const std::vector<ID3D11Texture2D*>& textures, unsigned width, unsigned height)
+		: pContext(pContext), textures(textures), width(width), height(height) {}
+
+	bool MapSlot(unsigned slot, FrameView* pView) override {
+		D3D11_MAPPED_SUBRESOURCE map;
+		HRESULT hr = pContext->Map(textures[slot], 0, D3D11_MAP_READ, 0, &map);
+		if (FAILED(hr)) {
+			ERR("failed to map to staging tex. Cannot access the pixels: hr = 0x%08x", hr);
+			return false;
+		}
+		FrameView view = { (const uint8_t*)map.pData, (long)map.RowPitch, width, height };
+		*pView = view;
+		return true;
+	}
+
+	void UnmapSlot(unsigned slot) override {
+		pContext->Unmap(textures[slot], 0);
+	}
+private:
+	ID3D11DeviceContext* pContext;
+	const std::vector<ID3D11Texture2D*>& textures;
+	unsigned width;
+	unsigned height;
+};
 
 DXGISource::DXGISource() {
 	outdupl_desc = DXGI_OUTDUPL_DESC();
@@ -11,18 +40,31 @@ DXGISource::DXGISource() {
 	pDx_device = nullptr;
 	pDx_context = nullptr;
 	pDx_feature_level = nullptr;
-	pDx_staging_tex = nullptr;
 	pDx_duplication = nullptr;
+	pStagingTarget = nullptr;
+	pReadback = nullptr;
+	pMirror = nullptr;
+	mirrorValid = FALSE;
+	fullCopyQueued = FALSE;
 
 	SetDxAdapter();
 	SetDxOutput();
 	SetDxDevice();
 	SetDxOutputDuplication();
 	SetDxStagingTex();
+
+	pStagingTarget = new StagingTextureTarget(pDx_context, stagingTextures, pDx_tex_desc.Width, pDx_tex_desc.Height);
+	pReadback = new ReadbackRing(pStagingTarget, (unsigned)stagingTextures.size());
+	pMirror = new FrameMirror(pDx_tex_desc.Width, pDx_tex_desc.Height);
 }
 
 DXGISource::~DXGISource() {
-	SafeRelease(&pDx_staging_tex);
+	delete pMirror;
+	delete pReadback;
+	delete pStagingTarget;
+	for (ID3D11Texture2D*& pTexture : stagingTextures) {
+		SafeRelease(&pTexture);
+	}
 	SafeRelease(&pDx_device);
 	SafeRelease(&pDx_context);
 	SafeRelease(&pDx_duplication);
@@ -149,7 +191,7 @@ void DXGISource::SetDxStagingTex() {
 		exit(EXIT_FAILURE);
 	}
 
-	// Create the staging texture that we need to download the pixels from gpu
+	// Create the staging textures that we need to download the pixels from gpu
 	pDx_tex_desc.Width = output_desc.DesktopCoordinates.right;
 	pDx_tex_desc.Height = output_desc.DesktopCoordinates.bottom;
 	pDx_tex_desc.MipLevels = 1;
@@ -162,20 +204,110 @@ void DXGISource::SetDxStagingTex() {
 	pDx_tex_desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
 	pDx_tex_desc.MiscFlags = 0;
 
-	hr = pDx_device->CreateTexture2D(&pDx_tex_desc, NULL, &pDx_staging_tex);
+	for (unsigned i = 0; i < DXGI_STAGING_TEXTURES; i++) {
+		ID3D11Texture2D* pTexture = nullptr;
+		hr = pDx_device->CreateTexture2D(&pDx_tex_desc, NULL, &pTexture);
 
-	if (hr == E_INVALIDARG) {
-		ERR("received E_INVALIDARG when trying to create the texture");
-		exit(EXIT_FAILURE);
+		if (hr == E_INVALIDARG) {
+			ERR("received E_INVALIDARG when trying to create the texture");
+			exit(EXIT_FAILURE);
+		}
+		else if (hr != S_OK) {
+			ERR("failed to create the 2D texture, error: %d", hr);
+			exit(EXIT_FAILURE);
+		}
+		stagingTextures.push_back(pTexture);
 	}
-	else if (hr != S_OK) {
-		ERR("failed to create the 2D texture, error: %d", hr);
-		exit(EXIT_FAILURE);
+}
+
+/*
+Reads the move and dirty rects of the acquired frame into moves/dirtyRegion.
+Returns FALSE when the frame carries no metadata and must be copied whole
+*/
+BOOL DXGISource::ReadFrameMetadata(const DXGI_OUTDUPL_FRAME_INFO& frame_info) {
+	HRESULT hr;
+	UINT cbMoves = 0;
+	UINT cbDirty = 0;
+	unsigned width = pDx_tex_desc.Width;
+	unsigned height = pDx_tex_desc.Height;
+
+	moves.clear();
+	dirtyRegion.Clear();
+
+	if (frame_info.TotalMetadataBufferSize == 0) {
+		return FALSE;
+	}
+	if (metadata.size() < frame_info.TotalMetadataBufferSize) {
+		metadata.resize(frame_info.TotalMetadataBufferSize);
+	}
+
+	hr = pDx_duplication->GetFrameMoveRects((UINT)metadata.size(), (DXGI_OUTDUPL_MOVE_RECT*)metadata.data(), &cbMoves);
+	if (FAILED(hr)) {
+		ERR("GetFrameMoveRects failed: hr = 0x%08x", hr);
+		return FALSE;
+	}
+	const DXGI_OUTDUPL_MOVE_RECT* pMoveRects = (const DXGI_OUTDUPL_MOVE_RECT*)metadata.data();
+	for (UINT i = 0; i < cbMoves / sizeof(DXGI_OUTDUPL_MOVE_RECT); i++) {
+		const RECT& dest = pMoveRects[i].DestinationRect;
+		FrameMove move = {
+			(unsigned)pMoveRects[i].SourcePoint.x,
+			(unsigned)pMoveRects[i].SourcePoint.y,
+			{ (unsigned)dest.left, (unsigned)dest.top, (unsigned)(dest.right - dest.left), (unsigned)(dest.bottom - dest.top) }
+		};
+		moves.push_back(move);
+	}
+
+	// Dirty rects are stored after the move rects
+	BYTE* pDirtyBuffer = metadata.data() + cbMoves;
+	hr = pDx_duplication->GetFrameDirtyRects((UINT)metadata.size() - cbMoves, (RECT*)pDirtyBuffer, &cbDirty);
+	if (FAILED(hr)) {
+		ERR("GetFrameDirtyRects failed: hr = 0x%08x", hr);
+		moves.clear();
+		return FALSE;
+	}
+	const RECT* pDirtyRects = (const RECT*)pDirtyBuffer;
+	for (UINT i = 0; i < cbDirty / sizeof(RECT); i++) {
+		const RECT& dirty = pDirtyRects[i];
+		FrameRect rect = { (unsigned)dirty.left, (unsigned)dirty.top, (unsigned)(dirty.right - dirty.left), (unsigned)(dirty.bottom - dirty.top) };
+		dirtyRegion.Add(rect, width, height);
 	}
+	dirtyRegion.Merge();
+
+	return TRUE;
+}
+
+// Issues GPU copies of the dirty rects from the desktop texture into a staging texture
+void DXGISource::CopyDirtyRegion(ID3D11Texture2D* tex, ID3D11Texture2D* pStaging) {
+	for (const FrameRect& rect : dirtyRegion.Rects()) {
+		D3D11_BOX box = { rect.x, rect.y, 0, rect.x + rect.width, rect.y + rect.height, 1 };
+		pDx_context->CopySubresourceRegion(pStaging, 0, rect.x, rect.y, 0, tex, 0, &box);
+	}
+}
+
+/*
+Reads the oldest frame of the readback ring into the mirror. When it cannot be
+mapped, the frames queued after it lack the changes it carried, so they are
+dropped too and the next frame is copied whole
+*/
+BOOL DXGISource::ReadOldestFrame(UINT64* pQpcPosition) {
+	StageTimer mapTimer(pMetrics, STAGE_VIDEO_MAP);
+	uint64_t qpcPosition = 0;
+
+	if (!pReadback->ReadOldest(pMirror, &qpcPosition)) {
+		pReadback->Clear();
+		fullCopyQueued = FALSE;
+		return FALSE;
+	}
+	mirrorValid = TRUE;
+	if (pQpcPosition != nullptr) {
+		*pQpcPosition = qpcPosition;
+	}
+	return TRUE;
 }
 
-void DXGISource::NextFrame(DWORD** ppData) {
+HRESULT DXGISource::NextFrame(FrameView* pFrame, UINT64* pQpcPosition) {
 	HRESULT hr;
+	HRESULT frameResult = S_FALSE;
 
 	// Access a couple of frames
 	DXGI_OUTDUPL_FRAME_INFO frame_info;
@@ -183,17 +315,44 @@ void DXGISource::NextFrame(DWORD** ppData) {
 	ID3D11Texture2D* tex = NULL;
 	DXGI_MAPPED_RECT mapped_rect;
 	BOOL mustRelease = FALSE;
+	BOOL frameQueued = FALSE;
 
+	StageTimer acquireTimer(pMetrics, STAGE_VIDEO_ACQUIRE);
 	hr = pDx_duplication->AcquireNextFrame(0, &frame_info, &desktop_resource);
-	if (DXGI_ERROR_ACCESS_LOST == hr) {
+	acquireTimer.Stop();
+	UINT64 acquiredAt = (UINT64)PresentationClock::Qpc100ns();
+
+	if (DXGI_ERROR_WAIT_TIMEOUT == hr) {
+		// Nothing was presented since the last frame
+	}
+	else if (DXGI_ERROR_ACCESS_LOST == hr) {
 		ERR("Received a DXGI_ERROR_ACCESS_LOST");
+		frameResult = hr;
 	}
 	else if (DXGI_ERROR_INVALID_CALL == hr) {
 		ERR("Received a DXGI_ERROR_INVALID_CALL");
+		frameResult = hr;
+	}
+	else if (S_OK == hr && frame_info.LastPresentTime.QuadPart == 0 && fullCopyQueued) {
+		// Only the mouse pointer was updated
+		mustRelease = TRUE;
 	}
 	else if (S_OK == hr) {
 		mustRelease = TRUE;
 
+		// With every staging texture taken, the oldest frame is read back to make room
+		if (pReadback->Full() && ReadOldestFrame(pQpcPosition)) {
+			frameResult = S_OK;
+		}
+
+		// Without metadata (or before the first full copy) the whole desktop is dirty
+		if (!ReadFrameMetadata(frame_info) || !fullCopyQueued) {
+			FrameRect full = { 0, 0, pDx_tex_desc.Width, pDx_tex_desc.Height };
+			moves.clear();
+			dirtyRegion.Clear();
+			dirtyRegion.Add(full, pDx_tex_desc.Width, pDx_tex_desc.Height);
+		}
+
 		// Get the texture interface
 
 		hr = desktop_resource->QueryInterface(__uuidof(ID3D11Texture2D), (void**)& tex);
@@ -206,32 +365,34 @@ void DXGISource::NextFrame(DWORD** ppData) {
 
 		hr = pDx_duplication->MapDesktopSurface(&mapped_rect);
 		if (S_OK == hr) {
-			LOG("We got access to the desktop surface");
+			// The desktop image is already in system memory. Frames still being read back come first
+			while (pReadback->Pending() > 0) {
+				ReadOldestFrame(nullptr);
+			}
+			StageTimer mapTimer(pMetrics, STAGE_VIDEO_MAP);
+			FrameView desktop = { mapped_rect.pBits, mapped_rect.Pitch, pDx_tex_desc.Width, pDx_tex_desc.Height };
+			pMirror->ApplyMoves(moves);
+			pMirror->UpdateRects(desktop, dirtyRegion.Rects());
+			mirrorValid = TRUE;
+			fullCopyQueued = TRUE;
+			frameResult = S_OK;
+			if (pQpcPosition != nullptr) {
+				*pQpcPosition = acquiredAt;
+			}
+
 			hr = pDx_duplication->UnMapDesktopSurface();
 			if (S_OK != hr) {
 				ERR("failed to unmap the desktop surface after successfully mapping it.");
 			}
-			// TODO: implement
 		}
 		else if (DXGI_ERROR_UNSUPPORTED == hr) {
-			// Capture pixel data from GPU memory
-			pDx_context->CopyResource(pDx_staging_tex, tex);
-
-			D3D11_MAPPED_SUBRESOURCE map;
-			HRESULT map_result = pDx_context->Map(pDx_staging_tex,
-				0,
-				D3D11_MAP_READ,
-				0,
-				&map);
-
-			if (S_OK == map_result) {
-				*ppData = (DWORD*)map.pData;
-			}
-			else {
-				ERR("failed to map to staging tex. Cannot access the pixels");
-			}
-
-			pDx_context->Unmap(pDx_staging_tex, 0);
+			// Capture the changed pixels from GPU memory; they are read back by a later call
+			CopyDirtyRegion(tex, stagingTextures[pReadback->NextSlot()]);
+			// Submit the copies now rather than when the texture is mapped
+			pDx_context->Flush();
+			pReadback->Push(acquiredAt, moves, dirtyRegion.Rects());
+			fullCopyQueued = TRUE;
+			frameQueued = TRUE;
 		}
 		else if (DXGI_ERROR_INVALID_CALL == hr) {
 			ERR("MapDesktopSurface returned DXGI_ERROR_INVALID_CALL.");
@@ -247,6 +408,20 @@ void DXGISource::NextFrame(DWORD** ppData) {
 		}
 	}
 
+	if (frameResult == S_FALSE && pReadback->Pending() > 0) {
+		// Keep one frame per call coming out of the ring; once the screen is still it drains
+		if (!frameQueued && ReadOldestFrame(pQpcPosition)) {
+			frameResult = S_OK;
+		}
+		else if (frameQueued) {
+			frameResult = E_PENDING;
+		}
+	}
+
+	if (mirrorValid) {
+		*pFrame = pMirror->View();
+	}
+
 	// Clean up
 	if (NULL != tex) {
 		tex->Release();
@@ -264,4 +439,6 @@ void DXGISource::NextFrame(DWORD** ppData) {
 			ERR("Failed to release the duplication frame.");
 		}
 	}
+
+	return frameResult;
 }
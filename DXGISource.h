@@ -11,19 +11,33 @@
 #include <d3d11.h>
 #include <string>
 
-const unsigned VIDEO_FRAMETICK_30FPS = 33;
+#include <CaptureSource.h>
+#include <DirtyRegion.h>
+#include <FrameCrop.h>
+#include <ReadbackRing.h>
 
-class DXGISource {
+/*
+Staging textures frames are read back through. A frame is returned this many
+calls minus one after it was acquired, unless nothing newer is acquired
+meanwhile, so the GPU copy is long done by the time it is mapped
+*/
+const unsigned DXGI_STAGING_TEXTURES = 3;
+
+// Desktop Duplication capture of the first output of the first adapter that has one
+class DXGISource : public VideoSource {
 public:
 	DXGISource();
 	~DXGISource();
-	void NextFrame(DWORD**);
+	HRESULT NextFrame(FrameView*, UINT64* pQpcPosition = nullptr) override;
 private:
 	void SetDxAdapter();
 	void SetDxOutput();
 	void SetDxDevice();
 	void SetDxOutputDuplication();
 	void SetDxStagingTex();
+	BOOL ReadFrameMetadata(const DXGI_OUTDUPL_FRAME_INFO&);
+	void CopyDirtyRegion(ID3D11Texture2D*, ID3D11Texture2D*);
+	BOOL ReadOldestFrame(UINT64*);
 
 	DXGI_OUTDUPL_DESC outdupl_desc;
 	IDXGIFactory1* pDx_factory;
@@ -34,6 +48,15 @@ private:
 	D3D_FEATURE_LEVEL* pDx_feature_level;
 	DXGI_OUTPUT_DESC output_desc;
 	D3D11_TEXTURE2D_DESC pDx_tex_desc;
-	ID3D11Texture2D* pDx_staging_tex;
+	std::vector<ID3D11Texture2D*> stagingTextures;
+	ReadbackTarget* pStagingTarget;
+	ReadbackRing* pReadback;
 	IDXGIOutputDuplication* pDx_duplication;
+
+	FrameMirror* pMirror;
+	BOOL mirrorValid;
+	BOOL fullCopyQueued; // a whole desktop copy was queued since the start or the last lost frame
+	std::vector<BYTE> metadata;
+	std::vector<FrameMove> moves;
+	DirtyRegion dirtyRegion;
 };
@@ -0,0 +1,126 @@
+#include <string.h>
+
+#include <DirtyRegion.h>
+
+static uint64_t RectArea(const FrameRect& rect) {
+	return (uint64_t)rect.width * rect.height;
+}
+
+static FrameRect RectUnion(const FrameRect& a, const FrameRect& b) {
+	unsigned left = a.x < b.x ? a.x : b.x;
+	unsigned top = a.y < b.y ? a.y : b.y;
+	unsigned right = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+	unsigned bottom = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+	FrameRect rect = { left, top, right - left, bottom - top };
+	return rect;
+}
+
+static uint64_t IntersectionArea(const FrameRect& a, const FrameRect& b) {
+	unsigned left = a.x > b.x ? a.x : b.x;
+	unsigned top = a.y > b.y ? a.y : b.y;
+	unsigned right = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+	unsigned bottom = a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+	if (right <= left || bottom <= top) {
+		return 0;
+	}
+	return (uint64_t)(right - left) * (bottom - top);
+}
+
+void DirtyRegion::Add(const FrameRect& rect, unsigned width, unsigned height) {
+	if (rect.x >= width || rect.y >= height) {
+		return;
+	}
+
+	FrameRect clipped = rect;
+	if (clipped.width > width - clipped.x) {
+		clipped.width = width - clipped.x;
+	}
+	if (clipped.height > height - clipped.y) {
+		clipped.height = height - clipped.y;
+	}
+	if (clipped.width == 0 || clipped.height == 0) {
+		return;
+	}
+
+	rects.push_back(clipped);
+}
+
+void DirtyRegion::Merge() {
+	bool merged = true;
+
+	while (merged) {
+		merged = false;
+		for (size_t i = 0; i < rects.size() && !merged; i++) {
+			for (size_t j = i + 1; j < rects.size(); j++) {
+				FrameRect combined = RectUnion(rects[i], rects[j]);
+				uint64_t covered = RectArea(rects[i]) + RectArea(rects[j]) - IntersectionArea(rects[i], rects[j]);
+				if (RectArea(combined) - covered <= DIRTY_MERGE_SLACK_PIXELS) {
+					rects[i] = combined;
+					rects.erase(rects.begin() + j);
+					merged = true;
+					break;
+				}
+			}
+		}
+	}
+
+	if (rects.size() > DIRTY_MAX_RECTS) {
+		FrameRect bounds = rects[0];
+		for (const FrameRect& rect : rects) {
+			bounds = RectUnion(bounds, rect);
+		}
+		rects.assign(1, bounds);
+	}
+}
+
+uint64_t DirtyRegion::Area() const {
+	uint64_t area = 0;
+	for (const FrameRect& rect : rects) {
+		area += RectArea(rect);
+	}
+	return area;
+}
+
+FrameMirror::FrameMirror(unsigned width, unsigned height) : width(width), height(height) {
+	pitch = (long)(width * FRAME_BYTES_PER_PIXEL);
+	pixels.assign((size_t)pitch * height, 0);
+}
+
+void FrameMirror::ApplyMoves(const std::vector<FrameMove>& moves) {
+	for (const FrameMove& move : moves) {
+		const FrameRect& dest = move.dest;
+		if (dest.x > width || dest.width > width - dest.x || dest.y > height || dest.height > height - dest.y ||
+			move.srcX > width - dest.width || move.srcY > height - dest.height) {
+			continue;
+		}
+
+		size_t cbRow = (size_t)dest.width * FRAME_BYTES_PER_PIXEL;
+		uint8_t* pBase = pixels.data();
+
+		// Source and destination can overlap: walk rows away from the overlap
+		if (dest.y > move.srcY) {
+			for (unsigned row = dest.height; row-- > 0;) {
+				memmove(pBase + (size_t)(dest.y + row) * pitch + (size_t)dest.x * FRAME_BYTES_PER_PIXEL,
+					pBase + (size_t)(move.srcY + row) * pitch + (size_t)move.srcX * FRAME_BYTES_PER_PIXEL, cbRow);
+			}
+		}
+		else {
+			for (unsigned row = 0; row < dest.height; row++) {
+				memmove(pBase + (size_t)(dest.y + row) * pitch + (size_t)dest.x * FRAME_BYTES_PER_PIXEL,
+					pBase + (size_t)(move.srcY + row) * pitch + (size_t)move.srcX * FRAME_BYTES_PER_PIXEL, cbRow);
+			}
+		}
+	}
+}
+
+void FrameMirror::UpdateRects(const FrameView& src, const std::vector<FrameRect>& rects) {
+	for (const FrameRect& rect : rects) {
+		uint8_t* pDest = pixels.data() + (size_t)rect.y * pitch + (size_t)rect.x * FRAME_BYTES_PER_PIXEL;
+		CropFrame(pDest, pitch, src, rect);
+	}
+}
+
+FrameView FrameMirror::View() const {
+	FrameView view = { pixels.data(), pitch, width, height };
+	return view;
+}
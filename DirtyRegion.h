@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <FrameCrop.h>
+
+// Dirty areas whose bounding box wastes fewer pixels than this are copied as one rect
+const unsigned DIRTY_MERGE_SLACK_PIXELS = 64 * 64;
+// Past this many rects the whole bounding box is copied instead
+const unsigned DIRTY_MAX_RECTS = 64;
+
+// Region that moved within the frame, e.g. a scrolled or dragged window
+typedef struct FrameMove {
+	unsigned srcX;
+	unsigned srcY;
+	FrameRect dest;
+} FrameMove;
+
+/*
+Set of changed rectangles of a frame. Rects that overlap, or whose union is
+barely larger than the rects themselves, are merged so that a frame turns into
+a few large copies instead of many small ones.
+*/
+class DirtyRegion {
+public:
+	void Clear() { rects.clear(); }
+	// Adds rect, clipped to width x height. Empty rects are ignored
+	void Add(const FrameRect& rect, unsigned width, unsigned height);
+	void Merge();
+	bool Empty() const { return rects.empty(); }
+	uint64_t Area() const;
+	const std::vector<FrameRect>& Rects() const { return rects; }
+private:
+	std::vector<FrameRect> rects;
+};
+
+/*
+CPU copy of the captured desktop, kept up to date from move and dirty rects so
+unchanged pixels are never read back from the GPU again.
+*/
+class FrameMirror {
+public:
+	FrameMirror(unsigned width, unsigned height);
+	// Moves are applied in order, before the dirty rects of the same frame
+	void ApplyMoves(const std::vector<FrameMove>& moves);
+	// Copies rects from src (same geometry as the mirror) into the mirror
+	void UpdateRects(const FrameView& src, const std::vector<FrameRect>& rects);
+	FrameView View() const;
+private:
+	std::vector<uint8_t> pixels;
+	unsigned width;
+	unsigned height;
+	long pitch;
+};
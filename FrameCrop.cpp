@@ -0,0 +1,159 @@
+#include <string.h>
+
+#include <CpuFeatures.h>
+#include <FrameCrop.h>
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+/*
+Crops larger than this are copied with non-temporal stores: the destination
+is consumed by the encoder, so pulling it through the cache only evicts the
+source rows we are about to read
+*/
+#define CROP_STREAMING_THRESHOLD (256 * 1024)
+
+typedef void (*CopyRowFn)(uint8_t* pDest, const uint8_t* pSrc, size_t cbRow, bool streaming);
+
+static void CopyRowScalar(uint8_t* pDest, const uint8_t* pSrc, size_t cbRow, bool) {
+	memcpy(pDest, pSrc, cbRow);
+}
+
+#if CPU_X86
+static void CopyRowSse2(uint8_t* pDest, const uint8_t* pSrc, size_t cbRow, bool streaming) {
+	size_t i = 0;
+
+	// Align the destination so the stores below can be aligned/non-temporal
+	size_t head = (16 - ((uintptr_t)pDest & 15)) & 15;
+	if (head > cbRow) {
+		head = cbRow;
+	}
+	memcpy(pDest, pSrc, head);
+	i = head;
+
+	if (streaming) {
+		for (; i + 64 <= cbRow; i += 64) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(pSrc + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(pSrc + i + 16));
+			__m128i c = _mm_loadu_si128((const __m128i*)(pSrc + i + 32));
+			__m128i d = _mm_loadu_si128((const __m128i*)(pSrc + i + 48));
+			_mm_stream_si128((__m128i*)(pDest + i), a);
+			_mm_stream_si128((__m128i*)(pDest + i + 16), b);
+			_mm_stream_si128((__m128i*)(pDest + i + 32), c);
+			_mm_stream_si128((__m128i*)(pDest + i + 48), d);
+		}
+	}
+	else {
+		for (; i + 64 <= cbRow; i += 64) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(pSrc + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(pSrc + i + 16));
+			__m128i c = _mm_loadu_si128((const __m128i*)(pSrc + i + 32));
+			__m128i d = _mm_loadu_si128((const __m128i*)(pSrc + i + 48));
+			_mm_store_si128((__m128i*)(pDest + i), a);
+			_mm_store_si128((__m128i*)(pDest + i + 16), b);
+			_mm_store_si128((__m128i*)(pDest + i + 32), c);
+			_mm_store_si128((__m128i*)(pDest + i + 48), d);
+		}
+	}
+	for (; i + 16 <= cbRow; i += 16) {
+		_mm_store_si128((__m128i*)(pDest + i), _mm_loadu_si128((const __m128i*)(pSrc + i)));
+	}
+	memcpy(pDest + i, pSrc + i, cbRow - i);
+}
+
+TARGET_AVX2 static void CopyRowAvx2(uint8_t* pDest, const uint8_t* pSrc, size_t cbRow, bool streaming) {
+	size_t i = 0;
+
+	size_t head = (32 - ((uintptr_t)pDest & 31)) & 31;
+	if (head > cbRow) {
+		head = cbRow;
+	}
+	memcpy(pDest, pSrc, head);
+	i = head;
+
+	if (streaming) {
+		for (; i + 128 <= cbRow; i += 128) {
+			__m256i a = _mm256_loadu_si256((const __m256i*)(pSrc + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(pSrc + i + 32));
+			__m256i c = _mm256_loadu_si256((const __m256i*)(pSrc + i + 64));
+			__m256i d = _mm256_loadu_si256((const __m256i*)(pSrc + i + 96));
+			_mm256_stream_si256((__m256i*)(pDest + i), a);
+			_mm256_stream_si256((__m256i*)(pDest + i + 32), b);
+			_mm256_stream_si256((__m256i*)(pDest + i + 64), c);
+			_mm256_stream_si256((__m256i*)(pDest + i + 96), d);
+		}
+	}
+	else {
+		for (; i + 128 <= cbRow; i += 128) {
+			__m256i a = _mm256_loadu_si256((const __m256i*)(pSrc + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(pSrc + i + 32));
+			__m256i c = _mm256_loadu_si256((const __m256i*)(pSrc + i + 64));
+			__m256i d = _mm256_loadu_si256((const __m256i*)(pSrc + i + 96));
+			_mm256_store_si256((__m256i*)(pDest + i), a);
+			_mm256_store_si256((__m256i*)(pDest + i + 32), b);
+			_mm256_store_si256((__m256i*)(pDest + i + 64), c);
+			_mm256_store_si256((__m256i*)(pDest + i + 96), d);
+		}
+	}
+	for (; i + 32 <= cbRow; i += 32) {
+		_mm256_store_si256((__m256i*)(pDest + i), _mm256_loadu_si256((const __m256i*)(pSrc + i)));
+	}
+	memcpy(pDest + i, pSrc + i, cbRow - i);
+}
+#endif
+
+CropKernel GetCropKernel() {
+	const CpuFeatures& cpu = GetCpuFeatures();
+
+	if (cpu.avx2) {
+		return CROP_KERNEL_AVX2;
+	}
+	if (cpu.sse2) {
+		return CROP_KERNEL_SSE2;
+	}
+	return CROP_KERNEL_SCALAR;
+}
+
+bool CropFrame(uint8_t* pDest, long destPitch, const FrameView& src, const FrameRect& rect, CropKernel kernel) {
+	if (rect.x > src.width || rect.width > src.width - rect.x ||
+		rect.y > src.height || rect.height > src.height - rect.y) {
+		return false;
+	}
+
+	size_t cbRow = (size_t)rect.width * FRAME_BYTES_PER_PIXEL;
+	if (cbRow == 0 || rect.height == 0) {
+		return true;
+	}
+
+	if (kernel == CROP_KERNEL_AUTO) {
+		kernel = GetCropKernel();
+	}
+
+	CopyRowFn copyRow = CopyRowScalar;
+#if CPU_X86
+	if (kernel == CROP_KERNEL_AVX2 && GetCpuFeatures().avx2) {
+		copyRow = CopyRowAvx2;
+	}
+	else if (kernel != CROP_KERNEL_SCALAR && GetCpuFeatures().sse2) {
+		copyRow = CopyRowSse2;
+	}
+#endif
+
+	bool streaming = cbRow * rect.height >= CROP_STREAMING_THRESHOLD;
+	const uint8_t* pSrcRow = src.pData + (size_t)rect.y * src.pitch + (size_t)rect.x * FRAME_BYTES_PER_PIXEL;
+
+	for (unsigned row = 0; row < rect.height; row++) {
+		copyRow(pDest, pSrcRow, cbRow, streaming);
+		pDest += destPitch;
+		pSrcRow += src.pitch;
+	}
+
+#if CPU_X86
+	if (streaming && copyRow != CopyRowScalar) {
+		_mm_sfence();
+	}
+#endif
+
+	return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Captured frames are 8-bit BGRA
+const unsigned FRAME_BYTES_PER_PIXEL = 4;
+
+/*
+Read-only view of a captured frame. pitch is the distance in bytes between the
+start of two consecutive rows and may be larger than width * FRAME_BYTES_PER_PIXEL
+(e.g. the RowPitch of a mapped staging texture)
+*/
+typedef struct FrameView {
+	const uint8_t* pData;
+	long pitch;
+	unsigned width;
+	unsigned height;
+} FrameView;
+
+// Region of a frame, in pixels
+typedef struct FrameRect {
+	unsigned x;
+	unsigned y;
+	unsigned width;
+	unsigned height;
+} FrameRect;
+
+typedef enum { CROP_KERNEL_AUTO, CROP_KERNEL_SCALAR, CROP_KERNEL_SSE2, CROP_KERNEL_AVX2 } CropKernel;
+
+/*
+Copies rect from src into pDest, whose rows are destPitch bytes apart.
+Returns false (and copies nothing) if rect does not fit inside src.
+*/
+bool CropFrame(uint8_t* pDest, long destPitch, const FrameView& src, const FrameRect& rect, CropKernel kernel = CROP_KERNEL_AUTO);
+
+// Kernel CROP_KERNEL_AUTO resolves to on this CPU
+CropKernel GetCropKernel();
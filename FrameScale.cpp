@@ -0,0 +1,543 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <CpuFeatures.h>
+#include <FrameScale.h>
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+#define WEIGHT_BITS 14
+// Fractional bits kept between the vertical and the horizontal pass
+#define INTERMEDIATE_BITS 6
+#define VERTICAL_SHIFT (WEIGHT_BITS - INTERMEDIATE_BITS)
+#define HORIZONTAL_SHIFT (WEIGHT_BITS + INTERMEDIATE_BITS)
+// Output rows per tile handed to a worker; even, so the 3:2 path never splits a pair of rows
+#define SCALE_TILE_ROWS 16
+
+typedef FrameScaler::Axis Axis;
+
+// Vertical pass over count bytes of taps source rows, into 8.6 fixed point values
+typedef void (*VerticalFn)(const uint8_t* const* ppRows, const int16_t* pWeights, unsigned taps, int16_t* pDest, unsigned count);
+// Horizontal pass of a vertical pass output row into width BGRA pixels
+typedef void (*HorizontalFn)(const int16_t* pRow, const Axis& axis, const int32_t* pPairs, uint8_t* pDest, unsigned width);
+// 2:1 box of two source rows into width pixels
+typedef void (*HalfFn)(const uint8_t* pSrc0, const uint8_t* pSrc1, uint8_t* pDest, unsigned width);
+// 3:2 box of three source rows into two rows of width pixels
+typedef void (*TwoThirdsFn)(const uint8_t* pSrc0, const uint8_t* pSrc1, const uint8_t* pSrc2, uint8_t* pDest0, uint8_t* pDest1, unsigned width);
+
+static inline uint8_t Clamp8(int value) {
+	return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+// Rounded v / 9 for v up to 9 * 255
+static inline uint8_t Ninth(unsigned v) {
+	return (uint8_t)(((v + 4) * 7282) >> 16);
+}
+
+static inline int32_t PairWeights(int16_t w0, int16_t w1) {
+	return (int32_t)((uint32_t)(uint16_t)w0 | ((uint32_t)(uint16_t)w1 << 16));
+}
+
+static double FilterRadius(ScaleFilter filter) {
+	switch (filter) {
+	case SCALE_FILTER_BILINEAR:
+		return 1.0;
+	case SCALE_FILTER_BICUBIC:
+		return 2.0;
+	default:
+		return 0.5;
+	}
+}
+
+// Bilinear and bicubic kernels at distance x, in source pixels of the unscaled filter
+static double FilterWeight(ScaleFilter filter, double x) {
+	x = fabs(x);
+	if (filter == SCALE_FILTER_BILINEAR) {
+		return x < 1.0 ? 1.0 - x : 0.0;
+	}
+	// Catmull-Rom, a = -0.5
+	if (x < 1.0) {
+		return (1.5 * x - 2.5) * x * x + 1.0;
+	}
+	if (x < 2.0) {
+		return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+	}
+	return 0.0;
+}
+
+/*
+Taps of every output pixel along an axis. Source pixels past the edges fold
+onto the edge pixels, and the weights of each output sum to exactly
+1 << WEIGHT_BITS. The tap count is even, so taps can be processed in pairs
+*/
+static void BuildAxis(ScaleFilter filter, unsigned srcSize, unsigned dstSize, Axis* pAxis) {
+	double scale = (double)srcSize / dstSize;
+	double support = scale > 1.0 ? scale : 1.0;
+	double radius = FilterRadius(filter) * support;
+
+	std::vector<std::vector<double>> outputWeights(dstSize);
+	std::vector<unsigned> first(dstSize);
+	unsigned taps = 1;
+
+	for (unsigned i = 0; i < dstSize; i++) {
+		double center = (i + 0.5) * scale;
+		int lo = (int)floor(center - radius);
+		int hi = (int)ceil(center + radius);
+		int clampedLo = lo < 0 ? 0 : lo;
+		int clampedHi = hi > (int)srcSize - 1 ? (int)srcSize - 1 : hi;
+		std::vector<double>& weights = outputWeights[i];
+		weights.assign(clampedHi - clampedLo + 1, 0.0);
+
+		for (int j = lo; j <= hi; j++) {
+			double weight;
+			if (filter == SCALE_FILTER_BOX) {
+				// Part of source pixel j inside the area the output covers
+				double left = j > center - radius ? j : center - radius;
+				double right = j + 1 < center + radius ? j + 1 : center + radius;
+				weight = right > left ? right - left : 0.0;
+			}
+			else {
+				weight = FilterWeight(filter, (j + 0.5 - center) / support);
+			}
+			int k = j < clampedLo ? clampedLo : (j > clampedHi ? clampedHi : j);
+			weights[k - clampedLo] += weight;
+		}
+
+		// Drop the taps the window only grazed
+		while (weights.size() > 1 && weights.back() == 0.0) {
+			weights.pop_back();
+		}
+		unsigned leading = 0;
+		while (leading + 1 < weights.size() && weights[leading] == 0.0) {
+			leading++;
+		}
+		weights.erase(weights.begin(), weights.begin() + leading);
+		first[i] = clampedLo + leading;
+		if (weights.size() > taps) {
+			taps = (unsigned)weights.size();
+		}
+	}
+	taps += taps & 1;
+
+	pAxis->taps = taps;
+	pAxis->start.assign(dstSize, 0);
+	pAxis->weights.assign((size_t)dstSize * taps, 0);
+	for (unsigned i = 0; i < dstSize; i++) {
+		const std::vector<double>& weights = outputWeights[i];
+		// Windows are shifted inside the source, so whole tap runs can be read without bounds checks
+		unsigned start = srcSize >= taps && first[i] > srcSize - taps ? srcSize - taps : first[i];
+		if (srcSize < taps) {
+			start = 0;
+		}
+		int16_t* pWeights = &pAxis->weights[(size_t)i * taps + (first[i] - start)];
+
+		double sum = 0.0;
+		for (double weight : weights) {
+			sum += weight;
+		}
+		int total = 0;
+		size_t largest = 0;
+		for (size_t t = 0; t < weights.size(); t++) {
+			pWeights[t] = (int16_t)lround(weights[t] / sum * (1 << WEIGHT_BITS));
+			total += pWeights[t];
+			if (abs(pWeights[t]) > abs(pWeights[largest])) {
+				largest = t;
+			}
+		}
+		pWeights[largest] = (int16_t)(pWeights[largest] + (1 << WEIGHT_BITS) - total);
+		pAxis->start[i] = start;
+	}
+}
+
+static void VerticalTail(const uint8_t* const* ppRows, const int16_t* pWeights, unsigned taps, int16_t* pDest, unsigned k, unsigned count) {
+	for (; k < count; k++) {
+		int sum = 1 << (VERTICAL_SHIFT - 1);
+		for (unsigned t = 0; t < taps; t++) {
+			sum += pWeights[t] * ppRows[t][k];
+		}
+		pDest[k] = (int16_t)(sum >> VERTICAL_SHIFT);
+	}
+}
+
+static void VerticalScalar(const uint8_t* const* ppRows, const int16_t* pWeights, unsigned taps, int16_t* pDest, unsigned count) {
+	VerticalTail(ppRows, pWeights, taps, pDest, 0, count);
+}
+
+static void HorizontalTail(const int16_t* pRow, const Axis& axis, uint8_t* pDest, unsigned x, unsigned width) {
+	for (; x < width; x++) {
+		const int16_t* pSrc = pRow + (size_t)axis.start[x] * FRAME_BYTES_PER_PIXEL;
+		const int16_t* pWeights = &axis.weights[(size_t)x * axis.taps];
+		for (unsigned c = 0; c < FRAME_BYTES_PER_PIXEL; c++) {
+			int sum = 1 << (HORIZONTAL_SHIFT - 1);
+			for (unsigned t = 0; t < axis.taps; t++) {
+				sum += pWeights[t] * pSrc[t * FRAME_BYTES_PER_PIXEL + c];
+			}
+			pDest[x * FRAME_BYTES_PER_PIXEL + c] = Clamp8(sum >> HORIZONTAL_SHIFT);
+		}
+	}
+}
+
+static void HorizontalScalar(const int16_t* pRow, const Axis& axis, const int32_t*, uint8_t* pDest, unsigned width) {
+	HorizontalTail(pRow, axis, pDest, 0, width);
+}
+
+static void HalfTail(const uint8_t* pSrc0, const uint8_t* pSrc1, uint8_t* pDest, unsigned x, unsigned width) {
+	for (; x < width; x++) {
+		const uint8_t* p0 = pSrc0 + (size_t)x * 2 * FRAME_BYTES_PER_PIXEL;
+		const uint8_t* p1 = pSrc1 + (size_t)x * 2 * FRAME_BYTES_PER_PIXEL;
+		for (unsigned c = 0; c < FRAME_BYTES_PER_PIXEL; c++) {
+			pDest[x * FRAME_BYTES_PER_PIXEL + c] = (uint8_t)((p0[c] + p0[c + 4] + p1[c] + p1[c + 4] + 2) >> 2);
+		}
+	}
+}
+
+static void HalfScalar(const uint8_t* pSrc0, const uint8_t* pSrc1, uint8_t* pDest, unsigned width) {
+	HalfTail(pSrc0, pSrc1, pDest, 0, width);
+}
+
+// Each source triple A B C gives two outputs weighted 2:1 and 1:2, on both axes
+static void TwoThirdsTail(const uint8_t* pSrc0, const uint8_t* pSrc1, const uint8_t* pSrc2, uint8_t* pDest0, uint8_t* pDest1, unsigned x, unsigned width) {
+	for (; x + 2 <= width; x += 2) {
+		size_t offset = (size_t)x / 2 * 3 * FRAME_BYTES_PER_PIXEL;
+		const uint8_t* p0 = pSrc0 + offset;
+		const uint8_t* p1 = pSrc1 + offset;
+		const uint8_t* p2 = pSrc2 + offset;
+		for (unsigned c = 0; c < FRAME_BYTES_PER_PIXEL; c++) {
+			unsigned a0 = 2 * p0[c] + p0[c + 4], b0 = p0[c + 4] + 2 * p0[c + 8];
+			unsigned a1 = 2 * p1[c] + p1[c + 4], b1 = p1[c + 4] + 2 * p1[c + 8];
+			unsigned a2 = 2 * p2[c] + p2[c + 4], b2 = p2[c + 4] + 2 * p2[c + 8];
+			pDest0[x * FRAME_BYTES_PER_PIXEL + c] = Ninth(2 * a0 + a1);
+			pDest0[(x + 1) * FRAME_BYTES_PER_PIXEL + c] = Ninth(2 * b0 + b1);
+			pDest1[x * FRAME_BYTES_PER_PIXEL + c] = Ninth(a1 + 2 * a2);
+			pDest1[(x + 1) * FRAME_BYTES_PER_PIXEL + c] = Ninth(b1 + 2 * b2);
+		}
+	}
+}
+
+static void TwoThirdsScalar(const uint8_t* pSrc0, const uint8_t* pSrc1, const uint8_t* pSrc2, uint8_t* pDest0, uint8_t* pDest1, unsigned width) {
+	TwoThirdsTail(pSrc0, pSrc1, pSrc2, pDest0, pDest1, 0, width);
+}
+
+#if CPU_X86
+/*
+Bytes of two rows are interleaved as 16-bit values so _mm_madd_epi16 applies
+a pair of taps at once. 16 bytes (4 pixels) per iteration
+*/
+TARGET_SSE41 static void VerticalSse41(const uint8_t* const* ppRows, const int16_t* pWeights, unsigned taps, int16_t* pDest, unsigned count) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (VERTICAL_SHIFT - 1));
+
+	unsigned k = 0;
+	for (; k + 16 <= count; k += 16) {
+		__m128i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+		for (unsigned t = 0; t < taps; t += 2) {
+			__m128i weights = _mm_set1_epi32(PairWeights(pWeights[t], pWeights[t + 1]));
+			__m128i a = _mm_loadu_si128((const __m128i*)(ppRows[t] + k));
+			__m128i b = _mm_loadu_si128((const __m128i*)(ppRows[t + 1] + k));
+			__m128i aLo = _mm_unpacklo_epi8(a, zero), aHi = _mm_unpackhi_epi8(a, zero);
+			__m128i bLo = _mm_unpacklo_epi8(b, zero), bHi = _mm_unpackhi_epi8(b, zero);
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(aLo, bLo), weights));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(aLo, bLo), weights));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi16(aHi, bHi), weights));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi16(aHi, bHi), weights));
+		}
+		acc0 = _mm_srai_epi32(acc0, VERTICAL_SHIFT);
+		acc1 = _mm_srai_epi32(acc1, VERTICAL_SHIFT);
+		acc2 = _mm_srai_epi32(acc2, VERTICAL_SHIFT);
+		acc3 = _mm_srai_epi32(acc3, VERTICAL_SHIFT);
+		_mm_storeu_si128((__m128i*)(pDest + k), _mm_packs_epi32(acc0, acc1));
+		_mm_storeu_si128((__m128i*)(pDest + k + 8), _mm_packs_epi32(acc2, acc3));
+	}
+
+	VerticalTail(ppRows, pWeights, taps, pDest, k, count);
+}
+
+/*
+Two taps of one pixel are reordered as B0 B1 G0 G1 R0 R1 A0 A1, so
+_mm_madd_epi16 against the tap pair yields the 4 channels at once
+*/
+TARGET_SSE41 static void HorizontalSse41(const int16_t* pRow, const Axis& axis, const int32_t* pPairs, uint8_t* pDest, unsigned width) {
+	const __m128i order = _mm_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+	const __m128i round = _mm_set1_epi32(1 << (HORIZONTAL_SHIFT - 1));
+	unsigned pairs = axis.taps / 2;
+
+	for (unsigned x = 0; x < width; x++) {
+		const int16_t* pSrc = pRow + (size_t)axis.start[x] * FRAME_BYTES_PER_PIXEL;
+		const int32_t* pWeights = pPairs + (size_t)x * pairs;
+		__m128i acc = round;
+		for (unsigned p = 0; p < pairs; p++) {
+			__m128i pixels = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pSrc + p * 8)), order);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(pixels, _mm_set1_epi32(pWeights[p])));
+		}
+		acc = _mm_srai_epi32(acc, HORIZONTAL_SHIFT);
+		__m128i packed = _mm_packs_epi32(acc, acc);
+		int pixel = _mm_cvtsi128_si32(_mm_packus_epi16(packed, packed));
+		memcpy(pDest + (size_t)x * FRAME_BYTES_PER_PIXEL, &pixel, 4);
+	}
+}
+
+// 4 output pixels from 8 pixels of each source row; blocks are summed as in the color converter
+TARGET_SSE41 static void HalfSse41(const uint8_t* pSrc0, const uint8_t* pSrc1, uint8_t* pDest, unsigned width) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+
+	unsigned x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(pSrc0 + x * 8));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(pSrc0 + x * 8 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(pSrc1 + x * 8));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(pSrc1 + x * 8 + 16));
+
+		__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+		s0 = _mm_add_epi16(s0, _mm_srli_si128(s0, 8));
+		s1 = _mm_add_epi16(s1, _mm_srli_si128(s1, 8));
+		s2 = _mm_add_epi16(s2, _mm_srli_si128(s2, 8));
+		s3 = _mm_add_epi16(s3, _mm_srli_si128(s3, 8));
+
+		__m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s0, s1), two), 2);
+		__m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s2, s3), two), 2);
+		_mm_storeu_si128((__m128i*)(pDest + x * 4), _mm_packus_epi16(lo, hi));
+	}
+
+	HalfTail(pSrc0, pSrc1, pDest, x, width);
+}
+
+/*
+Horizontal 3:2 step of 6 source pixels: 2X + Y with X = p0 p2 p3 p5 and
+Y = p1 p1 p4 p4, as 16-bit values of 4 outputs
+*/
+TARGET_SSE41 static inline void TwoThirdsRow(const uint8_t* pSrc, __m128i* pLo, __m128i* pHi) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i first = _mm_loadu_si128((const __m128i*)pSrc);
+	__m128i second = _mm_loadu_si128((const __m128i*)(pSrc + 8));
+
+	__m128i x = _mm_blend_epi16(_mm_shuffle_epi32(first, _MM_SHUFFLE(3, 3, 2, 0)), _mm_shuffle_epi32(second, _MM_SHUFFLE(3, 3, 3, 3)), 0xc0);
+	__m128i y = _mm_unpacklo_epi64(_mm_shuffle_epi32(first, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_epi32(second, _MM_SHUFFLE(2, 2, 2, 2)));
+	*pLo = _mm_add_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(x, zero), 1), _mm_unpacklo_epi8(y, zero));
+	*pHi = _mm_add_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(x, zero), 1), _mm_unpackhi_epi8(y, zero));
+}
+
+// 4 pixels of 2 output rows per iteration; the /9 is a rounded multiply by 7282 / 65536
+TARGET_SSE41 static void TwoThirdsSse41(const uint8_t* pSrc0, const uint8_t* pSrc1, const uint8_t* pSrc2, uint8_t* pDest0, uint8_t* pDest1, unsigned width) {
+	const __m128i four = _mm_set1_epi16(4);
+	const __m128i ninth = _mm_set1_epi16(7282);
+
+	unsigned x = 0;
+	for (; x + 4 <= width; x += 4) {
+		size_t offset = (size_t)x / 2 * 3 * FRAME_BYTES_PER_PIXEL;
+		__m128i lo0, hi0, lo1, hi1, lo2, hi2;
+		TwoThirdsRow(pSrc0 + offset, &lo0, &hi0);
+		TwoThirdsRow(pSrc1 + offset, &lo1, &hi1);
+		TwoThirdsRow(pSrc2 + offset, &lo2, &hi2);
+
+		__m128i top0 = _mm_add_epi16(_mm_slli_epi16(lo0, 1), lo1);
+		__m128i top1 = _mm_add_epi16(_mm_slli_epi16(hi0, 1), hi1);
+		__m128i bottom0 = _mm_add_epi16(lo1, _mm_slli_epi16(lo2, 1));
+		__m128i bottom1 = _mm_add_epi16(hi1, _mm_slli_epi16(hi2, 1));
+		top0 = _mm_mulhi_epu16(_mm_add_epi16(top0, four), ninth);
+		top1 = _mm_mulhi_epu16(_mm_add_epi16(top1, four), ninth);
+		bottom0 = _mm_mulhi_epu16(_mm_add_epi16(bottom0, four), ninth);
+		bottom1 = _mm_mulhi_epu16(_mm_add_epi16(bottom1, four), ninth);
+
+		_mm_storeu_si128((__m128i*)(pDest0 + x * 4), _mm_packus_epi16(top0, top1));
+		_mm_storeu_si128((__m128i*)(pDest1 + x * 4), _mm_packus_epi16(bottom0, bottom1));
+	}
+
+	TwoThirdsTail(pSrc0, pSrc1, pSrc2, pDest0, pDest1, x, width);
+}
+
+/*
+Same arithmetic as the SSE4.1 kernel on 32 bytes. unpack and pack work within
+128-bit lanes, so the two halves are put back in order before the stores
+*/
+TARGET_AVX2 static void VerticalAvx2(const uint8_t* const* ppRows, const int16_t* pWeights, unsigned taps, int16_t* pDest, unsigned count) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi32(1 << (VERTICAL_SHIFT - 1));
+
+	unsigned k = 0;
+	for (; k + 32 <= count; k += 32) {
+		__m256i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+		for (unsigned t = 0; t < taps; t += 2) {
+			__m256i weights = _mm256_set1_epi32(PairWeights(pWeights[t], pWeights[t + 1]));
+			__m256i a = _mm256_loadu_si256((const __m256i*)(ppRows[t] + k));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(ppRows[t + 1] + k));
+			__m256i aLo = _mm256_unpacklo_epi8(a, zero), aHi = _mm256_unpackhi_epi8(a, zero);
+			__m256i bLo = _mm256_unpacklo_epi8(b, zero), bHi = _mm256_unpackhi_epi8(b, zero);
+			acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_unpacklo_epi16(aLo, bLo), weights));
+			acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_unpackhi_epi16(aLo, bLo), weights));
+			acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_unpacklo_epi16(aHi, bHi), weights));
+			acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_unpackhi_epi16(aHi, bHi), weights));
+		}
+		// Lane 0 holds bytes 0-15, lane 1 bytes 16-31
+		__m256i first = _mm256_packs_epi32(_mm256_srai_epi32(acc0, VERTICAL_SHIFT), _mm256_srai_epi32(acc1, VERTICAL_SHIFT));
+		__m256i second = _mm256_packs_epi32(_mm256_srai_epi32(acc2, VERTICAL_SHIFT), _mm256_srai_epi32(acc3, VERTICAL_SHIFT));
+		_mm256_storeu_si256((__m256i*)(pDest + k), _mm256_permute2x128_si256(first, second, 0x20));
+		_mm256_storeu_si256((__m256i*)(pDest + k + 16), _mm256_permute2x128_si256(first, second, 0x31));
+	}
+
+	VerticalTail(ppRows, pWeights, taps, pDest, k, count);
+}
+
+// Two output pixels per iteration, one per 128-bit lane
+TARGET_AVX2 static void HorizontalAvx2(const int16_t* pRow, const Axis& axis, const int32_t* pPairs, uint8_t* pDest, unsigned width) {
+	const __m256i order = _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15,
+		0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+	const __m256i round = _mm256_set1_epi32(1 << (HORIZONTAL_SHIFT - 1));
+	unsigned pairs = axis.taps / 2;
+
+	unsigned x = 0;
+	for (; x + 2 <= width; x += 2) {
+		const int16_t* pSrc0 = pRow + (size_t)axis.start[x] * FRAME_BYTES_PER_PIXEL;
+		const int16_t* pSrc1 = pRow + (size_t)axis.start[x + 1] * FRAME_BYTES_PER_PIXEL;
+		const int32_t* pWeights0 = pPairs + (size_t)x * pairs;
+		const int32_t* pWeights1 = pWeights0 + pairs;
+		__m256i acc = round;
+		for (unsigned p = 0; p < pairs; p++) {
+			__m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(pSrc0 + p * 8))),
+				_mm_loadu_si128((const __m128i*)(pSrc1 + p * 8)), 1);
+			__m256i weights = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_set1_epi32(pWeights0[p])), _mm_set1_epi32(pWeights1[p]), 1);
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_shuffle_epi8(pixels, order), weights));
+		}
+		acc = _mm256_srai_epi32(acc, HORIZONTAL_SHIFT);
+		__m256i packed = _mm256_packs_epi32(acc, acc);
+		packed = _mm256_packus_epi16(packed, packed);
+		int pixel0 = _mm_cvtsi128_si32(_mm256_castsi256_si128(packed));
+		int pixel1 = _mm_cvtsi128_si32(_mm256_extracti128_si256(packed, 1));
+		memcpy(pDest + (size_t)x * FRAME_BYTES_PER_PIXEL, &pixel0, 4);
+		memcpy(pDest + (size_t)(x + 1) * FRAME_BYTES_PER_PIXEL, &pixel1, 4);
+	}
+
+	HorizontalTail(pRow, axis, pDest, x, width);
+}
+#endif
+
+FrameScaler::FrameScaler(unsigned srcWidth, unsigned srcHeight, unsigned dstWidth, unsigned dstHeight, ScaleFilter filter, ThreadPool* pPool, ScaleKernel kernel)
+	: srcWidth(srcWidth), srcHeight(srcHeight), dstWidth(dstWidth), dstHeight(dstHeight), pPool(pPool) {
+	const CpuFeatures& cpu = GetCpuFeatures();
+
+	if (kernel == SCALE_KERNEL_AUTO) {
+		kernel = cpu.avx2 ? SCALE_KERNEL_AVX2 : (cpu.sse41 ? SCALE_KERNEL_SSE41 : SCALE_KERNEL_SCALAR);
+	}
+	if (kernel == SCALE_KERNEL_AVX2 && !cpu.avx2) {
+		kernel = SCALE_KERNEL_SSE41;
+	}
+	if (kernel == SCALE_KERNEL_SSE41 && !cpu.sse41) {
+		kernel = SCALE_KERNEL_SCALAR;
+	}
+	this->kernel = kernel;
+
+	path = SCALE_PATH_SEPARABLE;
+	if (filter == SCALE_FILTER_BOX && dstWidth > 0 && dstHeight > 0) {
+		if (srcWidth == 2 * dstWidth && srcHeight == 2 * dstHeight) {
+			path = SCALE_PATH_HALF;
+		}
+		else if (2 * srcWidth == 3 * dstWidth && 2 * srcHeight == 3 * dstHeight) {
+			path = SCALE_PATH_TWO_THIRDS;
+		}
+	}
+	if (path != SCALE_PATH_SEPARABLE || srcWidth == 0 || srcHeight == 0 || dstWidth == 0 || dstHeight == 0) {
+		return;
+	}
+
+	BuildAxis(filter, srcWidth, dstWidth, &horizontal);
+	BuildAxis(filter, srcHeight, dstHeight, &vertical);
+
+	unsigned pairs = horizontal.taps / 2;
+	horizontalPairs.resize((size_t)dstWidth * pairs);
+	for (unsigned x = 0; x < dstWidth; x++) {
+		const int16_t* pWeights = &horizontal.weights[(size_t)x * horizontal.taps];
+		for (unsigned p = 0; p < pairs; p++) {
+			horizontalPairs[(size_t)x * pairs + p] = PairWeights(pWeights[2 * p], pWeights[2 * p + 1]);
+		}
+	}
+
+	unsigned tiles = (dstHeight + SCALE_TILE_ROWS - 1) / SCALE_TILE_ROWS;
+	tileRows.resize(tiles);
+	for (std::vector<int16_t>& row : tileRows) {
+		row.assign((size_t)(srcWidth + horizontal.taps) * FRAME_BYTES_PER_PIXEL, 0);
+	}
+}
+
+void FrameScaler::ScaleRows(const FrameView& src, const FrameRect& rect, uint8_t* pDest, long destPitch, unsigned firstRow, unsigned rowCount, unsigned tile) {
+	const uint8_t* pOrigin = src.pData + (size_t)rect.y * src.pitch + (size_t)rect.x * FRAME_BYTES_PER_PIXEL;
+	VerticalFn vertical = VerticalScalar;
+	HorizontalFn horizontalPass = HorizontalScalar;
+	HalfFn half = HalfScalar;
+	TwoThirdsFn twoThirds = TwoThirdsScalar;
+#if CPU_X86
+	if (kernel == SCALE_KERNEL_AVX2) {
+		vertical = VerticalAvx2;
+		horizontalPass = HorizontalAvx2;
+	}
+	else if (kernel == SCALE_KERNEL_SSE41) {
+		vertical = VerticalSse41;
+		horizontalPass = HorizontalSse41;
+	}
+	// The fixed ratio paths are memory bound, so 128-bit vectors are enough
+	if (kernel != SCALE_KERNEL_SCALAR) {
+		half = HalfSse41;
+		twoThirds = TwoThirdsSse41;
+	}
+#endif
+
+	if (path == SCALE_PATH_HALF) {
+		for (unsigned row = firstRow; row < firstRow + rowCount; row++) {
+			const uint8_t* pSrc0 = pOrigin + (size_t)row * 2 * src.pitch;
+			half(pSrc0, pSrc0 + src.pitch, pDest + (size_t)row * destPitch, dstWidth);
+		}
+		return;
+	}
+	if (path == SCALE_PATH_TWO_THIRDS) {
+		for (unsigned row = firstRow; row < firstRow + rowCount; row += 2) {
+			const uint8_t* pSrc0 = pOrigin + (size_t)row / 2 * 3 * src.pitch;
+			uint8_t* pDest0 = pDest + (size_t)row * destPitch;
+			twoThirds(pSrc0, pSrc0 + src.pitch, pSrc0 + 2 * src.pitch, pDest0, pDest0 + destPitch, dstWidth);
+		}
+		return;
+	}
+
+	int16_t* pRow = tileRows[tile].data();
+	std::vector<const uint8_t*> rows(this->vertical.taps);
+	for (unsigned row = firstRow; row < firstRow + rowCount; row++) {
+		unsigned start = this->vertical.start[row];
+		for (unsigned t = 0; t < this->vertical.taps; t++) {
+			// Taps past the last row of a tiny source have no weight
+			unsigned y = start + t < srcHeight ? start + t : srcHeight - 1;
+			rows[t] = pOrigin + (size_t)y * src.pitch;
+		}
+		vertical(rows.data(), &this->vertical.weights[(size_t)row * this->vertical.taps], this->vertical.taps, pRow, srcWidth * FRAME_BYTES_PER_PIXEL);
+		horizontalPass(pRow, horizontal, horizontalPairs.data(), pDest + (size_t)row * destPitch, dstWidth);
+	}
+}
+
+bool FrameScaler::Scale(const FrameView& src, const FrameRect& rect, uint8_t* pDest, long destPitch) {
+	if (rect.width != srcWidth || rect.height != srcHeight || dstWidth == 0 || dstHeight == 0 ||
+		rect.x > src.width || rect.width > src.width - rect.x ||
+		rect.y > src.height || rect.height > src.height - rect.y) {
+		return false;
+	}
+
+	unsigned tiles = (dstHeight + SCALE_TILE_ROWS - 1) / SCALE_TILE_ROWS;
+	auto scaleTile = [&](unsigned tile) {
+		unsigned firstRow = tile * SCALE_TILE_ROWS;
+		unsigned rowCount = dstHeight - firstRow < SCALE_TILE_ROWS ? dstHeight - firstRow : SCALE_TILE_ROWS;
+		ScaleRows(src, rect, pDest, destPitch, firstRow, rowCount, tile);
+	};
+
+	if (pPool != nullptr) {
+		pPool->ParallelFor(tiles, scaleTile);
+	}
+	else {
+		for (unsigned tile = 0; tile < tiles; tile++) {
+			scaleTile(tile);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <FrameCrop.h>
+#include <ThreadPool.h>
+
+/*
+BOX averages the source area each output pixel covers; BILINEAR and BICUBIC
+(Catmull-Rom) widen with the ratio when downscaling, so they never alias
+*/
+typedef enum { SCALE_FILTER_BOX, SCALE_FILTER_BILINEAR, SCALE_FILTER_BICUBIC } ScaleFilter;
+typedef enum { SCALE_KERNEL_AUTO, SCALE_KERNEL_SCALAR, SCALE_KERNEL_SSE41, SCALE_KERNEL_AVX2 } ScaleKernel;
+
+/*
+Resizes BGRA frames of a fixed size with a separable filter: a vertical pass
+into a row of 8.6 fixed point values, then a horizontal pass, both with 14-bit
+weights. Box scaling by exactly 2:1 or 3:2 takes dedicated paths that round
+each average exactly. For a given filter and size, every kernel produces
+bit-identical output.
+*/
+class FrameScaler {
+public:
+	FrameScaler(unsigned srcWidth, unsigned srcHeight, unsigned dstWidth, unsigned dstHeight, ScaleFilter filter, ThreadPool* pPool = nullptr, ScaleKernel kernel = SCALE_KERNEL_AUTO);
+	/*
+	Scales rect of src, which must be srcWidth x srcHeight, into pDest, whose rows
+	are destPitch bytes apart. Rows are split into tiles across the thread pool
+	when one was given. Returns false if rect does not fit inside src
+	*/
+	bool Scale(const FrameView& src, const FrameRect& rect, uint8_t* pDest, long destPitch);
+	ScaleKernel Kernel() const { return kernel; }
+
+	// Filter taps of one axis: output i reads taps source pixels from start[i]
+	struct Axis {
+		unsigned taps;
+		std::vector<unsigned> start;
+		std::vector<int16_t> weights;
+	};
+private:
+	typedef enum { SCALE_PATH_SEPARABLE, SCALE_PATH_HALF, SCALE_PATH_TWO_THIRDS } ScalePath;
+
+	void ScaleRows(const FrameView& src, const FrameRect& rect, uint8_t* pDest, long destPitch, unsigned firstRow, unsigned rowCount, unsigned tile);
+
+	unsigned srcWidth;
+	unsigned srcHeight;
+	unsigned dstWidth;
+	unsigned dstHeight;
+	ScalePath path;
+	Axis horizontal;
+	Axis vertical;
+	// Weights of the horizontal taps in pairs, as _mm_madd_epi16 takes them
+	std::vector<int32_t> horizontalPairs;
+	// Vertical pass output of each tile, padded so the horizontal pass can read whole tap pairs
+	std::vector<std::vector<int16_t>> tileRows;
+	ThreadPool* pPool;
+	ScaleKernel kernel;
+};
@@ -0,0 +1,104 @@
+#include <chrono>
+#include <thread>
+
+#include <FrameScheduler.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+SteadyClock::SteadyClock() : hTimer(nullptr), highResolution(false) {
+#ifdef _WIN32
+	// Available from Windows 10 1803; older systems fall back to a regular timer
+	hTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	highResolution = hTimer != NULL;
+	if (hTimer == NULL) {
+		hTimer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+	}
+#endif
+}
+
+SteadyClock::~SteadyClock() {
+#ifdef _WIN32
+	if (hTimer != NULL) {
+		CloseHandle(hTimer);
+	}
+#endif
+}
+
+int64_t SteadyClock::NowUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count();
+}
+
+void SteadyClock::SleepUntilUs(int64_t deadlineUs) {
+	int64_t remainingUs = deadlineUs - NowUs();
+	if (remainingUs <= 0) {
+		return;
+	}
+
+#ifdef _WIN32
+	if (hTimer != NULL) {
+		LARGE_INTEGER dueTime;
+		dueTime.QuadPart = -remainingUs * 10; // relative, in 100ns units
+		if (SetWaitableTimer(hTimer, &dueTime, 0, NULL, NULL, FALSE)) {
+			WaitForSingleObject(hTimer, INFINITE);
+			return;
+		}
+	}
+#endif
+	std::this_thread::sleep_for(std::chrono::microseconds(remainingUs));
+}
+
+FrameScheduler::FrameScheduler(unsigned fps, SchedulerClock* pClock) : pClock(pClock), fps(fps > 0 ? fps : 1), stats() {
+}
+
+void FrameScheduler::Start() {
+	startUs = pClock->NowUs();
+	nextFrame = 0;
+	stats = FrameSchedulerStats();
+}
+
+int64_t FrameScheduler::DeadlineUs(uint64_t frameIndex) const {
+	return startUs + (int64_t)(frameIndex * 1000000 / fps);
+}
+
+int64_t FrameScheduler::FrameTime(uint64_t frameIndex) const {
+	return (int64_t)(frameIndex * 10000000 / fps);
+}
+
+uint64_t FrameScheduler::WaitNextFrame() {
+	int64_t deadline = DeadlineUs(nextFrame);
+
+	if (pClock->NowUs() < deadline - FRAME_SPIN_TAIL_US) {
+		pClock->SleepUntilUs(deadline - FRAME_SPIN_TAIL_US);
+	}
+	while (pClock->NowUs() < deadline) {
+		std::this_thread::yield();
+	}
+
+	int64_t now = pClock->NowUs();
+
+	// Skip deadlines that are a whole period or more in the past
+	uint64_t currentFrame = (uint64_t)(now - startUs) * fps / 1000000;
+	if (currentFrame > nextFrame) {
+		stats.dropped += currentFrame - nextFrame;
+		nextFrame = currentFrame;
+		deadline = DeadlineUs(nextFrame);
+	}
+
+	int64_t lateness = now - deadline;
+	if (lateness > FRAME_LATE_TOLERANCE_US) {
+		stats.late += 1;
+	}
+	if (lateness > stats.maxLatenessUs) {
+		stats.maxLatenessUs = lateness;
+	}
+	stats.frames += 1;
+
+	return nextFrame++;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+// Monotonic time source the scheduler waits on. Times are in microseconds
+class SchedulerClock {
+public:
+	virtual ~SchedulerClock() {}
+	virtual int64_t NowUs() = 0;
+	// Coarse wait; may return somewhat before or after deadlineUs
+	virtual void SleepUntilUs(int64_t deadlineUs) = 0;
+};
+
+/*
+std::chrono::steady_clock based clock. On Windows the coarse wait uses a
+high-resolution waitable timer when the OS supports one
+*/
+class SteadyClock : public SchedulerClock {
+public:
+	SteadyClock();
+	~SteadyClock();
+	int64_t NowUs() override;
+	void SleepUntilUs(int64_t deadlineUs) override;
+private:
+	void* hTimer;
+	bool highResolution;
+};
+
+typedef struct FrameSchedulerStats {
+	uint64_t frames;        // deadlines that were served
+	uint64_t late;          // served more than FRAME_LATE_TOLERANCE_US after their deadline
+	uint64_t dropped;       // deadlines skipped because the previous frame overran them
+	int64_t maxLatenessUs;
+} FrameSchedulerStats;
+
+// Woken later than this past a deadline counts as a late frame
+const int64_t FRAME_LATE_TOLERANCE_US = 2000;
+// The last stretch before a deadline is spent spinning instead of sleeping
+const int64_t FRAME_SPIN_TAIL_US = 1500;
+
+/*
+Paces a capture loop at a fixed frame rate. Deadlines are computed from the
+start time and the frame index, so sleep inaccuracy never accumulates into drift.
+*/
+class FrameScheduler {
+public:
+	FrameScheduler(unsigned fps, SchedulerClock* pClock);
+	void Start();
+	/*
+	Blocks until the next deadline and returns its frame index. Deadlines that
+	already passed by a whole period are skipped and counted as dropped
+	*/
+	uint64_t WaitNextFrame();
+	// Presentation time of frameIndex relative to Start, in 100ns units
+	int64_t FrameTime(uint64_t frameIndex) const;
+	FrameSchedulerStats Stats() const { return stats; }
+private:
+	int64_t DeadlineUs(uint64_t frameIndex) const;
+
+	SchedulerClock* pClock;
+	unsigned fps;
+	int64_t startUs = 0;
+	uint64_t nextFrame = 0;
+	FrameSchedulerStats stats;
+};
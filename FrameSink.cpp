@@ -0,0 +1,29 @@
+#include <FrameSink.h>
+
+MemoryFrameSink::MemoryFrameSink(unsigned width, unsigned height, long pitch) {
+	this->pitch = pitch > 0 ? pitch : (long)(width * FRAME_BYTES_PER_PIXEL);
+	buffer.resize((size_t)this->pitch * height);
+}
+
+bool MemoryFrameSink::LockFrame(uint8_t** ppData, long* pPitch) {
+	*ppData = buffer.data();
+	*pPitch = pitch;
+	return true;
+}
+
+void MemoryFrameSink::UnlockFrame() {
+}
+
+bool CopyFrameToSink(FrameSink* pSink, const FrameView& src, const FrameRect& rect) {
+	uint8_t* pDest = nullptr;
+	long destPitch = 0;
+
+	if (!pSink->LockFrame(&pDest, &destPitch)) {
+		return false;
+	}
+
+	bool copied = CropFrame(pDest, destPitch, src, rect);
+	pSink->UnlockFrame();
+
+	return copied;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <FrameCrop.h>
+
+/*
+Destination of a cropped frame. The copy core only needs a writable pointer and a
+pitch, so it can write straight into an encoder buffer or into plain memory.
+*/
+class FrameSink {
+public:
+	virtual ~FrameSink() {}
+	// Exposes the destination surface. pPitch receives the distance between rows in bytes
+	virtual bool LockFrame(uint8_t** ppData, long* pPitch) = 0;
+	virtual void UnlockFrame() = 0;
+};
+
+// Frame sink backed by a heap buffer of width * height BGRA pixels
+class MemoryFrameSink : public FrameSink {
+public:
+	MemoryFrameSink(unsigned width, unsigned height, long pitch = 0);
+	bool LockFrame(uint8_t** ppData, long* pPitch) override;
+	void UnlockFrame() override;
+	const uint8_t* Data() const { return buffer.data(); }
+	long Pitch() const { return pitch; }
+private:
+	std::vector<uint8_t> buffer;
+	long pitch;
+};
+
+/*
+Locks the sink and copies rect from src into it in a single pass.
+Returns false if the sink cannot be locked or rect does not fit inside src.
+*/
+bool CopyFrameToSink(FrameSink* pSink, const FrameView& src, const FrameRect& rect);
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+typedef enum { STREAM_AUDIO = 0, STREAM_VIDEO = 1, STREAM_COUNT = 2 } StreamKind;
+
+typedef struct InterleaverStats {
+	uint64_t emitted;
+	uint64_t forced;        // emitted because the reorder window ran out, not because both streams caught up
+	uint64_t late;          // arrived after a later sample of the other stream had been emitted
+	int64_t skew;           // newest audio minus newest video timestamp, as of the last push
+	int64_t maxSkew;        // largest gap between the newest audio and newest video timestamps
+	unsigned maxQueueDepth;
+} InterleaverStats;
+
+/*
+Merges two timestamped streams into a single stream ordered by timestamp.
+Each stream must push in increasing timestamp order. A sample is emitted once
+the other stream has queued something at least as late, once the other stream
+ended, or once it is older than the newest sample by more than the reorder
+window, so a stalled stream delays the other one by at most that window.
+
+The sink is called with the lock held, so emissions are serialized.
+*/
+template <class T>
+class Interleaver {
+public:
+	typedef std::function<void(StreamKind, int64_t, T&)> Sink;
+
+	Interleaver(int64_t reorderWindow, Sink sink) : reorderWindow(reorderWindow), sink(sink), stats() {
+		for (int i = 0; i < STREAM_COUNT; i++) {
+			newest[i] = INT64_MIN;
+			ended[i] = false;
+		}
+	}
+
+	void Push(StreamKind stream, int64_t timestamp, T item) {
+		std::lock_guard<std::mutex> guard(lock);
+
+		Entry entry = { timestamp, item };
+		queues[stream].push_back(entry);
+		if (timestamp > newest[stream]) {
+			newest[stream] = timestamp;
+		}
+		if (timestamp < lastEmitted) {
+			stats.late += 1;
+		}
+
+		if (newest[STREAM_AUDIO] != INT64_MIN && newest[STREAM_VIDEO] != INT64_MIN) {
+			int64_t skew = newest[STREAM_AUDIO] - newest[STREAM_VIDEO];
+			stats.skew = skew;
+			if (skew < 0) {
+				skew = -skew;
+			}
+			if (skew > stats.maxSkew) {
+				stats.maxSkew = skew;
+			}
+		}
+
+		unsigned depth = (unsigned)(queues[STREAM_AUDIO].size() + queues[STREAM_VIDEO].size());
+		if (depth > stats.maxQueueDepth) {
+			stats.maxQueueDepth = depth;
+		}
+
+		Drain(false);
+	}
+
+	// No more samples will be pushed on stream
+	void EndOfStream(StreamKind stream) {
+		std::lock_guard<std::mutex> guard(lock);
+		ended[stream] = true;
+		Drain(false);
+	}
+
+	// Emits everything still queued, in timestamp order
+	void Flush() {
+		std::lock_guard<std::mutex> guard(lock);
+		Drain(true);
+	}
+
+	InterleaverStats Stats() {
+		std::lock_guard<std::mutex> guard(lock);
+		return stats;
+	}
+
+	unsigned QueueDepth() {
+		std::lock_guard<std::mutex> guard(lock);
+		return (unsigned)(queues[STREAM_AUDIO].size() + queues[STREAM_VIDEO].size());
+	}
+
+private:
+	struct Entry {
+		int64_t timestamp;
+		T item;
+	};
+
+	void Drain(bool flush) {
+		while (true) {
+			bool hasAudio = !queues[STREAM_AUDIO].empty();
+			bool hasVideo = !queues[STREAM_VIDEO].empty();
+			if (!hasAudio && !hasVideo) {
+				return;
+			}
+
+			StreamKind head;
+			if (hasAudio && hasVideo) {
+				head = queues[STREAM_AUDIO].front().timestamp <= queues[STREAM_VIDEO].front().timestamp ? STREAM_AUDIO : STREAM_VIDEO;
+			}
+			else {
+				head = hasAudio ? STREAM_AUDIO : STREAM_VIDEO;
+			}
+			StreamKind other = head == STREAM_AUDIO ? STREAM_VIDEO : STREAM_AUDIO;
+			int64_t timestamp = queues[head].front().timestamp;
+
+			bool ready = flush || !queues[other].empty() || ended[other];
+			if (!ready) {
+				// The other stream may still deliver something earlier: wait, but only up to the window
+				int64_t newestAny = newest[head] > newest[other] ? newest[head] : newest[other];
+				if (newestAny - timestamp <= reorderWindow) {
+					return;
+				}
+				stats.forced += 1;
+			}
+
+			Entry entry = queues[head].front();
+			queues[head].pop_front();
+			if (timestamp > lastEmitted) {
+				lastEmitted = timestamp;
+			}
+			stats.emitted += 1;
+			sink(head, entry.timestamp, entry.item);
+		}
+	}
+
+	std::mutex lock;
+	std::deque<Entry> queues[STREAM_COUNT];
+	int64_t newest[STREAM_COUNT];
+	bool ended[STREAM_COUNT];
+	int64_t lastEmitted = INT64_MIN;
+	int64_t reorderWindow;
+	Sink sink;
+	InterleaverStats stats;
+};
@@ -7,10 +7,23 @@ LoopbackSource::LoopbackSource() {
 		throw std::runtime_error("Failed to initialize COM");
 	}
 
-	GetDefaultDevice();
-	GetAudioClient();
-	GetDefaultDeviceFormat();
-	GetAudioCaptureClient();
+	hr = GetDefaultDevice();
+	if (FAILED(hr)) {
+		throw std::runtime_error("Failed to get the default audio endpoint");
+	}
+	hr = GetAudioClient();
+	if (FAILED(hr)) {
+		throw std::runtime_error("Failed to activate IAudioClient");
+	}
+	// pwfx stays null when the mix format can't be converted to 16-bit PCM
+	hr = GetDefaultDeviceFormat();
+	if (FAILED(hr)) {
+		throw std::runtime_error("Unsupported loopback mix format");
+	}
+	hr = GetAudioCaptureClient();
+	if (FAILED(hr)) {
+		throw std::runtime_error("Failed to initialize loopback capture");
+	}
 
 	// call IAudioClient::Start
 	hr = pAudioClient->Start();
@@ -25,6 +38,8 @@ LoopbackSource::~LoopbackSource() {
 		ERR(L"AvRevertMmThreadCharacteristics failed: last error is %d", GetLastError());
 	}
 	CoTaskMemFree(pwfx);
+	CoTaskMemFree(pCaptureFormat);
+	delete pConverter;
 	pAudioClient->Stop();
 
 	pMMDevice->Release();
@@ -36,7 +51,7 @@ HRESULT LoopbackSource::GetAudioCaptureClient() {
 	HRESULT hr = pAudioClient->Initialize(
 		AUDCLNT_SHAREMODE_SHARED,
 		AUDCLNT_STREAMFLAGS_LOOPBACK,
-		0, 0, pwfx, 0
+		0, 0, pCaptureFormat, 0
 	);
 	if (FAILED(hr)) {
 		ERR(L"IAudioClient::Initialize failed: hr = 0x%08x", hr);
@@ -103,52 +118,79 @@ HRESULT LoopbackSource::GetAudioClient() {
 		ERR(L"IMMDevice::Activate(IAudioClient) failed: hr = 0x%08x", hr);
 		return hr;
 	}
+
+	return hr;
 }
 
+/*
+Captures in the mix format as is, so that the audio engine does not
+requantize it. Float mixes are converted to the 16-bit PCM format in pwfx by
+our own converter, which also folds multichannel layouts down to stereo
+*/
 HRESULT LoopbackSource::GetDefaultDeviceFormat() {
-	HRESULT hr = pAudioClient->GetMixFormat(&pwfx);
+	HRESULT hr = pAudioClient->GetMixFormat(&pCaptureFormat);
 	if (FAILED(hr)) {
 		ERR(L"IAudioClient::GetMixFormat failed: hr = 0x%08x", hr);
 		return hr;
 	}
 
-	switch (pwfx->wFormatTag) {
+	BOOL isFloat = FALSE;
+	BOOL isPcm16 = FALSE;
+	uint32_t channelMask = 0;
+
+	switch (pCaptureFormat->wFormatTag) {
 	case WAVE_FORMAT_IEEE_FLOAT:
-		pwfx->wFormatTag = WAVE_FORMAT_PCM;
-		pwfx->wBitsPerSample = 16;
-		pwfx->nBlockAlign = pwfx->nChannels * pwfx->wBitsPerSample / 8;
-		pwfx->nAvgBytesPerSec = pwfx->nBlockAlign * pwfx->nSamplesPerSec;
+		isFloat = pCaptureFormat->wBitsPerSample == 32;
+		break;
+
+	case WAVE_FORMAT_PCM:
+		isPcm16 = pCaptureFormat->wBitsPerSample == 16;
 		break;
 
 	case WAVE_FORMAT_EXTENSIBLE:
 	{
 		// naked scope for case-local variable
-		PWAVEFORMATEXTENSIBLE pEx = reinterpret_cast<PWAVEFORMATEXTENSIBLE>(pwfx);
-		if (IsEqualGUID(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, pEx->SubFormat)) {
-			pEx->SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
-			pEx->Samples.wValidBitsPerSample = 16;
-			pwfx->wBitsPerSample = 16;
-			pwfx->nBlockAlign = pwfx->nChannels * pwfx->wBitsPerSample / 8;
-			pwfx->nAvgBytesPerSec = pwfx->nBlockAlign * pwfx->nSamplesPerSec;
-		}
-		else {
-			ERR(L"%s", L"Don't know how to coerce mix format to int-16");
+		PWAVEFORMATEXTENSIBLE pEx = reinterpret_cast<PWAVEFORMATEXTENSIBLE>(pCaptureFormat);
+		isFloat = IsEqualGUID(KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, pEx->SubFormat) && pCaptureFormat->wBitsPerSample == 32;
+		isPcm16 = IsEqualGUID(KSDATAFORMAT_SUBTYPE_PCM, pEx->SubFormat) && pCaptureFormat->wBitsPerSample == 16;
+		channelMask = pEx->dwChannelMask;
+	}
+	break;
+	}
+
+	WORD outChannels = pCaptureFormat->nChannels;
+	if (isFloat) {
+		pConverter = new PcmConverter(pCaptureFormat->nChannels, channelMask, LOOPBACK_DITHER);
+		if (!pConverter->Valid()) {
+			ERR(L"Can't convert a mix format with %u channels", pCaptureFormat->nChannels);
 			return E_UNEXPECTED;
 		}
+		outChannels = (WORD)pConverter->OutChannels();
 	}
-	break;
-	default:
-		ERR(L"Don't know how to coerce WAVEFORMATEX with wFormatTag = 0x%08x to int-16", pwfx->wFormatTag);
+	else if (!isPcm16 || outChannels > 2) {
+		ERR(L"Don't know how to convert WAVEFORMATEX with wFormatTag = 0x%08x to int-16", pCaptureFormat->wFormatTag);
 		return E_UNEXPECTED;
 	}
 
+	pwfx = (WAVEFORMATEX*)CoTaskMemAlloc(sizeof(WAVEFORMATEX));
+	if (pwfx == nullptr) {
+		return E_OUTOFMEMORY;
+	}
+	pwfx->wFormatTag = WAVE_FORMAT_PCM;
+	pwfx->nChannels = outChannels;
+	pwfx->nSamplesPerSec = pCaptureFormat->nSamplesPerSec;
+	pwfx->wBitsPerSample = 16;
+	pwfx->nBlockAlign = pwfx->nChannels * pwfx->wBitsPerSample / 8;
+	pwfx->nAvgBytesPerSec = pwfx->nBlockAlign * pwfx->nSamplesPerSec;
+	pwfx->cbSize = 0;
+
 	return hr;
 }
 
-HRESULT LoopbackSource::NextFrame(BYTE **ppData) {
+HRESULT LoopbackSource::NextFrame(SpscRing* pRing, UINT64* pQpcPosition) {
 	HRESULT hr;
-	BYTE* audioData = nullptr;
 
+	numFramesRead = 0;
 	hr = pAudioCaptureClient->GetNextPacketSize(&nNextPacketSize);
 
 	if (FAILED(hr)) {
@@ -156,59 +198,86 @@ HRESULT LoopbackSource::NextFrame(BYTE **ppData) {
 		return hr;
 	}
 
-	if (nNextPacketSize == 0) {
-		ppData = nullptr;
-		return S_OK;
-	}
-
-	// get the captured data
-	DWORD dwFlags;
-	UINT64 lastPos = 0;
+	while (nNextPacketSize != 0) {
+		// get the captured data
+		BYTE* pData = nullptr;
+		UINT32 packetFrames = 0;
+		DWORD dwFlags;
+		UINT64 lastPos = 0;
+		UINT64 qpcPosition = 0;
+
+		StageTimer packetTimer(pMetrics, STAGE_AUDIO_GET_BUFFER);
+		hr = pAudioCaptureClient->GetBuffer(
+			&pData,
+			&packetFrames,
+			&dwFlags,
+			&lastPos,
+			&qpcPosition
+		);
+		if (FAILED(hr)) {
+			ERR(L"IAudioCaptureClient::GetBuffer failed: hr = 0x%08x", hr);
+			return hr;
+		}
 
-	hr = pAudioCaptureClient->GetBuffer(
-		ppData,
-		&numFramesRead,
-		&dwFlags,
-		&lastPos,
-		NULL
-	);
-	if (FAILED(hr)) {
-		ERR(L"IAudioCaptureClient::GetBuffer failed: hr = 0x%08x", hr);
-		return hr;
-	}
+		if (0 == packetFrames) {
+			ERR(L"IAudioCaptureClient::GetBuffer said to read 0 frames");
+			pAudioCaptureClient->ReleaseBuffer(packetFrames);
+			return E_UNEXPECTED;
+		}
 
-	unsigned dataSize = numFramesRead * pwfx->nBlockAlign;
+		/*
+		Copy the packet into the ring. This releases the WASAPI buffer right away
+		without having to wait for the data to be encoded
+		*/
+		size_t dataSize = (size_t)packetFrames * pwfx->nBlockAlign;
+		bool copied;
+		if (numFramesRead == 0) {
+			// The endpoint delivers nothing while it plays nothing
+			WriteGapSilence(pRing, qpcPosition);
+		}
+		if (dwFlags & AUDCLNT_BUFFERFLAGS_SILENT) {
+			copied = pRing->WriteZeros(dataSize);
+		}
+		else if (pConverter != nullptr) {
+			converted.resize((size_t)packetFrames * pwfx->nChannels);
+			pConverter->Convert(reinterpret_cast<const float*>(pData), converted.data(), packetFrames);
+			copied = pRing->Write(reinterpret_cast<const BYTE*>(converted.data()), dataSize);
+		}
+		else {
+			copied = pRing->Write(pData, dataSize);
+		}
+		if (!copied) {
+			ERR(L"Audio ring full, dropping %u frames", packetFrames);
+		}
 
-	/*
-	Copy buffer content. This lets us load more packets into the buffer
-	without having to wait for the current data to be processed
-	*/
-	audioData = new BYTE[dataSize];
-	memcpy(audioData, *ppData, dataSize);
-	ppData = &audioData;
-	
-	hr = pAudioCaptureClient->ReleaseBuffer(numFramesRead);
-	if (FAILED(hr)) {
-		ERR(L"IAudioCaptureClient::ReleaseBuffer failed: hr = 0x%08x", hr);
-		return hr;
-	}
+		hr = pAudioCaptureClient->ReleaseBuffer(packetFrames);
+		if (FAILED(hr)) {
+			ERR(L"IAudioCaptureClient::ReleaseBuffer failed: hr = 0x%08x", hr);
+			return hr;
+		}
+		packetTimer.Stop();
+		if (numFramesRead == 0 && pQpcPosition != nullptr) {
+			*pQpcPosition = qpcPosition;
+		}
+		numFramesRead += packetFrames;
 
-	if (dwFlags == AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
-		LOG(L"IAudioCaptureClient::GetBuffer discontinuity %d %lld", numFramesRead, lastPos);
-		//return E_UNEXPECTED;
-	}
+		if (dwFlags == AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
+			LOG(L"IAudioCaptureClient::GetBuffer discontinuity %d %lld", packetFrames, lastPos);
+		}
 #if _DEBUG
-	else if (dwFlags == AUDCLNT_BUFFERFLAGS_SILENT) {
-		LOG(L"IAudioCaptureClient::GetBuffer SILENCE");
-	}
+		else if (dwFlags == AUDCLNT_BUFFERFLAGS_SILENT) {
+			LOG(L"IAudioCaptureClient::GetBuffer SILENCE");
+		}
 #endif
-	else if (dwFlags == AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) {
-		LOG(L"IAudioCaptureClient::GetBuffer timestamp error");
-	}
+		else if (dwFlags == AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) {
+			LOG(L"IAudioCaptureClient::GetBuffer timestamp error");
+		}
 
-	if (0 == numFramesRead) {
-		ERR(L"IAudioCaptureClient::GetBuffer said to read 0 frames");
-		return E_UNEXPECTED;
+		hr = pAudioCaptureClient->GetNextPacketSize(&nNextPacketSize);
+		if (FAILED(hr)) {
+			ERR(L"Failed to get packet size: hr = 0x%08x", hr);
+			return hr;
+		}
 	}
 
 	return hr;
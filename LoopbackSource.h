@@ -6,16 +6,25 @@
 #include <mmdeviceapi.h>
 #include <comdef.h>
 
+#include <vector>
+
+#include <AudioConvert.h>
+#include <CaptureSource.h>
 #include <Common.h>
+#include <SpscRing.h>
+
+// Apply TPDF dither when reducing the float mix to 16 bits
+const bool LOOPBACK_DITHER = true;
 
-class LoopbackSource {
+// WASAPI loopback capture of the default render endpoint
+class LoopbackSource : public AudioSource {
 public:
 	LoopbackSource();
 	~LoopbackSource();
-	HRESULT NextFrame(BYTE** ppData);
-	WAVEFORMATEX* pwfx;
-	unsigned bufferFrameCount = 0;
-	UINT32 numFramesRead = 0;
+	// Copies every pending packet into pRing; pQpcPosition is the device QPC position
+	HRESULT NextFrame(SpscRing* pRing, UINT64* pQpcPosition = nullptr) override;
+	// Format the endpoint is captured in, the shared-mode mix format
+	WAVEFORMATEX* pCaptureFormat = nullptr;
 	DWORD lastFrameReadTime;
 	UINT32 nNextPacketSize = 0;
 private:
@@ -28,4 +37,7 @@ private:
 	IMMDevice* pMMDevice;
 	IAudioClient* pAudioClient;
 	IAudioCaptureClient* pAudioCaptureClient;
+	// Converts float capture to pwfx, null when the mix format already is 16-bit PCM
+	PcmConverter* pConverter = nullptr;
+	std::vector<int16_t> converted;
 };
@@ -10,151 +10,236 @@ HRESULT MediaWriter::Finalize() {
 	return pWriter->Finalize();
 }
 
+SlotPoolStats MediaWriter::GetVideoPoolStats() {
+	return videoSamplePool.Stats();
+}
+
+SlotPoolStats MediaWriter::GetAudioPoolStats() {
+	return audioSamplePool.Stats();
+}
+
+void MediaWriter::SetMetrics(PipelineMetrics* pMetrics) {
+	this->pMetrics = pMetrics;
+}
+
 /*
-Calculates the buffer length that must be allocated to write the audio sample
-Writes the audio sample to the sink writer
+Copies an accumulated audio block into a recycled sample stamped with the block's timestamp
 */
-HRESULT MediaWriter::WriteAudioFrame(const WAVEFORMATEX* pwfx, BYTE* pAudioFrame, UINT32 numFramesToRead, REFERENCE_TIME bufDuration) {
-	HRESULT hr = S_OK;
+HRESULT MediaWriter::PrepareAudioSample(const AudioBlock& block, IMFSample** ppSample) {
 	IMFSample* pSample = nullptr;
 	IMFMediaBuffer* pMediaBuff = nullptr;
 	BYTE* pData = nullptr;
-	UINT32 lBytesToWrite; 
-	
-	if (numFramesToRead == 0) {
-		lBytesToWrite = pwfx->nAvgBytesPerSec * bufDuration / REFTIMES_PER_SEC;
-	}
-	else {
-		lBytesToWrite = numFramesToRead * pwfx->nBlockAlign;
-	}
+	DWORD cbMaxLength = 0;
+	StageTimer prepareTimer(pMetrics, STAGE_AUDIO_PREPARE);
 
-	hr = MFCreateSample(&pSample);
+	// The encoder drains audio much faster than real time, so waiting a block is plenty
+	DWORD timeoutMs = (DWORD)(block.duration / REFTIMES_PER_MILLISEC) + 1;
+	HRESULT hr = audioSamplePool.Acquire(timeoutMs, &pSample, &pMediaBuff);
 	if (FAILED(hr)) {
-		ERR(L"Failed to create media sample: hr = 0x%08x", hr);
+		ERR(L"No free audio sample, dropping %u frames: hr = 0x%08x", block.frames, hr);
 		return hr;
 	}
-	hr = MFCreateMemoryBuffer(lBytesToWrite, &pMediaBuff);
-	if (FAILED(hr)) {
-		ERR(L"Failed to create media buffer: hr = 0x%08x", hr);
-		return hr;
-	}
-	hr = pSample->AddBuffer(pMediaBuff);
-	if (FAILED(hr)) {
-		ERR(L"Failed to add buffer to media sample: hr = 0x%08x", hr);
-		return hr;
-	}
-	
-	ULONGLONG sampleDuration = bufDuration;
-
-	pSample->SetSampleTime(audioDuration);
-	pSample->SetSampleDuration(sampleDuration);
 
-	hr = pMediaBuff->Lock(&pData, nullptr, nullptr);
-	if (FAILED(hr)) {
+	hr = pMediaBuff->Lock(&pData, &cbMaxLength, nullptr);
+	if (SUCCEEDED(hr)) {
+		memcpy_s(pData, cbMaxLength, block.pData, block.bytes);
+		pMediaBuff->Unlock();
+		hr = pMediaBuff->SetCurrentLength((DWORD)block.bytes);
+	}
+	else {
 		ERR(L"Failed to write to buffer: hr = 0x%08x", hr);
-		return hr;
 	}
-	hr = pMediaBuff->SetCurrentLength(lBytesToWrite);
 
-	// Copy audio data to allocated buffer
-	memcpy_s(pData, lBytesToWrite, pAudioFrame, lBytesToWrite);
+	if (SUCCEEDED(hr)) {
+		pSample->SetSampleTime(block.timestamp);
+		pSample->SetSampleDuration(block.duration);
+		*ppSample = pSample;
+		pSample = nullptr;
+	}
 
-	hr = pWriter->WriteSample(audioStreamIndex, pSample);
+	SafeRelease(&pMediaBuff);
+	SafeRelease(&pSample);
+	return hr;
+}
 
+/*
+Writes a prepared sample to the sink writer stream it belongs to
+*/
+HRESULT MediaWriter::WriteSample(StreamKind stream, IMFSample* pSample) {
+	DWORD streamIndex = stream == STREAM_AUDIO ? audioStreamIndex : videoStreamIndex;
+	StageTimer writeTimer(pMetrics, stream == STREAM_AUDIO ? STAGE_AUDIO_WRITE : STAGE_VIDEO_WRITE);
+	HRESULT hr = pWriter->WriteSample(streamIndex, pSample);
 	if (FAILED(hr)) {
 		ERR(L"Failed to write sample: hr = 0x%08x", hr);
-		return hr;
 	}
-	audioDuration = audioDuration + sampleDuration;
-
 	return hr;
 }
 
 /*
-Crop a contiguous 2D array given the coordinates in videoOpts
+Exposes a locked IMF2DBuffer to the crop core, so the cropped region is copied
+straight into the buffer handed to the encoder
 */
-void MediaWriter::Crop2DArray(BYTE* pDest, BYTE* pData) {
-	// TODO: use multiple threads/processes and memcpy
-	long srcCbWidth = DEFAULT_VIDEO_WIDTH * STRIDE_WIDTH_BYTES;
-	long cbWidth = pVideoOpts->width * STRIDE_WIDTH_BYTES;
-	long offsetXStride = pVideoOpts->screenOffsetX * STRIDE_WIDTH_BYTES;
-	for (unsigned long i = 0; i < DEFAULT_VIDEO_HEIGHT; i++) {
-		for (unsigned long j = 0; j < cbWidth; j++) {
-			pDest[j + i * cbWidth] = pData[offsetXStride + j + i * (srcCbWidth + pVideoOpts->screenOffsetY)];
+class MF2DBufferSink : public FrameSink {
+public:
+	MF2DBufferSink(IMF2DBuffer* p2dBuffer) : p2dBuffer(p2dBuffer) {}
+
+	bool LockFrame(uint8_t** ppData, long* pPitch) override {
+		BYTE* pScanline0 = nullptr;
+		LONG pitch = 0;
+		HRESULT hr = p2dBuffer->Lock2D(&pScanline0, &pitch);
+		if (FAILED(hr)) {
+			ERR(L"Failed to lock 2D buffer: hr = 0x%08x", hr);
+			return false;
 		}
+		*ppData = pScanline0;
+		*pPitch = pitch;
+		return true;
 	}
-}
+
+	void UnlockFrame() override {
+		p2dBuffer->Unlock2D();
+	}
+private:
+	IMF2DBuffer* p2dBuffer;
+};
 
 /*
-Receives a pointer to a contiguous 2D RGBA array.
-Copies the array to a MF buffer and writes the sample to the sink writer
+Converts rect of the BGRA frame into a locked NV12 2D buffer.
+The UV plane follows the height rows of the Y plane, with the same pitch
 */
-HRESULT MediaWriter::WriteVideoFrame(const LONGLONG& rtStart, DWORD* videoFrameBuffer) {
-	IMFSample* pSample = nullptr;
-
-	LONG cbWidth = STRIDE_WIDTH_BYTES * pVideoOpts->width;
-	const DWORD cbBuffer = cbWidth * pVideoOpts->height;
+HRESULT MediaWriter::ConvertVideoFrame(IMF2DBuffer* p2dBuffer, const FrameView& frame, const FrameRect& rect) {
+	BYTE* pScanline0 = nullptr;
+	LONG pitch = 0;
 
-	BYTE* pData = nullptr;
-	BYTE* pCropped = nullptr;
-	
-	MFTIME st = timeGetTime();
-	HRESULT hr = p2dBuffer->Lock2D(&pData, &cbWidth);
+	HRESULT hr = p2dBuffer->Lock2D(&pScanline0, &pitch);
 	if (FAILED(hr)) {
-		ERR(L"Failed to allocate 2D buffer: hr = 0x%08x", hr);
+		ERR(L"Failed to lock 2D buffer: hr = 0x%08x", hr);
 		return hr;
 	}
-	
-	if (pVideoOpts->fullscreen) {
-		pCropped = (BYTE*)videoFrameBuffer;
+
+	YuvPlanes planes = {};
+	planes.pY = pScanline0;
+	planes.yPitch = pitch;
+	planes.pU = pScanline0 + (size_t)pitch * encodeHeight;
+	planes.uPitch = pitch;
+
+	if (!pColorConverter->Convert(frame, rect, planes)) {
+		ERR(L"Failed to convert region %ux%u+%u+%u of the %ux%u frame", rect.width, rect.height, rect.x, rect.y, frame.width, frame.height);
+		hr = E_FAIL;
 	}
-	else {
-		pCropped = new BYTE[cbBuffer];
-		Crop2DArray(pCropped, (BYTE*)videoFrameBuffer);
+
+	p2dBuffer->Unlock2D();
+	return hr;
+}
+
+/*
+Scales rect of the BGRA frame to the encoded size, straight into the locked 2D
+buffer when it holds BGRA, through scaledFrame when it holds NV12
+*/
+HRESULT MediaWriter::ScaleVideoFrame(IMF2DBuffer* p2dBuffer, const FrameView& frame, const FrameRect& rect) {
+	if (pColorConverter != nullptr) {
+		StageTimer scaleTimer(pMetrics, STAGE_VIDEO_SCALE);
+		if (!pScaler->Scale(frame, rect, scaledFrame.data(), (long)encodeWidth * FRAME_BYTES_PER_PIXEL)) {
+			ERR(L"Failed to scale region %ux%u+%u+%u of the %ux%u frame", rect.width, rect.height, rect.x, rect.y, frame.width, frame.height);
+			return E_FAIL;
+		}
+		scaleTimer.Stop();
+
+		FrameView scaled = { scaledFrame.data(), (long)encodeWidth * FRAME_BYTES_PER_PIXEL, encodeWidth, encodeHeight };
+		FrameRect whole = { 0, 0, encodeWidth, encodeHeight };
+		StageTimer convertTimer(pMetrics, STAGE_VIDEO_CONVERT);
+		return ConvertVideoFrame(p2dBuffer, scaled, whole);
 	}
-	
-	hr = MFCopyImage(
-		pData,
-		cbWidth,
-		pCropped,
-		cbWidth,
-		cbWidth,
-		pVideoOpts->height
-	);
+
+	StageTimer scaleTimer(pMetrics, STAGE_VIDEO_SCALE);
+	BYTE* pScanline0 = nullptr;
+	LONG pitch = 0;
+	HRESULT hr = p2dBuffer->Lock2D(&pScanline0, &pitch);
 	if (FAILED(hr)) {
-		ERR(L"MFCopyImage: hr = 0x%08x", hr);
+		ERR(L"Failed to lock 2D buffer: hr = 0x%08x", hr);
 		return hr;
 	}
 
-	if (!pVideoOpts->fullscreen) {
-		delete[] pCropped;
+	if (!pScaler->Scale(frame, rect, pScanline0, pitch)) {
+		ERR(L"Failed to scale region %ux%u+%u+%u of the %ux%u frame", rect.width, rect.height, rect.x, rect.y, frame.width, frame.height);
+		hr = E_FAIL;
 	}
 
 	p2dBuffer->Unlock2D();
+	return hr;
+}
+
+/*
+Receives a view of the captured BGRA frame.
+Copies the region selected in videoOpts, scaled to the encoded size, to a pooled MF buffer stamped with rtStart.
+The sample goes back to the pool once it is released by both the caller and the sink writer
+*/
+HRESULT MediaWriter::PrepareVideoSample(const LONGLONG& rtStart, const FrameView& frame, IMFSample** ppSample) {
+	IMFSample* pSample = nullptr;
+	IMFMediaBuffer* pBuffer = nullptr;
+	IMF2DBuffer* p2dBuffer = nullptr;
 
-	pBuffer->SetCurrentLength(cbBuffer);
-	hr = MFCreateSample(&pSample);
+	DWORD cbBuffer = 0;
+
+	FrameRect rect = CapturedRegion(pVideoOpts);
+
+	// Wait at most one frame for the encoder to hand a buffer back, then drop this frame
+	StageTimer poolTimer(pMetrics, STAGE_VIDEO_POOL_WAIT);
+	HRESULT hr = videoSamplePool.Acquire(1000 / pVideoOpts->fps, &pSample, &pBuffer);
+	poolTimer.Stop();
 	if (FAILED(hr)) {
-		ERR(L"MFCreateSample: hr = 0x%08x", hr);
+		ERR(L"No free video sample, dropping frame: hr = 0x%08x", hr);
 		return hr;
 	}
-	hr = pSample->AddBuffer(pBuffer);
-	hr = pSample->SetSampleTime(rtStart);
-	hr = pSample->SetSampleDuration(REFTIMES_PER_SEC / pVideoOpts->fps);
 
-	hr = pWriter->WriteSample(videoStreamIndex, pSample);
-	if (FAILED(hr)) {
-		ERR(L"Failed to write sample: hr = 0x%08x", hr);
-		return hr;
+	hr = pBuffer->QueryInterface(__uuidof(IMF2DBuffer), (void**)& p2dBuffer);
+	if (SUCCEEDED(hr)) {
+		hr = p2dBuffer->GetContiguousLength(&cbBuffer);
+	}
+	if (SUCCEEDED(hr) && pScaler != nullptr) {
+		hr = ScaleVideoFrame(p2dBuffer, frame, rect);
 	}
+	else if (SUCCEEDED(hr) && pColorConverter != nullptr) {
+		StageTimer convertTimer(pMetrics, STAGE_VIDEO_CONVERT);
+		hr = ConvertVideoFrame(p2dBuffer, frame, rect);
+	}
+	else if (SUCCEEDED(hr)) {
+		StageTimer cropTimer(pMetrics, STAGE_VIDEO_CROP);
+		MF2DBufferSink sink(p2dBuffer);
+		if (!CopyFrameToSink(&sink, frame, rect)) {
+			ERR(L"Failed to copy region %ux%u+%u+%u of the %ux%u frame", rect.width, rect.height, rect.x, rect.y, frame.width, frame.height);
+			hr = E_FAIL;
+		}
+	}
+	SafeRelease(&p2dBuffer);
 
+	if (SUCCEEDED(hr)) {
+		pBuffer->SetCurrentLength(cbBuffer);
+		pSample->SetSampleTime(rtStart);
+		pSample->SetSampleDuration(REFTIMES_PER_SEC / pVideoOpts->fps);
+		*ppSample = pSample;
+		pSample = nullptr;
+	}
+
+	SafeRelease(&pBuffer);
 	SafeRelease(&pSample);
 	return hr;
 }
 
+/*
+Signals that the frame due at rtStart is identical to the previous one.
+Nothing is encoded: the gap extends the previous frame in the output
+*/
+HRESULT MediaWriter::WriteRepeatFrame(const LONGLONG& rtStart) {
+	HRESULT hr = pWriter->SendStreamTick(videoStreamIndex, rtStart);
+	if (FAILED(hr)) {
+		ERR(L"Failed to send stream tick: hr = 0x%08x", hr);
+	}
+	return hr;
+}
+
 MediaWriter::MediaWriter(AudioEncodeOpts* pAudioOpts, VideoEncodeOpts* pVideoOpts) {
 	MFStartup(MF_VERSION);
-	audioDuration = 0;
 	this->pAudioOpts = pAudioOpts;
 	this->pVideoOpts = pVideoOpts;
 
@@ -168,6 +253,24 @@ MediaWriter::MediaWriter(AudioEncodeOpts* pAudioOpts, VideoEncodeOpts* pVideoOpt
 	IMFMediaType* pVideoIn = nullptr;
 	IMFMediaType* pAudioIn = nullptr;
 
+	const GUID videoInputFormat = pVideoOpts->convertToNV12 ? MFVideoFormat_NV12 : VIDEO_INPUT_FORMAT;
+	if (pVideoOpts->convertToNV12) {
+		pConvertPool = new ThreadPool(COLOR_CONVERT_THREADS);
+		pColorConverter = new ColorConverter(COLOR_MATRIX_BT709, COLOR_RANGE_LIMITED, YUV_LAYOUT_NV12, pConvertPool);
+	}
+
+	encodeWidth = pVideoOpts->outputWidth != 0 ? pVideoOpts->outputWidth : pVideoOpts->width;
+	encodeHeight = pVideoOpts->outputHeight != 0 ? pVideoOpts->outputHeight : pVideoOpts->height;
+	if (encodeWidth != pVideoOpts->width || encodeHeight != pVideoOpts->height) {
+		if (pConvertPool == nullptr) {
+			pConvertPool = new ThreadPool(COLOR_CONVERT_THREADS);
+		}
+		pScaler = new FrameScaler(pVideoOpts->width, pVideoOpts->height, encodeWidth, encodeHeight, pVideoOpts->scaleFilter, pConvertPool);
+		if (pColorConverter != nullptr) {
+			scaledFrame.resize((size_t)encodeWidth * encodeHeight * FRAME_BYTES_PER_PIXEL);
+		}
+	}
+
 	// Video stream output
 	IMFAttributes* pSinkAttrs;
 	MFCreateAttributes(&pSinkAttrs, 0);
@@ -183,7 +286,11 @@ MediaWriter::MediaWriter(AudioEncodeOpts* pAudioOpts, VideoEncodeOpts* pVideoOpt
 	pVideoOut->SetUINT32(MF_MT_VIDEO_LEVEL, eAVEncH264VLevel5);
 	pVideoOut->SetUINT32(MF_MT_AVG_BITRATE, pVideoOpts->bitrate);
 	pVideoOut->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
-	MFSetAttributeSize(pVideoOut, MF_MT_FRAME_SIZE, pVideoOpts->width, pVideoOpts->height);
+	if (pVideoOpts->convertToNV12) {
+		pVideoOut->SetUINT32(MF_MT_YUV_MATRIX, MFVideoTransferMatrix_BT709);
+		pVideoOut->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, MFNominalRange_16_235);
+	}
+	MFSetAttributeSize(pVideoOut, MF_MT_FRAME_SIZE, encodeWidth, encodeHeight);
 	MFSetAttributeRatio(pVideoOut, MF_MT_FRAME_RATE, pVideoOpts->fps, 1);
 	MFSetAttributeRatio(pVideoOut, MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
 	pSinkWriter->AddStream(pVideoOut, &videoStreamIndex);
@@ -200,8 +307,12 @@ MediaWriter::MediaWriter(AudioEncodeOpts* pAudioOpts, VideoEncodeOpts* pVideoOpt
 	// Video input (stream 0)
 	MFCreateMediaType(&pVideoIn);
 	pVideoIn->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
-	pVideoIn->SetGUID(MF_MT_SUBTYPE, VIDEO_INPUT_FORMAT);
-	MFSetAttributeSize(pVideoIn, MF_MT_FRAME_SIZE, pVideoOpts->width, pVideoOpts->height);
+	pVideoIn->SetGUID(MF_MT_SUBTYPE, videoInputFormat);
+	if (pVideoOpts->convertToNV12) {
+		pVideoIn->SetUINT32(MF_MT_YUV_MATRIX, MFVideoTransferMatrix_BT709);
+		pVideoIn->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, MFNominalRange_16_235);
+	}
+	MFSetAttributeSize(pVideoIn, MF_MT_FRAME_SIZE, encodeWidth, encodeHeight);
 	MFSetAttributeRatio(pVideoIn, MF_MT_FRAME_RATE, pVideoOpts->fps, 1);
 	MFSetAttributeRatio(pVideoIn, MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
 	pSinkWriter->SetInputMediaType(videoStreamIndex, pVideoIn, nullptr);
@@ -220,12 +331,22 @@ MediaWriter::MediaWriter(AudioEncodeOpts* pAudioOpts, VideoEncodeOpts* pVideoOpt
 	pWriter = pSinkWriter;
 	pWriter->AddRef();
 
-	// Create 2D buffer
-	hr = MFCreate2DMediaBuffer(pVideoOpts->width, pVideoOpts->height, MFVideoFormat_ARGB32.Data1, FALSE, &pBuffer);
+	// Preallocate the 2D buffers video frames are cropped or scaled into
+	hr = videoSamplePool.Initialize(VIDEO_SAMPLE_POOL_SIZE, [this, videoInputFormat](IMFMediaBuffer** ppBuffer) {
+		return MFCreate2DMediaBuffer(encodeWidth, encodeHeight, videoInputFormat.Data1, FALSE, ppBuffer);
+	});
 	if (FAILED(hr)) {
-		ERR(L"MFCreate2DMediaBuffer: hr = 0x%08x", hr);
+		ERR(L"Failed to create the video sample pool: hr = 0x%08x", hr);
+	}
+
+	// Audio blocks always have the same size, so their buffers are recycled too
+	DWORD audioBlockBytes = AUDIO_BLOCK_FRAMES * pAudioOpts->pwfx->nBlockAlign;
+	hr = audioSamplePool.Initialize(AUDIO_SAMPLE_POOL_SIZE, [audioBlockBytes](IMFMediaBuffer** ppBuffer) {
+		return MFCreateMemoryBuffer(audioBlockBytes, ppBuffer);
+	});
+	if (FAILED(hr)) {
+		ERR(L"Failed to create the audio sample pool: hr = 0x%08x", hr);
 	}
-	pBuffer->QueryInterface(__uuidof(IMF2DBuffer), (void**)& p2dBuffer);
 
 	SafeRelease(&pSinkWriter);
 	SafeRelease(&pVideoOut);
@@ -235,8 +356,12 @@ MediaWriter::MediaWriter(AudioEncodeOpts* pAudioOpts, VideoEncodeOpts* pVideoOpt
 }
 
 MediaWriter::~MediaWriter() {
-	SafeRelease(&pBuffer);
-	SafeRelease(&p2dBuffer);
 	SafeRelease(&pWriter);
+	// The pooled samples are Media Foundation objects too, so they go before it shuts down
+	videoSamplePool.Clear();
+	audioSamplePool.Clear();
+	delete pColorConverter;
+	delete pScaler;
+	delete pConvertPool;
 	MFShutdown();
 }
@@ -7,6 +7,14 @@
 #include <mfreadwrite.h>
 #include <mfapi.h>
 
+#include <AudioAccumulator.h>
+#include <ColorConvert.h>
+#include <FrameScale.h>
+#include <FrameSink.h>
+#include <Interleaver.h>
+#include <PipelineMetrics.h>
+#include <SamplePool.h>
+
 // Format constants
 const UINT32 DEFAULT_VIDEO_WIDTH = 2560;
 const UINT32 DEFAULT_VIDEO_HEIGHT = 1080;
@@ -14,6 +22,16 @@ const UINT32 DEFAULT_VIDEO_FPS = 30;
 const UINT32 DEFAULT_VIDEO_BIT_RATE = 12000000;
 const GUID   VIDEO_ENCODING_FORMAT = MFVideoFormat_H264;
 const GUID   VIDEO_INPUT_FORMAT = MFVideoFormat_ARGB32;
+// Frames the capture thread can fill ahead of the encoder, including those held by the interleaver
+const UINT32 VIDEO_SAMPLE_POOL_SIZE = 8;
+// AAC frames per audio sample written, about 43 ms at 48 kHz
+const UINT32 AUDIO_BLOCK_AAC_FRAMES = 2;
+const UINT32 AUDIO_BLOCK_FRAMES = AAC_FRAME_SAMPLES * AUDIO_BLOCK_AAC_FRAMES;
+// Audio blocks in flight between the writer thread and the encoder
+const UINT32 AUDIO_SAMPLE_POOL_SIZE = 8;
+// Threads (including the capture thread) used for scaling and BGRA -> NV12 conversion
+const UINT32 COLOR_CONVERT_THREADS = 4;
+const ScaleFilter DEFAULT_SCALE_FILTER = SCALE_FILTER_BILINEAR;
 
 typedef struct VideoEncodeOpts {
 	unsigned width;
@@ -23,8 +41,22 @@ typedef struct VideoEncodeOpts {
 	unsigned fps;
 	unsigned bitrate;
 	BOOL fullscreen;
+	BOOL convertToNV12; // convert to NV12 ourselves instead of feeding ARGB32 to Media Foundation
+	unsigned outputWidth; // encoded size; 0 encodes the captured width x height region as is
+	unsigned outputHeight;
+	ScaleFilter scaleFilter;
 };
 
+// Region of the captured frames that is recorded
+inline FrameRect CapturedRegion(const VideoEncodeOpts* pVideoOpts) {
+	FrameRect rect = { 0, 0, pVideoOpts->width, pVideoOpts->height };
+	if (!pVideoOpts->fullscreen) {
+		rect.x = pVideoOpts->screenOffsetX;
+		rect.y = pVideoOpts->screenOffsetY;
+	}
+	return rect;
+}
+
 typedef struct AudioEncodeOpts {
 	WAVEFORMATEX* pwfx;
 };
@@ -33,17 +65,32 @@ class MediaWriter {
 public:
 	MediaWriter(AudioEncodeOpts*, VideoEncodeOpts*);
 	~MediaWriter();
-	HRESULT WriteVideoFrame(const LONGLONG&, DWORD*);
-	HRESULT WriteAudioFrame(const WAVEFORMATEX*, BYTE*, UINT32, REFERENCE_TIME bufDuration);
-	void Crop2DArray(BYTE* pDest, BYTE* pData);
+	HRESULT PrepareVideoSample(const LONGLONG&, const FrameView&, IMFSample**);
+	HRESULT PrepareAudioSample(const AudioBlock&, IMFSample**);
+	HRESULT WriteSample(StreamKind, IMFSample*);
+	HRESULT WriteRepeatFrame(const LONGLONG&);
 	HRESULT Finalize();
-	ULONGLONG audioDuration = 0;
+	SlotPoolStats GetVideoPoolStats();
+	SlotPoolStats GetAudioPoolStats();
+	// Stage timings are recorded into pMetrics from then on; nullptr stops recording
+	void SetMetrics(PipelineMetrics* pMetrics);
 private:
+	HRESULT ConvertVideoFrame(IMF2DBuffer*, const FrameView&, const FrameRect&);
+	HRESULT ScaleVideoFrame(IMF2DBuffer*, const FrameView&, const FrameRect&);
+
 	IMFSinkWriter* pWriter;
 	DWORD audioStreamIndex = 0;
 	DWORD videoStreamIndex = 0;
-	IMFMediaBuffer* pBuffer = nullptr;
-	IMF2DBuffer* p2dBuffer = nullptr;
+	SamplePool videoSamplePool;
+	SamplePool audioSamplePool;
+	ThreadPool* pConvertPool = nullptr;
+	ColorConverter* pColorConverter = nullptr;
+	FrameScaler* pScaler = nullptr;
+	// Scaled BGRA frame awaiting NV12 conversion
+	std::vector<uint8_t> scaledFrame;
+	UINT32 encodeWidth;
+	UINT32 encodeHeight;
 	AudioEncodeOpts* pAudioOpts;
 	VideoEncodeOpts* pVideoOpts;
+	PipelineMetrics* pMetrics = nullptr;
 };
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <chrono>
+
+#include <PipelineMetrics.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Index of the highest set bit; v must not be 0
+static unsigned HighestBit(uint64_t v) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanReverse(&index, (unsigned long)(v >> 32))) {
+		return (unsigned)index + 32;
+	}
+	_BitScanReverse(&index, (unsigned long)v);
+	return (unsigned)index;
+#else
+	return 63 - (unsigned)__builtin_clzll(v);
+#endif
+}
+
+LatencyHistogram::LatencyHistogram() : sumNs(0) {
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		counts[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+unsigned LatencyHistogram::BucketIndex(uint64_t ns) {
+	if (ns < HISTOGRAM_SUB_BUCKETS) {
+		return (unsigned)ns;
+	}
+	unsigned exponent = HighestBit(ns);
+	if (exponent > HISTOGRAM_MAX_EXPONENT) {
+		return HISTOGRAM_BUCKETS - 1;
+	}
+	// The bits right under the highest one pick the linear bucket within [2^exponent, 2^(exponent+1))
+	unsigned shift = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+	return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + (unsigned)((ns >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(unsigned index) {
+	if (index < HISTOGRAM_SUB_BUCKETS) {
+		return index;
+	}
+	unsigned shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t lower = (uint64_t)(HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS) << shift;
+	return lower + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t ns) {
+	counts[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+	sumNs.fetch_add(ns, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Snapshot(HistogramSnapshot* pSnapshot) const {
+	pSnapshot->count = 0;
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		pSnapshot->counts[i] = counts[i].load(std::memory_order_relaxed);
+		pSnapshot->count += pSnapshot->counts[i];
+	}
+	// Not taken atomically with the counts, so the mean may be off by a value recorded meanwhile
+	pSnapshot->sumNs = sumNs.load(std::memory_order_relaxed);
+}
+
+void HistogramDelta(HistogramSnapshot* pCurrent, const HistogramSnapshot& previous) {
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		pCurrent->counts[i] -= previous.counts[i];
+	}
+	pCurrent->count -= previous.count;
+	pCurrent->sumNs -= previous.sumNs;
+}
+
+uint64_t HistogramValueAt(const HistogramSnapshot& snapshot, double quantile) {
+	if (snapshot.count == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(quantile * (double)snapshot.count + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += snapshot.counts[i];
+		if (seen >= rank) {
+			return LatencyHistogram::BucketUpperBound(i);
+		}
+	}
+	return LatencyHistogram::BucketUpperBound(HISTOGRAM_BUCKETS - 1);
+}
+
+PipelineMetrics::PipelineMetrics() {
+	for (unsigned i = 0; i < COUNTER_COUNT; i++) {
+		counters[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void PipelineMetrics::Snapshot(MetricsSnapshot* pSnapshot) const {
+	pSnapshot->timeNs = NowNs();
+	for (unsigned i = 0; i < STAGE_COUNT; i++) {
+		stages[i].Snapshot(&pSnapshot->stages[i]);
+	}
+	for (unsigned i = 0; i < COUNTER_COUNT; i++) {
+		pSnapshot->counters[i] = counters[i].load(std::memory_order_relaxed);
+	}
+}
+
+int64_t PipelineMetrics::NowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count();
+}
+
+const char* PipelineStageName(PipelineStage stage) {
+	static const char* names[STAGE_COUNT] = {
+		"video_capture", "video_acquire", "video_map", "video_detect", "video_pool_wait", "video_crop", "video_scale", "video_convert", "video_write", "video_latency",
+		"audio_capture", "audio_get_buffer", "audio_prepare", "audio_write", "audio_latency",
+	};
+	return stage < STAGE_COUNT ? names[stage] : "unknown";
+}
+
+const char* PipelineCounterName(PipelineCounter counter) {
+	static const char* names[COUNTER_COUNT] = {
+		"video_frames", "video_repeats", "video_late", "video_skipped", "video_dropped", "video_static",
+		"audio_blocks", "audio_dropped", "audio_ring_overruns",
+		"audio_ring_bytes", "interleaver_depth", "video_samples_in_flight", "video_changed_tiles", "av_skew_us", "max_av_skew_us",
+	};
+	return counter < COUNTER_COUNT ? names[counter] : "unknown";
+}
+
+static double Microseconds(uint64_t ns) {
+	return (double)ns / 1000.0;
+}
+
+std::string FormatMetricsJson(const MetricsSnapshot& current, const MetricsSnapshot& previous, int64_t startNs) {
+	char buffer[256];
+	std::string json;
+
+	snprintf(buffer, sizeof(buffer), "{\"t_ms\":%lld,\"interval_ms\":%lld,\"stages\":{",
+		(long long)((current.timeNs - startNs) / 1000000), (long long)((current.timeNs - previous.timeNs) / 1000000));
+	json += buffer;
+
+	bool first = true;
+	HistogramSnapshot interval;
+	for (unsigned i = 0; i < STAGE_COUNT; i++) {
+		interval = current.stages[i];
+		HistogramDelta(&interval, previous.stages[i]);
+		if (interval.count == 0) {
+			continue;
+		}
+		snprintf(buffer, sizeof(buffer),
+			"%s\"%s\":{\"n\":%llu,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}",
+			first ? "" : ",", PipelineStageName((PipelineStage)i), (unsigned long long)interval.count,
+			Microseconds(interval.sumNs) / (double)interval.count,
+			Microseconds(HistogramValueAt(interval, 0.5)), Microseconds(HistogramValueAt(interval, 0.9)),
+			Microseconds(HistogramValueAt(interval, 0.99)), Microseconds(HistogramValueAt(interval, 1.0)));
+		json += buffer;
+		first = false;
+	}
+
+	json += "},\"counters\":{";
+	for (unsigned i = 0; i < COUNTER_COUNT; i++) {
+		snprintf(buffer, sizeof(buffer), "%s\"%s\":%lld", i == 0 ? "" : ",", PipelineCounterName((PipelineCounter)i), (long long)current.counters[i]);
+		json += buffer;
+	}
+	json += "}}";
+	return json;
+}
+
+MetricsReporter::MetricsReporter(PipelineMetrics* pMetrics, unsigned intervalMs, std::function<void()> collect, Sink sink)
+	: pMetrics(pMetrics), intervalMs(intervalMs > 0 ? intervalMs : 1), collect(collect), sink(sink),
+	pCurrent(new MetricsSnapshot()), pPrevious(new MetricsSnapshot()) {
+	startNs = PipelineMetrics::NowNs();
+	pMetrics->Snapshot(pPrevious.get());
+	pPrevious->timeNs = startNs;
+	thread = std::thread(&MetricsReporter::ReportProc, this);
+}
+
+MetricsReporter::~MetricsReporter() {
+	Stop();
+}
+
+void MetricsReporter::Stop() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (stopping) {
+			return;
+		}
+		stopping = true;
+	}
+	wake.notify_all();
+	thread.join();
+	Report();
+}
+
+void MetricsReporter::Report() {
+	if (collect) {
+		collect();
+	}
+	pMetrics->Snapshot(pCurrent.get());
+	sink(FormatMetricsJson(*pCurrent, *pPrevious, startNs));
+	pCurrent.swap(pPrevious);
+}
+
+void MetricsReporter::ReportProc() {
+	auto next = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> guard(lock);
+
+	for (;;) {
+		next += std::chrono::milliseconds(intervalMs);
+		if (wake.wait_until(guard, next, [this] { return stopping; })) {
+			return;
+		}
+		guard.unlock();
+		Report();
+		guard.lock();
+	}
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Each power of two of nanoseconds is split into this many linear buckets, so a latency is known within 1/16
+const unsigned HISTOGRAM_SUB_BUCKET_BITS = 4;
+const unsigned HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+// Latencies past 2^40 ns (about 18 minutes) are counted in the last bucket
+const unsigned HISTOGRAM_MAX_EXPONENT = 40;
+const unsigned HISTOGRAM_BUCKETS = (HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BUCKET_BITS + 2) * HISTOGRAM_SUB_BUCKETS;
+
+typedef enum {
+	STAGE_VIDEO_CAPTURE,    // VideoSource::NextFrame
+	STAGE_VIDEO_ACQUIRE,    // AcquireNextFrame
+	STAGE_VIDEO_MAP,        // mapping the desktop or staging texture into the mirror
+	STAGE_VIDEO_DETECT,     // hashing tiles to find what changed
+	STAGE_VIDEO_POOL_WAIT,  // waiting for a free video sample
+	STAGE_VIDEO_CROP,
+	STAGE_VIDEO_SCALE,      // resizing to the encoded size
+	STAGE_VIDEO_CONVERT,
+	STAGE_VIDEO_WRITE,      // IMFSinkWriter::WriteSample
+	STAGE_VIDEO_LATENCY,    // from capture to WriteSample, interleaving included
+	STAGE_AUDIO_CAPTURE,    // AudioSource::NextFrame calls that delivered frames
+	STAGE_AUDIO_GET_BUFFER, // a WASAPI packet, GetBuffer to ReleaseBuffer
+	STAGE_AUDIO_PREPARE,    // copying a block into a sample
+	STAGE_AUDIO_WRITE,      // IMFSinkWriter::WriteSample
+	STAGE_AUDIO_LATENCY,    // from the start of a block to WriteSample
+	STAGE_COUNT
+} PipelineStage;
+
+typedef enum {
+	COUNTER_VIDEO_FRAMES,          // new frames handed to the interleaver
+	COUNTER_VIDEO_REPEATS,         // ticks that found nothing new on screen
+	COUNTER_VIDEO_LATE,            // scheduler deadlines served late
+	COUNTER_VIDEO_SKIPPED,         // scheduler deadlines skipped
+	COUNTER_VIDEO_DROPPED,         // captured frames that could not be prepared
+	COUNTER_VIDEO_STATIC,          // captured frames identical to the previous one, written as repeats
+	COUNTER_AUDIO_BLOCKS,
+	COUNTER_AUDIO_DROPPED,         // audio blocks that could not be prepared
+	COUNTER_AUDIO_RING_OVERRUNS,
+	GAUGE_AUDIO_RING_BYTES,        // queued between the audio capture and writer threads
+	GAUGE_INTERLEAVER_DEPTH,       // samples waiting in the interleaver
+	GAUGE_VIDEO_SAMPLES_IN_FLIGHT, // video samples between capture and the encoder
+	GAUGE_VIDEO_CHANGED_TILES,     // tiles that changed in the last captured frame
+	GAUGE_AV_SKEW_US,              // newest audio minus newest video timestamp
+	GAUGE_MAX_AV_SKEW_US,
+	COUNTER_COUNT
+} PipelineCounter;
+
+typedef struct HistogramSnapshot {
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t sumNs;
+} HistogramSnapshot;
+
+/*
+Log-linear latency histogram in nanoseconds, in the manner of HdrHistogram.
+Recording is lock-free: a relaxed increment of the bucket and of the sum, so
+any number of threads may record while another one takes snapshots
+*/
+class LatencyHistogram {
+public:
+	LatencyHistogram();
+	void Record(uint64_t ns);
+	void Snapshot(HistogramSnapshot* pSnapshot) const;
+	static unsigned BucketIndex(uint64_t ns);
+	// Largest value that falls in bucket index
+	static uint64_t BucketUpperBound(unsigned index);
+private:
+	std::atomic<uint64_t> counts[HISTOGRAM_BUCKETS];
+	std::atomic<uint64_t> sumNs;
+};
+
+// pCurrent minus previous, for the values recorded in between
+void HistogramDelta(HistogramSnapshot* pCurrent, const HistogramSnapshot& previous);
+// Upper bound of the bucket under which quantile (0 to 1) of the values fall; 0 when empty
+uint64_t HistogramValueAt(const HistogramSnapshot& snapshot, double quantile);
+
+typedef struct MetricsSnapshot {
+	int64_t timeNs;
+	HistogramSnapshot stages[STAGE_COUNT];
+	int64_t counters[COUNTER_COUNT];
+} MetricsSnapshot;
+
+/*
+Always-on timings and counters of the recording pipeline. Every call is
+lock-free, so the capture and writer threads record without waiting on the
+reporter
+*/
+class PipelineMetrics {
+public:
+	PipelineMetrics();
+	void Record(PipelineStage stage, uint64_t ns) { stages[stage].Record(ns); }
+	void Add(PipelineCounter counter, int64_t n = 1) { counters[counter].fetch_add(n, std::memory_order_relaxed); }
+	void Set(PipelineCounter counter, int64_t value) { counters[counter].store(value, std::memory_order_relaxed); }
+	void Snapshot(MetricsSnapshot* pSnapshot) const;
+	// steady_clock, so QPC on Windows
+	static int64_t NowNs();
+private:
+	LatencyHistogram stages[STAGE_COUNT];
+	std::atomic<int64_t> counters[COUNTER_COUNT];
+};
+
+const char* PipelineStageName(PipelineStage stage);
+const char* PipelineCounterName(PipelineCounter counter);
+
+/*
+One JSON object, without a line break: for every stage that ran since
+previous its count, mean, p50, p90, p99 and max in microseconds, then every
+counter and gauge as of current
+*/
+std::string FormatMetricsJson(const MetricsSnapshot& current, const MetricsSnapshot& previous, int64_t startNs);
+
+// Records the time from construction to Stop or destruction. Does nothing without metrics
+class StageTimer {
+public:
+	StageTimer(PipelineMetrics* pMetrics, PipelineStage stage)
+		: pMetrics(pMetrics), stage(stage), startNs(pMetrics != nullptr ? PipelineMetrics::NowNs() : 0) {}
+	~StageTimer() { Stop(); }
+	void Stop() {
+		if (pMetrics != nullptr) {
+			pMetrics->Record(stage, (uint64_t)(PipelineMetrics::NowNs() - startNs));
+			pMetrics = nullptr;
+		}
+	}
+private:
+	PipelineMetrics* pMetrics;
+	PipelineStage stage;
+	int64_t startNs;
+};
+
+/*
+Every intervalMs, calls collect (to refresh gauges owned by other components)
+and hands sink a JSON line covering the interval. A last line is reported
+when the reporter stops
+*/
+class MetricsReporter {
+public:
+	typedef std::function<void(const std::string&)> Sink;
+
+	MetricsReporter(PipelineMetrics* pMetrics, unsigned intervalMs, std::function<void()> collect, Sink sink);
+	~MetricsReporter();
+	void Stop();
+private:
+	void ReportProc();
+	void Report();
+
+	PipelineMetrics* pMetrics;
+	unsigned intervalMs;
+	std::function<void()> collect;
+	Sink sink;
+	int64_t startNs;
+	// Snapshots are around 60 KB, too large for the stack
+	std::unique_ptr<MetricsSnapshot> pCurrent;
+	std::unique_ptr<MetricsSnapshot> pPrevious;
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::thread thread;
+};
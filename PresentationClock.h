@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+
+/*
+Recording timeline shared by the audio and video threads, in 100ns units from Start.
+steady_clock is QPC based on Windows, so device positions expressed in QPC
+100ns units (e.g. WASAPI's pu64QPCPosition) map onto the same timeline
+*/
+class PresentationClock {
+public:
+	void Start() {
+		start100ns = Qpc100ns();
+	}
+
+	int64_t Now() const {
+		return Qpc100ns() - start100ns;
+	}
+
+	int64_t FromQpcPosition(uint64_t qpc100ns) const {
+		return (int64_t)qpc100ns - start100ns;
+	}
+
+	uint64_t ToQpcPosition(int64_t time) const {
+		return (uint64_t)(time + start100ns);
+	}
+
+	static int64_t Qpc100ns() {
+		return std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+	}
+private:
+	int64_t start100ns = 0;
+};
@@ -0,0 +1,43 @@
+#include <ReadbackRing.h>
+
+ReadbackRing::ReadbackRing(ReadbackTarget* pTarget, unsigned depth) : pTarget(pTarget), frames(depth > 0 ? depth : 1) {
+}
+
+unsigned ReadbackRing::NextSlot() const {
+	return (oldest + count) % (unsigned)frames.size();
+}
+
+void ReadbackRing::Push(uint64_t qpcPosition, const std::vector<FrameMove>& moves, const std::vector<FrameRect>& rects) {
+	PendingFrame& frame = frames[NextSlot()];
+	frame.qpcPosition = qpcPosition;
+	frame.moves.assign(moves.begin(), moves.end());
+	frame.rects.assign(rects.begin(), rects.end());
+	count += 1;
+}
+
+bool ReadbackRing::ReadOldest(FrameMirror* pMirror, uint64_t* pQpcPosition) {
+	if (count == 0) {
+		return false;
+	}
+
+	unsigned slot = oldest;
+	const PendingFrame& frame = frames[slot];
+	oldest = (oldest + 1) % (unsigned)frames.size();
+	count -= 1;
+
+	FrameView view;
+	if (!pTarget->MapSlot(slot, &view)) {
+		return false;
+	}
+	pMirror->ApplyMoves(frame.moves);
+	pMirror->UpdateRects(view, frame.rects);
+	pTarget->UnmapSlot(slot);
+
+	*pQpcPosition = frame.qpcPosition;
+	return true;
+}
+
+void ReadbackRing::Clear() {
+	oldest = 0;
+	count = 0;
+}
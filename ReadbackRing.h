@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <DirtyRegion.h>
+#include <FrameCrop.h>
+
+// Staging buffers a ReadbackRing cycles through, e.g. CPU-readable textures the GPU copies frames into
+class ReadbackTarget {
+public:
+	virtual ~ReadbackTarget() {}
+	// Maps buffer slot for reading, waiting for the copies issued into it to complete
+	virtual bool MapSlot(unsigned slot, FrameView* pView) = 0;
+	virtual void UnmapSlot(unsigned slot) = 0;
+};
+
+/*
+Schedules the readback of captured frames through depth staging buffers, so
+the copy of a frame overlaps with the reading of the frames before it: with 3
+buffers, frame k is copied while frame k-2 is read. Frames are read in capture
+order into a FrameMirror, each one's moves before its dirty rects, so a buffer
+only needs the dirty rects of the frame copied into it.
+The ring never touches a device itself
+*/
+class ReadbackRing {
+public:
+	ReadbackRing(ReadbackTarget* pTarget, unsigned depth);
+	unsigned Pending() const { return count; }
+	bool Full() const { return count == frames.size(); }
+	// Buffer the next frame must be copied into. Only meaningful while the ring is not full
+	unsigned NextSlot() const;
+	// Queues the frame just copied into NextSlot(), captured at qpcPosition (100ns units)
+	void Push(uint64_t qpcPosition, const std::vector<FrameMove>& moves, const std::vector<FrameRect>& rects);
+	/*
+	Reads the oldest queued frame into pMirror and frees its buffer; pQpcPosition
+	receives its capture time. Returns false when nothing is queued, or when the
+	buffer cannot be mapped: the frame is then dropped and the mirror misses its changes
+	*/
+	bool ReadOldest(FrameMirror* pMirror, uint64_t* pQpcPosition);
+	// Forgets every queued frame
+	void Clear();
+private:
+	typedef struct PendingFrame {
+		uint64_t qpcPosition;
+		std::vector<FrameMove> moves;
+		std::vector<FrameRect> rects;
+	} PendingFrame;
+
+	ReadbackTarget* pTarget;
+	// Indexed by slot; the vectors keep their capacity from one frame to the next
+	std::vector<PendingFrame> frames;
+	unsigned oldest = 0;
+	unsigned count = 0;
+};
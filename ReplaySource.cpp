@@ -0,0 +1,66 @@
+#include <string.h>
+
+#include <ReplaySource.h>
+
+ReplayVideoSource::ReplayVideoSource(const char* path, unsigned width, unsigned height)
+	: file(path, std::ios::binary), width(width), height(height) {
+	frame.resize((size_t)width * height * FRAME_BYTES_PER_PIXEL);
+
+	if (!file.is_open()) {
+		ERR(L"Failed to open video replay file %hs", path);
+		throw std::runtime_error("Failed to open the video replay file");
+	}
+	file.seekg(0, std::ios::end);
+	if (frame.empty() || (size_t)file.tellg() < frame.size()) {
+		ERR(L"%hs holds no whole %ux%u BGRA frame", path, width, height);
+		throw std::runtime_error("No frame in the video replay file");
+	}
+	file.seekg(0, std::ios::beg);
+}
+
+HRESULT ReplayVideoSource::NextFrame(FrameView* pFrame, UINT64* pQpcPosition) {
+	file.read(reinterpret_cast<char*>(frame.data()), frame.size());
+	if ((size_t)file.gcount() < frame.size()) {
+		// A partial frame at the end of the file is skipped
+		file.clear();
+		file.seekg(0, std::ios::beg);
+		file.read(reinterpret_cast<char*>(frame.data()), frame.size());
+	}
+
+	FrameView view = { frame.data(), (long)(width * FRAME_BYTES_PER_PIXEL), width, height };
+	*pFrame = view;
+	return S_OK;
+}
+
+ReplayAudioSource::ReplayAudioSource(const char* path, unsigned sampleRate, unsigned channels)
+	: PacedAudioSource(sampleRate, channels), file(path, std::ios::binary), channels(channels) {
+	if (!file.is_open()) {
+		ERR(L"Failed to open audio replay file %hs", path);
+		throw std::runtime_error("Failed to open the audio replay file");
+	}
+}
+
+void ReplayAudioSource::Generate(int16_t* pDest, UINT32 frames) {
+	size_t frameBytes = (size_t)channels * sizeof(int16_t);
+	size_t wanted = (size_t)frames * frameBytes;
+	size_t filled = 0;
+
+	while (filled < wanted) {
+		bool fromStart = file.tellg() == std::streampos(0);
+		file.read(reinterpret_cast<char*>(pDest) + filled, wanted - filled);
+		size_t read = (size_t)file.gcount();
+		filled += read;
+		if (filled < wanted) {
+			// A partial frame at the end is dropped; a file without a whole frame plays silence
+			filled -= filled % frameBytes;
+			if (fromStart && read < frameBytes) {
+				break;
+			}
+			file.clear();
+			file.seekg(0, std::ios::beg);
+		}
+	}
+	if (filled < wanted) {
+		memset(reinterpret_cast<char*>(pDest) + filled, 0, wanted - filled);
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <fstream>
+#include <vector>
+
+#include <CaptureSource.h>
+
+/*
+Replays a raw file of tightly packed width x height BGRA frames, one frame per
+call. The file starts over when it ends, so a short clip can feed a recording
+of any length. Throws std::runtime_error when the file holds no whole frame
+*/
+class ReplayVideoSource : public VideoSource {
+public:
+	ReplayVideoSource(const char* path, unsigned width, unsigned height);
+	HRESULT NextFrame(FrameView* pFrame, UINT64* pQpcPosition = nullptr) override;
+private:
+	std::ifstream file;
+	std::vector<uint8_t> frame;
+	unsigned width;
+	unsigned height;
+};
+
+/*
+Replays a raw file of interleaved 16-bit PCM at the real-time rate of its
+format, starting over when it ends. Throws std::runtime_error when the file
+cannot be opened
+*/
+class ReplayAudioSource : public PacedAudioSource {
+public:
+	ReplayAudioSource(const char* path, unsigned sampleRate, unsigned channels);
+protected:
+	void Generate(int16_t* pDest, UINT32 frames) override;
+private:
+	std::ifstream file;
+	unsigned channels;
+};
@@ -0,0 +1,130 @@
+#include <Common.h>
+#include <SamplePool.h>
+
+SamplePool::SamplePool() {
+}
+
+SamplePool::~SamplePool() {
+	Clear();
+}
+
+void SamplePool::Clear() {
+	for (IMFSample*& pSample : samples) {
+		SafeRelease(&pSample);
+	}
+	for (IMFMediaBuffer*& pBuffer : buffers) {
+		SafeRelease(&pBuffer);
+	}
+	samples.clear();
+	buffers.clear();
+	delete pSlots;
+	pSlots = nullptr;
+}
+
+HRESULT SamplePool::Initialize(unsigned count, std::function<HRESULT(IMFMediaBuffer**)> createBuffer) {
+	HRESULT hr = S_OK;
+
+	samples.assign(count, nullptr);
+	buffers.assign(count, nullptr);
+
+	for (unsigned i = 0; i < count; i++) {
+		IMFTrackedSample* pTracked = nullptr;
+
+		hr = createBuffer(&buffers[i]);
+		if (FAILED(hr)) {
+			ERR(L"Failed to create pooled media buffer: hr = 0x%08x", hr);
+			return hr;
+		}
+		hr = MFCreateTrackedSample(&pTracked);
+		if (FAILED(hr)) {
+			ERR(L"MFCreateTrackedSample: hr = 0x%08x", hr);
+			return hr;
+		}
+		hr = pTracked->QueryInterface(__uuidof(IMFSample), (void**)& samples[i]);
+		SafeRelease(&pTracked);
+		if (FAILED(hr)) {
+			return hr;
+		}
+		hr = samples[i]->AddBuffer(buffers[i]);
+		if (FAILED(hr)) {
+			ERR(L"Failed to add buffer to pooled sample: hr = 0x%08x", hr);
+			return hr;
+		}
+	}
+
+	pSlots = new SlotPool(count);
+	return hr;
+}
+
+HRESULT SamplePool::Acquire(DWORD timeoutMs, IMFSample** ppSample, IMFMediaBuffer** ppBuffer) {
+	IMFTrackedSample* pTracked = nullptr;
+
+	int slot = pSlots->Acquire(timeoutMs);
+	if (slot < 0) {
+		return MF_E_SAMPLEALLOCATOR_EMPTY;
+	}
+
+	// Ask the sample to call us back instead of being destroyed when its last reference goes away
+	HRESULT hr = samples[slot]->QueryInterface(__uuidof(IMFTrackedSample), (void**)& pTracked);
+	if (SUCCEEDED(hr)) {
+		hr = pTracked->SetAllocator(this, nullptr);
+		SafeRelease(&pTracked);
+	}
+	if (FAILED(hr)) {
+		ERR(L"IMFTrackedSample::SetAllocator: hr = 0x%08x", hr);
+		pSlots->Release(slot);
+		return hr;
+	}
+
+	// The pool's reference is handed over to the caller until Invoke gives it back
+	*ppSample = samples[slot];
+	*ppBuffer = buffers[slot];
+	(*ppBuffer)->AddRef();
+
+	return hr;
+}
+
+STDMETHODIMP SamplePool::Invoke(IMFAsyncResult* pResult) {
+	IUnknown* pObject = nullptr;
+	IMFSample* pSample = nullptr;
+
+	HRESULT hr = pResult->GetObject(&pObject);
+	if (FAILED(hr)) {
+		return hr;
+	}
+	hr = pObject->QueryInterface(__uuidof(IMFSample), (void**)& pSample);
+	SafeRelease(&pObject);
+	if (FAILED(hr)) {
+		return hr;
+	}
+
+	for (size_t slot = 0; slot < samples.size(); slot++) {
+		if (samples[slot] == pSample) {
+			// Keep the reference we just took; it is the pool's again
+			pSlots->Release((int)slot);
+			return S_OK;
+		}
+	}
+
+	SafeRelease(&pSample);
+	return E_UNEXPECTED;
+}
+
+STDMETHODIMP SamplePool::QueryInterface(REFIID riid, void** ppv) {
+	if (ppv == nullptr) {
+		return E_POINTER;
+	}
+	if (riid == __uuidof(IUnknown) || riid == __uuidof(IMFAsyncCallback)) {
+		*ppv = static_cast<IMFAsyncCallback*>(this);
+		return S_OK;
+	}
+	*ppv = nullptr;
+	return E_NOINTERFACE;
+}
+
+SlotPoolStats SamplePool::Stats() {
+	if (pSlots == nullptr) {
+		return SlotPoolStats();
+	}
+	return pSlots->Stats();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <mfidl.h>
+#include <mfapi.h>
+
+#include <SlotPool.h>
+
+/*
+Preallocated set of tracked IMFSamples, each owning one media buffer.
+A sample handed out by Acquire comes back to the pool by itself once the
+caller and the sink writer have released every reference to it, so capture
+can fill the next buffer while the encoder is still reading the previous one.
+*/
+class SamplePool : public IMFAsyncCallback {
+public:
+	SamplePool();
+	~SamplePool();
+	HRESULT Initialize(unsigned count, std::function<HRESULT(IMFMediaBuffer**)> createBuffer);
+	/*
+	Returns a free sample and its buffer, both AddRef'd.
+	MF_E_SAMPLEALLOCATOR_EMPTY if none was released within timeoutMs
+	*/
+	HRESULT Acquire(DWORD timeoutMs, IMFSample** ppSample, IMFMediaBuffer** ppBuffer);
+	SlotPoolStats Stats();
+	// Releases every sample and buffer; call once the sink writer holds none of them, before MFShutdown
+	void Clear();
+
+	// IUnknown: the pool is owned by its MediaWriter and outlives every sample
+	STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override;
+	STDMETHODIMP_(ULONG) AddRef() override { return 1; }
+	STDMETHODIMP_(ULONG) Release() override { return 1; }
+
+	// IMFAsyncCallback: invoked by a tracked sample whose reference count reached zero
+	STDMETHODIMP GetParameters(DWORD*, DWORD*) override { return E_NOTIMPL; }
+	STDMETHODIMP Invoke(IMFAsyncResult* pResult) override;
+private:
+	SlotPool* pSlots = nullptr;
+	std::vector<IMFSample*> samples;
+	std::vector<IMFMediaBuffer*> buffers;
+};
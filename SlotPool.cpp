@@ -0,0 +1,77 @@
+#include <chrono>
+
+#include <SlotPool.h>
+
+SlotPool::SlotPool(unsigned count) : count(count), stats() {
+	slotInUse.assign(count, false);
+	freeSlots.reserve(count);
+	for (int slot = (int)count - 1; slot >= 0; slot--) {
+		freeSlots.push_back(slot);
+	}
+}
+
+int SlotPool::PopLocked() {
+	int slot = freeSlots.back();
+	freeSlots.pop_back();
+	slotInUse[slot] = true;
+
+	stats.acquired += 1;
+	stats.inUse += 1;
+	if (stats.inUse > stats.maxInUse) {
+		stats.maxInUse = stats.inUse;
+	}
+	return slot;
+}
+
+int SlotPool::TryAcquire() {
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (freeSlots.empty()) {
+		stats.exhausted += 1;
+		return -1;
+	}
+	return PopLocked();
+}
+
+int SlotPool::Acquire(unsigned timeoutMs) {
+	std::unique_lock<std::mutex> guard(lock);
+
+	if (!freeSlots.empty()) {
+		return PopLocked();
+	}
+
+	// Every slot is still held by the consumer: wait for one to come back
+	stats.exhausted += 1;
+	auto waitStart = std::chrono::steady_clock::now();
+	bool available = slotReleased.wait_for(guard, std::chrono::milliseconds(timeoutMs), [this] {
+		return !freeSlots.empty();
+	});
+	stats.backpressureWaitUs += std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - waitStart
+	).count();
+
+	if (!available) {
+		stats.timeouts += 1;
+		return -1;
+	}
+	return PopLocked();
+}
+
+void SlotPool::Release(int slot) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (slot < 0 || slot >= (int)count || !slotInUse[slot]) {
+			return;
+		}
+		slotInUse[slot] = false;
+		freeSlots.push_back(slot);
+		stats.released += 1;
+		stats.inUse -= 1;
+	}
+	slotReleased.notify_one();
+}
+
+SlotPoolStats SlotPool::Stats() {
+	std::lock_guard<std::mutex> guard(lock);
+	return stats;
+}
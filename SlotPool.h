@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+typedef struct SlotPoolStats {
+	uint64_t acquired;
+	uint64_t released;
+	uint64_t exhausted;          // Acquire calls that found every slot in use
+	uint64_t timeouts;           // Acquire calls that gave up waiting
+	uint64_t backpressureWaitUs; // total time spent waiting for a slot
+	unsigned inUse;
+	unsigned maxInUse;
+} SlotPoolStats;
+
+/*
+Fixed set of slot indices shared between a producer, which acquires a free slot
+and fills it, and a consumer, which releases it once it is done with the data.
+The pool does not own the slot contents; callers index their own preallocated
+storage with the returned slot.
+*/
+class SlotPool {
+public:
+	SlotPool(unsigned count);
+	// Returns a free slot, waiting up to timeoutMs for one to be released. -1 on timeout
+	int Acquire(unsigned timeoutMs);
+	// Returns a free slot or -1 without waiting
+	int TryAcquire();
+	void Release(int slot);
+	unsigned Size() const { return count; }
+	SlotPoolStats Stats();
+private:
+	int PopLocked();
+
+	std::mutex lock;
+	std::condition_variable slotReleased;
+	std::vector<int> freeSlots;
+	std::vector<bool> slotInUse;
+	unsigned count;
+	SlotPoolStats stats;
+};
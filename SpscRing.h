@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+#define CACHE_LINE_SIZE 64
+
+/*
+Single-producer/single-consumer byte ring. The storage is allocated once; the
+producer and consumer each own one index, kept on separate cache lines, and only
+synchronize through acquire/release loads and stores of those indices.
+
+Only one thread may call the Write* functions and only one thread the Read* functions.
+*/
+class SpscRing {
+public:
+	// capacity is rounded up to a power of two
+	SpscRing(size_t capacity) {
+		size_t size = 1;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		buffer.resize(size);
+		mask = size - 1;
+	}
+
+	size_t Capacity() const { return mask + 1; }
+
+	size_t ReadAvailable() const {
+		return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_relaxed);
+	}
+
+	size_t WriteAvailable() const {
+		return Capacity() - (writeIndex.load(std::memory_order_relaxed) - readIndex.load(std::memory_order_acquire));
+	}
+
+	/*
+	Copies all of pData or nothing. A full ring is counted as an overrun
+	so the producer never blocks
+	*/
+	bool Write(const uint8_t* pData, size_t size) {
+		size_t write = writeIndex.load(std::memory_order_relaxed);
+
+		if (Capacity() - (write - cachedReadIndex) < size) {
+			cachedReadIndex = readIndex.load(std::memory_order_acquire);
+			if (Capacity() - (write - cachedReadIndex) < size) {
+				overruns.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+
+		CopyIn(write, pData, size);
+		writeIndex.store(write + size, std::memory_order_release);
+		return true;
+	}
+
+	// Writes size zero bytes, with the same all-or-nothing rule as Write
+	bool WriteZeros(size_t size) {
+		size_t write = writeIndex.load(std::memory_order_relaxed);
+
+		if (Capacity() - (write - readIndex.load(std::memory_order_acquire)) < size) {
+			overruns.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		size_t offset = write & mask;
+		size_t first = size < Capacity() - offset ? size : Capacity() - offset;
+		memset(&buffer[offset], 0, first);
+		memset(&buffer[0], 0, size - first);
+		writeIndex.store(write + size, std::memory_order_release);
+		return true;
+	}
+
+	/*
+	Copies up to maxSize bytes, rounded down to a multiple of granularity
+	(e.g. an audio block), into pData. Returns the number of bytes read
+	*/
+	size_t Read(uint8_t* pData, size_t maxSize, size_t granularity = 1) {
+		size_t read = readIndex.load(std::memory_order_relaxed);
+
+		if (cachedWriteIndex - read < maxSize) {
+			cachedWriteIndex = writeIndex.load(std::memory_order_acquire);
+		}
+
+		size_t size = cachedWriteIndex - read;
+		if (size > maxSize) {
+			size = maxSize;
+		}
+		size -= size % granularity;
+
+		CopyOut(read, pData, size);
+		readIndex.store(read + size, std::memory_order_release);
+		return size;
+	}
+
+	// Writes that did not fit
+	uint64_t Overruns() const { return overruns.load(std::memory_order_relaxed); }
+
+private:
+	void CopyIn(size_t index, const uint8_t* pData, size_t size) {
+		size_t offset = index & mask;
+		size_t first = size < Capacity() - offset ? size : Capacity() - offset;
+		memcpy(&buffer[offset], pData, first);
+		memcpy(&buffer[0], pData + first, size - first);
+	}
+
+	void CopyOut(size_t index, uint8_t* pData, size_t size) {
+		size_t offset = index & mask;
+		size_t first = size < Capacity() - offset ? size : Capacity() - offset;
+		memcpy(pData, &buffer[offset], first);
+		memcpy(pData + first, &buffer[0], size - first);
+	}
+
+	std::vector<uint8_t> buffer;
+	size_t mask;
+
+	// Producer-owned
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> writeIndex{ 0 };
+	size_t cachedReadIndex = 0;
+
+	// Consumer-owned
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> readIndex{ 0 };
+	size_t cachedWriteIndex = 0;
+
+	alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> overruns{ 0 };
+};
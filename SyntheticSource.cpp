@@ -0,0 +1,96 @@
+#include <math.h>
+
+#include <SyntheticSource.h>
+
+// Position along a back and forth run over [0, travel]
+static unsigned Bounce(uint64_t distance, unsigned travel) {
+	if (travel == 0) {
+		return 0;
+	}
+	unsigned phase = (unsigned)(distance % (2 * (uint64_t)travel));
+	return phase <= travel ? phase : 2 * travel - phase;
+}
+
+SyntheticVideoSource::SyntheticVideoSource(unsigned width, unsigned height, unsigned fps)
+	: width(width), height(height), fps(fps > 0 ? fps : 1) {
+	pitch = (long)(width * FRAME_BYTES_PER_PIXEL);
+	pixels.resize((size_t)pitch * height);
+
+	FrameRect full = { 0, 0, width, height };
+	DrawBackground(full);
+}
+
+FrameRect SyntheticVideoSource::BoxAt(uint64_t index) const {
+	unsigned size = height / 8 > 0 ? height / 8 : 1;
+	unsigned travelX = width > size ? width - size : 0;
+	unsigned travelY = height > size ? height - size : 0;
+	// The vertical run is a second slower, so the box does not retrace a diagonal
+	uint64_t x = index * travelX / ((uint64_t)SYNTHETIC_BOX_CROSS_SECONDS * fps);
+	uint64_t y = index * travelY / ((uint64_t)(SYNTHETIC_BOX_CROSS_SECONDS + 1) * fps);
+
+	FrameRect box = { Bounce(x, travelX), Bounce(y, travelY), size < width ? size : width, size < height ? size : height };
+	return box;
+}
+
+FrameRect SyntheticVideoSource::BarAt(uint64_t index) const {
+	unsigned y = (unsigned)(index * height / ((uint64_t)SYNTHETIC_BAR_SWEEP_SECONDS * fps) % (height > 0 ? height : 1));
+	unsigned rows = height - y < SYNTHETIC_BAR_ROWS ? height - y : SYNTHETIC_BAR_ROWS;
+
+	FrameRect bar = { 0, y, width, rows };
+	return bar;
+}
+
+// Blue and green ramps with a fine checker in red, so no two rows or columns are alike
+void SyntheticVideoSource::DrawBackground(const FrameRect& rect) {
+	for (unsigned y = rect.y; y < rect.y + rect.height; y++) {
+		uint8_t* pRow = pixels.data() + (size_t)y * pitch;
+		for (unsigned x = rect.x; x < rect.x + rect.width; x++) {
+			uint8_t* pPixel = pRow + (size_t)x * FRAME_BYTES_PER_PIXEL;
+			pPixel[0] = (uint8_t)((uint64_t)x * 255 / width);
+			pPixel[1] = (uint8_t)((uint64_t)y * 255 / height);
+			pPixel[2] = (uint8_t)(0x40 + ((x ^ y) & 0x3f));
+			pPixel[3] = 0xff;
+		}
+	}
+}
+
+void SyntheticVideoSource::FillRect(const FrameRect& rect, uint32_t bgra) {
+	for (unsigned y = rect.y; y < rect.y + rect.height; y++) {
+		uint32_t* pRow = reinterpret_cast<uint32_t*>(pixels.data() + (size_t)y * pitch);
+		for (unsigned x = rect.x; x < rect.x + rect.width; x++) {
+			pRow[x] = bgra;
+		}
+	}
+}
+
+HRESULT SyntheticVideoSource::NextFrame(FrameView* pFrame, UINT64* pQpcPosition) {
+	// Only what the previous frame drew is restored, as a desktop repaints its dirty rects
+	if (frameIndex > 0) {
+		DrawBackground(BarAt(frameIndex - 1));
+		DrawBackground(BoxAt(frameIndex - 1));
+	}
+	FillRect(BarAt(frameIndex), 0xffe0e0e0);
+	FillRect(BoxAt(frameIndex), 0xff000000 | (uint32_t)((frameIndex * 0x010307) & 0xffffff));
+	frameIndex += 1;
+
+	FrameView view = { pixels.data(), pitch, width, height };
+	*pFrame = view;
+	return S_OK;
+}
+
+SyntheticAudioSource::SyntheticAudioSource(unsigned sampleRate, unsigned channels)
+	: PacedAudioSource(sampleRate, channels), sampleRate(sampleRate), channels(channels) {
+}
+
+void SyntheticAudioSource::Generate(int16_t* pDest, UINT32 frames) {
+	const double step = 2.0 * 3.14159265358979323846 * SYNTHETIC_TONE_HZ / sampleRate;
+
+	for (UINT32 i = 0; i < frames; i++) {
+		// -12 dBFS; the phase is taken from the frame index so it never drifts
+		int16_t sample = (int16_t)lrint(8192.0 * sin(step * (double)((frameIndex + i) % sampleRate)));
+		for (unsigned c = 0; c < channels; c++) {
+			pDest[(size_t)i * channels + c] = sample;
+		}
+	}
+	frameIndex += frames;
+}
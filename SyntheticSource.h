@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <CaptureSource.h>
+
+// Seconds the box takes to cross the frame horizontally, and the bar to sweep down it
+const unsigned SYNTHETIC_BOX_CROSS_SECONDS = 4;
+const unsigned SYNTHETIC_BAR_SWEEP_SECONDS = 2;
+const unsigned SYNTHETIC_BAR_ROWS = 8;
+const unsigned SYNTHETIC_TONE_HZ = 440;
+
+/*
+Deterministic desktop, for running the pipeline without a GPU: a fixed
+gradient with a box bouncing across it and a bar sweeping down, so every
+frame changes a few small regions like a mostly idle screen. The image of
+the n-th frame only depends on n and the geometry
+*/
+class SyntheticVideoSource : public VideoSource {
+public:
+	SyntheticVideoSource(unsigned width, unsigned height, unsigned fps);
+	HRESULT NextFrame(FrameView* pFrame, UINT64* pQpcPosition = nullptr) override;
+private:
+	FrameRect BoxAt(uint64_t index) const;
+	FrameRect BarAt(uint64_t index) const;
+	void DrawBackground(const FrameRect& rect);
+	void FillRect(const FrameRect& rect, uint32_t bgra);
+
+	std::vector<uint8_t> pixels;
+	unsigned width;
+	unsigned height;
+	unsigned fps;
+	long pitch;
+	uint64_t frameIndex = 0;
+};
+
+// Deterministic audio: a SYNTHETIC_TONE_HZ sine, the same in every channel
+class SyntheticAudioSource : public PacedAudioSource {
+public:
+	SyntheticAudioSource(unsigned sampleRate, unsigned channels);
+protected:
+	void Generate(int16_t* pDest, UINT32 frames) override;
+private:
+	unsigned sampleRate;
+	unsigned channels;
+	uint64_t frameIndex = 0;
+};
@@ -0,0 +1,85 @@
+#include <ThreadPool.h>
+
+ThreadPool::ThreadPool(unsigned threadCount) : nextIndex(0) {
+	if (threadCount == 0) {
+		threadCount = std::thread::hardware_concurrency();
+	}
+	for (unsigned i = 1; i < threadCount; i++) {
+		workers.emplace_back(&ThreadPool::WorkerProc, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> guard(stateLock);
+		stopping = true;
+	}
+	jobReady.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::RunJob(const std::function<void(unsigned)>* pFn, unsigned count) {
+	unsigned index;
+	while ((index = nextIndex.fetch_add(1)) < count) {
+		(*pFn)(index);
+	}
+}
+
+void ThreadPool::WorkerProc() {
+	unsigned long long seenGeneration = 0;
+
+	while (true) {
+		const std::function<void(unsigned)>* pFn;
+		unsigned count;
+		{
+			std::unique_lock<std::mutex> guard(stateLock);
+			jobReady.wait(guard, [&] { return stopping || jobGeneration != seenGeneration; });
+			if (stopping) {
+				return;
+			}
+			seenGeneration = jobGeneration;
+			pFn = pJob;
+			count = jobCount;
+			activeWorkers += 1;
+		}
+
+		RunJob(pFn, count);
+
+		{
+			std::lock_guard<std::mutex> guard(stateLock);
+			activeWorkers -= 1;
+		}
+		jobDone.notify_one();
+	}
+}
+
+void ThreadPool::ParallelFor(unsigned count, const std::function<void(unsigned)>& fn) {
+	if (count == 0) {
+		return;
+	}
+	if (workers.empty() || count == 1) {
+		for (unsigned i = 0; i < count; i++) {
+			fn(i);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> serialize(jobLock);
+	{
+		// A worker that woke up late for the previous job may still be draining it
+		std::unique_lock<std::mutex> guard(stateLock);
+		jobDone.wait(guard, [this] { return activeWorkers == 0; });
+		pJob = &fn;
+		jobCount = count;
+		nextIndex.store(0);
+		jobGeneration += 1;
+	}
+	jobReady.notify_all();
+
+	RunJob(&fn, count);
+
+	std::unique_lock<std::mutex> guard(stateLock);
+	jobDone.wait(guard, [this] { return activeWorkers == 0; });
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Small pool of persistent worker threads for splitting per-frame work into tiles.
+Workers are started once, so a frame does not pay for thread creation.
+*/
+class ThreadPool {
+public:
+	// threadCount includes the calling thread; 0 uses every hardware thread
+	ThreadPool(unsigned threadCount = 0);
+	~ThreadPool();
+	/*
+	Runs fn(index) for every index in [0, count) across the pool and the calling thread.
+	Returns once all of them completed. Calls are serialized.
+	*/
+	void ParallelFor(unsigned count, const std::function<void(unsigned)>& fn);
+	unsigned ThreadCount() const { return (unsigned)workers.size() + 1; }
+private:
+	void WorkerProc();
+	void RunJob(const std::function<void(unsigned)>* pFn, unsigned count);
+
+	std::vector<std::thread> workers;
+	std::mutex jobLock;
+	std::mutex stateLock;
+	std::condition_variable jobReady;
+	std::condition_variable jobDone;
+
+	const std::function<void(unsigned)>* pJob = nullptr;
+	unsigned jobCount = 0;
+	unsigned long long jobGeneration = 0;
+	std::atomic<unsigned> nextIndex;
+	unsigned activeWorkers = 0;
+	bool stopping = false;
+};
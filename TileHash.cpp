@@ -0,0 +1,186 @@
+#include <CpuFeatures.h>
+#include <TileHash.h>
+
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+#define FNV32_OFFSET_BASIS 2166136261u
+#define FNV32_PRIME 16777619u
+#define FNV64_OFFSET_BASIS 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+/*
+Advances the column hashes in pLanes by one row of columns pixels. Kernels only
+differ in how many columns they advance at once
+*/
+typedef void (*HashRowFn)(const uint8_t* pRow, unsigned columns, uint32_t* pLanes);
+
+static void HashRowTail(const uint8_t* pRow, unsigned x, unsigned columns, uint32_t* pLanes) {
+	for (; x < columns; x++) {
+		const uint8_t* pPixel = pRow + (size_t)x * FRAME_BYTES_PER_PIXEL;
+		uint32_t value = (uint32_t)pPixel[0] | ((uint32_t)pPixel[1] << 8) | ((uint32_t)pPixel[2] << 16) | ((uint32_t)pPixel[3] << 24);
+		pLanes[x] = (pLanes[x] ^ value) * FNV32_PRIME;
+	}
+}
+
+static void HashRowScalar(const uint8_t* pRow, unsigned columns, uint32_t* pLanes) {
+	HashRowTail(pRow, 0, columns, pLanes);
+}
+
+// The lanes of a column are mixed into a running 64-bit FNV-1a, whose high half is folded back each step
+static uint64_t FoldLanes(const uint32_t* pLanes, unsigned columns) {
+	uint64_t hash = FNV64_OFFSET_BASIS;
+	for (unsigned x = 0; x < columns; x++) {
+		hash = (hash ^ pLanes[x]) * FNV64_PRIME;
+		hash ^= hash >> 32;
+	}
+	return hash;
+}
+
+#if CPU_X86
+TARGET_SSE41 static void HashRowSse41(const uint8_t* pRow, unsigned columns, uint32_t* pLanes) {
+	const __m128i prime = _mm_set1_epi32((int)FNV32_PRIME);
+
+	unsigned x = 0;
+	for (; x + 8 <= columns; x += 8) {
+		__m128i lanes0 = _mm_loadu_si128((const __m128i*)(pLanes + x));
+		__m128i lanes1 = _mm_loadu_si128((const __m128i*)(pLanes + x + 4));
+		__m128i pixels0 = _mm_loadu_si128((const __m128i*)(pRow + x * 4));
+		__m128i pixels1 = _mm_loadu_si128((const __m128i*)(pRow + x * 4 + 16));
+		_mm_storeu_si128((__m128i*)(pLanes + x), _mm_mullo_epi32(_mm_xor_si128(lanes0, pixels0), prime));
+		_mm_storeu_si128((__m128i*)(pLanes + x + 4), _mm_mullo_epi32(_mm_xor_si128(lanes1, pixels1), prime));
+	}
+
+	HashRowTail(pRow, x, columns, pLanes);
+}
+
+TARGET_AVX2 static void HashRowAvx2(const uint8_t* pRow, unsigned columns, uint32_t* pLanes) {
+	const __m256i prime = _mm256_set1_epi32((int)FNV32_PRIME);
+
+	unsigned x = 0;
+	for (; x + 16 <= columns; x += 16) {
+		__m256i lanes0 = _mm256_loadu_si256((const __m256i*)(pLanes + x));
+		__m256i lanes1 = _mm256_loadu_si256((const __m256i*)(pLanes + x + 8));
+		__m256i pixels0 = _mm256_loadu_si256((const __m256i*)(pRow + x * 4));
+		__m256i pixels1 = _mm256_loadu_si256((const __m256i*)(pRow + x * 4 + 32));
+		_mm256_storeu_si256((__m256i*)(pLanes + x), _mm256_mullo_epi32(_mm256_xor_si256(lanes0, pixels0), prime));
+		_mm256_storeu_si256((__m256i*)(pLanes + x + 8), _mm256_mullo_epi32(_mm256_xor_si256(lanes1, pixels1), prime));
+	}
+
+	HashRowTail(pRow, x, columns, pLanes);
+}
+#endif
+
+TileChangeDetector::TileChangeDetector(unsigned width, unsigned height, ThreadPool* pPool, HashKernel kernel)
+	: width(width), height(height), pPool(pPool) {
+	const CpuFeatures& cpu = GetCpuFeatures();
+
+	if (kernel == HASH_KERNEL_AUTO) {
+		kernel = cpu.avx2 ? HASH_KERNEL_AVX2 : (cpu.sse41 ? HASH_KERNEL_SSE41 : HASH_KERNEL_SCALAR);
+	}
+	if (kernel == HASH_KERNEL_AVX2 && !cpu.avx2) {
+		kernel = HASH_KERNEL_SSE41;
+	}
+	if (kernel == HASH_KERNEL_SSE41 && !cpu.sse41) {
+		kernel = HASH_KERNEL_SCALAR;
+	}
+	this->kernel = kernel;
+
+	changes.tilesX = (width + CHANGE_TILE_SIZE - 1) / CHANGE_TILE_SIZE;
+	changes.tilesY = (height + CHANGE_TILE_SIZE - 1) / CHANGE_TILE_SIZE;
+	changes.wordsPerRow = (changes.tilesX + 63) / 64;
+	changes.changed = 0;
+	changes.bits.assign((size_t)changes.wordsPerRow * changes.tilesY, 0);
+	hashes.assign((size_t)changes.tilesX * changes.tilesY, 0);
+	lanes.assign((size_t)width * changes.tilesY, 0);
+}
+
+bool TileChangeDetector::Update(const FrameView& frame, const FrameRect& rect) {
+	if (rect.width != width || rect.height != height ||
+		rect.x > frame.width || rect.width > frame.width - rect.x ||
+		rect.y > frame.height || rect.height > frame.height - rect.y) {
+		return false;
+	}
+
+	HashRowFn hashRow = HashRowScalar;
+#if CPU_X86
+	if (kernel == HASH_KERNEL_AVX2) {
+		hashRow = HashRowAvx2;
+	}
+	else if (kernel == HASH_KERNEL_SSE41) {
+		hashRow = HashRowSse41;
+	}
+#endif
+
+	const uint8_t* pOrigin = frame.pData + (size_t)rect.y * frame.pitch + (size_t)rect.x * FRAME_BYTES_PER_PIXEL;
+	/*
+	Rows are read whole, one after the other, while the hashes of every column of
+	the tile row advance together. Tile rows own whole words of the bitmap, so
+	workers never write the same word
+	*/
+	auto hashTileRow = [&](unsigned tileY) {
+		unsigned y = tileY * CHANGE_TILE_SIZE;
+		unsigned rows = height - y < CHANGE_TILE_SIZE ? height - y : CHANGE_TILE_SIZE;
+		uint64_t* pBits = &changes.bits[(size_t)tileY * changes.wordsPerRow];
+		uint32_t* pLanes = &lanes[(size_t)tileY * width];
+
+		for (unsigned x = 0; x < width; x++) {
+			pLanes[x] = FNV32_OFFSET_BASIS;
+		}
+		for (unsigned row = 0; row < rows; row++) {
+			hashRow(pOrigin + (size_t)(y + row) * frame.pitch, width, pLanes);
+		}
+
+		for (unsigned word = 0; word < changes.wordsPerRow; word++) {
+			pBits[word] = 0;
+		}
+		for (unsigned tileX = 0; tileX < changes.tilesX; tileX++) {
+			unsigned x = tileX * CHANGE_TILE_SIZE;
+			unsigned columns = width - x < CHANGE_TILE_SIZE ? width - x : CHANGE_TILE_SIZE;
+			uint64_t hash = FoldLanes(pLanes + x, columns);
+			uint64_t& previous = hashes[(size_t)tileY * changes.tilesX + tileX];
+			if (!hashed || hash != previous) {
+				pBits[tileX / 64] |= 1ull << (tileX % 64);
+			}
+			previous = hash;
+		}
+	};
+
+	if (pPool != nullptr) {
+		pPool->ParallelFor(changes.tilesY, hashTileRow);
+	}
+	else {
+		for (unsigned tileY = 0; tileY < changes.tilesY; tileY++) {
+			hashTileRow(tileY);
+		}
+	}
+
+	changes.changed = 0;
+	for (uint64_t word : changes.bits) {
+		for (; word != 0; word &= word - 1) {
+			changes.changed++;
+		}
+	}
+	hashed = true;
+	return true;
+}
+
+void TileChangeDetector::ChangedRects(DirtyRegion* pRegion) const {
+	for (unsigned tileY = 0; tileY < changes.tilesY; tileY++) {
+		unsigned tileX = 0;
+		while (tileX < changes.tilesX) {
+			if (!changes.Changed(tileX, tileY)) {
+				tileX++;
+				continue;
+			}
+			unsigned first = tileX;
+			while (tileX < changes.tilesX && changes.Changed(tileX, tileY)) {
+				tileX++;
+			}
+			FrameRect rect = { first * CHANGE_TILE_SIZE, tileY * CHANGE_TILE_SIZE, (tileX - first) * CHANGE_TILE_SIZE, CHANGE_TILE_SIZE };
+			pRegion->Add(rect, width, height);
+		}
+	}
+	pRegion->Merge();
+}
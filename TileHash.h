@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <DirtyRegion.h>
+#include <FrameCrop.h>
+#include <ThreadPool.h>
+
+// Side of the square tiles frames are compared by, in pixels
+const unsigned CHANGE_TILE_SIZE = 64;
+
+typedef enum { HASH_KERNEL_AUTO, HASH_KERNEL_SCALAR, HASH_KERNEL_SSE41, HASH_KERNEL_AVX2 } HashKernel;
+
+// Tiles of a frame that differ from the previous frame. Each row of tiles starts on a new word of bits
+typedef struct TileChangeMap {
+	unsigned tilesX;
+	unsigned tilesY;
+	unsigned wordsPerRow;
+	unsigned changed;
+	std::vector<uint64_t> bits;
+
+	bool Changed(unsigned tileX, unsigned tileY) const {
+		return (bits[(size_t)tileY * wordsPerRow + tileX / 64] >> (tileX % 64)) & 1;
+	}
+} TileChangeMap;
+
+/*
+Finds the parts of a frame that changed by hashing CHANGE_TILE_SIZE tiles,
+without any help from the capture backend. Every pixel column of a tile is
+hashed with 32-bit FNV-1a over its pixels, so a change confined to one column
+always alters the tile hash; the column hashes are then folded into 64 bits.
+Every kernel computes the same hashes.
+*/
+class TileChangeDetector {
+public:
+	TileChangeDetector(unsigned width, unsigned height, ThreadPool* pPool = nullptr, HashKernel kernel = HASH_KERNEL_AUTO);
+	/*
+	Hashes rect of frame, which must be width x height, and marks the tiles that
+	differ from the previous call in Changes(). Every tile is marked after
+	construction or Reset(). Returns false, leaving the hashes as they were, if
+	rect does not fit inside frame
+	*/
+	bool Update(const FrameView& frame, const FrameRect& rect);
+	const TileChangeMap& Changes() const { return changes; }
+	// Changed tiles as rects relative to rect, clipped to its size and merged
+	void ChangedRects(DirtyRegion* pRegion) const;
+	// Forgets the hashes, e.g. when the frame last hashed never reached the encoder
+	void Reset() { hashed = false; }
+	HashKernel Kernel() const { return kernel; }
+private:
+	unsigned width;
+	unsigned height;
+	std::vector<uint64_t> hashes;
+	// Column hashes, width per tile row, so the tile rows hashed on the pool never share them
+	std::vector<uint32_t> lanes;
+	TileChangeMap changes;
+	bool hashed = false;
+	ThreadPool* pPool;
+	HashKernel kernel;
+};
@@ -0,0 +1,35 @@
+#include <random>
+#include <vector>
+
+#include <AudioConvert.h>
+#include <BenchTimer.h>
+
+// Ten seconds of 48 kHz float to int16, stereo and 7.1 folded down, dithered, on each kernel
+int main() {
+	const size_t frames = 48000 * 10;
+	const unsigned layouts[] = { 2, 8 };
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> amplitude(-1.0f, 1.0f);
+
+	for (unsigned channels : layouts) {
+		std::vector<float> src(frames * channels);
+		for (float& sample : src) {
+			sample = amplitude(random);
+		}
+		std::vector<int16_t> out(frames * 2);
+
+		const struct { PcmKernel kernel; const char* name; } kernels[] = {
+			{ PCM_KERNEL_SCALAR, "scalar" },
+			{ PCM_KERNEL_SSE2, "sse2" },
+			{ PCM_KERNEL_AVX2, "avx2" }
+		};
+		for (const auto& entry : kernels) {
+			PcmConverter converter(channels, 0, true, entry.kernel);
+			char name[64];
+			snprintf(name, sizeof(name), "pcm %u ch 10 s %s", channels, entry.name);
+			double ms = BestOfMs(10, [&]() { converter.Convert(src.data(), out.data(), frames); });
+			ReportBench(name, ms, (double)src.size() * sizeof(float));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdio.h>
+#include <chrono>
+
+/*
+Timing for the benchmark executables. Each measurement is the best of a few
+runs, the one least disturbed by the rest of the machine
+*/
+template <typename Fn>
+double BestOfMs(int runs, Fn fn) {
+	double best = 0;
+
+	for (int run = 0; run < runs; run++) {
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (run == 0 || ms < best) {
+			best = ms;
+		}
+	}
+	return best;
+}
+
+// One line per measurement, with the throughput over bytes
+inline void ReportBench(const char* name, double ms, double bytes) {
+	printf("%-40s %10.3f ms %10.2f GB/s\n", name, ms, bytes / ms / 1e6);
+}
@@ -0,0 +1,33 @@
+#include <random>
+#include <vector>
+
+#include <BenchTimer.h>
+#include <ColorConvert.h>
+
+// A 1080p BGRA frame to NV12 on each kernel, then on the pool
+int main() {
+	const unsigned width = 1920, height = 1080;
+	std::mt19937 random(1);
+	std::vector<uint8_t> src((size_t)width * height * FRAME_BYTES_PER_PIXEL);
+	for (uint8_t& byte : src) {
+		byte = (uint8_t)random();
+	}
+	std::vector<uint8_t> out((size_t)width * height * 3 / 2);
+	FrameView view = { src.data(), (long)width * FRAME_BYTES_PER_PIXEL, width, height };
+	FrameRect rect = { 0, 0, width, height };
+	YuvPlanes planes = { out.data(), (long)width, out.data() + (size_t)width * height, (long)width, nullptr, 0 };
+	ThreadPool pool;
+
+	const struct { ConvertKernel kernel; ThreadPool* pPool; const char* name; } runs[] = {
+		{ CONVERT_KERNEL_SCALAR, nullptr, "nv12 1080p scalar" },
+		{ CONVERT_KERNEL_SSE41, nullptr, "nv12 1080p sse4.1" },
+		{ CONVERT_KERNEL_AVX2, nullptr, "nv12 1080p avx2" },
+		{ CONVERT_KERNEL_AUTO, &pool, "nv12 1080p auto, pooled" }
+	};
+	for (const auto& run : runs) {
+		ColorConverter converter(COLOR_MATRIX_BT709, COLOR_RANGE_LIMITED, YUV_LAYOUT_NV12, run.pPool, run.kernel);
+		double ms = BestOfMs(20, [&]() { converter.Convert(view, rect, planes); });
+		ReportBench(run.name, ms, (double)src.size());
+	}
+	return 0;
+}
@@ -0,0 +1,47 @@
+#include <vector>
+
+#include <BenchTimer.h>
+#include <FrameScale.h>
+
+// Desktops scaled to the delivered sizes, with each filter on each kernel, then on the pool
+int main() {
+	const struct { unsigned srcWidth, srcHeight, dstWidth, dstHeight; const char* name; } sizes[] = {
+		{ 3840, 2160, 1920, 1080, "4k to 1080p" },
+		{ 3840, 2160, 2560, 1440, "4k to 1440p" },
+		{ 2560, 1080, 1920, 810, "ultrawide to 1080p wide" },
+		{ 1920, 1080, 1280, 720, "1080p to 720p" }
+	};
+	const struct { ScaleFilter filter; const char* name; } filters[] = {
+		{ SCALE_FILTER_BOX, "box" },
+		{ SCALE_FILTER_BILINEAR, "bilinear" },
+		{ SCALE_FILTER_BICUBIC, "bicubic" }
+	};
+	ThreadPool pool;
+	const struct { ScaleKernel kernel; ThreadPool* pPool; const char* name; } runs[] = {
+		{ SCALE_KERNEL_SCALAR, nullptr, "scalar" },
+		{ SCALE_KERNEL_SSE41, nullptr, "sse4.1" },
+		{ SCALE_KERNEL_AVX2, nullptr, "avx2" },
+		{ SCALE_KERNEL_AUTO, &pool, "auto, pooled" }
+	};
+
+	for (const auto& size : sizes) {
+		std::vector<uint8_t> src((size_t)size.srcWidth * size.srcHeight * FRAME_BYTES_PER_PIXEL);
+		for (size_t i = 0; i < src.size(); i++) {
+			src[i] = (uint8_t)(i * 2654435761u >> 13);
+		}
+		std::vector<uint8_t> dest((size_t)size.dstWidth * size.dstHeight * FRAME_BYTES_PER_PIXEL);
+		FrameView view = { src.data(), (long)size.srcWidth * FRAME_BYTES_PER_PIXEL, size.srcWidth, size.srcHeight };
+		FrameRect rect = { 0, 0, size.srcWidth, size.srcHeight };
+
+		for (const auto& filter : filters) {
+			for (const auto& run : runs) {
+				FrameScaler scaler(size.srcWidth, size.srcHeight, size.dstWidth, size.dstHeight, filter.filter, run.pPool, run.kernel);
+				double ms = BestOfMs(5, [&]() { scaler.Scale(view, rect, dest.data(), (long)size.dstWidth * FRAME_BYTES_PER_PIXEL); });
+				char name[64];
+				snprintf(name, sizeof(name), "%s %s %s", size.name, filter.name, run.name);
+				ReportBench(name, ms, (double)src.size());
+			}
+		}
+	}
+	return 0;
+}
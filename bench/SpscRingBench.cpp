@@ -0,0 +1,38 @@
+#include <algorithm>
+#include <thread>
+
+#include <BenchTimer.h>
+#include <SpscRing.h>
+
+// 10 ms packets of 48 kHz stereo 16-bit audio through the ring, producer and consumer on their own threads
+int main() {
+	const size_t packetBytes = 480 * 4;
+	const size_t total = packetBytes * 200000;
+	SpscRing ring(packetBytes * 64);
+
+	double ms = BestOfMs(3, [&]() {
+		std::thread producer([&]() {
+			uint8_t packet[packetBytes] = {};
+			for (size_t written = 0; written < total;) {
+				if (ring.Write(packet, packetBytes)) {
+					written += packetBytes;
+				}
+				else {
+					std::this_thread::yield();
+				}
+			}
+		});
+
+		uint8_t block[4096];
+		for (size_t read = 0; read < total;) {
+			size_t size = ring.Read(block, sizeof(block), 4);
+			read += size;
+			if (size == 0) {
+				std::this_thread::yield();
+			}
+		}
+		producer.join();
+	});
+	ReportBench("spsc ring, 10 ms audio packets", ms, (double)total);
+	return 0;
+}
@@ -0,0 +1,38 @@
+#include <string.h>
+#include <vector>
+
+#include <BenchTimer.h>
+#include <TileHash.h>
+
+// Hashing the tiles of a 4K frame on each kernel, then on the pool, next to comparing it with the previous frame
+int main() {
+	const unsigned width = 3840, height = 2160;
+	std::vector<uint8_t> frame((size_t)width * height * FRAME_BYTES_PER_PIXEL);
+	for (size_t i = 0; i < frame.size(); i++) {
+		frame[i] = (uint8_t)(i * 2654435761u >> 11);
+	}
+	std::vector<uint8_t> previous(frame);
+	FrameView view = { frame.data(), (long)width * FRAME_BYTES_PER_PIXEL, width, height };
+	FrameRect rect = { 0, 0, width, height };
+	ThreadPool pool;
+
+	const struct { HashKernel kernel; ThreadPool* pPool; const char* name; } runs[] = {
+		{ HASH_KERNEL_SCALAR, nullptr, "tile hash 4k scalar" },
+		{ HASH_KERNEL_SSE41, nullptr, "tile hash 4k sse4.1" },
+		{ HASH_KERNEL_AVX2, nullptr, "tile hash 4k avx2" },
+		{ HASH_KERNEL_AUTO, &pool, "tile hash 4k auto, pooled" }
+	};
+	for (const auto& run : runs) {
+		TileChangeDetector detector(width, height, run.pPool, run.kernel);
+		double ms = BestOfMs(20, [&]() { detector.Update(view, rect); });
+		ReportBench(run.name, ms, (double)frame.size());
+	}
+
+	// What keeping the previous frame around instead would cost, on top of its copy
+	volatile int compared = 0;
+	double ms = BestOfMs(20, [&]() { compared += memcmp(frame.data(), previous.data(), frame.size()); });
+	ReportBench("memcmp 4k with the previous frame", ms, (double)frame.size());
+	ms = BestOfMs(20, [&]() { memcpy(previous.data(), frame.data(), frame.size()); });
+	ReportBench("memcpy 4k to keep the previous frame", ms, (double)frame.size());
+	return 0;
+}
@@ -0,0 +1,165 @@
+#include <random>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <BenchTimer.h>
+#include <MuxerHarness.h>
+
+// Output throughput of a mux, in MB/s and TS packets/s
+static void ReportMux(const char* name, double ms, double bytes) {
+	printf("%-40s %10.3f ms %10.2f MB/s %10.0f packets/s\n", name, ms, bytes / ms / 1e3, bytes / 188 / ms * 1e3);
+}
+
+static double OutputBytes(const std::string& dir, const char* extension) {
+	double bytes = 0;
+
+	for (const std::vector<uint8_t>& segment : ReadSegments(dir, extension)) {
+		bytes += (double)segment.size();
+	}
+	return bytes;
+}
+
+#ifdef __linux__
+/*
+Runs the muxer once from a forked child, so that the peak RSS of the child's
+own children, the shell and the muxer, is that of this run alone. Returns the
+time in ms and the peak RSS in MB
+*/
+static bool MeasureRun(const std::string& muxer, const std::string& dir, const std::vector<EnvVar>& env, double* pMs, double* pRssMb) {
+	int fds[2];
+	if (pipe(fds) != 0) {
+		return false;
+	}
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		double result[2];
+		result[0] = BestOfMs(1, [&]() { RunMuxer(muxer, dir, env); });
+		struct rusage usage;
+		getrusage(RUSAGE_CHILDREN, &usage);
+		// Kilobytes on Linux
+		result[1] = usage.ru_maxrss / 1024.0;
+		bool written = write(fds[1], result, sizeof(result)) == sizeof(result);
+		_exit(written ? 0 : 1);
+	}
+	close(fds[1]);
+	double result[2];
+	bool received = pid > 0 && read(fds[0], result, sizeof(result)) == sizeof(result);
+	close(fds[0]);
+	if (pid > 0) {
+		waitpid(pid, NULL, 0);
+	}
+	if (received) {
+		*pMs = result[0];
+		*pRssMb = result[1];
+	}
+	return received;
+}
+
+/*
+Hours of content, the five minutes repeated into a multi-GB input, muxed from
+mapped files then with TSMUX_STREAM_INPUT: a mapping's pages count in the RSS
+as the muxer touches them, the streamed reader holds a few buffers
+*/
+static void BenchLargeInput(const std::string& muxer, const EsStream& video, const EsStream& audio, int repeats) {
+	const std::string dir = "mux-bench-large";
+	MakeDirectory(dir);
+	FILE* videoFile = fopen((dir + "/video.h264").c_str(), "wb");
+	FILE* audioFile = fopen((dir + "/audio.aac").c_str(), "wb");
+	double inputBytes = 0;
+	for (int i = 0; i < repeats && videoFile != NULL && audioFile != NULL; i++) {
+		fwrite(video.data.data(), 1, video.data.size(), videoFile);
+		fwrite(audio.data.data(), 1, audio.data.size(), audioFile);
+		inputBytes += (double)(video.data.size() + audio.data.size());
+	}
+	if (videoFile != NULL) {
+		fclose(videoFile);
+	}
+	if (audioFile != NULL) {
+		fclose(audioFile);
+	}
+
+	const std::vector<EnvVar> env = { { "TSMUX_H264_FILE", "video.h264" }, { "TSMUX_ADTS_FILE", "audio.aac" } };
+	std::vector<EnvVar> streamEnv = env;
+	streamEnv.push_back({ "TSMUX_STREAM_INPUT", "1" });
+	const struct { const std::vector<EnvVar>* pEnv; const char* name; } runs[] = {
+		{ &env, "mapped" },
+		{ &streamEnv, "streamed" }
+	};
+	for (const auto& run : runs) {
+		double ms = 0, rssMb = 0;
+		if (!MeasureRun(muxer, dir, *run.pEnv, &ms, &rssMb)) {
+			continue;
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "ts mux %.1f GB input, %s", inputBytes / 1e9, run.name);
+		printf("%-40s %10.3f ms %10.2f MB/s in %10.1f MB peak RSS\n", name, ms, inputBytes / ms / 1e3, rssMb);
+	}
+
+	// Gigabytes of segments are not worth keeping around
+	for (int index = 0; remove((dir + "/mux-" + std::to_string(index) + ".ts").c_str()) == 0; index++) {
+	}
+	remove((dir + "/video.h264").c_str());
+	remove((dir + "/audio.aac").c_str());
+}
+#endif
+
+/*
+Five minutes of synthetic H.264 and ADTS muxed to TS segments, sequentially
+then in parallel, and to fMP4 for comparison
+*/
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: TsMuxerBench <ts_muxer executable>\n");
+		return 1;
+	}
+	const std::string muxer = argv[1];
+	const std::string dir = "mux-bench";
+	const int pictures = 25 * 300;
+	std::mt19937 random(11);
+
+	MakeDirectory(dir);
+	const EsStream video = SyntheticH264(random, pictures, 1, 8000);
+	const EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures));
+	WriteFileBytes(dir + "/video.h264", video.data);
+	WriteFileBytes(dir + "/audio.aac", audio.data);
+	const std::vector<EnvVar> env = { { "TSMUX_H264_FILE", "video.h264" }, { "TSMUX_ADTS_FILE", "audio.aac" } };
+
+	double tsMs = BestOfMs(3, [&]() { RunMuxer(muxer, dir, env); });
+	double tsBytes = OutputBytes(dir, "ts");
+	ReportMux("ts mux 5 min", tsMs, tsBytes);
+
+	// Parallel mode from 1 to 16 threads, which muxes whole segments on each
+	for (int threads = 1; threads <= 16; threads *= 2) {
+		std::vector<EnvVar> parallelEnv = env;
+		parallelEnv.push_back({ "TSMUX_THREADS", std::to_string(threads) });
+		double ms = BestOfMs(3, [&]() { RunMuxer(muxer, dir, parallelEnv); });
+		char name[64];
+		snprintf(name, sizeof(name), "ts mux 5 min, %d threads (%.2fx)", threads, tsMs / ms);
+		ReportMux(name, ms, OutputBytes(dir, "ts"));
+	}
+
+	// The same content as fMP4. The muxer is single-threaded, its time is its CPU time
+	std::vector<EnvVar> fmp4Env = env;
+	fmp4Env.push_back({ "TSMUX_FORMAT", "fmp4" });
+	double fmp4Ms = BestOfMs(3, [&]() { RunMuxer(muxer, dir, fmp4Env); });
+	std::vector<uint8_t> init;
+	ReadFileBytes(dir + "/init.mp4", &init);
+	double fmp4Bytes = OutputBytes(dir, "m4s") + (double)init.size();
+	const double hours = pictures / 25.0 / 3600;
+	printf("%-40s %10.1f MB/h %10.3f s/h\n", "ts per hour of content", tsBytes / 1e6 / hours, tsMs / 1e3 / hours);
+	printf("%-40s %10.1f MB/h %10.3f s/h %+.1f%% bytes\n", "fmp4 per hour of content", fmp4Bytes / 1e6 / hours, fmp4Ms / 1e3 / hours,
+		(fmp4Bytes / tsBytes - 1) * 100);
+
+#ifdef __linux__
+	// 48 times five minutes, four hours and about 2 GB
+	BenchLargeInput(muxer, video, audio, 48);
+#endif
+	return 0;
+}
@@ -0,0 +1,63 @@
+#include <random>
+#include <vector>
+
+#include <BenchTimer.h>
+#include <MuxerHarness.h>
+#include <ts_scan.h>
+
+// Each start code and the end of its NAL unit, as the muxer walks its input
+static size_t CountNalUnits(const std::vector<uint8_t>& buf) {
+	size_t count = 0;
+
+	for (size_t pos = 0; (pos = ts_scan_start_code(buf.data(), buf.size(), pos)) < buf.size(); count++) {
+		pos = ts_scan_nal_end(buf.data(), buf.size(), pos + 3);
+	}
+	return count;
+}
+
+static size_t CountSyncwords(const std::vector<uint8_t>& buf) {
+	size_t count = 0;
+
+	for (size_t pos = 0; (pos = ts_scan_adts_sync(buf.data(), buf.size(), pos)) < buf.size(); pos += 2) {
+		count++;
+	}
+	return count;
+}
+
+// NAL units in synthetic H.264 and in random bytes, syncwords in synthetic ADTS, on each kernel
+int main() {
+	std::mt19937 random(13);
+	std::vector<uint8_t> h264 = SyntheticH264(random, 25 * 600, 1, 8000).data;
+	std::vector<uint8_t> adts = SyntheticAdts(random, AdtsFramesFor(25 * 600)).data;
+	std::vector<uint8_t> noise(64 << 20);
+	for (uint8_t& byte : noise) {
+		byte = (uint8_t)random();
+	}
+
+	const struct { ts_scan_kernel kernel; const char* name; } kernels[] = {
+		{ TS_SCAN_SCALAR, "scalar" },
+		{ TS_SCAN_SSE2_KERNEL, "sse2" },
+		{ TS_SCAN_AVX2_KERNEL, "avx2" }
+	};
+	for (const auto& entry : kernels) {
+#if TS_SCAN_SSE2
+		if (entry.kernel == TS_SCAN_AVX2_KERNEL && !ts_scan_has_avx2()) {
+			continue;
+		}
+#endif
+		const struct { const char* input; const std::vector<uint8_t>* pData; size_t (*count)(const std::vector<uint8_t>&); } scans[] = {
+			{ "h264 nal units", &h264, CountNalUnits },
+			{ "random nal units", &noise, CountNalUnits },
+			{ "adts syncwords", &adts, CountSyncwords }
+		};
+		ts_scan_set_kernel(entry.kernel);
+		for (const auto& scan : scans) {
+			size_t found = 0;
+			double ms = BestOfMs(5, [&]() { found = scan.count(*scan.pData); });
+			char name[64];
+			snprintf(name, sizeof(name), "%s %s (%zu)", scan.input, entry.name, found);
+			ReportBench(name, ms, (double)scan.pData->size());
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,597 @@
+#pragma once
+
+/*
+	Fragmented MP4 boxes for HLS: an init segment (ftyp + moov with a video and
+	an audio track) and media fragments (moof + mdat).
+
+	Boxes are built in a growable buffer. A box is opened with its type and a
+	placeholder size, which fmp4_box_end patches once the content is written.
+	Video samples are AVCC (4 byte lengths), audio samples raw AAC.
+*/
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FMP4_VIDEO_TRACK_ID 1
+#define FMP4_AUDIO_TRACK_ID 2
+#define FMP4_SPS_MAX_SIZE 512
+
+// Sample flags: a sync sample depends on no other; other samples are not sync samples
+#define FMP4_SYNC_SAMPLE_FLAGS 0x02000000
+#define FMP4_NON_SYNC_SAMPLE_FLAGS 0x01010000
+
+typedef struct {
+	unsigned char* data;
+	size_t size;
+	size_t capacity;
+} fmp4_buffer;
+
+typedef struct {
+	const unsigned char* sps; // NAL units without start code
+	size_t sps_size;
+	const unsigned char* pps;
+	size_t pps_size;
+	uint32_t timescale;
+} fmp4_video_config;
+
+typedef struct {
+	unsigned char specific_config[2]; // AudioSpecificConfig
+	uint32_t sample_rate;
+	int channels;
+} fmp4_audio_config;
+
+typedef struct {
+	uint32_t size;
+	uint32_t duration;
+	uint32_t flags;
+} fmp4_sample;
+
+// The samples of one track in a fragment, stored back to back in the mdat
+typedef struct {
+	uint32_t track_id;
+	uint64_t base_decode_time;
+	const fmp4_sample* samples;
+	int sample_count;
+	uint32_t default_duration; // 0: every sample carries its duration
+	bool sample_flags;         // every sample carries its flags, else the trex default applies
+	size_t data_size;
+} fmp4_run;
+
+static void fmp4_reserve(fmp4_buffer* buf, size_t size) {
+	if (buf->size + size <= buf->capacity) {
+		return;
+	}
+	buf->capacity = buf->capacity * 2 > buf->size + size ? buf->capacity * 2 : buf->size + size;
+	buf->data = (unsigned char*)realloc(buf->data, buf->capacity);
+}
+
+static void fmp4_put_bytes(fmp4_buffer* buf, const void* src, size_t size) {
+	fmp4_reserve(buf, size);
+	memcpy(buf->data + buf->size, src, size);
+	buf->size += size;
+}
+
+static void fmp4_put_zeros(fmp4_buffer* buf, size_t size) {
+	fmp4_reserve(buf, size);
+	memset(buf->data + buf->size, 0, size);
+	buf->size += size;
+}
+
+static void fmp4_put_u8(fmp4_buffer* buf, unsigned value) {
+	unsigned char b = (unsigned char)value;
+	fmp4_put_bytes(buf, &b, 1);
+}
+
+static void fmp4_put_u16(fmp4_buffer* buf, unsigned value) {
+	unsigned char b[2] = { (unsigned char)(value >> 8), (unsigned char)value };
+	fmp4_put_bytes(buf, b, 2);
+}
+
+static void fmp4_put_u24(fmp4_buffer* buf, uint32_t value) {
+	unsigned char b[3] = { (unsigned char)(value >> 16), (unsigned char)(value >> 8), (unsigned char)value };
+	fmp4_put_bytes(buf, b, 3);
+}
+
+static void fmp4_set_u32(unsigned char* dest, uint32_t value) {
+	dest[0] = (unsigned char)(value >> 24);
+	dest[1] = (unsigned char)(value >> 16);
+	dest[2] = (unsigned char)(value >> 8);
+	dest[3] = (unsigned char)value;
+}
+
+static void fmp4_put_u32(fmp4_buffer* buf, uint32_t value) {
+	fmp4_reserve(buf, 4);
+	fmp4_set_u32(buf->data + buf->size, value);
+	buf->size += 4;
+}
+
+static void fmp4_put_u64(fmp4_buffer* buf, uint64_t value) {
+	fmp4_put_u32(buf, (uint32_t)(value >> 32));
+	fmp4_put_u32(buf, (uint32_t)value);
+}
+
+// Returns where the box starts, for fmp4_box_end
+static size_t fmp4_box_begin(fmp4_buffer* buf, const char* type) {
+	size_t start = buf->size;
+	fmp4_put_u32(buf, 0);
+	fmp4_put_bytes(buf, type, 4);
+	return start;
+}
+
+static size_t fmp4_full_box_begin(fmp4_buffer* buf, const char* type, unsigned version, uint32_t flags) {
+	size_t start = fmp4_box_begin(buf, type);
+	fmp4_put_u8(buf, version);
+	fmp4_put_u24(buf, flags);
+	return start;
+}
+
+static void fmp4_box_end(fmp4_buffer* buf, size_t start) {
+	fmp4_set_u32(buf->data + start, (uint32_t)(buf->size - start));
+}
+
+/*
+	Exp-Golomb reader over an SPS with its emulation prevention bytes removed.
+	Reads past the end return zeros
+*/
+typedef struct {
+	unsigned char rbsp[FMP4_SPS_MAX_SIZE];
+	size_t size;
+	size_t bit;
+} fmp4_bit_reader;
+
+static unsigned fmp4_read_bit(fmp4_bit_reader* reader) {
+	if (reader->bit >= reader->size * 8) {
+		return 0;
+	}
+	unsigned bit = (reader->rbsp[reader->bit / 8] >> (7 - reader->bit % 8)) & 1;
+	reader->bit += 1;
+	return bit;
+}
+
+static uint32_t fmp4_read_bits(fmp4_bit_reader* reader, int count) {
+	uint32_t value = 0;
+	for (int i = 0; i < count; i++) {
+		value = (value << 1) | fmp4_read_bit(reader);
+	}
+	return value;
+}
+
+static uint32_t fmp4_read_ue(fmp4_bit_reader* reader) {
+	int zeros = 0;
+	while (fmp4_read_bit(reader) == 0 && zeros < 32) {
+		if (reader->bit >= reader->size * 8) {
+			return 0;
+		}
+		zeros++;
+	}
+	return (uint32_t)((1ull << zeros) - 1 + fmp4_read_bits(reader, zeros));
+}
+
+static int32_t fmp4_read_se(fmp4_bit_reader* reader) {
+	uint32_t code = fmp4_read_ue(reader);
+	return (code & 1) ? (int32_t)((code + 1) / 2) : -(int32_t)(code / 2);
+}
+
+typedef struct {
+	unsigned profile_idc;
+	unsigned chroma_format_idc;
+	unsigned bit_depth_luma;
+	unsigned bit_depth_chroma;
+	unsigned width;
+	unsigned height;
+} fmp4_sps_info;
+
+/*
+	Reads what the sample entry needs from an SPS (NAL header included): the
+	profile, chroma format and bit depths for avcC, and the cropped picture size
+*/
+static bool fmp4_parse_sps(const unsigned char* sps, size_t size, fmp4_sps_info* info) {
+	fmp4_bit_reader reader = { .size = 0, .bit = 0 };
+	int zeros = 0;
+
+	for (size_t i = 1; i < size && reader.size < FMP4_SPS_MAX_SIZE; i++) {
+		if (zeros >= 2 && sps[i] == 0x03) {
+			zeros = 0;
+			continue;
+		}
+		zeros = sps[i] == 0 ? zeros + 1 : 0;
+		reader.rbsp[reader.size++] = sps[i];
+	}
+	if (reader.size < 4) {
+		return false;
+	}
+
+	info->profile_idc = fmp4_read_bits(&reader, 8);
+	fmp4_read_bits(&reader, 16); // constraint flags, level_idc
+	fmp4_read_ue(&reader);       // seq_parameter_set_id
+
+	info->chroma_format_idc = 1;
+	info->bit_depth_luma = 8;
+	info->bit_depth_chroma = 8;
+	unsigned profile = info->profile_idc;
+	if (
+		profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+		profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138 ||
+		profile == 139 || profile == 134 || profile == 135
+	) {
+		info->chroma_format_idc = fmp4_read_ue(&reader);
+		if (info->chroma_format_idc == 3) {
+			fmp4_read_bit(&reader); // separate_colour_plane_flag
+		}
+		info->bit_depth_luma = 8 + fmp4_read_ue(&reader);
+		info->bit_depth_chroma = 8 + fmp4_read_ue(&reader);
+		fmp4_read_bit(&reader); // qpprime_y_zero_transform_bypass_flag
+		if (fmp4_read_bit(&reader)) {
+			// seq_scaling_matrix_present_flag: skip the scaling lists
+			int lists = info->chroma_format_idc != 3 ? 8 : 12;
+			for (int i = 0; i < lists; i++) {
+				if (!fmp4_read_bit(&reader)) {
+					continue;
+				}
+				int last = 8, next = 8, count = i < 6 ? 16 : 64;
+				for (int j = 0; j < count && next != 0; j++) {
+					next = (last + fmp4_read_se(&reader) + 256) % 256;
+					last = next == 0 ? last : next;
+				}
+			}
+		}
+	}
+
+	fmp4_read_ue(&reader); // log2_max_frame_num_minus4
+	uint32_t poc_type = fmp4_read_ue(&reader);
+	if (poc_type == 0) {
+		fmp4_read_ue(&reader); // log2_max_pic_order_cnt_lsb_minus4
+	} else if (poc_type == 1) {
+		fmp4_read_bit(&reader);
+		fmp4_read_se(&reader);
+		fmp4_read_se(&reader);
+		uint32_t cycle = fmp4_read_ue(&reader);
+		for (uint32_t i = 0; i < cycle && i < 256; i++) {
+			fmp4_read_se(&reader);
+		}
+	}
+	fmp4_read_ue(&reader); // max_num_ref_frames
+	fmp4_read_bit(&reader); // gaps_in_frame_num_value_allowed_flag
+
+	uint32_t width_mbs = fmp4_read_ue(&reader) + 1;
+	uint32_t height_map_units = fmp4_read_ue(&reader) + 1;
+	uint32_t frame_mbs_only = fmp4_read_bit(&reader);
+	if (!frame_mbs_only) {
+		fmp4_read_bit(&reader); // mb_adaptive_frame_field_flag
+	}
+	fmp4_read_bit(&reader); // direct_8x8_inference_flag
+
+	uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+	if (fmp4_read_bit(&reader)) {
+		crop_left = fmp4_read_ue(&reader);
+		crop_right = fmp4_read_ue(&reader);
+		crop_top = fmp4_read_ue(&reader);
+		crop_bottom = fmp4_read_ue(&reader);
+	}
+
+	if (width_mbs > 1024 || height_map_units > 1024) {
+		return false;
+	}
+
+	// Crop units are chroma samples, and field pairs when coded as fields
+	uint32_t crop_x = info->chroma_format_idc == 0 || info->chroma_format_idc == 3 ? 1 : 2;
+	uint32_t crop_y = (info->chroma_format_idc == 1 ? 2 : 1) * (2 - frame_mbs_only);
+	uint32_t width = width_mbs * 16;
+	uint32_t height = height_map_units * 16 * (2 - frame_mbs_only);
+
+	if ((crop_left + crop_right) * crop_x >= width || (crop_top + crop_bottom) * crop_y >= height) {
+		return false;
+	}
+	info->width = width - (crop_left + crop_right) * crop_x;
+	info->height = height - (crop_top + crop_bottom) * crop_y;
+	return true;
+}
+
+static const uint32_t fmp4_adts_sample_rates[16] = {
+	96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350, 0, 0, 0
+};
+
+// Builds the AudioSpecificConfig from the fields of an ADTS header
+static bool fmp4_audio_config_from_adts(const unsigned char* header, fmp4_audio_config* config) {
+	unsigned object_type = (header[2] >> 6) + 1;
+	unsigned rate_index = (header[2] >> 2) & 0x0f;
+	unsigned channel_config = ((header[2] & 0x01) << 2) | (header[3] >> 6);
+
+	if (fmp4_adts_sample_rates[rate_index] == 0) {
+		return false;
+	}
+
+	config->specific_config[0] = (unsigned char)((object_type << 3) | (rate_index >> 1));
+	config->specific_config[1] = (unsigned char)(((rate_index & 1) << 7) | (channel_config << 3));
+	config->sample_rate = fmp4_adts_sample_rates[rate_index];
+	config->channels = channel_config == 7 ? 8 : (int)channel_config;
+	return true;
+}
+
+static void fmp4_put_matrix(fmp4_buffer* buf) {
+	static const uint32_t unity[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+	for (int i = 0; i < 9; i++) {
+		fmp4_put_u32(buf, unity[i]);
+	}
+}
+
+static void fmp4_put_tkhd(fmp4_buffer* buf, uint32_t track_id, bool audio, unsigned width, unsigned height) {
+	size_t box = fmp4_full_box_begin(buf, "tkhd", 0, 0x000003); // enabled, in movie
+	fmp4_put_zeros(buf, 8);        // creation, modification time
+	fmp4_put_u32(buf, track_id);
+	fmp4_put_zeros(buf, 4 + 4 + 8); // reserved, duration, reserved
+	fmp4_put_u16(buf, 0);          // layer
+	fmp4_put_u16(buf, 0);          // alternate_group
+	fmp4_put_u16(buf, audio ? 0x0100 : 0);
+	fmp4_put_u16(buf, 0);
+	fmp4_put_matrix(buf);
+	fmp4_put_u32(buf, width << 16);
+	fmp4_put_u32(buf, height << 16);
+	fmp4_box_end(buf, box);
+}
+
+static void fmp4_put_mdhd_hdlr(fmp4_buffer* buf, uint32_t timescale, const char* handler, const char* name) {
+	size_t box = fmp4_full_box_begin(buf, "mdhd", 0, 0);
+	fmp4_put_zeros(buf, 8);
+	fmp4_put_u32(buf, timescale);
+	fmp4_put_u32(buf, 0);
+	fmp4_put_u16(buf, 0x55c4); // "und"
+	fmp4_put_u16(buf, 0);
+	fmp4_box_end(buf, box);
+
+	box = fmp4_full_box_begin(buf, "hdlr", 0, 0);
+	fmp4_put_u32(buf, 0);
+	fmp4_put_bytes(buf, handler, 4);
+	fmp4_put_zeros(buf, 12);
+	fmp4_put_bytes(buf, name, strlen(name) + 1);
+	fmp4_box_end(buf, box);
+}
+
+// Fragmented tracks keep their sample tables empty: the samples are in the fragments
+static void fmp4_put_empty_sample_tables(fmp4_buffer* buf) {
+	size_t box = fmp4_full_box_begin(buf, "stts", 0, 0);
+	fmp4_put_u32(buf, 0);
+	fmp4_box_end(buf, box);
+	box = fmp4_full_box_begin(buf, "stsc", 0, 0);
+	fmp4_put_u32(buf, 0);
+	fmp4_box_end(buf, box);
+	box = fmp4_full_box_begin(buf, "stsz", 0, 0);
+	fmp4_put_u32(buf, 0);
+	fmp4_put_u32(buf, 0);
+	fmp4_box_end(buf, box);
+	box = fmp4_full_box_begin(buf, "stco", 0, 0);
+	fmp4_put_u32(buf, 0);
+	fmp4_box_end(buf, box);
+}
+
+static void fmp4_put_dinf(fmp4_buffer* buf) {
+	size_t dinf = fmp4_box_begin(buf, "dinf");
+	size_t dref = fmp4_full_box_begin(buf, "dref", 0, 0);
+	fmp4_put_u32(buf, 1);
+	size_t url = fmp4_full_box_begin(buf, "url ", 0, 0x000001); // media in the same file
+	fmp4_box_end(buf, url);
+	fmp4_box_end(buf, dref);
+	fmp4_box_end(buf, dinf);
+}
+
+static void fmp4_put_avc1(fmp4_buffer* buf, const fmp4_video_config* video, const fmp4_sps_info* info) {
+	size_t entry = fmp4_box_begin(buf, "avc1");
+	fmp4_put_zeros(buf, 6);
+	fmp4_put_u16(buf, 1); // data_reference_index
+	fmp4_put_zeros(buf, 16);
+	fmp4_put_u16(buf, info->width);
+	fmp4_put_u16(buf, info->height);
+	fmp4_put_u32(buf, 0x00480000); // 72 dpi
+	fmp4_put_u32(buf, 0x00480000);
+	fmp4_put_u32(buf, 0);
+	fmp4_put_u16(buf, 1);  // frame_count
+	fmp4_put_zeros(buf, 32); // compressorname
+	fmp4_put_u16(buf, 0x0018);
+	fmp4_put_u16(buf, 0xffff);
+
+	size_t avcc = fmp4_box_begin(buf, "avcC");
+	fmp4_put_u8(buf, 1);
+	fmp4_put_bytes(buf, video->sps + 1, 3); // profile, compatibility, level
+	fmp4_put_u8(buf, 0xfc | 3);             // 4 byte NAL unit lengths
+	fmp4_put_u8(buf, 0xe0 | 1);
+	fmp4_put_u16(buf, (unsigned)video->sps_size);
+	fmp4_put_bytes(buf, video->sps, video->sps_size);
+	fmp4_put_u8(buf, 1);
+	fmp4_put_u16(buf, (unsigned)video->pps_size);
+	fmp4_put_bytes(buf, video->pps, video->pps_size);
+	if (info->profile_idc == 100 || info->profile_idc == 110 || info->profile_idc == 122 || info->profile_idc == 144) {
+		fmp4_put_u8(buf, 0xfc | info->chroma_format_idc);
+		fmp4_put_u8(buf, 0xf8 | (info->bit_depth_luma - 8));
+		fmp4_put_u8(buf, 0xf8 | (info->bit_depth_chroma - 8));
+		fmp4_put_u8(buf, 0); // no SPS extensions
+	}
+	fmp4_box_end(buf, avcc);
+	fmp4_box_end(buf, entry);
+}
+
+static void fmp4_put_mp4a(fmp4_buffer* buf, const fmp4_audio_config* audio) {
+	size_t entry = fmp4_box_begin(buf, "mp4a");
+	fmp4_put_zeros(buf, 6);
+	fmp4_put_u16(buf, 1);
+	fmp4_put_zeros(buf, 8);
+	fmp4_put_u16(buf, (unsigned)audio->channels);
+	fmp4_put_u16(buf, 16);
+	fmp4_put_u32(buf, 0);
+	fmp4_put_u32(buf, audio->sample_rate << 16);
+
+	// ES_Descriptor > DecoderConfigDescriptor > DecoderSpecificInfo, SLConfigDescriptor
+	size_t esds = fmp4_full_box_begin(buf, "esds", 0, 0);
+	fmp4_put_u8(buf, 0x03);
+	fmp4_put_u8(buf, 3 + 2 + 13 + 2 + 2 + 3);
+	fmp4_put_u16(buf, 0);   // ES_ID
+	fmp4_put_u8(buf, 0);
+	fmp4_put_u8(buf, 0x04);
+	fmp4_put_u8(buf, 13 + 2 + 2);
+	fmp4_put_u8(buf, 0x40); // MPEG-4 audio
+	fmp4_put_u8(buf, 0x15); // audio stream
+	fmp4_put_u24(buf, 0);   // bufferSizeDB
+	fmp4_put_u32(buf, 0);   // maxBitrate
+	fmp4_put_u32(buf, 0);   // avgBitrate
+	fmp4_put_u8(buf, 0x05);
+	fmp4_put_u8(buf, 2);
+	fmp4_put_bytes(buf, audio->specific_config, 2);
+	fmp4_put_u8(buf, 0x06);
+	fmp4_put_u8(buf, 1);
+	fmp4_put_u8(buf, 0x02);
+	fmp4_box_end(buf, esds);
+	fmp4_box_end(buf, entry);
+}
+
+static void fmp4_put_trak(fmp4_buffer* buf, const fmp4_video_config* video, const fmp4_sps_info* info, const fmp4_audio_config* audio) {
+	size_t trak = fmp4_box_begin(buf, "trak");
+	fmp4_put_tkhd(buf, video ? FMP4_VIDEO_TRACK_ID : FMP4_AUDIO_TRACK_ID, video == NULL, video ? info->width : 0, video ? info->height : 0);
+
+	size_t mdia = fmp4_box_begin(buf, "mdia");
+	if (video) {
+		fmp4_put_mdhd_hdlr(buf, video->timescale, "vide", "VideoHandler");
+	} else {
+		fmp4_put_mdhd_hdlr(buf, audio->sample_rate, "soun", "SoundHandler");
+	}
+
+	size_t minf = fmp4_box_begin(buf, "minf");
+	if (video) {
+		size_t vmhd = fmp4_full_box_begin(buf, "vmhd", 0, 0x000001);
+		fmp4_put_zeros(buf, 8);
+		fmp4_box_end(buf, vmhd);
+	} else {
+		size_t smhd = fmp4_full_box_begin(buf, "smhd", 0, 0);
+		fmp4_put_zeros(buf, 4);
+		fmp4_box_end(buf, smhd);
+	}
+	fmp4_put_dinf(buf);
+
+	size_t stbl = fmp4_box_begin(buf, "stbl");
+	size_t stsd = fmp4_full_box_begin(buf, "stsd", 0, 0);
+	fmp4_put_u32(buf, 1);
+	if (video) {
+		fmp4_put_avc1(buf, video, info);
+	} else {
+		fmp4_put_mp4a(buf, audio);
+	}
+	fmp4_box_end(buf, stsd);
+	fmp4_put_empty_sample_tables(buf);
+	fmp4_box_end(buf, stbl);
+
+	fmp4_box_end(buf, minf);
+	fmp4_box_end(buf, mdia);
+	fmp4_box_end(buf, trak);
+}
+
+static void fmp4_put_trex(fmp4_buffer* buf, uint32_t track_id, uint32_t default_flags) {
+	size_t trex = fmp4_full_box_begin(buf, "trex", 0, 0);
+	fmp4_put_u32(buf, track_id);
+	fmp4_put_u32(buf, 1); // default_sample_description_index
+	fmp4_put_u32(buf, 0);
+	fmp4_put_u32(buf, 0);
+	fmp4_put_u32(buf, default_flags);
+	fmp4_box_end(buf, trex);
+}
+
+// ftyp + moov, without an audio track when audio is NULL. Fails when the SPS cannot be parsed
+static bool fmp4_write_init(fmp4_buffer* buf, const fmp4_video_config* video, const fmp4_audio_config* audio) {
+	fmp4_sps_info info;
+	if (!fmp4_parse_sps(video->sps, video->sps_size, &info)) {
+		return false;
+	}
+
+	size_t ftyp = fmp4_box_begin(buf, "ftyp");
+	fmp4_put_bytes(buf, "iso6", 4);
+	fmp4_put_u32(buf, 0);
+	fmp4_put_bytes(buf, "iso6mp41", 8);
+	fmp4_box_end(buf, ftyp);
+
+	size_t moov = fmp4_box_begin(buf, "moov");
+	size_t mvhd = fmp4_full_box_begin(buf, "mvhd", 0, 0);
+	fmp4_put_zeros(buf, 8);
+	fmp4_put_u32(buf, 1000); // timescale
+	fmp4_put_u32(buf, 0);    // duration: unknown, the movie is fragmented
+	fmp4_put_u32(buf, 0x00010000);
+	fmp4_put_u16(buf, 0x0100);
+	fmp4_put_zeros(buf, 10);
+	fmp4_put_matrix(buf);
+	fmp4_put_zeros(buf, 24);
+	fmp4_put_u32(buf, FMP4_AUDIO_TRACK_ID + 1); // next_track_ID
+	fmp4_box_end(buf, mvhd);
+
+	fmp4_put_trak(buf, video, &info, NULL);
+	if (audio) {
+		fmp4_put_trak(buf, NULL, NULL, audio);
+	}
+
+	size_t mvex = fmp4_box_begin(buf, "mvex");
+	fmp4_put_trex(buf, FMP4_VIDEO_TRACK_ID, FMP4_NON_SYNC_SAMPLE_FLAGS);
+	if (audio) {
+		fmp4_put_trex(buf, FMP4_AUDIO_TRACK_ID, FMP4_SYNC_SAMPLE_FLAGS);
+	}
+	fmp4_box_end(buf, mvex);
+	fmp4_box_end(buf, moov);
+	return true;
+}
+
+/*
+	moof for the runs, followed by the mdat header. The caller writes the run
+	data after it in the same order
+*/
+static void fmp4_write_fragment_header(fmp4_buffer* buf, uint32_t sequence, const fmp4_run* runs, int run_count) {
+	size_t data_offset_at[2];
+	size_t moof = fmp4_box_begin(buf, "moof");
+	size_t mfhd = fmp4_full_box_begin(buf, "mfhd", 0, 0);
+	fmp4_put_u32(buf, sequence);
+	fmp4_box_end(buf, mfhd);
+
+	for (int r = 0; r < run_count && r < 2; r++) {
+		const fmp4_run* run = &runs[r];
+		size_t traf = fmp4_box_begin(buf, "traf");
+
+		// default-base-is-moof, and a default duration when the run has one
+		size_t tfhd = fmp4_full_box_begin(buf, "tfhd", 0, 0x020000 | (run->default_duration ? 0x000008 : 0));
+		fmp4_put_u32(buf, run->track_id);
+		if (run->default_duration) {
+			fmp4_put_u32(buf, run->default_duration);
+		}
+		fmp4_box_end(buf, tfhd);
+
+		size_t tfdt = fmp4_full_box_begin(buf, "tfdt", 1, 0);
+		fmp4_put_u64(buf, run->base_decode_time);
+		fmp4_box_end(buf, tfdt);
+
+		// data offset, sample size, and the per-sample duration and flags in use
+		uint32_t trun_flags = 0x000001 | 0x000200 | (run->default_duration ? 0 : 0x000100) | (run->sample_flags ? 0x000400 : 0);
+		size_t trun = fmp4_full_box_begin(buf, "trun", 0, trun_flags);
+		fmp4_put_u32(buf, (uint32_t)run->sample_count);
+		data_offset_at[r] = buf->size;
+		fmp4_put_u32(buf, 0);
+		for (int i = 0; i < run->sample_count; i++) {
+			if (!run->default_duration) {
+				fmp4_put_u32(buf, run->samples[i].duration);
+			}
+			fmp4_put_u32(buf, run->samples[i].size);
+			if (run->sample_flags) {
+				fmp4_put_u32(buf, run->samples[i].flags);
+			}
+		}
+		fmp4_box_end(buf, trun);
+		fmp4_box_end(buf, traf);
+	}
+	fmp4_box_end(buf, moof);
+
+	// Data offsets count from the start of the moof, past the mdat header
+	size_t data_size = 0;
+	size_t offset = buf->size - moof + 8;
+	for (int r = 0; r < run_count && r < 2; r++) {
+		fmp4_set_u32(buf->data + data_offset_at[r], (uint32_t)offset);
+		offset += runs[r].data_size;
+		data_size += runs[r].data_size;
+	}
+
+	fmp4_put_u32(buf, (uint32_t)(8 + data_size));
+	fmp4_put_bytes(buf, "mdat", 4);
+}
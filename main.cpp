@@ -3,106 +3,360 @@
 #include <thread>
 #include <iostream>
 
+#include <atomic>
 #include <chrono>
+#include <fstream>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <DXGISource.h>
+#include <FrameScheduler.h>
+#include <Interleaver.h>
 #include <LoopbackSource.h>
 #include <MediaWriter.h>
+#include <PipelineMetrics.h>
+#include <PresentationClock.h>
+#include <ReplaySource.h>
+#include <SyntheticSource.h>
+#include <TileHash.h>
 
-LONGLONG globalAudioDuration = 0;
-LONGLONG globalVideoDuration = 0;
+// Seconds of audio the capture thread can queue ahead of the writer thread
+#define AUDIO_RING_SECONDS 2
+#define AUDIO_WRITER_POLL_MS 5
+// Longest a stream waits for the other one before its samples are written anyway
+#define AV_REORDER_WINDOW_MS 100
+// Format of synthetic and replayed audio
+#define GENERATED_AUDIO_SAMPLE_RATE 48000
+#define GENERATED_AUDIO_CHANNELS 2
+// Pipeline metrics are appended to LOOM_METRICS_FILE (METRICS_DEFAULT_FILE when unset, nowhere when empty) every interval
+#define METRICS_REPORT_INTERVAL_MS 1000
+#define METRICS_DEFAULT_FILE "metrics.jsonl"
 
-void audioCaptureProc(BOOL *pActive, MediaWriter* pMediaWriter, LoopbackSource* pAudioSource) {
-	BYTE* pData = nullptr;
-	BYTE* pSilenceData = nullptr;
-	REFERENCE_TIME bufferActualDuration, fullBufferDuration;
-	UINT32 fullBufferSize = pAudioSource->pwfx->wBitsPerSample * pAudioSource->bufferFrameCount * pAudioSource->pwfx->nChannels / 8;
+// Timeline position of the first frame in the audio ring, until it is known
+const int64_t AUDIO_START_UNKNOWN = INT64_MIN;
 
-	fullBufferDuration = (double)REFTIMES_PER_SEC * pAudioSource->bufferFrameCount / pAudioSource->pwfx->nSamplesPerSec;
-	pSilenceData = new BYTE[fullBufferSize];
-	memset(pSilenceData, 0xff, fullBufferSize);
+/*
+Orders audio and video samples by presentation time before they reach the sink writer.
+A null video sample stands for a frame identical to the previous one
+*/
+typedef Interleaver<IMFSample*> SampleInterleaver;
+
+/*
+Capture backends are chosen with environment variables, so the pipeline can
+run without a desktop or an audio endpoint:
+	LOOM_VIDEO_SOURCE	dxgi (default), synthetic, or the path of a raw BGRA file
+	LOOM_AUDIO_SOURCE	loopback (default), synthetic, or the path of a raw 16-bit PCM file
+Synthetic and replayed frames cover the captured region; their audio is
+GENERATED_AUDIO_SAMPLE_RATE stereo. Both return nullptr when the source fails
+*/
+VideoSource* createVideoSource(const VideoEncodeOpts* pVideoOpts) {
+	const char* name = getenv("LOOM_VIDEO_SOURCE");
+	unsigned width = pVideoOpts->width + (pVideoOpts->fullscreen ? 0 : pVideoOpts->screenOffsetX);
+	unsigned height = pVideoOpts->height + (pVideoOpts->fullscreen ? 0 : pVideoOpts->screenOffsetY);
+
+	try {
+		if (name == nullptr || strcmp(name, "dxgi") == 0) {
+			return new DXGISource();
+		}
+		if (strcmp(name, "synthetic") == 0) {
+			return new SyntheticVideoSource(width, height, pVideoOpts->fps);
+		}
+		return new ReplayVideoSource(name, width, height);
+	} catch (const std::exception& e) {
+		ERR(L"Failed to initialize the video source: %hs", e.what());
+		return nullptr;
+	}
+}
+
+AudioSource* createAudioSource() {
+	const char* name = getenv("LOOM_AUDIO_SOURCE");
+
+	try {
+		if (name == nullptr || strcmp(name, "loopback") == 0) {
+			return new LoopbackSource();
+		}
+		if (strcmp(name, "synthetic") == 0) {
+			return new SyntheticAudioSource(GENERATED_AUDIO_SAMPLE_RATE, GENERATED_AUDIO_CHANNELS);
+		}
+		return new ReplayAudioSource(name, GENERATED_AUDIO_SAMPLE_RATE, GENERATED_AUDIO_CHANNELS);
+	} catch (const std::exception& e) {
+		ERR(L"Failed to initialize the audio source: %hs", e.what());
+		return nullptr;
+	}
+}
+
+/*
+Recording below the captured resolution is set with environment variables too:
+	LOOM_OUTPUT_SIZE	WxH of the encoded video; unset encodes the captured region as is
+	LOOM_SCALE_FILTER	box, bilinear (DEFAULT_SCALE_FILTER) or bicubic
+The encoder needs even dimensions, so odd ones are rounded down
+*/
+void applyOutputSize(VideoEncodeOpts* pVideoOpts) {
+	const char* size = getenv("LOOM_OUTPUT_SIZE");
+	const char* filter = getenv("LOOM_SCALE_FILTER");
+	unsigned width = 0;
+	unsigned height = 0;
+
+	if (size != nullptr && (sscanf(size, "%ux%u", &width, &height) != 2 || width < 2 || height < 2)) {
+		ERR(L"Ignoring LOOM_OUTPUT_SIZE %hs, expected WxH", size);
+		width = height = 0;
+	}
+	pVideoOpts->outputWidth = width & ~1u;
+	pVideoOpts->outputHeight = height & ~1u;
+
+	if (filter == nullptr) {
+		pVideoOpts->scaleFilter = DEFAULT_SCALE_FILTER;
+	}
+	else if (strcmp(filter, "bilinear") == 0) {
+		pVideoOpts->scaleFilter = SCALE_FILTER_BILINEAR;
+	}
+	else if (strcmp(filter, "box") == 0) {
+		pVideoOpts->scaleFilter = SCALE_FILTER_BOX;
+	}
+	else if (strcmp(filter, "bicubic") == 0) {
+		pVideoOpts->scaleFilter = SCALE_FILTER_BICUBIC;
+	}
+	else {
+		ERR(L"Unknown LOOM_SCALE_FILTER %hs, using the default filter", filter);
+		pVideoOpts->scaleFilter = DEFAULT_SCALE_FILTER;
+	}
+}
+
+/*
+Moves captured packets into the ring as fast as they arrive. When the endpoint
+plays nothing, loopback capture delivers no packets, so silence is queued for
+the time the ring lacks once it is older than a buffer: a playing endpoint
+would have delivered it by then. The rest of a gap is filled by the source
+from the device position of the packet that ends it.
+The ring holds a gapless run of frames: pAudioStart receives the timeline
+position of its first frame, taken from the device QPC position of the first
+packet, or from the clock when silence comes first
+*/
+void audioCaptureProc(BOOL *pActive, SpscRing* pRing, AudioSource* pAudioSource, const PresentationClock* pClock, std::atomic<int64_t>* pAudioStart, PipelineMetrics* pMetrics) {
+	const WAVEFORMATEX* pwfx = pAudioSource->pwfx;
+	REFERENCE_TIME fullBufferDuration = (double)REFTIMES_PER_SEC * pAudioSource->bufferFrameCount / pwfx->nSamplesPerSec;
+	// The ring ends ringFrames after ringAnchor on the timeline
+	int64_t ringAnchor = 0;
+	unsigned long long ringFrames = 0;
 
 	if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST)) {
 		ERR("failed to set thread priority: %d", GetLastError());
 	}
 
 	while (*pActive) {
-		/*
-		Do not capture audio stream if video stream is behind
-		MediaFoundation SinkWriter expects audio and video writes to be interleaved
-		*/
-		if (globalAudioDuration >= globalVideoDuration) {
-			continue;
-		}
+		UINT64 qpcPosition = 0;
+		bool started = pAudioStart->load(std::memory_order_relaxed) != AUDIO_START_UNKNOWN;
+		int64_t ringEnd = ringAnchor + (int64_t)(ringFrames * REFTIMES_PER_SEC / pwfx->nSamplesPerSec);
+		int64_t captureStartNs = PipelineMetrics::NowNs();
+		pAudioSource->ringEndQpc = started ? pClock->ToQpcPosition(ringEnd) : 0;
+		pAudioSource->NextFrame(pRing, &qpcPosition);
 
-		pAudioSource->NextFrame(&pData);
-		if (pAudioSource->nNextPacketSize == 0) {
-			// Write "silence"
-			// 0xff means absence of sound 8-bit PCM: https://en.wikipedia.org/wiki/%CE%9C-law_algorithm
-			pMediaWriter->WriteAudioFrame(pAudioSource->pwfx, pSilenceData, pAudioSource->numFramesRead, fullBufferDuration);
-			globalAudioDuration += fullBufferDuration;
-			Sleep(fullBufferDuration / REFTIMES_PER_MILLISEC / 2);
-			continue;
+		if (pAudioSource->numFramesRead > 0) {
+			pMetrics->Record(STAGE_AUDIO_CAPTURE, (uint64_t)(PipelineMetrics::NowNs() - captureStartNs));
+			int64_t packetStart = pClock->FromQpcPosition(qpcPosition);
+			if (!started) {
+				pAudioStart->store(packetStart > 0 ? packetStart : 0, std::memory_order_release);
+			}
+			// Any gap before the packets was filled by the source
+			ringAnchor = packetStart;
+			ringFrames = pAudioSource->numFramesRead;
 		}
-
-		while (pAudioSource->nNextPacketSize != 0) {
-			bufferActualDuration = (double)REFTIMES_PER_SEC * pAudioSource->numFramesRead / pAudioSource->pwfx->nSamplesPerSec;
-			pMediaWriter->WriteAudioFrame(pAudioSource->pwfx, pData, pAudioSource->numFramesRead, bufferActualDuration);
-			globalAudioDuration = globalAudioDuration + bufferActualDuration;
-			pAudioSource->NextFrame(&pData);
+		else {
+			int64_t now = pClock->Now();
+			if (!started) {
+				pAudioStart->store(now, std::memory_order_release);
+				ringAnchor = now;
+				ringFrames = 0;
+				ringEnd = now;
+			}
+			int64_t silentUntil = now - fullBufferDuration;
+			if (silentUntil > ringEnd) {
+				unsigned long long silenceFrames = (unsigned long long)(silentUntil - ringEnd) * pwfx->nSamplesPerSec / REFTIMES_PER_SEC;
+				pRing->WriteZeros((size_t)silenceFrames * pwfx->nBlockAlign);
+				ringFrames += silenceFrames;
+			}
 		}
 
 		Sleep(fullBufferDuration / REFTIMES_PER_MILLISEC / 2);
 	}
+}
 
-	delete[] pSilenceData;
+void submitAudioBlock(MediaWriter* pMediaWriter, SampleInterleaver* pInterleaver, AudioAccumulator* pAccumulator, PipelineMetrics* pMetrics) {
+	AudioBlock block = pAccumulator->PendingBlock();
+	IMFSample* pSample = nullptr;
+	HRESULT hr = pMediaWriter->PrepareAudioSample(block, &pSample);
+	if (SUCCEEDED(hr)) {
+		pMetrics->Add(COUNTER_AUDIO_BLOCKS);
+		pInterleaver->Push(STREAM_AUDIO, block.timestamp, pSample);
+	}
+	else {
+		pMetrics->Add(COUNTER_AUDIO_DROPPED);
+	}
+	pAccumulator->NextBlock();
 }
 
-void videoCaptureProc(BOOL *pActive, MediaWriter* pMediaWriter) {
-	DXGISource videoSource{};
-	DWORD* pData = nullptr;
+/*
+Drains the audio ring into AAC-aligned blocks and hands each full block to the interleaver.
+Timestamps are counted in frames from the start of the ring, so they never drift from the data
+*/
+void audioWriterProc(BOOL *pActive, MediaWriter* pMediaWriter, SampleInterleaver* pInterleaver, SpscRing* pRing, const WAVEFORMATEX* pwfx, std::atomic<int64_t>* pAudioStart, PipelineMetrics* pMetrics) {
+	AudioAccumulator accumulator(pwfx->nSamplesPerSec, pwfx->nBlockAlign, AUDIO_BLOCK_FRAMES);
+	BOOL started = FALSE;
+
+	while (*pActive || pRing->ReadAvailable() >= pwfx->nBlockAlign) {
+		if (!started) {
+			int64_t audioStart = pAudioStart->load(std::memory_order_acquire);
+			if (audioStart == AUDIO_START_UNKNOWN) {
+				Sleep(AUDIO_WRITER_POLL_MS);
+				continue;
+			}
+			accumulator.Start(audioStart);
+			started = TRUE;
+		}
+
+		size_t bytesFree = 0;
+		uint8_t* pBlock = accumulator.WritePointer(&bytesFree);
+		size_t bytesRead = pRing->Read(pBlock, bytesFree, pwfx->nBlockAlign);
+		accumulator.Commit(bytesRead);
+
+		if (accumulator.BlockReady()) {
+			submitAudioBlock(pMediaWriter, pInterleaver, &accumulator, pMetrics);
+		}
+		else if (bytesRead == 0) {
+			Sleep(AUDIO_WRITER_POLL_MS);
+		}
+	}
+
+	// The last block is usually partial: the encoder pads it
+	if (accumulator.PendingBlock().frames > 0) {
+		submitAudioBlock(pMediaWriter, pInterleaver, &accumulator, pMetrics);
+	}
+
+	pInterleaver->EndOfStream(STREAM_AUDIO);
+}
 
-	REFERENCE_TIME duration;
-	DWORD lastTick, currentTick;
+/*
+Captures a frame per scheduler tick, stamped with the presentation clock at
+capture time, and hands it to the interleaver. Frames whose tiles all hash as
+before are written as repeats, whether or not the source reported changes
+*/
+void videoCaptureProc(BOOL *pActive, MediaWriter* pMediaWriter, SampleInterleaver* pInterleaver, const PresentationClock* pClock, const VideoEncodeOpts* pVideoOpts, PipelineMetrics* pMetrics) {
+	// Created on the thread that polls it
+	std::unique_ptr<VideoSource> pVideoSource(createVideoSource(pVideoOpts));
+	unsigned fps = pVideoOpts->fps;
+	FrameView frame = {};
+	SteadyClock clock;
+	FrameScheduler scheduler(fps, &clock);
+	FrameRect region = CapturedRegion(pVideoOpts);
+	TileChangeDetector detector(region.width, region.height);
 
 #if _DEBUG
-	REFERENCE_TIME countFps = 1 * REFTIMES_PER_SEC;
-	unsigned fps = 0;
-	unsigned fpsAverage = 0;
+	uint64_t countFpsFrame = fps;
+	uint64_t lastFrames = 0;
 #endif
 
+	if (!pVideoSource) {
+		pInterleaver->EndOfStream(STREAM_VIDEO);
+		return;
+	}
+	pVideoSource->pMetrics = pMetrics;
+
 	if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST)) {
 		ERR("failed to set thread priority: %d", GetLastError());
 	}
 
-	lastTick = currentTick = timeGetTime();
+	scheduler.Start();
 	while (*pActive) {
-		if (globalVideoDuration > globalAudioDuration) {
-			continue;
+		uint64_t frameIndex = scheduler.WaitNextFrame();
+		LONGLONG rtStart = pClock->Now();
+
+		UINT64 qpcPosition = 0;
+		StageTimer captureTimer(pMetrics, STAGE_VIDEO_CAPTURE);
+		HRESULT hr = pVideoSource->NextFrame(&frame, &qpcPosition);
+		captureTimer.Stop();
+		// A frame read back later than it was captured keeps its capture time, and so does a static frame
+		LONGLONG rtCapture = qpcPosition != 0 ? pClock->FromQpcPosition(qpcPosition) : rtStart;
+		if (hr == S_OK) {
+			StageTimer detectTimer(pMetrics, STAGE_VIDEO_DETECT);
+			bool hashed = detector.Update(frame, region);
+			detectTimer.Stop();
+			if (hashed) {
+				pMetrics->Set(GAUGE_VIDEO_CHANGED_TILES, detector.Changes().changed);
+			}
+			if (hashed && detector.Changes().changed == 0) {
+				pMetrics->Add(COUNTER_VIDEO_STATIC);
+				hr = S_FALSE;
+			}
 		}
-		if ((currentTick = timeGetTime()) - lastTick >= VIDEO_FRAMETICK_30FPS) {
-			duration = (currentTick - lastTick) * REFTIMES_PER_MILLISEC;
-			globalVideoDuration += duration;
-			videoSource.NextFrame(&pData);
-			pMediaWriter->WriteVideoFrame(globalVideoDuration, pData);
-			lastTick = currentTick;
-#if _DEBUG // display recording FPS
-			fps += 1;
-			if (globalVideoDuration >= countFps) {
-				fpsAverage += fps;
-				fps = 0;
-				std::cout << "FPS: " << (fpsAverage / (countFps / REFTIMES_PER_SEC)) << std::endl;
-				countFps += (1 * REFTIMES_PER_SEC);
+		if (hr == S_OK) {
+			IMFSample* pSample = nullptr;
+			hr = pMediaWriter->PrepareVideoSample(rtCapture, frame, &pSample);
+			if (SUCCEEDED(hr)) {
+				pMetrics->Add(COUNTER_VIDEO_FRAMES);
+				pInterleaver->Push(STREAM_VIDEO, rtCapture, pSample);
 			}
-#endif
+			else {
+				// The next frame must not be taken for a repeat of this one
+				detector.Reset();
+				pMetrics->Add(COUNTER_VIDEO_DROPPED);
+			}
+		}
+		else if (hr == S_FALSE && frame.pData != nullptr) {
+			pMetrics->Add(COUNTER_VIDEO_REPEATS);
+			pInterleaver->Push(STREAM_VIDEO, rtCapture, nullptr);
+		}
+
+		FrameSchedulerStats schedulerStats = scheduler.Stats();
+		pMetrics->Set(COUNTER_VIDEO_LATE, (int64_t)schedulerStats.late);
+		pMetrics->Set(COUNTER_VIDEO_SKIPPED, (int64_t)schedulerStats.dropped);
+#if _DEBUG // display recording FPS
+		if (frameIndex >= countFpsFrame) {
+			FrameSchedulerStats stats = scheduler.Stats();
+			std::cout << "FPS: " << (stats.frames - lastFrames) << std::endl;
+			lastFrames = stats.frames;
+			countFpsFrame += fps;
 		}
+#endif
 	}
+
+	FrameSchedulerStats stats = scheduler.Stats();
+	LOG(L"Video scheduler: %llu frames, %llu late, %llu dropped, %lld us max lateness",
+		stats.frames, stats.late, stats.dropped, stats.maxLatenessUs);
+
+	pInterleaver->EndOfStream(STREAM_VIDEO);
 }
 
+/*
+Refreshes the gauges owned by other components before each metrics report.
+Timestamps are in 100ns units, gauges in microseconds
+*/
+void collectMetrics(PipelineMetrics* pMetrics, SampleInterleaver* pInterleaver, SpscRing* pAudioRing, MediaWriter* pMediaWriter) {
+	InterleaverStats interleaverStats = pInterleaver->Stats();
+	pMetrics->Set(GAUGE_INTERLEAVER_DEPTH, pInterleaver->QueueDepth());
+	pMetrics->Set(GAUGE_AV_SKEW_US, interleaverStats.skew / 10);
+	pMetrics->Set(GAUGE_MAX_AV_SKEW_US, interleaverStats.maxSkew / 10);
+	pMetrics->Set(GAUGE_AUDIO_RING_BYTES, (int64_t)pAudioRing->ReadAvailable());
+	pMetrics->Set(COUNTER_AUDIO_RING_OVERRUNS, (int64_t)pAudioRing->Overruns());
+	pMetrics->Set(GAUGE_VIDEO_SAMPLES_IN_FLIGHT, pMediaWriter->GetVideoPoolStats().inUse);
+}
 
+void logMetricsSummary(const PipelineMetrics* pMetrics) {
+	std::unique_ptr<MetricsSnapshot> pSnapshot(new MetricsSnapshot());
+	pMetrics->Snapshot(pSnapshot.get());
+
+	for (unsigned i = 0; i < STAGE_COUNT; i++) {
+		const HistogramSnapshot& stage = pSnapshot->stages[i];
+		if (stage.count == 0) {
+			continue;
+		}
+		LOG(L"%hs: %llu, mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us", PipelineStageName((PipelineStage)i), stage.count,
+			stage.sumNs / 1000.0 / stage.count, HistogramValueAt(stage, 0.5) / 1000.0, HistogramValueAt(stage, 0.99) / 1000.0, HistogramValueAt(stage, 1.0) / 1000.0);
+	}
+}
 
 int main() {
-	LoopbackSource* pAudioSource;
 	VideoEncodeOpts videoOpts = { 
 		DEFAULT_VIDEO_WIDTH, 
 		DEFAULT_VIDEO_HEIGHT, 
@@ -110,23 +364,74 @@ int main() {
 		0, 
 		DEFAULT_VIDEO_FPS,
 		DEFAULT_VIDEO_BIT_RATE,
-		TRUE 
+		TRUE,
+		FALSE,
+		0,
+		0,
+		DEFAULT_SCALE_FILTER
 	};
+	applyOutputSize(&videoOpts);
 	
-	try {
-		pAudioSource = new LoopbackSource;
-	} catch (const char* msg) {
-		ERR(L"Failed to initialize LoopbackSource: %s", msg);
+	AudioSource* pAudioSource = createAudioSource();
+	if (pAudioSource == nullptr) {
+		return EXIT_FAILURE;
 	}
 
+	PipelineMetrics* pMetrics = new PipelineMetrics;
+	pAudioSource->pMetrics = pMetrics;
+
 	AudioEncodeOpts audioOpts = { pAudioSource->pwfx };
 	MediaWriter* pMediaWriter = new MediaWriter(&audioOpts, &videoOpts);
+	pMediaWriter->SetMetrics(pMetrics);
 
 	BOOL* pActive = new BOOL(TRUE);
 	std::string line;
+
+	SpscRing* pAudioRing = new SpscRing((size_t)pAudioSource->pwfx->nAvgBytesPerSec * AUDIO_RING_SECONDS);
+	std::atomic<int64_t>* pAudioStart = new std::atomic<int64_t>(AUDIO_START_UNKNOWN);
+
+	PresentationClock* pClock = new PresentationClock;
+
+	SampleInterleaver* pInterleaver = new SampleInterleaver(AV_REORDER_WINDOW_MS * REFTIMES_PER_MILLISEC,
+		[pMediaWriter, pMetrics, pClock](StreamKind stream, int64_t timestamp, IMFSample*& pSample) {
+			if (pSample == nullptr) {
+				pMediaWriter->WriteRepeatFrame(timestamp);
+				return;
+			}
+			// Audio timestamps are those of the first frame of the block, so its latency includes the accumulation
+			int64_t latency = pClock->Now() - timestamp;
+			pMetrics->Record(stream == STREAM_AUDIO ? STAGE_AUDIO_LATENCY : STAGE_VIDEO_LATENCY, latency > 0 ? (uint64_t)latency * 100 : 0);
+			pMediaWriter->WriteSample(stream, pSample);
+			SafeRelease(&pSample);
+		});
+
+	const char* metricsPath = getenv("LOOM_METRICS_FILE");
+	if (metricsPath == nullptr) {
+		metricsPath = METRICS_DEFAULT_FILE;
+	}
+	std::ofstream metricsFile;
+	std::unique_ptr<MetricsReporter> pReporter;
+	if (metricsPath[0] != '\0') {
+		metricsFile.open(metricsPath, std::ios::app);
+		if (!metricsFile.is_open()) {
+			ERR(L"Failed to open metrics file %hs", metricsPath);
+		}
+		else {
+			pReporter.reset(new MetricsReporter(pMetrics, METRICS_REPORT_INTERVAL_MS,
+				[pMetrics, pInterleaver, pAudioRing, pMediaWriter]() {
+					collectMetrics(pMetrics, pInterleaver, pAudioRing, pMediaWriter);
+				},
+				[&metricsFile](const std::string& json) {
+					metricsFile << json << std::endl;
+				}));
+		}
+	}
+
+	pClock->Start();
 	
-	std::thread audioProc(audioCaptureProc, pActive, pMediaWriter, pAudioSource);
-	std::thread videoProc(videoCaptureProc, pActive, pMediaWriter);
+	std::thread audioProc(audioCaptureProc, pActive, pAudioRing, pAudioSource, pClock, pAudioStart, pMetrics);
+	std::thread audioWriter(audioWriterProc, pActive, pMediaWriter, pInterleaver, pAudioRing, pAudioSource->pwfx, pAudioStart, pMetrics);
+	std::thread videoProc(videoCaptureProc, pActive, pMediaWriter, pInterleaver, pClock, &videoOpts, pMetrics);
 
 	// Block until user inputs ENTER
 	while (std::getline(std::cin, line) && line.length() > 0) {
@@ -135,12 +440,36 @@ int main() {
 	*pActive = FALSE;
 	
 	audioProc.join();
+	audioWriter.join();
 	videoProc.join();
+	pInterleaver->Flush();
+
+	// The last report covers the samples flushed above
+	if (pReporter) {
+		pReporter->Stop();
+	}
+	logMetricsSummary(pMetrics);
+
+	InterleaverStats interleaverStats = pInterleaver->Stats();
+	LOG(L"Interleaver: %llu samples, %llu written before the other stream caught up, %llu late, %lld ms max A/V skew, %u max queued",
+		interleaverStats.emitted, interleaverStats.forced, interleaverStats.late, interleaverStats.maxSkew / REFTIMES_PER_MILLISEC, interleaverStats.maxQueueDepth);
+
+	if (pAudioRing->Overruns() > 0) {
+		ERR(L"Audio ring overflowed %llu times", pAudioRing->Overruns());
+	}
 
 	HRESULT hr = pMediaWriter->Finalize();
 	if (FAILED(hr)) {
 		ERR(L"Failed to Finalize MediaWriter: hr = 0x%08x", hr);
 	}
 
+	SlotPoolStats poolStats = pMediaWriter->GetVideoPoolStats();
+	LOG(L"Video sample pool: %llu frames, %llu waits for a free buffer (%llu ms), %llu dropped, %u max in flight",
+		poolStats.acquired, poolStats.exhausted, poolStats.backpressureWaitUs / 1000, poolStats.timeouts, poolStats.maxInUse);
+
+	SlotPoolStats audioPoolStats = pMediaWriter->GetAudioPoolStats();
+	LOG(L"Audio sample pool: %llu blocks, %llu waits for a free buffer, %llu dropped, %u max in flight",
+		audioPoolStats.acquired, audioPoolStats.exhausted, audioPoolStats.timeouts, audioPoolStats.maxInUse);
+
 	return 0;
 }
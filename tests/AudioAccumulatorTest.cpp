@@ -0,0 +1,79 @@
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include <AudioAccumulator.h>
+#include <TestCheck.h>
+
+/*
+Six hours of packets of random size: blocks are whole, back to back, and the
+last one ends where the frame count says, to the 100ns unit
+*/
+static void TestBlocksDoNotDrift() {
+	const uint32_t rates[] = { 44100, 48000, 96000 };
+	const uint32_t blockAlign = 4, blockFrames = 2 * AAC_FRAME_SAMPLES;
+	const int64_t start = 12345;
+
+	for (uint32_t rate : rates) {
+		AudioAccumulator accumulator(rate, blockAlign, blockFrames);
+		std::mt19937 random(rate);
+		std::vector<uint8_t> packet(blockAlign * 1000);
+		uint64_t frames = rate * 3600ull * 6, appended = 0;
+		int64_t expected = start;
+
+		accumulator.Start(start);
+		while (appended < frames) {
+			uint64_t packetFrames = random() % 1000 + 1;
+			if (packetFrames > frames - appended) {
+				packetFrames = frames - appended;
+			}
+			const uint8_t* pData = packet.data();
+			size_t bytes = (size_t)packetFrames * blockAlign;
+			while (bytes > 0) {
+				size_t taken = accumulator.Append(pData, bytes);
+				pData += taken;
+				bytes -= taken;
+				if (accumulator.BlockReady()) {
+					AudioBlock block = accumulator.PendingBlock();
+					CHECK(block.frames == blockFrames && block.bytes == (size_t)blockFrames * blockAlign);
+					CHECK(block.timestamp == expected);
+					expected += block.duration;
+					accumulator.NextBlock();
+				}
+			}
+			appended += packetFrames;
+		}
+
+		AudioBlock tail = accumulator.PendingBlock();
+		CHECK(tail.timestamp == expected);
+		CHECK(accumulator.FramesSubmitted() + tail.frames == frames);
+		CHECK(tail.timestamp + tail.duration == start + (int64_t)(frames * 10000000 / rate));
+	}
+}
+
+// Data copied through WritePointer lands in the block as Append's would
+static void TestWritePointer() {
+	AudioAccumulator accumulator(48000, 4, AAC_FRAME_SAMPLES);
+	size_t bytesFree = 0;
+
+	accumulator.Start(0);
+	uint8_t* pDest = accumulator.WritePointer(&bytesFree);
+	CHECK(bytesFree == AAC_FRAME_SAMPLES * 4);
+	memset(pDest, 0x11, 400);
+	accumulator.Commit(400);
+
+	// Append takes whole frames only
+	uint8_t partial[7] = { 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22 };
+	CHECK(accumulator.Append(partial, sizeof(partial)) == 4);
+
+	AudioBlock block = accumulator.PendingBlock();
+	CHECK(block.frames == 101 && !accumulator.BlockReady());
+	CHECK(block.pData[399] == 0x11 && block.pData[400] == 0x22);
+	CHECK(block.duration == 101 * 10000000 / 48000);
+}
+
+int main() {
+	TestBlocksDoNotDrift();
+	TestWritePointer();
+	return TEST_RESULT();
+}
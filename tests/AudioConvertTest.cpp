@@ -0,0 +1,92 @@
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <AudioConvert.h>
+#include <TestCheck.h>
+
+// Converts in uneven chunks, so the kernel tails and the dither state carry across calls
+static std::vector<int16_t> ConvertInChunks(PcmConverter& converter, const std::vector<float>& src) {
+	size_t frames = src.size() / converter.InChannels();
+	std::vector<int16_t> out(frames * converter.OutChannels());
+	size_t chunk = 1;
+
+	for (size_t pos = 0; pos < frames; pos += chunk) {
+		chunk = std::min(chunk * 3 % 1031 + 1, frames - pos);
+		converter.Convert(src.data() + pos * converter.InChannels(), out.data() + pos * converter.OutChannels(), chunk);
+	}
+	return out;
+}
+
+// Every kernel gives the same samples, with or without dither and downmix, special values included
+static void TestKernelsMatch() {
+	const unsigned layouts[] = { 1, 2, 6, 8 };
+	std::mt19937 random(10);
+	std::uniform_real_distribution<float> amplitude(-1.3f, 1.3f);
+
+	for (unsigned channels : layouts) {
+		std::vector<float> src((48000 + 7) * channels);
+		for (float& sample : src) {
+			sample = amplitude(random);
+		}
+		src[3] = NAN;
+		src[5] = INFINITY;
+		src[6] = -INFINITY;
+		src[7] = 0.99999f;
+
+		for (int dither = 0; dither < 2; dither++) {
+			PcmConverter scalar(channels, 0, dither != 0, PCM_KERNEL_SCALAR);
+			PcmConverter sse2(channels, 0, dither != 0, PCM_KERNEL_SSE2);
+			PcmConverter avx2(channels, 0, dither != 0, PCM_KERNEL_AVX2);
+			CHECK(scalar.Valid() && scalar.OutChannels() == std::min(channels, 2u));
+
+			std::vector<int16_t> expected = ConvertInChunks(scalar, src);
+			CHECK(ConvertInChunks(sse2, src) == expected);
+			CHECK(ConvertInChunks(avx2, src) == expected);
+		}
+	}
+}
+
+static void TestScaleAndSaturation() {
+	const float src[] = { 0.0f, 0.5f, -0.5f, 1.0f, -1.0f, 1.5f, -2.0f, 1.0f / 32768 };
+	const int16_t expected[] = { 0, 16384, -16384, 32767, -32768, 32767, -32768, 1 };
+	int16_t out[8];
+	PcmConverter converter(2, 0, false);
+
+	converter.Convert(src, out, 4);
+	CHECK(std::equal(out, out + 8, expected));
+}
+
+// A full-scale 5.1 mix folded to stereo never clips, and TPDF dither averages out
+static void TestDownmixAndDither() {
+	std::vector<float> loud(6 * 100, 1.0f);
+	std::vector<int16_t> stereo(2 * 100);
+	PcmConverter downmix(6, 0, false);
+
+	CHECK(downmix.OutChannels() == 2);
+	downmix.Convert(loud.data(), stereo.data(), 100);
+	for (int16_t sample : stereo) {
+		CHECK(sample > 0 && sample <= 32767);
+	}
+
+	PcmConverter dithered(2, 0, true);
+	std::vector<float> quarter(200000, 0.25f / 32768);
+	std::vector<int16_t> out(quarter.size());
+	dithered.Convert(quarter.data(), out.data(), quarter.size() / 2);
+	double sum = 0;
+	for (int16_t sample : out) {
+		sum += sample;
+	}
+	CHECK(fabs(sum / out.size() - 0.25) < 0.01);
+
+	PcmConverter invalid(PCM_MAX_CHANNELS + 1, 0, false);
+	CHECK(!invalid.Valid());
+}
+
+int main() {
+	TestKernelsMatch();
+	TestScaleAndSaturation();
+	TestDownmixAndDither();
+	return TEST_RESULT();
+}
@@ -0,0 +1,130 @@
+#include <math.h>
+#include <random>
+#include <vector>
+
+#include <ColorConvert.h>
+#include <TestCheck.h>
+
+// Reference conversion in double precision, before rounding
+static void Expected(const uint8_t* pBgra, ColorMatrix matrix, ColorRange range, double* pY, double* pU, double* pV) {
+	double kr = matrix == COLOR_MATRIX_BT709 ? 0.2126 : 0.299;
+	double kb = matrix == COLOR_MATRIX_BT709 ? 0.0722 : 0.114;
+	double kg = 1 - kr - kb;
+	double yScale = range == COLOR_RANGE_FULL ? 1 : 219.0 / 255;
+	double cScale = range == COLOR_RANGE_FULL ? 1 : 224.0 / 255;
+	double yOffset = range == COLOR_RANGE_FULL ? 0 : 16;
+
+	double luma = kr * pBgra[2] + kg * pBgra[1] + kb * pBgra[0];
+	*pY = yOffset + yScale * luma;
+	*pU = 128 + cScale * (pBgra[0] - luma) / (2 * (1 - kb));
+	*pV = 128 + cScale * (pBgra[2] - luma) / (2 * (1 - kr));
+}
+
+static std::vector<uint8_t> ConvertWith(ConvertKernel kernel, ThreadPool* pPool, ColorMatrix matrix, ColorRange range, YuvLayout layout,
+	const FrameView& view, const FrameRect& rect) {
+	long pitch = (long)rect.width + 3;
+	std::vector<uint8_t> out((size_t)pitch * rect.height * 2 + 64, 0xab);
+	YuvPlanes planes = {
+		out.data(), pitch,
+		out.data() + (size_t)pitch * rect.height, pitch,
+		out.data() + (size_t)pitch * rect.height + (size_t)pitch * rect.height / 2, pitch
+	};
+	ColorConverter converter(matrix, range, layout, pPool, kernel);
+	CHECK(converter.Convert(view, rect, planes));
+	return out;
+}
+
+// Scalar, SSE4.1, AVX2 and the tiled pool produce the same bytes
+static void TestKernelsMatch() {
+	std::mt19937 random(4);
+	ThreadPool pool(4);
+
+	for (int i = 0; i < 150; i++) {
+		unsigned width = 2 + random() % 200, height = 2 + random() % 40;
+		long pitch = (long)width * FRAME_BYTES_PER_PIXEL + random() % 32;
+		std::vector<uint8_t> src((size_t)pitch * height);
+		for (size_t b = 0; b < src.size(); b++) {
+			src[b] = i % 3 == 0 ? (uint8_t)random() : (uint8_t)(b * 3 + random() % 8);
+		}
+		FrameView view = { src.data(), pitch, width, height };
+		FrameRect rect = { (unsigned)(random() % width), (unsigned)(random() % height), 0, 0 };
+		rect.width = (width - rect.x) & ~1u;
+		rect.height = (height - rect.y) & ~1u;
+		if (rect.width == 0 || rect.height == 0) {
+			continue;
+		}
+
+		for (int layout = 0; layout < 2; layout++) {
+			for (int matrix = 0; matrix < 2; matrix++) {
+				for (int range = 0; range < 2; range++) {
+					std::vector<uint8_t> scalar = ConvertWith(CONVERT_KERNEL_SCALAR, nullptr, (ColorMatrix)matrix, (ColorRange)range, (YuvLayout)layout, view, rect);
+					CHECK(ConvertWith(CONVERT_KERNEL_SSE41, nullptr, (ColorMatrix)matrix, (ColorRange)range, (YuvLayout)layout, view, rect) == scalar);
+					CHECK(ConvertWith(CONVERT_KERNEL_AVX2, nullptr, (ColorMatrix)matrix, (ColorRange)range, (YuvLayout)layout, view, rect) == scalar);
+					CHECK(ConvertWith(CONVERT_KERNEL_AUTO, &pool, (ColorMatrix)matrix, (ColorRange)range, (YuvLayout)layout, view, rect) == scalar);
+				}
+			}
+		}
+	}
+}
+
+// Flat 2x2 blocks make the chroma average exact, so every sample is within rounding of the reference
+static void TestAccuracy() {
+	const unsigned width = 64, height = 32;
+	std::mt19937 random(5);
+	std::vector<uint8_t> src((size_t)width * height * FRAME_BYTES_PER_PIXEL);
+	for (unsigned y = 0; y < height; y += 2) {
+		for (unsigned x = 0; x < width; x += 2) {
+			uint8_t bgra[4] = { (uint8_t)random(), (uint8_t)random(), (uint8_t)random(), 0xff };
+			for (unsigned i = 0; i < 4; i++) {
+				for (unsigned c = 0; c < 4; c++) {
+					src[((size_t)(y + i / 2) * width + x + i % 2) * FRAME_BYTES_PER_PIXEL + c] = bgra[c];
+				}
+			}
+		}
+	}
+	FrameView view = { src.data(), (long)width * FRAME_BYTES_PER_PIXEL, width, height };
+	FrameRect rect = { 0, 0, width, height };
+	long pitch = (long)width + 3;
+
+	for (int matrix = 0; matrix < 2; matrix++) {
+		for (int range = 0; range < 2; range++) {
+			std::vector<uint8_t> out = ConvertWith(CONVERT_KERNEL_AUTO, nullptr, (ColorMatrix)matrix, (ColorRange)range, YUV_LAYOUT_NV12, view, rect);
+			const uint8_t* pUv = out.data() + (size_t)pitch * height;
+			double maxError = 0;
+
+			for (unsigned y = 0; y < height; y++) {
+				for (unsigned x = 0; x < width; x++) {
+					double expectedY, expectedU, expectedV;
+					Expected(&src[((size_t)y * width + x) * FRAME_BYTES_PER_PIXEL], (ColorMatrix)matrix, (ColorRange)range, &expectedY, &expectedU, &expectedV);
+					maxError = fmax(maxError, fabs(out[(size_t)y * pitch + x] - fmin(fmax(expectedY, 0), 255)));
+					if (y % 2 == 0 && x % 2 == 0) {
+						const uint8_t* pPair = pUv + (size_t)(y / 2) * pitch + x;
+						maxError = fmax(maxError, fabs(pPair[0] - fmin(fmax(expectedU, 0), 255)));
+						maxError = fmax(maxError, fabs(pPair[1] - fmin(fmax(expectedV, 0), 255)));
+					}
+				}
+			}
+			CHECK(maxError <= 1.0);
+		}
+	}
+}
+
+static void TestRejectsOddRects() {
+	std::vector<uint8_t> src(16 * 16 * FRAME_BYTES_PER_PIXEL);
+	std::vector<uint8_t> out(16 * 16 * 2);
+	FrameView view = { src.data(), 16 * FRAME_BYTES_PER_PIXEL, 16, 16 };
+	YuvPlanes planes = { out.data(), 16, out.data() + 256, 16, nullptr, 0 };
+	ColorConverter converter(COLOR_MATRIX_BT709, COLOR_RANGE_LIMITED, YUV_LAYOUT_NV12);
+	FrameRect odd = { 0, 0, 15, 16 };
+	FrameRect outside = { 4, 0, 16, 16 };
+
+	CHECK(!converter.Convert(view, odd, planes));
+	CHECK(!converter.Convert(view, outside, planes));
+}
+
+int main() {
+	TestKernelsMatch();
+	TestAccuracy();
+	TestRejectsOddRects();
+	return TEST_RESULT();
+}
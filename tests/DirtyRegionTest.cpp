@@ -0,0 +1,105 @@
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <DirtyRegion.h>
+#include <TestCheck.h>
+
+static bool Contains(const FrameRect& outer, const FrameRect& inner) {
+	return inner.x >= outer.x && inner.y >= outer.y &&
+		inner.x + inner.width <= outer.x + outer.width && inner.y + inner.height <= outer.y + outer.height;
+}
+
+static void TestAddClipsAndMerges() {
+	DirtyRegion region;
+	FrameRect empty = { 5, 5, 0, 10 };
+	FrameRect overhang = { 90, 50, 20, 20 };
+	FrameRect outside = { 200, 0, 4, 4 };
+
+	region.Add(empty, 100, 60);
+	region.Add(outside, 100, 60);
+	CHECK(region.Empty());
+
+	region.Add(overhang, 100, 60);
+	CHECK(region.Rects().size() == 1);
+	CHECK(region.Rects()[0].width == 10 && region.Rects()[0].height == 10);
+
+	// Two overlapping rects become their bounding box
+	FrameRect a = { 0, 0, 30, 30 };
+	FrameRect b = { 20, 20, 30, 30 };
+	region.Clear();
+	region.Add(a, 100, 60);
+	region.Add(b, 100, 60);
+	region.Merge();
+	CHECK(region.Rects().size() == 1);
+	CHECK(region.Rects()[0].width == 50 && region.Rects()[0].height == 50);
+}
+
+// Mirroring moves and dirty rects reproduces the captured frame, and merged rects still cover every change
+static void TestMirrorFollowsFrames() {
+	const unsigned width = 97, height = 61;
+	const long pitch = (long)width * FRAME_BYTES_PER_PIXEL;
+	std::mt19937 random(5);
+
+	for (int i = 0; i < 1000; i++) {
+		std::vector<uint8_t> current((size_t)pitch * height);
+		for (uint8_t& byte : current) {
+			byte = (uint8_t)random();
+		}
+		FrameView currentView = { current.data(), pitch, width, height };
+		FrameMirror mirror(width, height);
+		FrameRect all = { 0, 0, width, height };
+		mirror.UpdateRects(currentView, { all });
+
+		FrameMove move;
+		move.dest.width = 1 + random() % width;
+		move.dest.height = 1 + random() % height;
+		move.dest.x = random() % (width - move.dest.width + 1);
+		move.dest.y = random() % (height - move.dest.height + 1);
+		move.srcX = random() % (width - move.dest.width + 1);
+		move.srcY = random() % (height - move.dest.height + 1);
+
+		std::vector<uint8_t> next = current;
+		for (unsigned y = 0; y < move.dest.height; y++) {
+			memcpy(&next[(size_t)(move.dest.y + y) * pitch + move.dest.x * FRAME_BYTES_PER_PIXEL],
+				&current[(size_t)(move.srcY + y) * pitch + move.srcX * FRAME_BYTES_PER_PIXEL], move.dest.width * FRAME_BYTES_PER_PIXEL);
+		}
+
+		DirtyRegion region;
+		int dirtyCount = random() % 10;
+		for (int d = 0; d < dirtyCount; d++) {
+			FrameRect rect = { (unsigned)(random() % width), (unsigned)(random() % height), (unsigned)(random() % 40), (unsigned)(random() % 40) };
+			region.Add(rect, width, height);
+			for (unsigned y = rect.y; y < std::min(height, rect.y + rect.height); y++) {
+				for (unsigned x = rect.x; x < std::min(width, rect.x + rect.width); x++) {
+					for (unsigned c = 0; c < FRAME_BYTES_PER_PIXEL; c++) {
+						next[(size_t)y * pitch + x * FRAME_BYTES_PER_PIXEL + c] = (uint8_t)random();
+					}
+				}
+			}
+		}
+
+		std::vector<FrameRect> added = region.Rects();
+		region.Merge();
+		CHECK(region.Rects().size() <= DIRTY_MAX_RECTS);
+		for (const FrameRect& rect : added) {
+			bool covered = false;
+			for (const FrameRect& merged : region.Rects()) {
+				covered = covered || Contains(merged, rect);
+			}
+			CHECK(covered);
+		}
+
+		FrameView nextView = { next.data(), pitch, width, height };
+		mirror.ApplyMoves({ move });
+		mirror.UpdateRects(nextView, region.Rects());
+		CHECK(memcmp(mirror.View().pData, next.data(), next.size()) == 0);
+	}
+}
+
+int main() {
+	TestAddClipsAndMerges();
+	TestMirrorFollowsFrames();
+	return TEST_RESULT();
+}
@@ -0,0 +1,74 @@
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include <FrameCrop.h>
+#include <TestCheck.h>
+
+static const CropKernel kernels[] = { CROP_KERNEL_AUTO, CROP_KERNEL_SCALAR, CROP_KERNEL_SSE2, CROP_KERNEL_AVX2 };
+
+// Every kernel copies exactly the rows of rect, leaving the destination padding alone
+static void CheckCrop(std::mt19937& random, unsigned width, unsigned height, const FrameRect& rect) {
+	long pitch = (long)width * FRAME_BYTES_PER_PIXEL + random() % 64;
+	std::vector<uint8_t> src((size_t)pitch * height);
+	for (uint8_t& byte : src) {
+		byte = (uint8_t)random();
+	}
+	FrameView view = { src.data(), pitch, width, height };
+
+	// Odd offset and padded rows, as a locked buffer may have
+	long destPitch = (long)rect.width * FRAME_BYTES_PER_PIXEL + random() % 40;
+	std::vector<uint8_t> expected((size_t)destPitch * rect.height + 64, 0xcd);
+	for (unsigned y = 0; y < rect.height; y++) {
+		memcpy(&expected[1 + (size_t)y * destPitch], &src[(size_t)(rect.y + y) * pitch + (size_t)rect.x * FRAME_BYTES_PER_PIXEL], (size_t)rect.width * FRAME_BYTES_PER_PIXEL);
+	}
+
+	for (CropKernel kernel : kernels) {
+		std::vector<uint8_t> dest(expected.size(), 0xcd);
+		CHECK(CropFrame(dest.data() + 1, destPitch, view, rect, kernel));
+		CHECK(dest == expected);
+	}
+}
+
+static void TestRandomRects() {
+	std::mt19937 random(1);
+
+	for (int i = 0; i < 300; i++) {
+		unsigned width = 1 + random() % 3000;
+		unsigned height = 1 + random() % 150;
+		FrameRect rect;
+		rect.x = random() % width;
+		rect.y = random() % height;
+		rect.width = random() % (width - rect.x + 1);
+		rect.height = random() % (height - rect.y + 1);
+		CheckCrop(random, width, height, rect);
+	}
+
+	// Large enough for the streaming stores
+	FrameRect full = { 0, 0, 1920, 1080 };
+	CheckCrop(random, 1920, 1080, full);
+	FrameRect inner = { 13, 7, 1280, 720 };
+	CheckCrop(random, 1920, 1080, inner);
+}
+
+static void TestRectOutsideFrame() {
+	uint8_t dest[64] = {};
+	FrameView view = { nullptr, 40, 10, 10 };
+	FrameRect tooWide = { 5, 0, 6, 1 };
+	FrameRect tooTall = { 0, 9, 1, 2 };
+	FrameRect offFrame = { 11, 0, 0, 0 };
+
+	CHECK(!CropFrame(dest, 40, view, tooWide));
+	CHECK(!CropFrame(dest, 40, view, tooTall));
+	CHECK(!CropFrame(dest, 40, view, offFrame));
+
+	// An empty rect inside the frame copies nothing and succeeds
+	FrameRect empty = { 10, 10, 0, 0 };
+	CHECK(CropFrame(dest, 40, view, empty));
+}
+
+int main() {
+	TestRandomRects();
+	TestRectOutsideFrame();
+	return TEST_RESULT();
+}
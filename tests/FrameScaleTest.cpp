@@ -0,0 +1,162 @@
+#include <math.h>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <FrameScale.h>
+#include <TestCheck.h>
+
+// Bilinear and Catmull-Rom weights at distance x
+static double FilterWeight(ScaleFilter filter, double x) {
+	x = fabs(x);
+	if (filter == SCALE_FILTER_BILINEAR) {
+		return x < 1 ? 1 - x : 0;
+	}
+	if (x < 1) {
+		return (1.5 * x - 2.5) * x * x + 1;
+	}
+	if (x < 2) {
+		return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+	}
+	return 0;
+}
+
+typedef std::vector<std::vector<std::pair<unsigned, double>>> ReferenceAxis;
+
+// Taps of each output pixel in double precision, the filter widened by the downscaling ratio, edges clamped
+static ReferenceAxis ReferenceTaps(ScaleFilter filter, unsigned srcSize, unsigned dstSize) {
+	double ratio = (double)srcSize / dstSize;
+	double support = ratio > 1 ? ratio : 1;
+	double radius = (filter == SCALE_FILTER_BOX ? 0.5 : filter == SCALE_FILTER_BILINEAR ? 1 : 2) * support;
+	ReferenceAxis axis(dstSize);
+
+	for (unsigned i = 0; i < dstSize; i++) {
+		double center = (i + 0.5) * ratio;
+		double sum = 0;
+		for (int j = (int)floor(center - radius); j <= (int)ceil(center + radius); j++) {
+			double weight;
+			if (filter == SCALE_FILTER_BOX) {
+				double left = fmax(j, center - radius), right = fmin(j + 1, center + radius);
+				weight = right > left ? right - left : 0;
+			} else {
+				weight = FilterWeight(filter, (j + 0.5 - center) / support);
+			}
+			unsigned clamped = j < 0 ? 0 : (j > (int)srcSize - 1 ? srcSize - 1 : (unsigned)j);
+			axis[i].push_back(std::make_pair(clamped, weight));
+			sum += weight;
+		}
+		for (std::pair<unsigned, double>& tap : axis[i]) {
+			tap.second /= sum;
+		}
+	}
+	return axis;
+}
+
+// Each channel of rect scaled to dstWidth x dstHeight, clamped to 0..255 but not rounded
+static std::vector<double> ReferenceScale(ScaleFilter filter, const FrameView& src, const FrameRect& rect, unsigned dstWidth, unsigned dstHeight) {
+	ReferenceAxis horizontal = ReferenceTaps(filter, rect.width, dstWidth);
+	ReferenceAxis vertical = ReferenceTaps(filter, rect.height, dstHeight);
+	std::vector<double> row((size_t)rect.width * FRAME_BYTES_PER_PIXEL);
+	std::vector<double> out((size_t)dstWidth * dstHeight * FRAME_BYTES_PER_PIXEL);
+
+	for (unsigned y = 0; y < dstHeight; y++) {
+		std::fill(row.begin(), row.end(), 0.0);
+		for (const std::pair<unsigned, double>& tap : vertical[y]) {
+			const uint8_t* pRow = src.pData + (size_t)(rect.y + tap.first) * src.pitch + (size_t)rect.x * FRAME_BYTES_PER_PIXEL;
+			for (size_t i = 0; i < row.size(); i++) {
+				row[i] += tap.second * pRow[i];
+			}
+		}
+		for (unsigned x = 0; x < dstWidth; x++) {
+			for (unsigned c = 0; c < FRAME_BYTES_PER_PIXEL; c++) {
+				double sum = 0;
+				for (const std::pair<unsigned, double>& tap : horizontal[x]) {
+					sum += tap.second * row[tap.first * FRAME_BYTES_PER_PIXEL + c];
+				}
+				out[((size_t)y * dstWidth + x) * FRAME_BYTES_PER_PIXEL + c] = fmin(fmax(sum, 0), 255);
+			}
+		}
+	}
+	return out;
+}
+
+/*
+Scales into a destination with padding between rows, and returns the rows
+without it. The padding must come back untouched
+*/
+static std::vector<uint8_t> ScaleWith(ScaleKernel kernel, ThreadPool* pPool, ScaleFilter filter, const FrameView& src, const FrameRect& rect,
+	unsigned dstWidth, unsigned dstHeight) {
+	const long rowBytes = (long)dstWidth * FRAME_BYTES_PER_PIXEL, destPitch = rowBytes + 12;
+	std::vector<uint8_t> dest((size_t)destPitch * dstHeight, 0xcd);
+	std::vector<uint8_t> packed;
+	FrameScaler scaler(rect.width, rect.height, dstWidth, dstHeight, filter, pPool, kernel);
+
+	CHECK(scaler.Scale(src, rect, dest.data(), destPitch));
+	for (unsigned y = 0; y < dstHeight; y++) {
+		const uint8_t* pRow = dest.data() + (size_t)y * destPitch;
+		packed.insert(packed.end(), pRow, pRow + rowBytes);
+		for (long i = rowBytes; i < destPitch; i++) {
+			CHECK(pRow[i] == 0xcd);
+		}
+	}
+	return packed;
+}
+
+/*
+Up, down, by odd ratios, the 2:1 and 3:2 box paths and degenerate sizes:
+every kernel, pooled or not, produces the scalar bytes, each within one
+level of the reference
+*/
+static void TestMatchesReference() {
+	const struct { unsigned srcWidth, srcHeight, dstWidth, dstHeight; } sizes[] = {
+		{ 64, 48, 32, 24 }, { 96, 60, 64, 40 }, { 101, 77, 37, 29 }, { 37, 29, 101, 77 }, { 300, 200, 211, 133 },
+		{ 3, 3, 2, 2 }, { 1, 1, 3, 3 }, { 7, 5, 1, 1 }, { 250, 130, 248, 129 }, { 160, 90, 160, 90 }, { 500, 300, 61, 37 }
+	};
+	std::mt19937 random(24);
+	ThreadPool pool(4);
+
+	for (const auto& size : sizes) {
+		// The rect sits inside a larger frame with a padded pitch
+		const unsigned width = size.srcWidth + 5, height = size.srcHeight + 7;
+		const long pitch = (long)width * FRAME_BYTES_PER_PIXEL + 8;
+		std::vector<uint8_t> src((size_t)pitch * height);
+		for (uint8_t& byte : src) {
+			byte = (uint8_t)random();
+		}
+		FrameView view = { src.data(), pitch, width, height };
+		FrameRect rect = { 2, 3, size.srcWidth, size.srcHeight };
+
+		for (int filter = 0; filter < 3; filter++) {
+			std::vector<double> reference = ReferenceScale((ScaleFilter)filter, view, rect, size.dstWidth, size.dstHeight);
+			std::vector<uint8_t> scalar = ScaleWith(SCALE_KERNEL_SCALAR, nullptr, (ScaleFilter)filter, view, rect, size.dstWidth, size.dstHeight);
+			double maxError = 0;
+
+			CHECK(scalar.size() == reference.size());
+			for (size_t i = 0; i < scalar.size() && i < reference.size(); i++) {
+				maxError = fmax(maxError, fabs(scalar[i] - reference[i]));
+			}
+			CHECK(maxError <= 1.0 + 1e-9);
+
+			CHECK(ScaleWith(SCALE_KERNEL_SSE41, nullptr, (ScaleFilter)filter, view, rect, size.dstWidth, size.dstHeight) == scalar);
+			CHECK(ScaleWith(SCALE_KERNEL_AVX2, nullptr, (ScaleFilter)filter, view, rect, size.dstWidth, size.dstHeight) == scalar);
+			CHECK(ScaleWith(SCALE_KERNEL_SCALAR, &pool, (ScaleFilter)filter, view, rect, size.dstWidth, size.dstHeight) == scalar);
+			CHECK(ScaleWith(SCALE_KERNEL_AUTO, &pool, (ScaleFilter)filter, view, rect, size.dstWidth, size.dstHeight) == scalar);
+		}
+	}
+}
+
+static void TestRejectsRectOutsideFrame() {
+	std::vector<uint8_t> src(64 * 64 * FRAME_BYTES_PER_PIXEL);
+	std::vector<uint8_t> dest(16 * 16 * FRAME_BYTES_PER_PIXEL);
+	FrameView view = { src.data(), 64 * FRAME_BYTES_PER_PIXEL, 64, 64 };
+	FrameScaler scaler(32, 32, 16, 16, SCALE_FILTER_BOX);
+	FrameRect outside = { 40, 0, 32, 32 };
+
+	CHECK(!scaler.Scale(view, outside, dest.data(), 16 * FRAME_BYTES_PER_PIXEL));
+}
+
+int main() {
+	TestMatchesReference();
+	TestRejectsRectOutsideFrame();
+	return TEST_RESULT();
+}
@@ -0,0 +1,66 @@
+#include <FrameScheduler.h>
+#include <TestCheck.h>
+
+// Time passes a little with each read, and sleeps overshoot their deadline
+class FakeClock : public SchedulerClock {
+public:
+	int64_t NowUs() override { return nowUs += 7; }
+	void SleepUntilUs(int64_t deadlineUs) override {
+		if (deadlineUs > nowUs) {
+			nowUs = deadlineUs + oversleepUs;
+		}
+	}
+
+	int64_t nowUs = 1000000;
+	int64_t oversleepUs = FRAME_SPIN_TAIL_US - 50;
+};
+
+// Three hours at 30 fps stay on the deadlines computed from the start
+static void TestNoDrift() {
+	const unsigned fps = 30;
+	const uint64_t frames = 30ull * 3600 * 3;
+	FakeClock clock;
+	FrameScheduler scheduler(fps, &clock);
+	int64_t startUs = clock.nowUs;
+
+	scheduler.Start();
+	uint64_t last = 0;
+	for (uint64_t i = 0; i < frames; i++) {
+		last = scheduler.WaitNextFrame();
+		CHECK(last == i);
+	}
+
+	FrameSchedulerStats stats = scheduler.Stats();
+	CHECK(stats.frames == frames);
+	CHECK(stats.dropped == 0 && stats.late == 0);
+	// Woken within a few clock reads of the last deadline
+	int64_t deadlineUs = startUs + (int64_t)(last * 1000000 / fps);
+	CHECK(clock.nowUs >= deadlineUs && clock.nowUs - deadlineUs < 100);
+	CHECK(scheduler.FrameTime(last) == (int64_t)(last * 10000000 / fps));
+}
+
+// A stall skips the deadlines it overran instead of bursting through them
+static void TestStallDropsFrames() {
+	FakeClock clock;
+	FrameScheduler scheduler(25, &clock);
+
+	scheduler.Start();
+	for (int i = 0; i < 10; i++) {
+		scheduler.WaitNextFrame();
+	}
+	clock.nowUs += 200000; // five periods
+	uint64_t next = scheduler.WaitNextFrame();
+
+	FrameSchedulerStats stats = scheduler.Stats();
+	CHECK(next == 14);
+	CHECK(stats.dropped == 4);
+	// Resuming at the current deadline is not late
+	CHECK(stats.late == 0);
+	CHECK(scheduler.WaitNextFrame() == 15);
+}
+
+int main() {
+	TestNoDrift();
+	TestStallDropsFrames();
+	return TEST_RESULT();
+}
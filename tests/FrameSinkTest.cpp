@@ -0,0 +1,75 @@
+#include <string.h>
+#include <vector>
+
+#include <FrameSink.h>
+#include <TestCheck.h>
+
+// Counts the locks, and can refuse them as an encoder buffer might
+class CountingFrameSink : public FrameSink {
+public:
+	CountingFrameSink(bool lockable) : lockable(lockable), buffer(64 * 64 * FRAME_BYTES_PER_PIXEL) {}
+	bool LockFrame(uint8_t** ppData, long* pPitch) override {
+		if (!lockable) {
+			return false;
+		}
+		locks++;
+		*ppData = buffer.data();
+		*pPitch = 64 * FRAME_BYTES_PER_PIXEL;
+		return true;
+	}
+	void UnlockFrame() override { unlocks++; }
+
+	bool lockable;
+	int locks = 0;
+	int unlocks = 0;
+	std::vector<uint8_t> buffer;
+};
+
+static std::vector<uint8_t> PatternFrame(unsigned width, unsigned height) {
+	std::vector<uint8_t> frame((size_t)width * height * FRAME_BYTES_PER_PIXEL);
+	for (size_t i = 0; i < frame.size(); i++) {
+		frame[i] = (uint8_t)(i * 7);
+	}
+	return frame;
+}
+
+static void TestCopyIntoPaddedSink() {
+	std::vector<uint8_t> src = PatternFrame(100, 50);
+	FrameView view = { src.data(), 100 * FRAME_BYTES_PER_PIXEL, 100, 50 };
+	FrameRect rect = { 3, 5, 30, 20 };
+	MemoryFrameSink sink(30, 20, 128);
+
+	CHECK(sink.Pitch() == 128);
+	CHECK(CopyFrameToSink(&sink, view, rect));
+	for (unsigned y = 0; y < rect.height; y++) {
+		const uint8_t* pExpected = &src[(size_t)(rect.y + y) * view.pitch + rect.x * FRAME_BYTES_PER_PIXEL];
+		CHECK(memcmp(sink.Data() + (size_t)y * sink.Pitch(), pExpected, rect.width * FRAME_BYTES_PER_PIXEL) == 0);
+	}
+
+	MemoryFrameSink tight(30, 20);
+	CHECK(tight.Pitch() == 30 * FRAME_BYTES_PER_PIXEL);
+}
+
+static void TestLockIsReleased() {
+	std::vector<uint8_t> src = PatternFrame(64, 64);
+	FrameView view = { src.data(), 64 * FRAME_BYTES_PER_PIXEL, 64, 64 };
+	FrameRect inside = { 0, 0, 64, 64 };
+	FrameRect outside = { 32, 0, 64, 64 };
+
+	CountingFrameSink sink(true);
+	CHECK(CopyFrameToSink(&sink, view, inside));
+	CHECK(sink.buffer == src);
+	// A rect that does not fit still unlocks the sink
+	CHECK(!CopyFrameToSink(&sink, view, outside));
+	CHECK(sink.locks == 2 && sink.unlocks == 2);
+
+	CountingFrameSink locked(false);
+	CHECK(!CopyFrameToSink(&locked, view, inside));
+	CHECK(locked.unlocks == 0);
+}
+
+int main() {
+	TestCopyIntoPaddedSink();
+	TestLockIsReleased();
+	return TEST_RESULT();
+}
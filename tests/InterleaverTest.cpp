@@ -0,0 +1,91 @@
+#include <random>
+#include <vector>
+
+#include <Interleaver.h>
+#include <PresentationClock.h>
+#include <TestCheck.h>
+
+typedef struct Emitted {
+	StreamKind stream;
+	int64_t timestamp;
+	int item;
+} Emitted;
+
+// Audio and video pushed with jittered arrival come out in timestamp order, every sample once
+static void TestOrdering() {
+	std::vector<Emitted> out;
+	Interleaver<int> interleaver(1000000, [&](StreamKind stream, int64_t timestamp, int& item) {
+		Emitted emitted = { stream, timestamp, item };
+		out.push_back(emitted);
+	});
+	std::mt19937 random(8);
+	// The same 133 s of both
+	const int audioCount = 625, videoCount = 400;
+	int audio = 0, video = 0;
+
+	while (audio < audioCount || video < videoCount) {
+		// Whichever stream is behind in arrival time pushes next, give or take 2 ms
+		int64_t audioArrival = audio < audioCount ? (int64_t)audio * 213333 + random() % 20000 : INT64_MAX;
+		int64_t videoArrival = video < videoCount ? (int64_t)video * 333333 + random() % 20000 : INT64_MAX;
+		if (audioArrival <= videoArrival) {
+			interleaver.Push(STREAM_AUDIO, (int64_t)audio * 213333, audio);
+			audio++;
+		}
+		else {
+			interleaver.Push(STREAM_VIDEO, (int64_t)video * 333333, video);
+			video++;
+		}
+	}
+	interleaver.EndOfStream(STREAM_AUDIO);
+	interleaver.EndOfStream(STREAM_VIDEO);
+
+	CHECK(out.size() == (size_t)(audioCount + videoCount));
+	for (size_t i = 1; i < out.size(); i++) {
+		CHECK(out[i].timestamp >= out[i - 1].timestamp);
+	}
+	InterleaverStats stats = interleaver.Stats();
+	CHECK(stats.emitted == out.size());
+	CHECK(stats.forced == 0 && stats.late == 0);
+	CHECK(interleaver.QueueDepth() == 0);
+}
+
+// A stalled stream holds the other back by the reorder window at most
+static void TestStalledStream() {
+	std::vector<Emitted> out;
+	Interleaver<int> interleaver(1000000, [&](StreamKind stream, int64_t timestamp, int& item) {
+		Emitted emitted = { stream, timestamp, item };
+		out.push_back(emitted);
+	});
+
+	for (int i = 0; i < 10; i++) {
+		interleaver.Push(STREAM_VIDEO, (int64_t)i * 333333, i);
+	}
+	// 300 ms queued: the six pictures more than the 100 ms window older than the newest are emitted
+	CHECK(out.size() == 6);
+	CHECK(interleaver.Stats().forced == 6);
+
+	// Audio arriving for time already emitted is late, but still emitted
+	interleaver.Push(STREAM_AUDIO, 0, 0);
+	CHECK(interleaver.Stats().late == 1);
+	interleaver.Flush();
+	CHECK(out.size() == 11);
+	CHECK(out.back().stream == STREAM_VIDEO && out.back().timestamp == 9 * 333333);
+}
+
+static void TestClockQpcPositions() {
+	PresentationClock clock;
+	clock.Start();
+
+	int64_t now = clock.Now();
+	CHECK(now >= 0);
+	CHECK(clock.FromQpcPosition(clock.ToQpcPosition(123456789)) == 123456789);
+	CHECK(clock.FromQpcPosition(clock.ToQpcPosition(-5000)) == -5000);
+	CHECK(clock.FromQpcPosition((uint64_t)PresentationClock::Qpc100ns()) >= now);
+}
+
+int main() {
+	TestOrdering();
+	TestStalledStream();
+	TestClockQpcPositions();
+	return TEST_RESULT();
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <random>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+/*
+Synthetic elementary streams for ts_muxer, and a way to run it. The muxer is
+its own executable, configured through its environment, and writes its
+segments and playlist to the directory it runs in
+*/
+
+typedef struct EsStream {
+	std::vector<uint8_t> data;
+	// Where each access unit or ADTS frame starts in data
+	std::vector<size_t> units;
+} EsStream;
+
+typedef struct EnvVar {
+	const char* name;
+	std::string value;
+} EnvVar;
+
+// Never a zero byte, so no start code and no emulation prevention byte shows up
+inline void AppendBody(std::vector<uint8_t>& data, std::mt19937& random, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		data.push_back((uint8_t)(random() % 255 + 1));
+	}
+}
+
+/*
+Annex-B H.264 at the muxer's 25 fps: SPS, PPS and an IDR picture every gop
+pictures, each second by default, P pictures in between, each picture cut
+into the given number of slices. The first slice of a picture has
+first_mb_in_slice 0, a leading 1 bit
+*/
+inline EsStream SyntheticH264(std::mt19937& random, int pictures, int slices, size_t sliceBytes, int gop = 25) {
+	EsStream stream;
+
+	for (int picture = 0; picture < pictures; picture++) {
+		std::vector<uint8_t>& data = stream.data;
+		bool idr = picture % gop == 0;
+
+		stream.units.push_back(data.size());
+		if (idr) {
+			// Baseline profile, 1280x720
+			data.insert(data.end(), { 0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x1f, 0xda, 0x01, 0x40, 0x16, 0xe4 });
+			data.insert(data.end(), { 0x00, 0x00, 0x00, 0x01, 0x68 });
+			AppendBody(data, random, 4);
+		}
+		for (int slice = 0; slice < slices; slice++) {
+			data.insert(data.end(), { 0x00, 0x00, 0x01, (uint8_t)(idr ? 0x65 : 0x41) });
+			data.push_back((uint8_t)(slice == 0 ? 0x80 | random() % 0x80 : 0x40 | random() % 0x40));
+			AppendBody(data, random, random() % (idr ? 3 * sliceBytes : sliceBytes) + 1);
+		}
+	}
+	return stream;
+}
+
+/*
+AAC-LC 48 kHz stereo, one raw data block per frame of minBytes and up to
+rangeBytes more. No 0xff byte in the payload fakes a syncword
+*/
+inline EsStream SyntheticAdts(std::mt19937& random, int frames, size_t minBytes = 100, size_t rangeBytes = 400) {
+	EsStream stream;
+
+	for (int frame = 0; frame < frames; frame++) {
+		std::vector<uint8_t>& data = stream.data;
+		size_t length = random() % rangeBytes + minBytes + 7;
+
+		stream.units.push_back(data.size());
+		data.insert(data.end(), { 0xff, 0xf1, 0x4c, (uint8_t)(0x80 | length >> 11),
+			(uint8_t)(length >> 3), (uint8_t)((length & 7) << 5 | 0x1f), 0xfc });
+		for (size_t i = 7; i < length; i++) {
+			data.push_back((uint8_t)(random() % 0xff));
+		}
+	}
+	return stream;
+}
+
+// Audio frames covering the same time as the pictures at 25 fps
+inline int AdtsFramesFor(int pictures) {
+	return (int)((long long)pictures * 48000 / 1024 / 25);
+}
+
+inline bool WriteFileBytes(const std::string& path, const std::vector<uint8_t>& data) {
+	FILE* file = fopen(path.c_str(), "wb");
+
+	if (file == NULL) {
+		return false;
+	}
+	bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+	return fclose(file) == 0 && written;
+}
+
+inline bool ReadFileBytes(const std::string& path, std::vector<uint8_t>* pData) {
+	FILE* file = fopen(path.c_str(), "rb");
+
+	pData->clear();
+	if (file == NULL) {
+		return false;
+	}
+	uint8_t chunk[65536];
+	size_t size;
+	while ((size = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+		pData->insert(pData->end(), chunk, chunk + size);
+	}
+	fclose(file);
+	return true;
+}
+
+inline std::string ReadFileText(const std::string& path) {
+	std::vector<uint8_t> data;
+	ReadFileBytes(path, &data);
+	return std::string(data.begin(), data.end());
+}
+
+// The segments mux-0, mux-1 and on with the given extension, up to the first missing one
+inline std::vector<std::vector<uint8_t>> ReadSegments(const std::string& dir, const char* extension) {
+	std::vector<std::vector<uint8_t>> segments;
+	std::vector<uint8_t> data;
+
+	while (ReadFileBytes(dir + "/mux-" + std::to_string(segments.size()) + "." + extension, &data)) {
+		segments.push_back(data);
+	}
+	return segments;
+}
+
+inline void MakeDirectory(const std::string& dir) {
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+}
+
+inline void SetEnv(const char* name, const char* value) {
+#ifdef _WIN32
+	_putenv_s(name, value != NULL ? value : "");
+#else
+	if (value != NULL) {
+		setenv(name, value, 1);
+	}
+	else {
+		unsetenv(name);
+	}
+#endif
+}
+
+/*
+Runs the muxer in dir with only the given TSMUX_ variables set, its output
+discarded. Files of an earlier run are removed first, so they cannot pass
+for this one's. Returns the exit status
+*/
+inline int RunMuxer(const std::string& muxer, const std::string& dir, const std::vector<EnvVar>& env) {
+	static const char* const variables[] = {
+		"TSMUX_H264_FILE", "TSMUX_ADTS_FILE", "TSMUX_FORMAT", "TSMUX_THREADS", "TSMUX_LIVE", "TSMUX_PART_MS",
+		"TSMUX_H264_TIMESTAMPS", "TSMUX_ADTS_TIMESTAMPS", "TSMUX_STREAM_INPUT", "TSMUX_SERVICE_NAME", "TSMUX_PROVIDER_NAME"
+	};
+
+	MakeDirectory(dir);
+	for (int index = 0;; index++) {
+		std::string segment = dir + "/mux-" + std::to_string(index);
+		bool removed = remove((segment + ".ts").c_str()) == 0;
+		if (remove((segment + ".m4s").c_str()) != 0 && !removed) {
+			break;
+		}
+	}
+	remove((dir + "/playlist.m3u8").c_str());
+	remove((dir + "/init.mp4").c_str());
+
+	for (const char* name : variables) {
+		SetEnv(name, NULL);
+	}
+	for (const EnvVar& var : env) {
+		SetEnv(var.name, var.value.c_str());
+	}
+	std::string command = "cd \"" + dir + "\" && \"" + muxer + "\" > muxer.log 2>&1";
+	return system(command.c_str());
+}
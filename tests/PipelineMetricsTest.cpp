@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <PipelineMetrics.h>
+#include <TestCheck.h>
+
+// Buckets tile the values without gaps, and every value is known within 1/16
+static void TestBuckets() {
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		uint64_t upper = LatencyHistogram::BucketUpperBound(i);
+		CHECK(LatencyHistogram::BucketIndex(upper) == i);
+		if (i > 0) {
+			CHECK(LatencyHistogram::BucketIndex(LatencyHistogram::BucketUpperBound(i - 1) + 1) == i);
+		}
+	}
+	CHECK(LatencyHistogram::BucketIndex(UINT64_MAX) == HISTOGRAM_BUCKETS - 1);
+
+	std::mt19937_64 random(22);
+	for (int round = 0; round < 100000; round++) {
+		uint64_t ns = random() >> (random() % 64);
+		uint64_t upper = LatencyHistogram::BucketUpperBound(LatencyHistogram::BucketIndex(ns));
+		if (ns < (uint64_t)1 << HISTOGRAM_MAX_EXPONENT) {
+			CHECK(upper >= ns && (double)(upper - ns) <= (double)ns / HISTOGRAM_SUB_BUCKETS + 1);
+		}
+	}
+}
+
+// Quantiles of a long-tailed distribution within a bucket of the exact ones
+static void TestQuantiles() {
+	PipelineMetrics metrics;
+	std::mt19937_64 random(22);
+	std::lognormal_distribution<double> latency(10, 1.5);
+	std::vector<uint64_t> values;
+
+	for (int i = 0; i < 100000; i++) {
+		uint64_t ns = (uint64_t)latency(random);
+		values.push_back(ns);
+		metrics.Record(STAGE_VIDEO_CONVERT, ns);
+	}
+	std::sort(values.begin(), values.end());
+
+	std::unique_ptr<MetricsSnapshot> snapshot(new MetricsSnapshot());
+	metrics.Snapshot(snapshot.get());
+	const HistogramSnapshot& histogram = snapshot->stages[STAGE_VIDEO_CONVERT];
+	CHECK(histogram.count == values.size());
+	for (double quantile : { 0.5, 0.9, 0.99, 1.0 }) {
+		uint64_t exact = values[std::min(values.size() - 1, (size_t)(quantile * values.size()))];
+		uint64_t estimate = HistogramValueAt(histogram, quantile);
+		CHECK(estimate >= exact * 15 / 16 && estimate <= exact + exact / 16 + 1);
+	}
+	CHECK(HistogramValueAt(snapshot->stages[STAGE_AUDIO_WRITE], 0.5) == 0);
+}
+
+// Threads recording at once lose nothing
+static void TestConcurrentRecording() {
+	PipelineMetrics metrics;
+	std::vector<std::thread> threads;
+
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&]() {
+			for (int i = 0; i < 100000; i++) {
+				metrics.Record(STAGE_AUDIO_WRITE, (uint64_t)(i & 1023));
+				metrics.Add(COUNTER_VIDEO_FRAMES);
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	std::unique_ptr<MetricsSnapshot> snapshot(new MetricsSnapshot());
+	metrics.Snapshot(snapshot.get());
+	CHECK(snapshot->stages[STAGE_AUDIO_WRITE].count == 400000);
+	CHECK(snapshot->counters[COUNTER_VIDEO_FRAMES] == 400000);
+}
+
+/*
+The reporter hands out a line per interval and a last one on Stop. A line
+covers the stages that ran in its interval, and every counter
+*/
+static void TestReporter() {
+	PipelineMetrics metrics;
+	std::vector<std::string> lines;
+	int collects = 0;
+
+	metrics.Record(STAGE_VIDEO_CROP, 2000);
+	MetricsReporter reporter(&metrics, 20, [&]() {
+		collects++;
+		metrics.Set(GAUGE_AV_SKEW_US, -123);
+	}, [&](const std::string& line) { lines.push_back(line); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(70));
+	metrics.Record(STAGE_VIDEO_WRITE, 5000);
+	reporter.Stop();
+	reporter.Stop();
+
+	CHECK(lines.size() >= 2 && (int)lines.size() == collects);
+	for (const std::string& line : lines) {
+		CHECK(line.front() == '{' && line.back() == '}' && line.find('\n') == std::string::npos);
+		CHECK(line.find("\"av_skew_us\":-123") != std::string::npos);
+		CHECK(line.find("\"max_av_skew_us\":0") != std::string::npos);
+		// Recorded before the reporter started
+		CHECK(line.find("video_crop") == std::string::npos);
+	}
+	CHECK(lines.back().find("\"video_write\":{\"n\":1,\"mean_us\":5.0,") != std::string::npos);
+}
+
+int main() {
+	TestBuckets();
+	TestQuantiles();
+	TestConcurrentRecording();
+	TestReporter();
+	return TEST_RESULT();
+}
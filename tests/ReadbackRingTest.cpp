@@ -0,0 +1,202 @@
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include <ReadbackRing.h>
+#include <TestCheck.h>
+
+static const unsigned width = 160, height = 90;
+static const long pitch = (long)width * FRAME_BYTES_PER_PIXEL;
+
+/*
+Fake device with staging buffers on a tick clock: a copy lands copyTicks
+after it is issued, and mapping before then stalls until it does
+*/
+class FakeTarget : public ReadbackTarget {
+public:
+	FakeTarget(unsigned depth, unsigned copyTicks)
+		: buffers(depth, std::vector<uint8_t>((size_t)pitch * height)), ready(depth), mapped(depth), copyTicks(copyTicks) {}
+
+	void Copy(unsigned slot, const std::vector<uint8_t>& desktop, const std::vector<FrameRect>& rects) {
+		// A buffer is never written while the CPU reads it
+		CHECK(!mapped[slot]);
+		for (const FrameRect& rect : rects) {
+			for (unsigned y = rect.y; y < rect.y + rect.height; y++) {
+				size_t offset = y * pitch + rect.x * FRAME_BYTES_PER_PIXEL;
+				memcpy(&buffers[slot][offset], &desktop[offset], rect.width * FRAME_BYTES_PER_PIXEL);
+			}
+		}
+		ready[slot] = now + copyTicks;
+	}
+
+	bool MapSlot(unsigned slot, FrameView* pView) override {
+		if ((int)slot == failSlot) {
+			failSlot = -1;
+			return false;
+		}
+		if (now < ready[slot]) {
+			stalledTicks += ready[slot] - now;
+		}
+		mapped[slot] = true;
+		FrameView view = { buffers[slot].data(), pitch, width, height };
+		*pView = view;
+		return true;
+	}
+
+	void UnmapSlot(unsigned slot) override {
+		mapped[slot] = false;
+	}
+
+	uint64_t now = 0;
+	uint64_t stalledTicks = 0;
+	int failSlot = -1;
+private:
+	std::vector<std::vector<uint8_t>> buffers;
+	std::vector<uint64_t> ready;
+	std::vector<bool> mapped;
+	unsigned copyTicks;
+};
+
+static unsigned Pick(std::mt19937& random, unsigned range) {
+	return (unsigned)(random() % range);
+}
+
+static void MoveRegion(std::vector<uint8_t>& desktop, const FrameMove& move) {
+	std::vector<uint8_t> before(desktop);
+	for (unsigned y = 0; y < move.dest.height; y++) {
+		memcpy(&desktop[(move.dest.y + y) * pitch + move.dest.x * FRAME_BYTES_PER_PIXEL],
+			&before[(move.srcY + y) * pitch + move.srcX * FRAME_BYTES_PER_PIXEL], move.dest.width * FRAME_BYTES_PER_PIXEL);
+	}
+}
+
+static bool MirrorMatches(const FrameMirror& mirror, const std::vector<uint8_t>& desktop) {
+	FrameView view = mirror.View();
+	for (unsigned y = 0; y < height; y++) {
+		if (memcmp(view.pData + y * view.pitch, &desktop[y * pitch], pitch) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+A desktop changing by moves and dirty rects, one frame per tick, read back
+as DXGISource does: a frame is read once the ring is full. Returns the
+ticks the CPU stalled in Map. Every frame read is the desktop at its
+capture, in capture order, the first one copied in full
+*/
+static uint64_t RunFrames(unsigned depth, unsigned copyTicks, int failAt = -1) {
+	std::mt19937 random(23 + depth);
+	FakeTarget target(depth, copyTicks);
+	ReadbackRing ring(&target, depth);
+	FrameMirror mirror(width, height);
+	std::vector<uint8_t> desktop((size_t)pitch * height);
+	std::vector<std::vector<uint8_t>> history;
+	uint64_t expected = 0;
+	bool synced = false;
+	const int frames = 100;
+
+	for (uint8_t& byte : desktop) {
+		byte = (uint8_t)random();
+	}
+	auto readOldest = [&]() {
+		uint64_t qpc = 0;
+		if (!ring.ReadOldest(&mirror, &qpc)) {
+			// The mirror missed that frame's changes: start over from a full copy
+			ring.Clear();
+			synced = false;
+			return;
+		}
+		CHECK(qpc >= expected && qpc < history.size());
+		CHECK(failAt >= 0 || qpc == expected);
+		CHECK(MirrorMatches(mirror, history[qpc]));
+		expected = qpc + 1;
+	};
+
+	for (int frame = 0; frame < frames; frame++, target.now++) {
+		if (ring.Full()) {
+			readOldest();
+		}
+
+		std::vector<FrameMove> moves;
+		std::vector<FrameRect> rects;
+		if (random() % 3 == 0) {
+			FrameMove move = { Pick(random, 40), Pick(random, 40), { Pick(random, 40), Pick(random, 40), 100, 40 } };
+			MoveRegion(desktop, move);
+			moves.push_back(move);
+			rects.push_back(move.dest);
+		}
+		for (int i = random() % 4; i > 0; i--) {
+			FrameRect rect = { Pick(random, width - 32), Pick(random, height - 32), Pick(random, 32) + 1, Pick(random, 32) + 1 };
+			for (unsigned y = rect.y; y < rect.y + rect.height; y++) {
+				for (unsigned x = rect.x * FRAME_BYTES_PER_PIXEL; x < (rect.x + rect.width) * FRAME_BYTES_PER_PIXEL; x++) {
+					desktop[y * pitch + x] = (uint8_t)random();
+				}
+			}
+			rects.push_back(rect);
+		}
+		if (!synced) {
+			moves.clear();
+			rects.assign(1, FrameRect{ 0, 0, width, height });
+			synced = true;
+		}
+
+		history.push_back(desktop);
+		if (frame == failAt) {
+			target.failSlot = (int)ring.NextSlot();
+		}
+		target.Copy(ring.NextSlot(), desktop, rects);
+		ring.Push(history.size() - 1, moves, rects);
+		CHECK(ring.Pending() <= depth);
+	}
+
+	while (ring.Pending() > 0) {
+		target.now++;
+		readOldest();
+	}
+	CHECK(failAt >= 0 || expected == history.size());
+	return target.stalledTicks;
+}
+
+// Copies taking three frames stall Map with fewer than three buffers, never with three or more
+static void TestReadbackOverlapsCopies() {
+	CHECK(RunFrames(1, 3) > 0);
+	CHECK(RunFrames(2, 3) > 0);
+	CHECK(RunFrames(3, 3) == 0);
+	CHECK(RunFrames(4, 3) == 0);
+	CHECK(RunFrames(1, 0) == 0);
+}
+
+// A buffer that cannot be mapped drops its frame; a full copy brings the mirror back
+static void TestFailedMapDropsFrame() {
+	RunFrames(3, 3, 50);
+}
+
+static void TestSlots() {
+	FakeTarget target(3, 0);
+	ReadbackRing ring(&target, 3);
+	FrameMirror mirror(width, height);
+	const std::vector<FrameMove> moves;
+	const std::vector<FrameRect> rects;
+	uint64_t qpc = 0;
+
+	CHECK(ring.Pending() == 0 && !ring.Full() && ring.NextSlot() == 0);
+	CHECK(!ring.ReadOldest(&mirror, &qpc));
+	for (unsigned i = 0; i < 3; i++) {
+		CHECK(ring.NextSlot() == i);
+		ring.Push(100 + i, moves, rects);
+	}
+	CHECK(ring.Full());
+	CHECK(ring.ReadOldest(&mirror, &qpc) && qpc == 100);
+	// The freed buffer is the next one copied into
+	CHECK(ring.NextSlot() == 0 && ring.Pending() == 2);
+	ring.Clear();
+	CHECK(ring.Pending() == 0 && !ring.ReadOldest(&mirror, &qpc));
+}
+
+int main() {
+	TestSlots();
+	TestReadbackOverlapsCopies();
+	TestFailedMapDropsFrame();
+	return TEST_RESULT();
+}
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include <SlotPool.h>
+#include <TestCheck.h>
+
+static void TestExhaustion() {
+	SlotPool pool(2);
+
+	int first = pool.TryAcquire();
+	int second = pool.TryAcquire();
+	CHECK(first >= 0 && second >= 0 && first != second);
+	CHECK(pool.TryAcquire() == -1);
+	CHECK(pool.Acquire(5) == -1);
+
+	// Releasing twice, or a slot the pool never handed out, changes nothing
+	pool.Release(first);
+	pool.Release(first);
+	pool.Release(7);
+	CHECK(pool.TryAcquire() == first);
+
+	SlotPoolStats stats = pool.Stats();
+	CHECK(stats.acquired == 3);
+	CHECK(stats.released == 1);
+	CHECK(stats.exhausted == 2);
+	CHECK(stats.timeouts == 1);
+	CHECK(stats.inUse == 2 && stats.maxInUse == 2);
+}
+
+// A slow consumer holds slots; the producer never gets one that is still held
+static void TestProducerConsumer() {
+	const int frames = 3000;
+	SlotPool pool(4);
+	std::mutex queueLock;
+	std::deque<int> queue;
+	std::vector<std::atomic<int>> owners(4);
+	std::atomic<bool> done(false);
+	std::atomic<int> shared(0);
+
+	std::thread consumer([&]() {
+		while (true) {
+			int slot = -1;
+			{
+				std::lock_guard<std::mutex> guard(queueLock);
+				if (!queue.empty()) {
+					slot = queue.front();
+					queue.pop_front();
+				}
+			}
+			if (slot < 0) {
+				if (done) {
+					break;
+				}
+				std::this_thread::yield();
+				continue;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			owners[slot] = 0;
+			pool.Release(slot);
+		}
+	});
+
+	int dropped = 0;
+	for (int i = 0; i < frames; i++) {
+		int slot = pool.Acquire(100);
+		if (slot < 0) {
+			dropped++;
+			continue;
+		}
+		if (owners[slot].exchange(1) != 0) {
+			shared++;
+		}
+		std::lock_guard<std::mutex> guard(queueLock);
+		queue.push_back(slot);
+	}
+	done = true;
+	consumer.join();
+
+	SlotPoolStats stats = pool.Stats();
+	CHECK(shared == 0);
+	CHECK(stats.acquired == (uint64_t)(frames - dropped));
+	CHECK(stats.released == stats.acquired);
+	CHECK(stats.inUse == 0);
+	CHECK(stats.maxInUse <= 4);
+}
+
+int main() {
+	TestExhaustion();
+	TestProducerConsumer();
+	return TEST_RESULT();
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <SpscRing.h>
+#include <TestCheck.h>
+
+static void TestWrapAndOverrun() {
+	SpscRing ring(1000);
+	uint8_t data[600];
+	uint8_t out[1024];
+
+	CHECK(ring.Capacity() == 1024);
+	for (size_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)i;
+	}
+
+	CHECK(ring.Write(data, 600));
+	CHECK(ring.Read(out, 1024) == 600);
+	// This one wraps around the end of the storage
+	CHECK(ring.Write(data, 600));
+	CHECK(ring.WriteZeros(400));
+	CHECK(ring.ReadAvailable() == 1000 && ring.WriteAvailable() == 24);
+
+	// Neither fits: nothing is written and both count as overruns
+	CHECK(!ring.Write(data, 25));
+	CHECK(!ring.WriteZeros(25));
+	CHECK(ring.Overruns() == 2);
+
+	// Reads stop at a whole number of granules
+	CHECK(ring.Read(out, 1024, 7) == 994);
+	CHECK(std::equal(data, data + 600, out));
+	CHECK(std::count(out + 600, out + 994, 0) == 394);
+	CHECK(ring.ReadAvailable() == 6);
+	CHECK(ring.Read(out, 1024, 7) == 0);
+}
+
+// A producer and a consumer moving a numbered byte stream in uneven chunks
+static void TestConcurrentStream() {
+	const size_t total = 20000000;
+	SpscRing ring(1000);
+	std::atomic<size_t> corrupted(0);
+
+	std::thread producer([&]() {
+		uint8_t chunk[333];
+		size_t written = 0;
+		while (written < total) {
+			size_t size = std::min<size_t>(1 + (written * 7) % sizeof(chunk), total - written);
+			for (size_t i = 0; i < size; i++) {
+				chunk[i] = (uint8_t)(written + i);
+			}
+			if (ring.Write(chunk, size)) {
+				written += size;
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	uint8_t out[512];
+	size_t read = 0;
+	while (read < total) {
+		size_t size = ring.Read(out, sizeof(out), read % 3 + 1);
+		for (size_t i = 0; i < size; i++) {
+			if (out[i] != (uint8_t)(read + i)) {
+				corrupted++;
+			}
+		}
+		read += size;
+		if (size == 0) {
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+
+	CHECK(corrupted == 0);
+	CHECK(ring.ReadAvailable() == 0);
+}
+
+int main() {
+	TestWrapAndOverrun();
+	TestConcurrentStream();
+	return TEST_RESULT();
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdio.h>
+
+/*
+Checks for the test executables, which run without a framework. A failed CHECK
+reports itself and the test carries on; main returns TEST_RESULT()
+*/
+static int testFailures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+			testFailures++; \
+		} \
+	} while (0)
+
+#define TEST_RESULT() (testFailures == 0 ? 0 : 1)
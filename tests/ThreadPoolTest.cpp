@@ -0,0 +1,38 @@
+#include <atomic>
+#include <vector>
+
+#include <TestCheck.h>
+#include <ThreadPool.h>
+
+// Every index runs exactly once per call, however many calls follow each other
+static void TestEveryIndexOnce() {
+	ThreadPool pool(4);
+	CHECK(pool.ThreadCount() == 4);
+
+	for (int call = 0; call < 5000; call++) {
+		std::vector<int> runs(37, 0);
+		pool.ParallelFor((unsigned)runs.size(), [&](unsigned index) { runs[index]++; });
+		for (int count : runs) {
+			CHECK(count == 1);
+		}
+	}
+
+	std::atomic<int> calls(0);
+	pool.ParallelFor(0, [&](unsigned) { calls++; });
+	CHECK(calls == 0);
+}
+
+static void TestSingleThread() {
+	ThreadPool pool(1);
+	unsigned sum = 0;
+
+	CHECK(pool.ThreadCount() == 1);
+	pool.ParallelFor(100, [&](unsigned index) { sum += index; });
+	CHECK(sum == 4950);
+}
+
+int main() {
+	TestEveryIndexOnce();
+	TestSingleThread();
+	return TEST_RESULT();
+}
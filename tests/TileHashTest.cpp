@@ -0,0 +1,164 @@
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include <TileHash.h>
+#include <TestCheck.h>
+
+/*
+On an odd-sized rect inside a larger frame, with every kernel, pooled or not:
+every tile is new at first, nothing changes on a repeat, and flipping a bit of
+any pixel marks exactly its tile, as does flipping it back. Pixels outside the
+rect are not looked at
+*/
+static void TestSinglePixelChanges() {
+	const unsigned width = 150, height = 70, frameWidth = width + 3, frameHeight = height + 2;
+	const long pitch = (long)frameWidth * FRAME_BYTES_PER_PIXEL;
+	std::mt19937 random(25);
+	std::vector<uint8_t> frame((size_t)pitch * frameHeight);
+	for (uint8_t& byte : frame) {
+		byte = (uint8_t)random();
+	}
+	FrameView view = { frame.data(), pitch, frameWidth, frameHeight };
+	FrameRect rect = { 2, 1, width, height };
+	ThreadPool pool(4);
+
+	for (int kernel = HASH_KERNEL_SCALAR; kernel <= HASH_KERNEL_AVX2; kernel++) {
+		for (ThreadPool* pPool : { (ThreadPool*)nullptr, &pool }) {
+			TileChangeDetector detector(width, height, pPool, (HashKernel)kernel);
+			const TileChangeMap& changes = detector.Changes();
+
+			CHECK(detector.Update(view, rect) && changes.changed == changes.tilesX * changes.tilesY);
+			CHECK(detector.Update(view, rect) && changes.changed == 0);
+
+			unsigned missed = 0;
+			for (unsigned y = 0; y < height; y++) {
+				for (unsigned x = 0; x < width; x++) {
+					uint8_t& byte = frame[(size_t)(rect.y + y) * pitch + (rect.x + x) * FRAME_BYTES_PER_PIXEL + (x + y) % 4];
+					uint8_t before = byte;
+					byte ^= (uint8_t)(1 << (x * 7 + y) % 8);
+					detector.Update(view, rect);
+					missed += changes.changed != 1 || !changes.Changed(x / CHANGE_TILE_SIZE, y / CHANGE_TILE_SIZE);
+					byte = before;
+					detector.Update(view, rect);
+					missed += changes.changed != 1 || !changes.Changed(x / CHANGE_TILE_SIZE, y / CHANGE_TILE_SIZE);
+				}
+			}
+			CHECK(missed == 0);
+
+			frame[0] ^= 0xff;
+			frame[frame.size() - 1] ^= 0xff;
+			CHECK(detector.Update(view, rect) && changes.changed == 0);
+
+			detector.Reset();
+			CHECK(detector.Update(view, rect) && changes.changed == changes.tilesX * changes.tilesY);
+		}
+	}
+
+	TileChangeDetector detector(width, height);
+	FrameRect outside = { 10, 0, width, height };
+	CHECK(!detector.Update(view, outside));
+}
+
+// Kernels mark the same tiles over random edits, pixels swapped within a column included
+static void TestKernelsMatch() {
+	const unsigned width = 150, height = 70;
+	const long pitch = (long)width * FRAME_BYTES_PER_PIXEL;
+	std::mt19937 random(25);
+	std::vector<uint8_t> frame((size_t)pitch * height);
+	for (uint8_t& byte : frame) {
+		byte = (uint8_t)random();
+	}
+	FrameView view = { frame.data(), pitch, width, height };
+	FrameRect rect = { 0, 0, width, height };
+	ThreadPool pool(4);
+	TileChangeDetector scalar(width, height, nullptr, HASH_KERNEL_SCALAR);
+	TileChangeDetector sse41(width, height, nullptr, HASH_KERNEL_SSE41);
+	TileChangeDetector avx2(width, height, &pool, HASH_KERNEL_AVX2);
+
+	for (int round = 0; round < 300; round++) {
+		for (int i = random() % 4; i > 0; i--) {
+			frame[random() % frame.size()] = (uint8_t)random();
+		}
+		if (round % 7 == 0) {
+			unsigned x = random() % width, y0 = random() % height, y1 = random() % height;
+			uint8_t* p0 = &frame[(size_t)y0 * pitch + x * FRAME_BYTES_PER_PIXEL];
+			uint8_t* p1 = &frame[(size_t)y1 * pitch + x * FRAME_BYTES_PER_PIXEL];
+			uint8_t swap[FRAME_BYTES_PER_PIXEL];
+			memcpy(swap, p0, sizeof(swap));
+			memcpy(p0, p1, sizeof(swap));
+			memcpy(p1, swap, sizeof(swap));
+		}
+		scalar.Update(view, rect);
+		sse41.Update(view, rect);
+		avx2.Update(view, rect);
+		CHECK(sse41.Changes().bits == scalar.Changes().bits);
+		CHECK(avx2.Changes().bits == scalar.Changes().bits);
+	}
+}
+
+/*
+A 1080p desktop: static for a while, then a blinking cursor, a band scrolled
+by a row, a full change and a change in the partial corner tile, each found
+as the tiles and rects it touches
+*/
+static void TestDesktopSequence() {
+	const unsigned width = 1920, height = 1080;
+	std::vector<uint8_t> screen((size_t)width * height * FRAME_BYTES_PER_PIXEL);
+	for (size_t i = 0; i < screen.size(); i++) {
+		screen[i] = (uint8_t)(i * 2654435761u >> 11);
+	}
+	FrameView view = { screen.data(), (long)width * FRAME_BYTES_PER_PIXEL, width, height };
+	FrameRect rect = { 0, 0, width, height };
+	ThreadPool pool;
+	TileChangeDetector detector(width, height, &pool);
+	const TileChangeMap& changes = detector.Changes();
+	const unsigned tiles = changes.tilesX * changes.tilesY;
+
+	CHECK(detector.Update(view, rect) && changes.changed == tiles);
+	for (int i = 0; i < 10; i++) {
+		CHECK(detector.Update(view, rect) && changes.changed == 0);
+	}
+
+	for (int blink = 0; blink < 4; blink++) {
+		for (unsigned y = 460; y < 476; y++) {
+			for (unsigned x = 700; x < 702; x++) {
+				screen[((size_t)y * width + x) * FRAME_BYTES_PER_PIXEL] ^= 0xff;
+			}
+		}
+		DirtyRegion region;
+		detector.Update(view, rect);
+		detector.ChangedRects(&region);
+		CHECK(changes.changed == 1 && changes.Changed(700 / CHANGE_TILE_SIZE, 460 / CHANGE_TILE_SIZE));
+		CHECK(region.Rects().size() == 1 && region.Rects()[0].x == 640 && region.Rects()[0].y == 448 && region.Rects()[0].width == 64);
+	}
+
+	// Rows 200 to 299 up by one, over tile rows 3 and 4
+	const size_t rowBytes = (size_t)width * FRAME_BYTES_PER_PIXEL;
+	memmove(&screen[200 * rowBytes], &screen[201 * rowBytes], 99 * rowBytes);
+	DirtyRegion scrolled;
+	detector.Update(view, rect);
+	detector.ChangedRects(&scrolled);
+	CHECK(changes.changed == 2 * changes.tilesX);
+	CHECK(scrolled.Rects().size() == 1 && scrolled.Rects()[0].y == 192 && scrolled.Rects()[0].height == 128 && scrolled.Rects()[0].width == width);
+
+	for (uint8_t& byte : screen) {
+		byte++;
+	}
+	CHECK(detector.Update(view, rect) && changes.changed == tiles);
+
+	// 1080 rows leave 56 in the last tile row
+	screen[screen.size() - FRAME_BYTES_PER_PIXEL] ^= 1;
+	DirtyRegion corner;
+	detector.Update(view, rect);
+	detector.ChangedRects(&corner);
+	CHECK(changes.changed == 1 && changes.Changed(changes.tilesX - 1, changes.tilesY - 1));
+	CHECK(corner.Rects().size() == 1 && corner.Rects()[0].height == 56);
+}
+
+int main() {
+	TestSinglePixelChanges();
+	TestKernelsMatch();
+	TestDesktopSequence();
+	return TEST_RESULT();
+}
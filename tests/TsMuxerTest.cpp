@@ -0,0 +1,877 @@
+#include <math.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#endif
+
+#include <MuxerHarness.h>
+#include <TestCheck.h>
+
+// The muxer executable, passed by ctest
+static std::string muxer;
+
+typedef struct TsPid {
+	int packets = 0;
+	int continuity = -1;
+	// Each payload unit, PES packets with their headers
+	std::vector<std::vector<uint8_t>> units;
+	// The PCR base of each packet with one, with the unit that packet belongs to
+	std::vector<std::pair<size_t, long long>> pcrs;
+} TsPid;
+
+/*
+Splits the segments into packets, checking sync bytes, alignment and the
+continuity counters of every PID across segment boundaries, and gathers
+the payload units of each PID
+*/
+static std::map<int, TsPid> Demux(const std::vector<std::vector<uint8_t>>& segments) {
+	std::map<int, TsPid> pids;
+
+	for (const std::vector<uint8_t>& segment : segments) {
+		CHECK(!segment.empty() && segment.size() % 188 == 0);
+		for (size_t pos = 0; pos + 188 <= segment.size(); pos += 188) {
+			const uint8_t* packet = &segment[pos];
+			int pid = (packet[1] & 0x1f) << 8 | packet[2];
+			int control = packet[3] >> 4 & 3;
+			int continuity = packet[3] & 0x0f;
+			size_t payload = 4 + ((control & 2) != 0 ? 1 + packet[4] : 0);
+			TsPid& stream = pids[pid];
+
+			CHECK(packet[0] == 0x47);
+			CHECK((control & 1) != 0 && payload <= 188);
+			if (stream.continuity >= 0) {
+				CHECK(continuity == ((stream.continuity + 1) & 0x0f));
+			}
+			stream.continuity = continuity;
+			stream.packets++;
+
+			if ((packet[1] & 0x40) != 0) {
+				stream.units.emplace_back();
+			}
+			if (!stream.units.empty() && payload < 188) {
+				stream.units.back().insert(stream.units.back().end(), packet + payload, packet + 188);
+			}
+			if ((control & 2) != 0 && packet[4] >= 7 && (packet[5] & 0x10) != 0 && !stream.units.empty()) {
+				long long pcr = (long long)packet[6] << 25 | packet[7] << 17 | packet[8] << 9 | packet[9] << 1 | packet[10] >> 7;
+				stream.pcrs.push_back(std::make_pair(stream.units.size() - 1, pcr));
+			}
+		}
+	}
+	return pids;
+}
+
+static void WriteInputs(const std::string& dir, const EsStream& video, const EsStream& audio) {
+	MakeDirectory(dir);
+	CHECK(WriteFileBytes(dir + "/video.h264", video.data));
+	CHECK(WriteFileBytes(dir + "/audio.aac", audio.data));
+}
+
+static std::vector<EnvVar> InputVars() {
+	return { { "TSMUX_H264_FILE", "video.h264" }, { "TSMUX_ADTS_FILE", "audio.aac" } };
+}
+
+/*
+Ten seconds of video and audio: 4 s segments, each with a PAT and a PMT up
+front, packets whole and continuous, PES packets on the H.264 and ADTS PIDs
+*/
+static void TestPacketStructure() {
+	const std::string dir = "mux-structure";
+	const int pictures = 250;
+	std::mt19937 random(11);
+	EsStream video = SyntheticH264(random, pictures, 1, 3000);
+	EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures));
+
+	WriteInputs(dir, video, audio);
+	CHECK(RunMuxer(muxer, dir, InputVars()) == 0);
+
+	std::vector<std::vector<uint8_t>> segments = ReadSegments(dir, "ts");
+	CHECK(segments.size() == 3);
+	// A segment is cut at the packet opening its first picture, the PAT and the PMT follow it
+	for (const std::vector<uint8_t>& segment : segments) {
+		int psi = 0;
+		for (size_t pos = 0; pos < 3 * 188 && pos + 188 <= segment.size(); pos += 188) {
+			int pid = (segment[pos + 1] & 0x1f) << 8 | segment[pos + 2];
+			psi += pid == 0x0000 || pid == 0x1000;
+		}
+		CHECK(psi == 2);
+	}
+
+	std::map<int, TsPid> pids = Demux(segments);
+	CHECK(pids.size() == 4);
+	CHECK(pids[0x0000].packets > 0 && pids[0x1000].packets == pids[0x0000].packets);
+	for (int pid : { 256, 257 }) {
+		CHECK(!pids[pid].units.empty());
+		for (const std::vector<uint8_t>& unit : pids[pid].units) {
+			CHECK(unit.size() > 9 && unit[0] == 0x00 && unit[1] == 0x00 && unit[2] == 0x01);
+		}
+	}
+	// 100 pictures at 25 fps, the picture that cuts a segment counted in the next
+	std::string playlist = ReadFileText(dir + "/playlist.m3u8");
+	CHECK(playlist.find("#EXT-X-ENDLIST") != std::string::npos);
+	CHECK(playlist.find("#EXTINF:4.000\nmux-0.ts\n#EXTINF:4.000\nmux-1.ts\n#EXTINF:2.000\nmux-2.ts\n") != std::string::npos);
+}
+
+// The bytes of a PES packet after its header
+static std::vector<uint8_t> PesPayload(const std::vector<uint8_t>& pes) {
+	if (pes.size() < 9 || pes.size() < 9 + (size_t)pes[8]) {
+		return std::vector<uint8_t>();
+	}
+	return std::vector<uint8_t>(pes.begin() + 9 + pes[8], pes.end());
+}
+
+// The PTS of a PES packet, -1 without one
+static long long PesPts(const std::vector<uint8_t>& pes) {
+	if (pes.size() < 14 || (pes[7] & 0x80) == 0) {
+		return -1;
+	}
+	return (long long)(pes[9] >> 1 & 7) << 30 | pes[10] << 22 | (pes[11] >> 1) << 15 | pes[12] << 7 | pes[13] >> 1;
+}
+
+// The DTS of a PES packet, its PTS when it has none
+static long long PesDts(const std::vector<uint8_t>& pes) {
+	if (pes.size() < 19 || (pes[7] & 0xc0) != 0xc0) {
+		return PesPts(pes);
+	}
+	return (long long)(pes[14] >> 1 & 7) << 30 | pes[15] << 22 | (pes[16] >> 1) << 15 | pes[17] << 7 | pes[18] >> 1;
+}
+
+static std::vector<uint8_t> Unit(const EsStream& stream, size_t index) {
+	size_t end = index + 1 < stream.units.size() ? stream.units[index + 1] : stream.data.size();
+	return std::vector<uint8_t>(stream.data.begin() + stream.units[index], stream.data.begin() + end);
+}
+
+/*
+One PES packet per picture and per ADTS frame, the last of each included,
+carrying exactly the input: an access unit delimiter goes before each picture.
+ADTS PES packets are as long as they say
+*/
+static void CheckPayloads(const std::map<int, TsPid>& pids, const EsStream& video, const EsStream& audio) {
+	const std::vector<std::vector<uint8_t>>& pictures = pids.at(256).units;
+	const std::vector<std::vector<uint8_t>>& frames = pids.at(257).units;
+	const uint8_t delimiter[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xf0 };
+
+	CHECK(pictures.size() == video.units.size());
+	for (size_t i = 0; i < pictures.size() && i < video.units.size(); i++) {
+		std::vector<uint8_t> expected(delimiter, delimiter + sizeof(delimiter));
+		std::vector<uint8_t> unit = Unit(video, i);
+		expected.insert(expected.end(), unit.begin(), unit.end());
+		CHECK(PesPayload(pictures[i]) == expected);
+	}
+
+	CHECK(frames.size() == audio.units.size());
+	for (size_t i = 0; i < frames.size() && i < audio.units.size(); i++) {
+		const std::vector<uint8_t>& pes = frames[i];
+		CHECK(PesPayload(pes) == Unit(audio, i));
+		CHECK(pes.size() >= 6 && (size_t)(pes[4] << 8 | pes[5]) == pes.size() - 6);
+	}
+}
+
+/*
+Inputs over the 1 MiB stream chunk, mapped and read as a stream: the same
+output, with every unit in it
+*/
+static void TestPayloadsAndInputModes() {
+	const std::string mapped = "mux-mapped", streamed = "mux-streamed";
+	const int pictures = 500;
+	std::mt19937 random(12);
+	EsStream video = SyntheticH264(random, pictures, 1, 6000);
+	EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures));
+	std::vector<EnvVar> streamVars = InputVars();
+
+	streamVars.push_back({ "TSMUX_STREAM_INPUT", "1" });
+	WriteInputs(mapped, video, audio);
+	WriteInputs(streamed, video, audio);
+	CHECK(RunMuxer(muxer, mapped, InputVars()) == 0);
+	CHECK(RunMuxer(muxer, streamed, streamVars) == 0);
+
+	std::vector<std::vector<uint8_t>> segments = ReadSegments(mapped, "ts");
+	CHECK(segments.size() == 5);
+	CHECK(ReadSegments(streamed, "ts") == segments);
+	CHECK(ReadFileText(streamed + "/playlist.m3u8") == ReadFileText(mapped + "/playlist.m3u8"));
+	CheckPayloads(Demux(segments), video, audio);
+}
+
+// A service name adds an SDT, sent as often as the PAT
+static void TestServiceDescription() {
+	const std::string dir = "mux-service";
+	const int pictures = 50;
+	std::mt19937 random(18);
+	EsStream video = SyntheticH264(random, pictures, 1, 3000);
+	EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures));
+	std::vector<EnvVar> env = InputVars();
+
+	env.push_back({ "TSMUX_SERVICE_NAME", "Recording" });
+	env.push_back({ "TSMUX_PROVIDER_NAME", "Loom" });
+	WriteInputs(dir, video, audio);
+	CHECK(RunMuxer(muxer, dir, env) == 0);
+
+	std::map<int, TsPid> pids = Demux(ReadSegments(dir, "ts"));
+	CHECK(pids[0x0011].packets > 0 && pids[0x0011].packets == pids[0x0000].packets);
+	for (const std::vector<uint8_t>& unit : pids[0x0011].units) {
+		std::string section(unit.begin(), unit.end());
+		CHECK(section.find("\x04Loom\x09Recording") != std::string::npos);
+	}
+}
+
+/*
+Segments muxed in parallel, whatever the thread count, are the sequential
+ones byte for byte, playlist too. Multi-slice pictures are one PES packet
+each, 3600 ticks apart
+*/
+static void TestParallelMatchesSequential() {
+	const std::string sequential = "mux-sequential";
+	const int pictures = 25 * 30;
+	std::mt19937 random(17);
+	EsStream video = SyntheticH264(random, pictures, 3, 2000);
+	EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures));
+
+	WriteInputs(sequential, video, audio);
+	CHECK(RunMuxer(muxer, sequential, InputVars()) == 0);
+	std::vector<std::vector<uint8_t>> segments = ReadSegments(sequential, "ts");
+	std::string playlist = ReadFileText(sequential + "/playlist.m3u8");
+	CHECK(segments.size() == 8);
+	CHECK(playlist.find("#EXTINF:4.000\nmux-6.ts\n#EXTINF:2.000\nmux-7.ts\n") != std::string::npos);
+	std::map<int, TsPid> pids = Demux(segments);
+	CheckPayloads(pids, video, audio);
+	const std::vector<std::vector<uint8_t>>& pes = pids[256].units;
+	for (size_t i = 1; i < pes.size(); i++) {
+		CHECK(PesPts(pes[i]) - PesPts(pes[i - 1]) == 3600);
+	}
+
+	for (const char* threads : { "2", "3", "16" }) {
+		const std::string parallel = std::string("mux-parallel-") + threads;
+		std::vector<EnvVar> env = InputVars();
+		env.push_back({ "TSMUX_THREADS", threads });
+		WriteInputs(parallel, video, audio);
+		CHECK(RunMuxer(muxer, parallel, env) == 0);
+		CHECK(ReadSegments(parallel, "ts") == segments);
+		CHECK(ReadFileText(parallel + "/playlist.m3u8") == playlist);
+	}
+
+	// Audio ending after 12 s of the 30: the video goes on alone, and the segments are still muxed in parallel
+	EsStream shortAudio = SyntheticAdts(random, AdtsFramesFor(25 * 12));
+	const std::string truncated = "mux-sequential-short-audio", truncatedParallel = "mux-parallel-short-audio";
+	WriteInputs(truncated, video, shortAudio);
+	CHECK(RunMuxer(muxer, truncated, InputVars()) == 0);
+	std::vector<std::vector<uint8_t>> truncatedSegments = ReadSegments(truncated, "ts");
+	CHECK(truncatedSegments.size() == 8);
+	CheckPayloads(Demux(truncatedSegments), video, shortAudio);
+
+	std::vector<EnvVar> env = InputVars();
+	env.push_back({ "TSMUX_THREADS", "2" });
+	WriteInputs(truncatedParallel, video, shortAudio);
+	CHECK(RunMuxer(muxer, truncatedParallel, env) == 0);
+	CHECK(ReadSegments(truncatedParallel, "ts") == truncatedSegments);
+	CHECK(ReadFileText(truncatedParallel + "/playlist.m3u8") == ReadFileText(truncated + "/playlist.m3u8"));
+	CHECK(ReadFileText(truncatedParallel + "/muxer.log").find("muxing sequentially") == std::string::npos);
+}
+
+typedef struct Mp4Box {
+	std::string type;
+	size_t offset;
+	size_t size;
+} Mp4Box;
+
+static uint32_t BigEndian32(const std::vector<uint8_t>& data, size_t pos) {
+	return (uint32_t)data[pos] << 24 | data[pos + 1] << 16 | data[pos + 2] << 8 | data[pos + 3];
+}
+
+// The boxes from begin to end, which they must fill exactly
+static std::vector<Mp4Box> Boxes(const std::vector<uint8_t>& data, size_t begin, size_t end) {
+	std::vector<Mp4Box> boxes;
+	size_t pos = begin;
+
+	while (pos + 8 <= end) {
+		size_t size = BigEndian32(data, pos);
+		if (size < 8 || pos + size > end) {
+			break;
+		}
+		boxes.push_back({ std::string(data.begin() + pos + 4, data.begin() + pos + 8), pos, size });
+		pos += size;
+	}
+	CHECK(pos == end);
+	return boxes;
+}
+
+// Where the children start: sample entries have their fields first. The file itself has no header
+static size_t ChildrenOffset(const Mp4Box& box) {
+	if (box.type.empty()) {
+		return 0;
+	}
+	return box.type == "stsd" ? 16 : box.type == "avc1" ? 86 : box.type == "mp4a" ? 36 : 8;
+}
+
+// Down the path of box types from parent
+static Mp4Box FindBox(const std::vector<uint8_t>& data, Mp4Box parent, std::initializer_list<const char*> path) {
+	for (const char* type : path) {
+		Mp4Box found = { "", 0, 0 };
+		for (const Mp4Box& child : Boxes(data, parent.offset + ChildrenOffset(parent), parent.offset + parent.size)) {
+			if (child.type == type) {
+				found = child;
+				break;
+			}
+		}
+		CHECK(!found.type.empty());
+		if (found.type.empty()) {
+			return found;
+		}
+		parent = found;
+	}
+	return parent;
+}
+
+// The NAL units of an Annex-B stream without their start codes. The synthetic bodies have no zero byte
+static std::vector<std::vector<uint8_t>> NalUnits(const std::vector<uint8_t>& data) {
+	std::vector<size_t> starts;
+	std::vector<std::vector<uint8_t>> units;
+
+	for (size_t i = 0; i + 3 <= data.size(); i++) {
+		if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+			starts.push_back(i + 3);
+		}
+	}
+	for (size_t i = 0; i < starts.size(); i++) {
+		size_t end = i + 1 < starts.size() ? starts[i + 1] - 3 : data.size();
+		while (end > starts[i] && data[end - 1] == 0) {
+			end--;
+		}
+		units.emplace_back(data.begin() + starts[i], data.begin() + end);
+	}
+	return units;
+}
+
+/*
+fMP4 of the same inputs: an init segment describing both tracks, then a moof
+and an mdat per segment. Their samples are the input slices in AVCC form and
+its AAC frames without ADTS headers, on timelines without gaps
+*/
+static void TestFmp4() {
+	const std::string dir = "mux-fmp4";
+	const int pictures = 250;
+	std::mt19937 random(16);
+	EsStream video = SyntheticH264(random, pictures, 2, 3000);
+	EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures));
+	std::vector<EnvVar> env = InputVars();
+
+	env.push_back({ "TSMUX_FORMAT", "fmp4" });
+	WriteInputs(dir, video, audio);
+	CHECK(RunMuxer(muxer, dir, env) == 0);
+
+	std::vector<uint8_t> init;
+	CHECK(ReadFileBytes(dir + "/init.mp4", &init));
+	Mp4Box file = { "", 0, init.size() };
+	std::vector<Mp4Box> top = Boxes(init, 0, init.size());
+	CHECK(top.size() == 2 && top[0].type == "ftyp" && top[1].type == "moov");
+	Mp4Box avc1 = FindBox(init, file, { "moov", "trak", "mdia", "minf", "stbl", "stsd", "avc1" });
+	CHECK(avc1.size > 36 && (init[avc1.offset + 32] << 8 | init[avc1.offset + 33]) == 1280);
+	CHECK(avc1.size > 36 && (init[avc1.offset + 34] << 8 | init[avc1.offset + 35]) == 720);
+	Mp4Box avcC = FindBox(init, avc1, { "avcC" });
+	std::vector<uint8_t> sps = NalUnits(video.data)[0];
+	CHECK(avcC.size >= 16 + sps.size() && std::equal(sps.begin(), sps.end(), init.begin() + avcC.offset + 16));
+	std::vector<Mp4Box> traks;
+	for (const Mp4Box& box : Boxes(init, top[1].offset + 8, top[1].offset + top[1].size)) {
+		if (box.type == "trak") {
+			traks.push_back(box);
+		}
+	}
+	CHECK(traks.size() == 2);
+	if (traks.size() == 2) {
+		FindBox(init, traks[1], { "mdia", "minf", "stbl", "stsd", "mp4a", "esds" });
+	}
+
+	std::vector<std::vector<uint8_t>> segments = ReadSegments(dir, "m4s");
+	std::vector<std::vector<uint8_t>> slices, frames;
+	std::map<uint32_t, uint64_t> timelines;
+	CHECK(segments.size() == 3);
+	for (size_t index = 0; index < segments.size(); index++) {
+		const std::vector<uint8_t>& segment = segments[index];
+		std::vector<Mp4Box> boxes = Boxes(segment, 0, segment.size());
+		CHECK(boxes.size() == 2 && boxes[0].type == "moof" && boxes[1].type == "mdat");
+		if (boxes.size() != 2) {
+			continue;
+		}
+		const Mp4Box& moof = boxes[0];
+		const Mp4Box& mdat = boxes[1];
+		CHECK(BigEndian32(segment, FindBox(segment, moof, { "mfhd" }).offset + 12) == index + 1);
+
+		for (const Mp4Box& traf : Boxes(segment, moof.offset + 8, moof.offset + moof.size)) {
+			if (traf.type != "traf") {
+				continue;
+			}
+			size_t tfhd = FindBox(segment, traf, { "tfhd" }).offset;
+			size_t tfdt = FindBox(segment, traf, { "tfdt" }).offset;
+			size_t trun = FindBox(segment, traf, { "trun" }).offset;
+			uint32_t track = BigEndian32(segment, tfhd + 12);
+			uint32_t defaultDuration = (BigEndian32(segment, tfhd + 8) & 0x000008) != 0 ? BigEndian32(segment, tfhd + 16) : 0;
+			uint64_t base = (uint64_t)BigEndian32(segment, tfdt + 12) << 32 | BigEndian32(segment, tfdt + 16);
+			uint32_t flags = BigEndian32(segment, trun + 8) & 0xffffff;
+			uint32_t count = BigEndian32(segment, trun + 12);
+			size_t pos = moof.offset + BigEndian32(segment, trun + 16), entry = trun + 20;
+			CHECK(base == timelines[track]);
+
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t duration = defaultDuration;
+				if ((flags & 0x000100) != 0) {
+					duration = BigEndian32(segment, entry);
+					entry += 4;
+				}
+				uint32_t size = BigEndian32(segment, entry);
+				entry += 4;
+				uint32_t sampleFlags = 0;
+				if ((flags & 0x000400) != 0) {
+					sampleFlags = BigEndian32(segment, entry);
+					entry += 4;
+				}
+				CHECK(pos >= mdat.offset + 8 && pos + size <= mdat.offset + mdat.size);
+				if (pos + size > segment.size()) {
+					break;
+				}
+				timelines[track] += duration;
+
+				if (track == 1) {
+					bool idr = false;
+					for (size_t nal = pos; nal + 4 <= pos + size;) {
+						size_t length = BigEndian32(segment, nal);
+						CHECK(nal + 4 + length <= pos + size);
+						slices.emplace_back(segment.begin() + nal + 4, segment.begin() + std::min(nal + 4 + length, pos + size));
+						idr = idr || (segment[nal + 4] & 0x1f) == 5;
+						nal += 4 + length;
+					}
+					// Each segment opens on an IDR picture, the one sync sample of a second
+					CHECK(i > 0 || idr);
+					CHECK(sampleFlags == (idr ? 0x02000000u : 0x01010000u));
+				}
+				else {
+					frames.emplace_back(segment.begin() + pos, segment.begin() + pos + size);
+				}
+				pos += size;
+			}
+		}
+	}
+
+	std::vector<std::vector<uint8_t>> expected;
+	for (const std::vector<uint8_t>& nal : NalUnits(video.data)) {
+		int type = nal[0] & 0x1f;
+		if (type != 7 && type != 8 && type != 9) {
+			expected.push_back(nal);
+		}
+	}
+	CHECK(slices == expected);
+	CHECK(frames.size() == audio.units.size());
+	for (size_t i = 0; i < frames.size() && i < audio.units.size(); i++) {
+		std::vector<uint8_t> frame = Unit(audio, i);
+		CHECK(frames[i] == std::vector<uint8_t>(frame.begin() + 7, frame.end()));
+	}
+	CHECK(timelines[1] == (uint64_t)pictures * 90000 / 25);
+	CHECK(timelines[2] == (uint64_t)audio.units.size() * 1024);
+
+	std::string playlist = ReadFileText(dir + "/playlist.m3u8");
+	CHECK(playlist.find("#EXT-X-MAP:URI=\"init.mp4\"\n") != std::string::npos);
+	CHECK(playlist.find("mux-2.m4s\n#EXT-X-ENDLIST") != std::string::npos);
+}
+
+// Decode order of a 25 picture GOP with B pictures: the IDR, then each P picture ahead of the two B pictures it follows
+static int DisplayIndex(int picture) {
+	int inGop = picture % 25;
+	if (inGop == 0) {
+		return picture;
+	}
+	int group = (inGop - 1) / 3, position = (inGop - 1) % 3;
+	return picture - inGop + 3 * group + (position == 0 ? 3 : position);
+}
+
+/*
+Three hours of capture timestamps, jittered by up to 5 ms, video with B
+pictures reordered and audio starting later. Every PES PTS and DTS is its
+timestamp on the 90 kHz clock from the earliest one, without a tick of
+drift by the end; the PCR never goes back and trails the DTS by at most
+the PCR delay; the segments add up to the span of the pictures
+*/
+static void TestTimestampsOverThreeHours() {
+	const std::string dir = "mux-timestamps-3h";
+	const int pictures = 25 * 3600 * 3, frames = AdtsFramesFor(pictures);
+	const long long videoStart = 10000000, audioStart = 10123457, jitter = 50000;
+	std::mt19937 random(19);
+	EsStream video = SyntheticH264(random, pictures, 1, 1);
+	EsStream audio = SyntheticAdts(random, frames, 1, 8);
+
+	// In 100 ns units: pictures 40 ms apart, presented two pictures after they are decoded
+	std::vector<long long> captured(pictures), pts(pictures), dts(pictures), audioPts(frames);
+	for (int i = 0; i < pictures; i++) {
+		captured[i] = videoStart + i * 400000LL + (long long)(random() % (2 * jitter + 1)) - jitter;
+	}
+	std::string videoTimestamps, audioTimestamps;
+	for (int i = 0; i < pictures; i++) {
+		dts[i] = captured[i];
+		pts[i] = captured[DisplayIndex(i)] + 800000;
+		videoTimestamps += std::to_string(pts[i]) + " " + std::to_string(dts[i]) + "\n";
+	}
+	for (int i = 0; i < frames; i++) {
+		audioPts[i] = audioStart + i * 640000LL / 3 + (long long)(random() % (2 * jitter + 1)) - jitter;
+		audioTimestamps += std::to_string(audioPts[i]) + "\n";
+	}
+	const long long origin = std::min(dts[0], audioPts[0]);
+	// The muxer's first dts is twice its initial PCR of 63000
+	auto clock = [&](long long time) { return 126000 + (time - origin) * 90000 / 10000000; };
+
+	WriteInputs(dir, video, audio);
+	WriteFileBytes(dir + "/video.pts", std::vector<uint8_t>(videoTimestamps.begin(), videoTimestamps.end()));
+	WriteFileBytes(dir + "/audio.pts", std::vector<uint8_t>(audioTimestamps.begin(), audioTimestamps.end()));
+	std::vector<EnvVar> env = InputVars();
+	env.push_back({ "TSMUX_H264_TIMESTAMPS", "video.pts" });
+	env.push_back({ "TSMUX_ADTS_TIMESTAMPS", "audio.pts" });
+	CHECK(RunMuxer(muxer, dir, env) == 0);
+
+	std::vector<std::vector<uint8_t>> segments = ReadSegments(dir, "ts");
+	std::map<int, TsPid> pids = Demux(segments);
+	const std::vector<std::vector<uint8_t>>& pes = pids[256].units;
+	const std::vector<std::vector<uint8_t>>& audioPes = pids[257].units;
+	CHECK(pes.size() == (size_t)pictures && audioPes.size() == (size_t)frames);
+	if (pes.size() != (size_t)pictures || audioPes.size() != (size_t)frames) {
+		return;
+	}
+
+	CHECK(PesPts(pes[0]) == clock(pts[0]) && PesDts(pes[0]) == clock(dts[0]));
+	CHECK(PesPts(pes[pictures - 1]) == clock(pts[pictures - 1]) && PesDts(pes[pictures - 1]) == clock(dts[pictures - 1]));
+	CHECK(PesPts(audioPes[0]) == clock(audioPts[0]) && PesPts(audioPes[frames - 1]) == clock(audioPts[frames - 1]));
+	int wrong = 0, reordered = 0;
+	for (int i = 0; i < pictures; i++) {
+		wrong += PesPts(pes[i]) != clock(pts[i]) || PesDts(pes[i]) != clock(dts[i]);
+		reordered += PesPts(pes[i]) != PesDts(pes[i]);
+	}
+	for (int i = 0; i < frames; i++) {
+		wrong += PesPts(audioPes[i]) != clock(audioPts[i]) || PesDts(audioPes[i]) != PesPts(audioPes[i]);
+	}
+	CHECK(wrong == 0 && reordered == pictures);
+
+	// A PCR with each IDR picture
+	const std::vector<std::pair<size_t, long long>>& pcrs = pids[256].pcrs;
+	CHECK(pcrs.size() == (size_t)pictures / 25);
+	long long lastPcr = 0;
+	for (const std::pair<size_t, long long>& pcr : pcrs) {
+		long long lead = PesDts(pes[pcr.first]) - pcr.second;
+		// The PCR delay is the initial PCR
+		CHECK(pcr.second >= lastPcr && lead > 0 && lead <= 63000);
+		lastPcr = pcr.second;
+	}
+
+	// The last picture lasts as long as the interval before it
+	std::string playlist = ReadFileText(dir + "/playlist.m3u8");
+	long long lastDts = clock(dts[pictures - 1]);
+	double span = (double)(2 * lastDts - clock(dts[pictures - 2]) - clock(dts[0])) / 90000;
+	double sum = 0;
+	int count = 0;
+	for (size_t pos = playlist.find("#EXTINF:"); pos != std::string::npos; pos = playlist.find("#EXTINF:", pos + 1)) {
+		sum += atof(playlist.c_str() + pos + 8);
+		count += 1;
+	}
+	CHECK(count == (int)segments.size() && fabs(sum - span) <= 0.0005 * count);
+}
+
+#ifndef _WIN32
+/*
+Feeds a named pipe from its own thread, as a recorder would, holding at
+holdAt until released. Gives up when no reader opens the pipe within ten
+seconds, so a muxer that fails cannot hang the test
+*/
+static std::thread FeedPipe(const std::string& path, const std::vector<uint8_t>& data, size_t holdAt, const std::atomic<bool>& release) {
+	mkfifo(path.c_str(), 0644);
+	return std::thread([path, &data, holdAt, &release]() {
+		int fd = -1;
+		for (int attempt = 0; attempt < 1000 && fd < 0; attempt++) {
+			fd = open(path.c_str(), O_WRONLY | O_NONBLOCK);
+			if (fd < 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+		CHECK(fd >= 0);
+		if (fd < 0) {
+			return;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+		for (size_t pos = 0; pos < data.size();) {
+			if (pos == holdAt) {
+				while (!release) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				}
+			}
+			size_t end = pos < holdAt ? holdAt : data.size();
+			ssize_t written = write(fd, data.data() + pos, std::min<size_t>(end - pos, 4096));
+			if (written < 0 && errno != EINTR) {
+				break;
+			}
+			pos += written > 0 ? (size_t)written : 0;
+		}
+		close(fd);
+	});
+}
+
+/*
+The muxer in live mode on pipes fed with the inputs. With midway, the feeds
+hold at half the units until it returns, so it sees the muxer mid-stream
+*/
+static int RunLiveMuxer(const std::string& dir, const EsStream& video, const EsStream& audio, std::vector<EnvVar> env,
+	std::function<void()> midway = nullptr) {
+	std::atomic<bool> release(!midway);
+	size_t videoHold = midway ? video.units[video.units.size() / 2] : video.data.size();
+	size_t audioHold = midway ? audio.units[audio.units.size() / 2] : audio.data.size();
+	int status = -1;
+
+	MakeDirectory(dir);
+	std::thread videoFeed = FeedPipe(dir + "/video.fifo", video.data, videoHold, release);
+	std::thread audioFeed = FeedPipe(dir + "/audio.fifo", audio.data, audioHold, release);
+	env.push_back({ "TSMUX_H264_FILE", "video.fifo" });
+	env.push_back({ "TSMUX_ADTS_FILE", "audio.fifo" });
+	env.push_back({ "TSMUX_LIVE", "1" });
+	std::thread run([&]() { status = RunMuxer(muxer, dir, env); });
+
+	if (midway) {
+		midway();
+		release = true;
+	}
+	run.join();
+	videoFeed.join();
+	audioFeed.join();
+	return status;
+}
+
+/*
+Live from pipes, without parts: the segments are the offline ones, and the
+playlist slides to keep the last six
+*/
+static void TestLiveFromPipes() {
+	const std::string offline = "mux-offline", live = "mux-live";
+	const int pictures = 25 * 40;
+	std::mt19937 random(14);
+	EsStream video = SyntheticH264(random, pictures, 1, 3000);
+	EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures));
+
+	WriteInputs(offline, video, audio);
+	CHECK(RunMuxer(muxer, offline, InputVars()) == 0);
+	CHECK(RunLiveMuxer(live, video, audio, { { "TSMUX_PART_MS", "0" } }) == 0);
+
+	std::vector<std::vector<uint8_t>> segments = ReadSegments(live, "ts");
+	CHECK(segments.size() == 10);
+	CHECK(segments == ReadSegments(offline, "ts"));
+
+	std::string playlist = ReadFileText(live + "/playlist.m3u8");
+	CHECK(playlist.find("#EXT-X-TARGETDURATION:4\n") != std::string::npos);
+	CHECK(playlist.find("#EXT-X-MEDIA-SEQUENCE:4\n#EXTINF:4.000\nmux-4.ts\n") != std::string::npos);
+	CHECK(playlist.find("mux-3.ts") == std::string::npos);
+	CHECK(playlist.find("mux-4.ts") != std::string::npos && playlist.find("mux-9.ts") != std::string::npos);
+	CHECK(playlist.find("#EXT-X-PART") == std::string::npos);
+	CHECK(playlist.find("#EXT-X-ENDLIST") != std::string::npos);
+	// Publication latency is reported for every segment
+	CHECK(ReadFileText(live + "/muxer.log").find("live: 10 segments, latency") != std::string::npos);
+}
+
+typedef struct LivePart {
+	double duration;
+	int segment;
+	long size;
+	long offset;
+	bool independent;
+} LivePart;
+
+static std::vector<LivePart> ParseParts(const std::string& playlist) {
+	std::vector<LivePart> parts;
+
+	for (size_t pos = playlist.find("#EXT-X-PART:"); pos != std::string::npos; pos = playlist.find("#EXT-X-PART:", pos + 1)) {
+		std::string line = playlist.substr(pos, playlist.find('\n', pos) - pos);
+		LivePart part = {};
+		CHECK(sscanf(line.c_str(), "#EXT-X-PART:DURATION=%lf,URI=\"mux-%d.ts\",BYTERANGE=\"%ld@%ld\"",
+			&part.duration, &part.segment, &part.size, &part.offset) == 4);
+		part.independent = line.find(",INDEPENDENT=YES") != std::string::npos;
+		parts.push_back(part);
+	}
+	return parts;
+}
+
+/*
+A part opens with the first packet of a picture's PES, and is independent
+when that picture is an IDR with its SPS
+*/
+static void CheckPartStart(const std::vector<uint8_t>& segment, const LivePart& part) {
+	CHECK(part.offset % 188 == 0 && part.size % 188 == 0 && (size_t)(part.offset + part.size) <= segment.size());
+	if (part.offset % 188 != 0 || (size_t)part.offset + 188 > segment.size()) {
+		return;
+	}
+	const uint8_t* packet = &segment[part.offset];
+	int control = packet[3] >> 4 & 3;
+	size_t payload = 4 + ((control & 2) != 0 ? 1 + packet[4] : 0);
+	CHECK(((packet[1] & 0x1f) << 8 | packet[2]) == 256 && (packet[1] & 0x40) != 0);
+	CHECK(payload + 9 + 11 <= 188);
+	if (payload + 9 + 11 <= 188) {
+		// The PES header, the delimiter, then the SPS start code of an IDR access unit
+		const uint8_t* es = packet + payload + 9 + packet[payload + 8];
+		bool sps = es + 11 <= packet + 188 && es[6] == 0x00 && es[7] == 0x00 && es[8] == 0x00 && es[9] == 0x01 && (es[10] & 0x1f) == 7;
+		CHECK(sps == part.independent);
+	}
+}
+
+/*
+LL-HLS at 200 ms parts. Mid-stream the open segment is listed part by part,
+ending with a hint at where the next part starts; at the end, the parts of
+the last two segments cover their files back to back
+*/
+static void TestLowLatencyParts() {
+	const std::string dir = "mux-parts";
+	const int pictures = 25 * 10;
+	std::mt19937 random(15);
+	EsStream video = SyntheticH264(random, pictures, 1, 3000);
+	EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures));
+
+	CHECK(RunLiveMuxer(dir, video, audio, { { "TSMUX_PART_MS", "200" } }, [&]() {
+		// Half the input is 5 s: the first segment closes, the second is open
+		std::string playlist;
+		for (int attempt = 0; attempt < 1000; attempt++) {
+			playlist = ReadFileText(dir + "/playlist.m3u8");
+			if (playlist.find("mux-0.ts\n") != std::string::npos && playlist.find("#EXT-X-PRELOAD-HINT") != std::string::npos) {
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		CHECK(playlist.find("#EXT-X-PART-INF:PART-TARGET=0.200\n") != std::string::npos);
+		CHECK(playlist.find("#EXT-X-ENDLIST") == std::string::npos);
+
+		long next = 0;
+		for (const LivePart& part : ParseParts(playlist)) {
+			if (part.segment == 1) {
+				CHECK(part.offset == next);
+				next = part.offset + part.size;
+			}
+		}
+		char hint[80];
+		snprintf(hint, sizeof(hint), "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"mux-1.ts\",BYTERANGE-START=%ld\n", next);
+		CHECK(playlist.find(hint) != std::string::npos);
+	}) == 0);
+
+	std::vector<std::vector<uint8_t>> segments = ReadSegments(dir, "ts");
+	std::vector<LivePart> parts = ParseParts(ReadFileText(dir + "/playlist.m3u8"));
+	std::map<int, long> covered;
+	CHECK(segments.size() == 3 && !parts.empty());
+	for (const LivePart& part : parts) {
+		CHECK(part.segment >= 1 && part.segment < (int)segments.size());
+		CHECK(part.duration > 0 && part.duration <= 0.2005);
+		CHECK(part.offset == covered[part.segment]);
+		covered[part.segment] = part.offset + part.size;
+		if (part.segment >= 0 && part.segment < (int)segments.size()) {
+			CheckPartStart(segments[part.segment], part);
+		}
+	}
+	for (const auto& entry : covered) {
+		CHECK(entry.second == (long)segments[entry.first].size());
+	}
+	CHECK(ReadFileText(dir + "/muxer.log").find("parts, latency from the last frame of a part") != std::string::npos);
+}
+
+/*
+40 ms parts, one picture each, in a 10 s GOP: the first segment runs to the
+second IDR picture, its 250 parts all within the target and adding up to it
+*/
+static void TestPartsOfLongSegments() {
+	const std::string dir = "mux-parts-long";
+	const int pictures = 25 * 12;
+	std::mt19937 random(15);
+	EsStream video = SyntheticH264(random, pictures, 1, 1000, 250);
+	EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures));
+
+	CHECK(RunLiveMuxer(dir, video, audio, { { "TSMUX_PART_MS", "40" } }) == 0);
+
+	std::string playlist = ReadFileText(dir + "/playlist.m3u8");
+	std::vector<LivePart> parts = ParseParts(playlist);
+	int firstParts = 0;
+	double firstSum = 0;
+	CHECK(playlist.find("#EXT-X-PART-INF:PART-TARGET=0.040\n") != std::string::npos);
+	CHECK(playlist.find("#EXTINF:10.000\nmux-0.ts\n") != std::string::npos);
+	for (const LivePart& part : parts) {
+		CHECK(part.duration > 0 && part.duration <= 0.0405);
+		if (part.segment == 0) {
+			firstParts += 1;
+			firstSum += part.duration;
+		}
+	}
+	CHECK(firstParts == 250 && fabs(firstSum - 10) < 0.001);
+}
+
+/*
+Parts of pictures with capture timestamps at 40 fps, not the fixed 25: they
+are cut and timed by their dts, so 200 ms parts hold 8 pictures and add up
+to their segment
+*/
+static void TestTimestampedParts() {
+	const std::string dir = "mux-parts-timestamps";
+	const int pictures = 40 * 10;
+	std::mt19937 random(19);
+	EsStream video = SyntheticH264(random, pictures, 1, 2000);
+	EsStream audio = SyntheticAdts(random, AdtsFramesFor(pictures * 25 / 40));
+
+	// In 100 ns units, 25 ms apart
+	std::string timestamps;
+	for (int i = 0; i < pictures; i++) {
+		timestamps += std::to_string(i * 250000LL) + "\n";
+	}
+	MakeDirectory(dir);
+	WriteFileBytes(dir + "/video.pts", std::vector<uint8_t>(timestamps.begin(), timestamps.end()));
+	CHECK(RunLiveMuxer(dir, video, audio, { { "TSMUX_PART_MS", "200" }, { "TSMUX_H264_TIMESTAMPS", "video.pts" } }) == 0);
+
+	std::string playlist = ReadFileText(dir + "/playlist.m3u8");
+	std::vector<LivePart> parts = ParseParts(playlist);
+	std::map<int, double> partSums;
+	std::map<int, int> partCounts;
+	CHECK(!parts.empty());
+	for (size_t i = 0; i < parts.size(); i++) {
+		const LivePart& part = parts[i];
+		bool last = i + 1 == parts.size() || parts[i + 1].segment != part.segment;
+		CHECK(part.duration > 0 && part.duration <= 0.2005);
+		// Only the part a segment cut ends can be shorter
+		CHECK(last || (part.duration > 0.1995));
+		partSums[part.segment] += part.duration;
+		partCounts[part.segment] += 1;
+	}
+	for (const auto& entry : partSums) {
+		char uri[32];
+		snprintf(uri, sizeof(uri), "\nmux-%d.ts\n", entry.first);
+		size_t pos = playlist.find(uri);
+		size_t extinf = playlist.rfind("#EXTINF:", pos);
+		CHECK(pos != std::string::npos && extinf != std::string::npos);
+		if (pos != std::string::npos && extinf != std::string::npos) {
+			double duration = atof(playlist.c_str() + extinf + 8);
+			CHECK(fabs(entry.second - duration) <= 0.0005 * partCounts[entry.first]);
+		}
+	}
+}
+#endif
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: TsMuxerTest <ts_muxer executable>\n");
+		return 1;
+	}
+	muxer = argv[1];
+
+	TestPacketStructure();
+	TestPayloadsAndInputModes();
+	TestServiceDescription();
+	TestParallelMatchesSequential();
+	TestFmp4();
+	TestTimestampsOverThreeHours();
+#ifndef _WIN32
+	TestLiveFromPipes();
+	TestLowLatencyParts();
+	TestPartsOfLongSegments();
+	TestTimestampedParts();
+#endif
+	return TEST_RESULT();
+}
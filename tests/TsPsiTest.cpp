@@ -0,0 +1,127 @@
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ts_psi.h>
+#include <TestCheck.h>
+
+// Reference CRC, one bit at a time
+static uint32_t Crc32Bitwise(const unsigned char* data, size_t size) {
+	uint32_t crc = 0xffffffff;
+
+	for (size_t i = 0; i < size; i++) {
+		crc ^= (uint32_t)data[i] << 24;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80000000) != 0 ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static void TestCrc() {
+	std::mt19937 random(18);
+	std::vector<unsigned char> buf(8192);
+	for (unsigned char& byte : buf) {
+		byte = (unsigned char)random();
+	}
+
+	// The CRC-32/MPEG-2 check value
+	CHECK(ts_psi_crc32((const unsigned char*)"123456789", 9) == 0x0376e6e7);
+	CHECK(ts_psi_crc32(buf.data(), 0) == 0xffffffff);
+	for (int round = 0; round < 2000; round++) {
+		size_t offset = random() % 64, size = random() % (buf.size() - 64);
+		CHECK(ts_psi_crc32(buf.data() + offset, size) == Crc32Bitwise(buf.data() + offset, size));
+	}
+}
+
+static const unsigned char audioDescriptors[6] = { 0x0a, 0x04, 'u', 'n', 'd', 0x00 };
+static const ts_psi_stream defaultStreams[2] = {
+	{ 256, TS_PSI_STREAM_TYPE_H264, NULL, 0 },
+	{ 257, TS_PSI_STREAM_TYPE_ADTS, audioDescriptors, sizeof(audioDescriptors) }
+};
+
+// The muxer's program
+static ts_psi_program DefaultProgram() {
+	ts_psi_program program = {};
+	program.transport_stream_id = 1;
+	program.original_network_id = 0xff01;
+	program.program_number = 1;
+	program.pmt_pid = 0x1000;
+	program.pcr_pid = 256;
+	program.streams = defaultStreams;
+	program.stream_count = 2;
+	return program;
+}
+
+static bool Stuffed(const unsigned char* packet, size_t from) {
+	for (size_t i = from; i < TS_PSI_PACKET_SIZE; i++) {
+		if (packet[i] != 0xff) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The built packets are the ones the muxer hardcoded before, CRCs included
+static void TestDefaultProgramMatchesBaseline() {
+	const unsigned char pat[21] = {
+		0x47, 0x40, 0x00, 0x10, 0x00,
+		0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x00, 0x2a, 0xb1, 0x04, 0xb2
+	};
+	const unsigned char pmt[37] = {
+		0x47, 0x50, 0x00, 0x10, 0x00,
+		0x02, 0xb0, 0x1d, 0x00, 0x01, 0xc1, 0x00, 0x00, 0xe1, 0x00, 0xf0, 0x00, 0x1b, 0xe1, 0x00, 0xf0, 0x00,
+		0x0f, 0xe1, 0x01, 0xf0, 0x06, 0x0a, 0x04, 0x75, 0x6e, 0x64, 0x00, 0x08, 0x7d, 0xe8, 0x77
+	};
+	ts_psi_program program = DefaultProgram();
+	unsigned char packet[TS_PSI_PACKET_SIZE];
+
+	CHECK(ts_psi_build_pat(&program, packet));
+	CHECK(memcmp(packet, pat, sizeof(pat)) == 0 && Stuffed(packet, sizeof(pat)));
+	CHECK(ts_psi_build_pmt(&program, packet));
+	CHECK(memcmp(packet, pmt, sizeof(pmt)) == 0 && Stuffed(packet, sizeof(pmt)));
+
+	// Only the continuity counter changes on emission
+	ts_psi_set_continuity(packet, 0x1b);
+	CHECK(packet[3] == 0x1b);
+	CHECK(memcmp(packet + 4, pmt + 4, sizeof(pmt) - 4) == 0);
+}
+
+// A section followed by its CRC sums to 0
+static bool SectionValid(const unsigned char* packet) {
+	size_t length = (packet[6] & 0x0f) << 8 | packet[7];
+	return length >= 9 && 5 + 3 + length <= TS_PSI_PACKET_SIZE && ts_psi_crc32(packet + 5, 3 + length) == 0 &&
+		Stuffed(packet, 5 + 3 + length);
+}
+
+static void TestSdtAndLimits() {
+	ts_psi_program program = DefaultProgram();
+	unsigned char packet[TS_PSI_PACKET_SIZE];
+
+	program.provider_name = "Loom";
+	program.service_name = "Recording";
+	CHECK(ts_psi_build_sdt(&program, packet));
+	CHECK(packet[1] == 0x40 && packet[2] == TS_PSI_SDT_PID && packet[5] == TS_PSI_SDT_TABLE_ID);
+	CHECK(SectionValid(packet));
+	CHECK(memcmp(packet + 24, "\x04Loom\x09Recording", 15) == 0);
+
+	// Tables that cannot fit in a packet are refused
+	std::string longName(200, 'x');
+	program.service_name = longName.c_str();
+	CHECK(!ts_psi_build_sdt(&program, packet));
+
+	std::vector<ts_psi_stream> streams(40, defaultStreams[1]);
+	program.streams = streams.data();
+	program.stream_count = 10;
+	CHECK(ts_psi_build_pmt(&program, packet) && SectionValid(packet));
+	program.stream_count = (int)streams.size();
+	CHECK(!ts_psi_build_pmt(&program, packet));
+}
+
+int main() {
+	TestCrc();
+	TestDefaultProgramMatchesBaseline();
+	TestSdtAndLimits();
+	return TEST_RESULT();
+}
@@ -0,0 +1,108 @@
+#include <random>
+#include <vector>
+
+#include <ts_scan.h>
+#include <TestCheck.h>
+
+// Mostly the bytes the scanners look for, so matches and near misses are everywhere
+static std::vector<unsigned char> Biased(std::mt19937& random, size_t size) {
+	const unsigned char interesting[] = { 0x00, 0x00, 0x00, 0x01, 0xff, 0xf1 };
+	std::vector<unsigned char> buf(size);
+
+	for (unsigned char& byte : buf) {
+		unsigned pick = random() % 10;
+		byte = pick < sizeof(interesting) ? interesting[pick] : (unsigned char)random();
+	}
+	return buf;
+}
+
+// The definitions the scalar scanners implement, one offset at a time
+static size_t ZeroPairAt(const std::vector<unsigned char>& buf, size_t from, unsigned char lo, unsigned char hi) {
+	for (size_t i = from; i + 3 <= buf.size(); i++) {
+		if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] >= lo && buf[i + 2] <= hi) {
+			return i;
+		}
+	}
+	return buf.size();
+}
+
+static size_t SyncAt(const std::vector<unsigned char>& buf, size_t from) {
+	for (size_t i = from; i + 2 <= buf.size(); i++) {
+		if (buf[i] == 0xff && buf[i + 1] == 0xf1) {
+			return i;
+		}
+	}
+	return buf.size();
+}
+
+/*
+Every kernel finds what the scalar reference finds, from every offset of
+buffers of every size up to a few registers, where the tails are
+*/
+static void TestKernelsMatchScalar() {
+	std::mt19937 random(13);
+#if TS_SCAN_SSE2
+	bool avx2 = ts_scan_has_avx2();
+#endif
+
+	for (size_t size = 0; size < 300; size++) {
+		for (int round = 0; round < 4; round++) {
+			// Exactly sized, so a read past the end is one past the allocation
+			std::vector<unsigned char> buf = Biased(random, size);
+			const unsigned char* data = buf.empty() ? NULL : buf.data();
+
+			for (size_t from = 0; from <= size; from++) {
+				size_t start = ts_scan_zero_pair_scalar(data, size, from, 0x01, 0x01);
+				size_t end = ts_scan_zero_pair_scalar(data, size, from, 0x00, 0x01);
+				size_t sync = ts_scan_adts_sync_scalar(data, size, from);
+				CHECK(start == ZeroPairAt(buf, from, 0x01, 0x01));
+				CHECK(end == ZeroPairAt(buf, from, 0x00, 0x01));
+				CHECK(sync == SyncAt(buf, from));
+#if TS_SCAN_SSE2
+				CHECK(ts_scan_zero_pair_sse2(data, size, from, 0x01, 0x01) == start);
+				CHECK(ts_scan_zero_pair_sse2(data, size, from, 0x00, 0x01) == end);
+				CHECK(ts_scan_adts_sync_sse2(data, size, from) == sync);
+				if (avx2) {
+					CHECK(ts_scan_zero_pair_avx2(data, size, from, 0x01, 0x01) == start);
+					CHECK(ts_scan_zero_pair_avx2(data, size, from, 0x00, 0x01) == end);
+					CHECK(ts_scan_adts_sync_avx2(data, size, from) == sync);
+				}
+#endif
+			}
+		}
+	}
+}
+
+// Through the dispatch, on whichever kernel is selected, a small Annex-B and ADTS stream
+static void TestDispatch() {
+	const unsigned char h264[] = {
+		0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x00, 0x03, 0x01,
+		0x00, 0x00, 0x01, 0x68, 0xce, 0x00, 0x00, 0x00, 0x01, 0x65, 0x88
+	};
+	const unsigned char adts[] = { 0x12, 0xff, 0xf0, 0xff, 0xff, 0xf1, 0x4c, 0x80 };
+	const ts_scan_kernel kernels[] = { TS_SCAN_SCALAR, TS_SCAN_SSE2_KERNEL, TS_SCAN_AVX2_KERNEL, TS_SCAN_AUTO };
+
+	for (ts_scan_kernel kernel : kernels) {
+#if TS_SCAN_SSE2
+		if (kernel == TS_SCAN_AVX2_KERNEL && !ts_scan_has_avx2()) {
+			continue;
+		}
+#endif
+		ts_scan_set_kernel(kernel);
+		CHECK(ts_scan_start_code(h264, sizeof(h264), 0) == 1);
+		CHECK(ts_scan_start_code(h264, sizeof(h264), 2) == 10);
+		CHECK(ts_scan_start_code(h264, sizeof(h264), 11) == 16);
+		// 00 00 03 is emulation prevention, not the end of the SPS
+		CHECK(ts_scan_nal_end(h264, sizeof(h264), 4) == 10);
+		CHECK(ts_scan_nal_end(h264, sizeof(h264), 13) == 15);
+		CHECK(ts_scan_start_code(h264, sizeof(h264), 17) == sizeof(h264));
+		CHECK(ts_scan_adts_sync(adts, sizeof(adts), 0) == 4);
+		CHECK(ts_scan_adts_sync(adts, sizeof(adts) - 3, 0) == sizeof(adts) - 3);
+	}
+}
+
+int main() {
+	TestKernelsMatchScalar();
+	TestDispatch();
+	return TEST_RESULT();
+}
@@ -1,5 +1,6 @@
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -7,6 +8,21 @@
 
 #include <signal.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "ts_scan.h"
+#include "fmp4_writer.h"
+#include "ts_psi.h"
+
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
@@ -26,33 +42,126 @@
 #define AUDIO_FRAME_CLOCK 1920 // 90000 / 46.875
 #define PES_H264_PID 256
 #define PES_ADTS_PID 257
+#define PMT_PID 0x1000
+#define DEFAULT_PROGRAM_NUMBER 1
+#define DEFAULT_TRANSPORT_STREAM_ID 1
+#define DEFAULT_ORIGINAL_NETWORK_ID 0xff01
 #define PES_H264_HEADER_SIZE 19
+#define AUD_NAL_SIZE 6
 #define PES_ADTS_HEADER_SIZE 14
 
 #define DEFAULT_PAT_INTERVAL 40 // interval in number of packets
 #define DEFAULT_PMT_INTERVAL 40
+#define DEFAULT_SDT_INTERVAL 40 // only with a service name (TSMUX_SERVICE_NAME)
 
-#define H264_BUFFER_SIZE 32 * 1024 * 1024
-#define ADTS_BUFFER_SIZE 32 * 1024 * 1024
+// Inputs that cannot be mapped (pipes) are read in chunks of this size
+#define ES_STREAM_CHUNK_SIZE 1024 * 1024
+// Zeroed bytes kept readable past the end of the data: the parsers look a few bytes ahead
+#define ES_INPUT_PADDING 8
 #define ADTS_SAMPLES_PER_FRAME 1024
 #define ADTS_SAMPLES_PER_SECOND 48000
 
+// Capture timestamps (TSMUX_H264_TIMESTAMPS, TSMUX_ADTS_TIMESTAMPS) count 100 ns units, as the recorder's sample times
+#define TIMESTAMP_UNITS_PER_SECOND 10000000
+#define TIMESTAMP_LINE_SIZE 64
+// The PCR runs this far behind the DTS, which leaves the decoder its buffering time
+#define PCR_DELAY INITIAL_PCR
+
+// Whole packets are assembled in memory and written in batches of about 64 KiB
+#define TS_OUTPUT_BATCH_PACKETS 348
+#define TS_OUTPUT_BUFFER_SIZE (TS_OUTPUT_BATCH_PACKETS * MPEGTS_PACKET_SIZE)
+
+// Live mode (TSMUX_LIVE): inputs are tailed while the recorder still writes them
+#define LIVE_INPUT_POLL_MS 20
+// A growing file that stays this long without new data has ended (pipes end at EOF)
+#define LIVE_INPUT_IDLE_TIMEOUT_MS 10000
+// Segments listed in the live playlist
+#define LIVE_PLAYLIST_WINDOW 6
+// LL-HLS part target (TSMUX_PART_MS, 0 publishes whole segments only)
+#define LIVE_PART_DURATION_MS 400
+// Closed segments whose parts are still listed, besides the open one
+#define LIVE_PART_SEGMENTS 2
+
+// Parallel offline muxing (TSMUX_THREADS): segments muxed ahead of the oldest one not yet written
+#define PARALLEL_SEGMENTS_PER_THREAD 4
+
 #define OUTPUT_SEGMENT_PREFIX "mux"
+#define FMP4_INIT_FILENAME "init.mp4"
 #define HLS_PLAYLIST_FILENAME "playlist.m3u8"
+#define HLS_PLAYLIST_TMP_FILENAME "playlist.m3u8.tmp"
 
 typedef unsigned char u_char;
-typedef enum { PMT, PAT, PES_ADTS, PES_H264, TS_UNKNOWN } ts_packet_type;
-typedef enum { VCL, NON_VCL, IDR, SPS, PPS, AUD } nalu_type;
+typedef enum { PMT, PAT, PES_ADTS, PES_H264, SDT, TS_UNKNOWN } ts_packet_type;
+
+// A partial segment: a byte range of its segment file
+typedef struct {
+	long offset;
+	long size;
+	double duration;
+	bool independent; // starts with an IDR picture
+} live_part;
+
+/*
+	Elementary stream input. Frames are handed out as views into data, which is
+	either a read-only mapping of the whole file, or a buffer refilled from the
+	file that keeps the unit being parsed when it straddles a refill.
 
+	data + size is always followed by ES_INPUT_PADDING readable bytes: a mapping
+	exposes all but its last bytes, which are copied into the padded buffer once
+	the parser reaches them.
+*/
 typedef struct {
 	FILE* fileptr;
-	u_char* frame;
-	u_char* bufferptr;
-	u_char* initbufferptr;
-	int buffer_load_count;
-	long initial_buffer_size;
-	long loaded_buffer_size;
-	long file_size;
+	const u_char* data;
+	size_t size;
+	size_t pos; // start of the next unit
+	bool eof;   // data holds everything left in the file
+
+	u_char* buffer;
+	size_t capacity;
+
+	const u_char* map;
+	size_t map_size;
+#ifdef _WIN32
+	HANDLE mapping;
+#endif
+
+	bool live;           // wait for more data at end of file
+	bool pipe;           // end of file is final even when live
+	double last_read_ms; // when data last arrived
+} es_input;
+
+/*
+	Capture timestamps of an input, from a text sidecar with one line per access
+	unit or ADTS frame, in input order:
+
+		pts [dts]
+
+	dts defaults to pts and differs for reordered (B) pictures. Lines are read
+	as the units are, so the sidecar of a live input may grow with it.
+*/
+typedef struct {
+	FILE* fileptr;  // NULL once every line is read
+	bool live;
+	double last_read_ms;
+
+	long long* pts;
+	long long* dts;
+	size_t count;
+	size_t capacity;
+
+	char line[TIMESTAMP_LINE_SIZE]; // a line still being written
+	size_t line_size;
+
+	long long origin; // maps to the first dts of the mux
+} es_timestamps;
+
+typedef struct {
+	es_input input;
+	es_timestamps* timestamps; // NULL: the units are at a fixed rate
+	size_t units_read;         // units with a timestamp: access units, or ADTS frames
+	const u_char* frame;
+	double frame_arrival_ms; // when the data completing the current frame was read
 
 	int frames_read;
 	int pes_pid;
@@ -61,179 +170,587 @@ typedef struct {
 
 	long frame_size_bytes;
 	long initial_frame_size_bytes;
+	unsigned nal_types; // H.264: the NAL unit types in the access unit, a bit each
 
 	unsigned long pcr;
 	unsigned long pts;
 	unsigned long dts;
+	unsigned long frame_duration; // of the last unit, from its dts to the next
 
 	bool pes_initialized;
 } output_stream;
 
+// The tables of the program, serialized once
+typedef struct {
+	u_char pat[MPEGTS_PACKET_SIZE];
+	u_char pmt[MPEGTS_PACKET_SIZE];
+	u_char sdt[MPEGTS_PACKET_SIZE];
+	bool has_sdt;
+} psi_packets;
+
 typedef struct {
 	FILE* segptr;
 	FILE* hlsptr;
 
 	int segment_index;
+	unsigned long segment_start_dts; // of its first picture
 
 	unsigned curr_packet_idx;
 	ts_packet_type curr_packet_type;
 	int last_pat_idx;
 	int last_pmt_idx;
+	int last_sdt_idx;
 	unsigned pat_cc;
 	unsigned pmt_cc;
+	unsigned sdt_cc;
+	const psi_packets* psi;
 	
 	unsigned long bytes_written;
 
+	// The packet being written starts at out_buffer + out_size
+	u_char out_buffer[TS_OUTPUT_BUFFER_SIZE];
+	size_t out_size;
+
 	output_stream* audio_stream;
 	output_stream* video_stream;
+
+	// Parallel muxing: the segment is collected here, and muxing stops where the next one starts
+	fmp4_buffer* memory_output;
+	bool cut_reached;
+
+	// Live mode: the playlist is rewritten with the last segments after each one closes
+	bool live;
+	int window_index[LIVE_PLAYLIST_WINDOW];
+	double window_duration[LIVE_PLAYLIST_WINDOW];
+	int window_count;
+	int target_duration;
+	double segment_arrival_ms; // when the first frame of the open segment arrived
+	int published_count;
+	double latency_sum_ms;
+	double latency_max_ms;
+
+	// LL-HLS: the open segment is published part by part as it grows
+	int part_duration_ms;
+	// A segment runs to the next IDR picture, so it may hold any number of parts: each array grows with its segment
+	live_part* window_parts[LIVE_PLAYLIST_WINDOW];
+	int window_part_count[LIVE_PLAYLIST_WINDOW];
+	live_part* open_parts;
+	int open_part_count;
+	int open_part_capacity;
+	long segment_bytes; // flushed to the open segment file
+	long part_start;
+	int part_frames;
+	unsigned long part_start_dts;
+	bool part_independent;
+	double part_arrival_ms;
+	int part_published_count;
+	double part_latency_sum_ms;
+	double part_latency_max_ms;
 } ts_writer;
 
-int find_adts_header(u_char* buf, int size, int* frame_start, int* frame_end) {
+double now_ms(void) {
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (double)counter.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+void sleep_ms(unsigned ms) {
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	usleep(ms * 1000);
+#endif
+}
+
+int find_adts_header(const u_char* buf, int size, int* frame_start, int* frame_end) {
 	/*
 		ADTS header will have 7 bytes when the protection absent field is 1
 
 		Look for 0xFFF1 (0xFFF -> syncword, 1 -> MPEG version = MPEG-4)
+		The frame ends at the next syncword
 	*/
-	int i = 0;
+	size_t start, end;
 	*frame_start = *frame_end = 0;
-	
-	while (buf[i] != 0xff || buf[i + 1] != 0xf1) {
-		i += 1;
-		if (i + 1 > size) { return 0; }
-	}
 
-	*frame_start = i;
+	start = ts_scan_adts_sync(buf, size, 0);
+	if (start >= (size_t)size) { return 0; }
+	*frame_start = (int)start;
 
-	i += 1;
-
-	while (buf[i] != 0xff || buf[i + 1] != 0xf1) {
-		i += 1;
-		if (i + 1 > size) { return -1; }
-	}
-	*frame_end = i;
+	end = ts_scan_adts_sync(buf, size, start + 1);
+	if (end >= (size_t)size) { return -1; }
+	*frame_end = (int)end;
 
 	return (*frame_end - *frame_start);
 }
 
-int find_nal_unit(u_char* buf, int size, int* nal_start, int* nal_end) {
-	int i = 0;
-	// find start
+int find_nal_unit(const u_char* buf, int size, int* nal_start, int* nal_end) {
+	size_t code, first, end;
 	*nal_start = 0;
 	*nal_end = 0;
 
-	while (   // look for 24 or 32-bit NALU start code
-		(buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 0x01) &&
-		(buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 0 || buf[i + 3] != 0x01)
-		)
-	{
-		i += 1; // skip leading zero
-		if (i + 4 >= size) { return 0; } // did not find nal start
+	// look for 24 or 32-bit NALU start code
+	code = ts_scan_start_code(buf, size, 0);
+	if (code >= (size_t)size) { return 0; } // did not find nal start
+
+	// As in the byte-wise scan this replaces, a code in the last 4 bytes (other than at 0) does not count
+	first = (code > 0 && buf[code - 1] == 0) ? code - 1 : code;
+	if (first != 0 && first + 4 >= (size_t)size) { return 0; }
+
+	*nal_start = (int)(code + 3);
+
+	// ( next_bits( 24 ) != 0x000000 && next_bits( 24 ) != 0x000001 )
+	end = ts_scan_nal_end(buf, size, *nal_start);
+	if (end >= (size_t)size || (end != (size_t)*nal_start && end + 3 >= (size_t)size)) {
+		*nal_end = size; // did not find nal end, stream ended first
+		return -1;
 	}
 
-	if (buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 0x01) { // ( next_bits( 24 ) != 0x000001 )
-		i++;
+	*nal_end = (int)end;
+	return (*nal_end - *nal_start);
+}
+
+#define NAL_TYPE_BIT(type) (1u << (type))
+#define NAL_SLICE_TYPES (NAL_TYPE_BIT(1) | NAL_TYPE_BIT(2) | NAL_TYPE_BIT(5))
+
+/*
+	Whether a NAL unit (its header on) following a slice of the access unit
+	starts the next one (7.4.1.2.3): delimiters, SEI, parameter sets and
+	prefix units do, as does the first slice of the next picture, which has
+	first_mb_in_slice 0 (a leading 1 bit in its Exp-Golomb code)
+*/
+bool nal_starts_access_unit(const u_char* nal) {
+	int type = nal[0] & 0x1f;
+
+	if (type == 1 || type == 2 || type == 5) {
+		return (nal[1] & 0x80) != 0;
 	}
+	return type == 6 || type == 7 || type == 8 || type == 9 || (type >= 14 && type <= 18);
+}
+
+/*
+	Finds the next access unit: its NAL units, start codes included between
+	them, up to the one that starts the next picture. Returns its size, -1
+	when the data may end inside it (it then runs to size), or 0 when there is
+	no NAL unit. The NAL unit types found are set in nal_types
+*/
+int find_access_unit(const u_char* buf, int size, int* au_start, int* au_end, unsigned* nal_types) {
+	int nal_start, nal_end;
+	int res = find_nal_unit(buf, size, &nal_start, &nal_end);
+
+	*au_start = nal_start;
+	*au_end = nal_end;
+	*nal_types = 0;
+
+	while (res > 0) {
+		*nal_types |= NAL_TYPE_BIT(buf[nal_start] & 0x1f);
 
-	if (buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 0x01) { /* error, should never happen */ return 0; }
-	i += 3;
-	*nal_start = i;
+		// The header of the next NAL unit decides, and a slice's first byte with it
+		size_t code = ts_scan_start_code(buf, size, nal_end);
+		if (code + 4 >= (size_t)size) {
+			break;
+		}
+		if ((*nal_types & NAL_SLICE_TYPES) != 0 && nal_starts_access_unit(buf + code + 3)) {
+			return *au_end - *au_start;
+		}
 
-	while (   //( next_bits( 24 ) != 0x000000 && next_bits( 24 ) != 0x000001 )
-		(buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 0) &&
-		(buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 0x01)
-		)
-	{
-		i++;
-		// FIXME the next line fails when reading a nal that ends exactly at the end of the data
-		if (i + 3 >= size) { *nal_end = size; return -1; } // did not find nal end, stream ended first
+		// As find_nal_unit: the NAL unit ends before 00 00 00 or 00 00 01
+		nal_start = (int)code + 3;
+		size_t end = ts_scan_nal_end(buf, size, nal_start);
+		if (end >= (size_t)size || (end != (size_t)nal_start && end + 3 >= (size_t)size)) {
+			*nal_types |= NAL_TYPE_BIT(buf[nal_start] & 0x1f);
+			break;
+		}
+		nal_end = (int)end;
+		*au_end = nal_end;
 	}
 
-	*nal_end = i;
-	return (*nal_end - *nal_start);
+	if (res == 0) {
+		return 0;
+	}
+	if (res < 0 && nal_start < size) {
+		*nal_types |= NAL_TYPE_BIT(buf[nal_start] & 0x1f);
+	}
+	*au_end = size;
+	return -1;
+}
+
+// A segment or part can start at an access unit with an SPS and an IDR picture
+bool access_unit_is_random_access(const output_stream* stream) {
+	unsigned needed = NAL_TYPE_BIT(5) | NAL_TYPE_BIT(7);
+	return (stream->nal_types & needed) == needed;
+}
+
+bool es_input_map(es_input* input) {
+#ifdef _WIN32
+	LARGE_INTEGER file_size;
+	HANDLE file = (HANDLE)_get_osfhandle(_fileno(input->fileptr));
+
+	if (file == INVALID_HANDLE_VALUE || GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &file_size)) {
+		return false;
+	}
+	if (file_size.QuadPart <= ES_INPUT_PADDING || (unsigned long long)file_size.QuadPart > (size_t)-1) {
+		return false;
+	}
+
+	input->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (input->mapping == NULL) {
+		return false;
+	}
+	input->map = (const u_char*)MapViewOfFile(input->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (input->map == NULL) {
+		CloseHandle(input->mapping);
+		input->mapping = NULL;
+		return false;
+	}
+	input->map_size = (size_t)file_size.QuadPart;
+#else
+	struct stat st;
+
+	if (fstat(fileno(input->fileptr), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= ES_INPUT_PADDING) {
+		return false;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(input->fileptr), 0);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	input->map = (const u_char*)map;
+	input->map_size = st.st_size;
+#endif
+
+	input->data = input->map;
+	input->size = input->map_size - ES_INPUT_PADDING;
+	return true;
+}
+
+// Whether the opened input is a file on disk, rather than a pipe or a device
+bool es_input_is_regular_file(es_input* input) {
+#ifdef _WIN32
+	HANDLE file = (HANDLE)_get_osfhandle(_fileno(input->fileptr));
+	return file != INVALID_HANDLE_VALUE && GetFileType(file) == FILE_TYPE_DISK;
+#else
+	struct stat st;
+	return fstat(fileno(input->fileptr), &st) == 0 && S_ISREG(st.st_mode);
+#endif
+}
+
+/*
+	Maps path when it is a regular file (unless TSMUX_STREAM_INPUT is set or the
+	input is live), otherwise prepares to read it in chunks
+*/
+bool es_input_open(es_input* input, const char* path, bool live) {
+	memset(input, 0, sizeof(es_input));
+
+	if (path == NULL || (input->fileptr = fopen(path, "rb")) == NULL) {
+		printf("Error: cannot open input %s\n", path != NULL ? path : "(unset)");
+		return false;
+	}
+
+	// A file that is still growing cannot be mapped
+	input->live = live;
+	input->pipe = !es_input_is_regular_file(input);
+	input->last_read_ms = now_ms();
+
+	if (!live && getenv("TSMUX_STREAM_INPUT") == NULL && es_input_map(input)) {
+		return true;
+	}
+
+	input->capacity = ES_STREAM_CHUNK_SIZE;
+	input->buffer = (u_char*)calloc(input->capacity + ES_INPUT_PADDING, 1);
+	input->data = input->buffer;
+	return true;
+}
+
+void es_input_close(es_input* input) {
+	if (input->map != NULL) {
+#ifdef _WIN32
+		UnmapViewOfFile(input->map);
+		CloseHandle(input->mapping);
+#else
+		munmap((void*)input->map, input->map_size);
+#endif
+	}
+	free(input->buffer);
+	if (input->fileptr != NULL) {
+		fclose(input->fileptr);
+	}
+	memset(input, 0, sizeof(es_input));
 }
 
 /*
-	VCL = Video Coding Layer
+	Reads what is available. A live input waits for the file to grow, until its
+	writer closes the pipe or the file has been idle for too long
+*/
+size_t es_input_read(es_input* input, u_char* dest, size_t size) {
+	if (!input->live) {
+		return fread(dest, 1, size, input->fileptr);
+	}
+
+	while (true) {
+		// Unbuffered: returns as soon as anything is available instead of waiting for size bytes
+#ifdef _WIN32
+		int bytes_read = _read(_fileno(input->fileptr), dest, (unsigned)MIN(size, INT_MAX));
+#else
+		ssize_t bytes_read = read(fileno(input->fileptr), dest, size);
+#endif
+		if (bytes_read > 0) {
+			input->last_read_ms = now_ms();
+			return (size_t)bytes_read;
+		}
+		if (bytes_read < 0 || input->pipe || now_ms() - input->last_read_ms >= LIVE_INPUT_IDLE_TIMEOUT_MS) {
+			return 0;
+		}
+		sleep_ms(LIVE_INPUT_POLL_MS);
+	}
+}
 
-	VCL NALU contains picture data
-	non-VCL NALU contains parameter sets
+/*
+	Makes more data available after data + pos, keeping the bytes from pos on.
+	Returns false once the whole file is in data
 */
-nalu_type get_nalu_type(u_char* frame) {
-	int nal_unit_type;
-	int start = 0;
-	u_char unit_type;
-
-	if (frame[1] == 0x00 && frame[2] == 0x00 && frame[3] == 0x01) { 
-		unit_type = frame[4];
-	} else if (frame[0] == 0x00 && frame[1] == 0x00 && frame[2] == 0x01) {
-		unit_type = frame[3];
-	} else {
+bool es_input_refill(es_input* input) {
+	if (input->eof) {
 		return false;
 	}
 
-	nal_unit_type = unit_type & 0x1f;
+	size_t pending = input->size - input->pos;
+
+	if (input->map != NULL) {
+		// Copy the end of the mapping into a padded buffer, so the parsers can look past it
+		size_t remaining = input->map_size - input->pos;
+		input->buffer = (u_char*)calloc(remaining + ES_INPUT_PADDING, 1);
+		memcpy(input->buffer, input->map + input->pos, remaining);
+		input->capacity = remaining;
+		input->data = input->buffer;
+		input->size = remaining;
+		input->pos = 0;
+		input->eof = true;
+		return true;
+	}
+
+	memmove(input->buffer, input->buffer + input->pos, pending);
+	input->pos = 0;
+	input->size = pending;
+
+	// A single unit fills the buffer: grow it
+	if (input->size == input->capacity) {
+		input->capacity *= 2;
+		input->buffer = (u_char*)realloc(input->buffer, input->capacity + ES_INPUT_PADDING);
+	}
+
+	size_t bytes_read = es_input_read(input, input->buffer + input->size, input->capacity - input->size);
+	input->size += bytes_read;
+	input->data = input->buffer;
+	input->eof = bytes_read == 0;
+	memset(input->buffer + input->size, 0, ES_INPUT_PADDING);
 
-	// IDR is preceeded by SPS -> PPS (SPS -> PPS -> IDR)
-	if (nal_unit_type == 7) { return SPS; }
-	if (nal_unit_type == 8) { return PPS; }
-	if (nal_unit_type == 1) { return VCL; } 
-	if (nal_unit_type == 5) { return IDR; }
-	if (nal_unit_type == 9) { return AUD; }
+	return bytes_read > 0 || pending > 0;
+}
 
-	return NON_VCL;
+bool es_input_exhausted(const es_input* input) {
+	return input->eof && input->pos >= input->size;
 }
 
-void load_buffer(output_stream* stream) {
-	// Do not create a buffer bigger than the input file
-	long bufsize = MIN(stream->pes_pid == PES_H264_PID ? H264_BUFFER_SIZE : ADTS_BUFFER_SIZE, stream->file_size);
-	u_char* buf = (u_char*)malloc(bufsize);
-	
-	// Free previously allocated buffer
-	if (stream->bufferptr != NULL) {
-		free(stream->initbufferptr);
+bool es_timestamps_open(es_timestamps* timestamps, const char* path, bool live) {
+	memset(timestamps, 0, sizeof(es_timestamps));
+
+	if ((timestamps->fileptr = fopen(path, "r")) == NULL) {
+		printf("Error: cannot open timestamps %s\n", path);
+		return false;
+	}
+	timestamps->live = live;
+	timestamps->last_read_ms = now_ms();
+	return true;
+}
+
+void es_timestamps_close(es_timestamps* timestamps) {
+	if (timestamps->fileptr != NULL) {
+		fclose(timestamps->fileptr);
+	}
+	free(timestamps->pts);
+	free(timestamps->dts);
+	memset(timestamps, 0, sizeof(es_timestamps));
+}
+
+void es_timestamps_parse_line(es_timestamps* timestamps) {
+	long long pts, dts;
+	int fields = sscanf(timestamps->line, "%lld %lld", &pts, &dts);
+
+	timestamps->line_size = 0;
+	if (fields < 1) {
+		return; // blank
+	}
+	if (timestamps->count == timestamps->capacity) {
+		timestamps->capacity = MAX(timestamps->capacity * 2, 4096);
+		timestamps->pts = (long long*)realloc(timestamps->pts, timestamps->capacity * sizeof(long long));
+		timestamps->dts = (long long*)realloc(timestamps->dts, timestamps->capacity * sizeof(long long));
+	}
+	timestamps->pts[timestamps->count] = pts;
+	timestamps->dts[timestamps->count] = fields == 2 ? dts : pts;
+	timestamps->count += 1;
+}
+
+/*
+	Reads lines until one more timestamp is known. A live sidecar is waited for
+	as its input is; returns false once it has ended
+*/
+bool es_timestamps_read(es_timestamps* timestamps) {
+	size_t count = timestamps->count;
+
+	while (timestamps->fileptr != NULL && timestamps->count == count) {
+		char* line = timestamps->line + timestamps->line_size;
+
+		if (fgets(line, TIMESTAMP_LINE_SIZE - (int)timestamps->line_size, timestamps->fileptr) != NULL) {
+			timestamps->line_size += strlen(line);
+			timestamps->last_read_ms = now_ms();
+			if (timestamps->line[timestamps->line_size - 1] == '\n' || timestamps->line_size == TIMESTAMP_LINE_SIZE - 1) {
+				es_timestamps_parse_line(timestamps);
+			}
+			continue;
+		}
+
+		if (timestamps->live && now_ms() - timestamps->last_read_ms < LIVE_INPUT_IDLE_TIMEOUT_MS) {
+			clearerr(timestamps->fileptr);
+			sleep_ms(LIVE_INPUT_POLL_MS);
+			continue;
+		}
+
+		// The last line may have no line break
+		if (timestamps->line_size > 0) {
+			es_timestamps_parse_line(timestamps);
+		}
+		fclose(timestamps->fileptr);
+		timestamps->fileptr = NULL;
+	}
+
+	return timestamps->count > count;
+}
+
+bool es_timestamps_get(es_timestamps* timestamps, size_t index, long long* pts, long long* dts) {
+	while (index >= timestamps->count) {
+		if (!es_timestamps_read(timestamps)) {
+			return false;
+		}
+	}
+	*pts = timestamps->pts[index];
+	*dts = timestamps->dts[index];
+	return true;
+}
+
+// On the 90 kHz clock, the origin at the first dts a stream without timestamps would have
+unsigned long timestamp_to_clock(const es_timestamps* timestamps, long long time) {
+	long long elapsed = MAX(time - timestamps->origin, 0);
+	return INITIAL_PCR * 2 + (unsigned long)(elapsed * 90000 / TIMESTAMP_UNITS_PER_SECOND);
+}
+
+/*
+	Opens the sidecars that are set, and puts both streams on the clock of the
+	earliest timestamp so they keep their offset
+*/
+bool open_stream_timestamps(output_stream* vstream, output_stream* astream, es_timestamps timestamps[2], bool live) {
+	const char* paths[2] = { getenv("TSMUX_H264_TIMESTAMPS"), getenv("TSMUX_ADTS_TIMESTAMPS") };
+	output_stream* streams[2] = { vstream, astream };
+	long long origin = LLONG_MAX;
+
+	memset(timestamps, 0, 2 * sizeof(es_timestamps));
+	for (int i = 0; i < 2; i++) {
+		long long pts, dts;
+
+		if (paths[i] == NULL) {
+			continue;
+		}
+		if (!es_timestamps_open(&timestamps[i], paths[i], live)) {
+			return false;
+		}
+		streams[i]->timestamps = &timestamps[i];
+		if (es_timestamps_get(&timestamps[i], 0, &pts, &dts)) {
+			origin = MIN(origin, dts);
+		}
+	}
+
+	for (int i = 0; i < 2; i++) {
+		timestamps[i].origin = origin;
+	}
+	return true;
+}
+
+// With timestamps, the first picture opens the first segment
+unsigned long first_segment_start_dts(output_stream* vstream) {
+	long long pts, dts;
+
+	if (vstream->timestamps != NULL && es_timestamps_get(vstream->timestamps, 0, &pts, &dts)) {
+		return timestamp_to_clock(vstream->timestamps, dts);
 	}
+	return vstream->dts;
+}
+
+/*
+	Moves the stream clock to the unit just loaded: to its capture timestamps,
+	by their mean interval past the end of them, else by step. With timestamps
+	the PCR follows the dts and never goes back
+*/
+void advance_stream_clock(output_stream* stream, unsigned long step, unsigned long pcr_step) {
+	long long pts, dts;
 
-	fread(buf, 1, bufsize, stream->fileptr);
-	stream->initial_buffer_size = bufsize;
-	stream->loaded_buffer_size = bufsize;
-	stream->bufferptr = buf;
-	stream->initbufferptr = buf;
-	stream->buffer_load_count += 1;
-	stream->file_size -= bufsize;
+	if (stream->timestamps != NULL && es_timestamps_get(stream->timestamps, stream->units_read, &pts, &dts)) {
+		unsigned long next_dts = timestamp_to_clock(stream->timestamps, dts);
+
+		if (stream->units_read > 0 && next_dts > stream->dts) {
+			stream->frame_duration = next_dts - stream->dts;
+		}
+		stream->pts = timestamp_to_clock(stream->timestamps, pts);
+		stream->dts = next_dts;
+		if (next_dts >= PCR_DELAY) {
+			stream->pcr = MAX(stream->pcr, next_dts - PCR_DELAY);
+		}
+	} else if (stream->timestamps != NULL) {
+		const es_timestamps* timestamps = stream->timestamps;
+		if (timestamps->count >= 2) {
+			long long span = timestamps->dts[timestamps->count - 1] - timestamps->dts[0];
+			step = (unsigned long)(span * 90000 / TIMESTAMP_UNITS_PER_SECOND / (long long)(timestamps->count - 1));
+		}
+		stream->frame_duration = step;
+		stream->pts += step;
+		stream->dts += step;
+		stream->pcr = MAX(stream->pcr, stream->dts - PCR_DELAY);
+	} else {
+		stream->pts += step;
+		stream->dts += step;
+		stream->pcr += pcr_step;
+	}
+	stream->units_read += 1;
 }
 
 void extract_frame_from_buffer(output_stream* stream, int frame_start, int frame_end) {
 	/*
-		The method responsible for writing PES payloads must also free the allocated frame
-		once it has been completely consumed
+		The frame is a view into the input: it stays valid until the next frame is loaded
 	*/
+	es_input* input = &stream->input;
 	int frame_size = frame_end - frame_start;
-	stream->frame = (u_char*)malloc(frame_size);
+	stream->frame = input->data + input->pos + frame_start;
+	stream->frame_arrival_ms = input->last_read_ms;
 	stream->initial_frame_size_bytes = frame_size;
 	stream->frame_size_bytes = stream->initial_frame_size_bytes;
-
-	// Copy data from buffer to frame
-	if (frame_start == frame_end && stream->file_size == 0) {
-		memcpy(stream->frame, stream->bufferptr + frame_start, stream->loaded_buffer_size);
-		stream->loaded_buffer_size = 0;
-		stream->bufferptr = NULL;
-	} else {
-		memcpy(stream->frame, stream->bufferptr + frame_start, frame_end - frame_start);
-		stream->loaded_buffer_size -= frame_end;
-		stream->bufferptr += frame_end;
-	}
+	input->pos += frame_end;
 
 	if (stream->pes_pid == PES_H264_PID) {
-		if (get_nalu_type(stream->frame) == VCL || get_nalu_type(stream->frame) == SPS) {
+		// Parameter sets or SEI left at the end of the stream are no picture
+		if ((stream->nal_types & NAL_SLICE_TYPES) != 0) {
 			stream->frames_read += 1;
-			stream->pts += VIDEO_FRAME_CLOCK;
-			stream->pcr += VIDEO_FRAME_CLOCK;
+			advance_stream_clock(stream, VIDEO_FRAME_CLOCK, VIDEO_FRAME_CLOCK);
 		} 
 	} else if (stream->pes_pid == PES_ADTS_PID) {
 		// Need to get samples per frame from ADTS header
 		int audio_frames = (stream->frame[6] & 0x03) + 1;
-		stream->pcr += AUDIO_FRAME_CLOCK;
-		stream->pts += AUDIO_FRAME_CLOCK * audio_frames;
+		advance_stream_clock(stream, AUDIO_FRAME_CLOCK * audio_frames, AUDIO_FRAME_CLOCK);
 #if _DEBUG
 		printf("audio frame: %d || pts: %ld  || frame length %d || real fl: %d\n", 
 			total_audio_frames, 
@@ -245,49 +762,85 @@ void extract_frame_from_buffer(output_stream* stream, int frame_start, int frame
 	}
 }
 
-void load_frame(ts_writer* writer) {
+/*
+	Finds the next complete unit, refilling the input while the unit may continue
+	past the loaded data. The last unit of the input ends with it
+*/
+void load_stream_frame(output_stream* stream) {
 	int frame_start, frame_end, res;
-	output_stream* stream = writer->curr_packet_type == PES_H264 ? writer->video_stream : writer->audio_stream;
+	es_input* input = &stream->input;
 	
 	if (stream->frame != NULL) {
 		return;
 	}
-	
-	if (stream->loaded_buffer_size == 0) {
-		load_buffer(stream);
+
+	while (true) {
+		const u_char* data = input->data + input->pos;
+		int size = (int)(input->size - input->pos);
+
+		if (stream->pes_pid == PES_H264_PID) {
+			res = find_access_unit(data, size, &frame_start, &frame_end, &stream->nal_types);
+		} else {
+			res = find_adts_header(data, size, &frame_start, &frame_end);
+		}
+
+		if (res > 0 || !es_input_refill(input)) {
+			break;
+		}
+	}
+
+	if (res == 0) {
+		// Nothing but trailing garbage: the stream is over
+		stream->frame = input->data + input->size;
+		stream->initial_frame_size_bytes = 0;
+		stream->frame_size_bytes = 0;
+		input->pos = input->size;
+		return;
 	}
 
 	if (stream->pes_pid == PES_H264_PID) {
-		while (find_nal_unit(stream->bufferptr, stream->loaded_buffer_size, &frame_start, &frame_end) < 1) {
-			if (stream->file_size == 0) {
-				break;
-			}
-			load_buffer(stream);
-		}
-		
-		if (stream->bufferptr[frame_start - 4] != 0x00) {
-			frame_start -= 3;
-		} else {
+		// Include the 3 or 4 byte start code
+		if (frame_start >= 4 && input->data[input->pos + frame_start - 4] == 0x00) {
 			frame_start -= 4;
+		} else {
+			frame_start -= 3;
 		}
-		extract_frame_from_buffer(stream, frame_start, frame_end);
-	} else if (stream->pes_pid == PES_ADTS_PID) {
-		while (find_adts_header(stream->bufferptr, stream->loaded_buffer_size, &frame_start, &frame_end) < 1) {
-			if (stream->file_size == 0) {
-				break;
-			}
-			load_buffer(stream);
+	} else if (res < 0) {
+		// The last ADTS frame has no syncword after it
+		frame_end = (int)(input->size - input->pos);
+	}
+	extract_frame_from_buffer(stream, frame_start, frame_end);
+}
+
+void load_frame(ts_writer* writer) {
+	load_stream_frame(writer->curr_packet_type == PES_H264 ? writer->video_stream : writer->audio_stream);
+}
+
+void flush_ts_output(ts_writer* writer) {
+	if (writer->out_size > 0) {
+		if (writer->memory_output != NULL) {
+			fmp4_put_bytes(writer->memory_output, writer->out_buffer, writer->out_size);
+		} else {
+			fwrite(writer->out_buffer, 1, writer->out_size, writer->segptr);
 		}
-		extract_frame_from_buffer(stream, frame_start, frame_end);
+		writer->segment_bytes += (long)writer->out_size;
+		writer->out_size = 0;
 	}
 }
 
 void write_stuffing_bytes(ts_writer *writer) {
-	int stuffing_byte = 0xff;
+	memset(writer->out_buffer + writer->out_size + writer->bytes_written, 0xff, MPEGTS_PACKET_SIZE - writer->bytes_written);
+}
+
+/*
+	Pads the current packet and queues it, writing the batch once it is full
+*/
+void finish_ts_packet(ts_writer* writer) {
+	write_stuffing_bytes(writer);
+	writer->out_size += MPEGTS_PACKET_SIZE;
 
-	// stuffing bytes
-	for (size_t i = 0; i < (MPEGTS_PACKET_SIZE - writer->bytes_written); i++) {
-		fwrite(&stuffing_byte, 1, 1, writer->segptr);
+	if (writer->out_size + MPEGTS_PACKET_SIZE > TS_OUTPUT_BUFFER_SIZE) {
+		flush_ts_output(writer);
 	}
 }
 
@@ -304,64 +857,93 @@ output_stream* get_current_stream(ts_writer* writer) {
 }
 
 void writer_increment_bytes_written(ts_writer* writer, int size) {
-	writer->bytes_written += size;
-
-	if (writer->bytes_written > MPEGTS_PACKET_SIZE) {
+	// Checked before the write: the packet lives inside the output batch
+	if (writer->bytes_written + size > MPEGTS_PACKET_SIZE) {
 		printf("Error: ts packet overflow\n");
 		raise(SIGTERM);
 	}
+
+	writer->bytes_written += size;
 }
 
-void write_to_ts_file(u_char* source, ts_writer *writer, int source_size) {
-	fwrite(source, 1, source_size, writer->segptr);
+void write_to_ts_file(const u_char* source, ts_writer *writer, int source_size) {
+	u_char* dest = writer->out_buffer + writer->out_size + writer->bytes_written;
+
 	writer_increment_bytes_written(writer, source_size);
+	memcpy(dest, source, source_size);
 }
 
 /*
-	Payload references the Program Map Table (PID 4096)
+	The default program: PMT on PID 4096, with
+
+	PID 0100 (256) -> Stream type 1b H.264/14496-10 video (MPEG-4/AVC), which carries the PCR
+	PID 0101 (257) -> Stream type 0f 13818-7 Audio with ADTS transport syntax, language undetermined
+
+	A service name (TSMUX_SERVICE_NAME, with TSMUX_PROVIDER_NAME) adds an SDT
 */
-void write_pat(ts_writer *writer) {
-	u_char pat_header[4] = { 0x47, 0x40, 0x00, 0x10 }; // 4 bytes  010 0000000000000 00 01 0000
-	u_char pat_data_bytes[13] = { 0x00, 0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00, 0x00, 0x01, 0xf0, 0x00 };
-	u_char pat_crc_32[4] = { 0x2a, 0xb1, 0x04, 0xb2 };
-	// Set continuity counter
-	pat_header[3] |= 0x0f & writer->pat_cc;
-	
-	write_to_ts_file(&pat_header[0], writer, 4);
-	write_to_ts_file(&pat_data_bytes[0], writer, 13);
-	write_to_ts_file(&pat_crc_32[0], writer, 4);
-	
-	writer->last_pat_idx = writer->curr_packet_idx;
-	writer->pat_cc = (writer->pat_cc + 1) % 16;
+void build_psi_packets(psi_packets* psi) {
+	static const u_char audio_descriptors[6] = { 0x0a, 0x04, 'u', 'n', 'd', 0x00 }; // ISO 639 language
+	const ts_psi_stream streams[2] = {
+		{ PES_H264_PID, TS_PSI_STREAM_TYPE_H264, NULL, 0 },
+		{ PES_ADTS_PID, TS_PSI_STREAM_TYPE_ADTS, audio_descriptors, sizeof(audio_descriptors) }
+	};
+	const ts_psi_program program = {
+		.transport_stream_id = DEFAULT_TRANSPORT_STREAM_ID,
+		.original_network_id = DEFAULT_ORIGINAL_NETWORK_ID,
+		.program_number = DEFAULT_PROGRAM_NUMBER,
+		.pmt_pid = PMT_PID,
+		.pcr_pid = PES_H264_PID,
+		.streams = streams,
+		.stream_count = 2,
+		.provider_name = getenv("TSMUX_PROVIDER_NAME"),
+		.service_name = getenv("TSMUX_SERVICE_NAME")
+	};
+
+	ts_psi_build_pat(&program, psi->pat);
+	ts_psi_build_pmt(&program, psi->pmt);
+	psi->has_sdt = program.service_name != NULL && ts_psi_build_sdt(&program, psi->sdt);
+	if (program.service_name != NULL && !psi->has_sdt) {
+		printf("Warning: service name too long for the SDT, writing none\n");
+	}
 }
 
-/*
-	Payload describes the stream types
+// Queues a prebuilt table packet, with its continuity counter
+void write_psi_packet(ts_writer* writer, const u_char* packet, unsigned* cc) {
+	u_char* dest = writer->out_buffer + writer->out_size;
 
-	PID 0100 (256) -> Stream type 1b H.264/14496-10 video (MPEG-4/AVC)
-    PID 0101 (257) -> Stream type 0f 13818-7 Audio with ADTS transport syntax
-*/
-void write_pmt(ts_writer *writer) {
-	u_char pmt_header[4] = { 0x47, 0x50, 0x00, 0x10 };
-	// Specifies a program map table with an H264 and an ADTS stream
-	u_char pmt_data_bytes[29] = { 0x00, 0x02, 0xb0, 0x1d, 0x00, 0x01, 0xc1, 0x00, 0x00, 0xe1, 0x00, 0xf0, 0x00, 0x1b, 0xe1, 0x00, 0xf0, 0x00, 0x0f, 0xe1, 0x01, 0xf0, 0x06, 0x0a, 0x04, 0x75, 0x6e, 0x64, 0x00};
-	u_char pmt_crc_32[4] = { 0x08, 0x7d, 0xe8, 0x77 };
-	// Set continuity counter
-	pmt_header[3] |= 0x0f & writer->pmt_cc;
+	memcpy(dest, packet, MPEGTS_PACKET_SIZE);
+	ts_psi_set_continuity(dest, *cc);
+	writer->bytes_written = MPEGTS_PACKET_SIZE;
+	// continuity counter is a 4 bit field that must be reseted on overflow
+	*cc = (*cc + 1) % 16;
+}
 
-	write_to_ts_file(&pmt_header[0], writer, 4);
-	write_to_ts_file(&pmt_data_bytes[0], writer, 29);
-	write_to_ts_file(&pmt_crc_32[0], writer, 4);
+void write_pat(ts_writer *writer) {
+	write_psi_packet(writer, writer->psi->pat, &writer->pat_cc);
+	writer->last_pat_idx = writer->curr_packet_idx;
+}
 
+void write_pmt(ts_writer *writer) {
+	write_psi_packet(writer, writer->psi->pmt, &writer->pmt_cc);
 	writer->last_pmt_idx = writer->curr_packet_idx;
-	// continuity counter is a 4 bit field that must be reseted on overflow
-	writer->pmt_cc = (writer->pmt_cc + 1) % 16;
 }
 
+void write_sdt(ts_writer* writer) {
+	write_psi_packet(writer, writer->psi->sdt, &writer->sdt_cc);
+	writer->last_sdt_idx = writer->curr_packet_idx;
+}
+
+// The first packet of a random access point carries the PCR
 bool packet_has_pcr(ts_writer* writer) {
 	output_stream* stream = get_current_stream(writer);
 
-	return stream->pes_pid == PES_H264_PID && get_nalu_type(stream->frame) == SPS;
+	return stream->pes_pid == PES_H264_PID && !stream->pes_initialized && access_unit_is_random_access(stream);
+}
+
+// Every access unit starts with a delimiter, added unless the input has its own
+bool access_unit_needs_delimiter(const output_stream* stream) {
+	return stream->pes_pid == PES_H264_PID && stream->frame_size_bytes == stream->initial_frame_size_bytes &&
+		(stream->nal_types & NAL_TYPE_BIT(9)) == 0;
 }
 
 /*
@@ -388,12 +970,12 @@ int adaptation_field_length(ts_writer* writer) {
 	// Determine if we'll need to add stuffing bytes
 	int curr_pkt_size = MPEGTS_HEADER_SIZE + afsize;
 
-	if (packet_has_pcr(writer) || !stream->pes_initialized) {
+	if (!stream->pes_initialized) {
 		curr_pkt_size += pes_header_size;
 	}
 
-	if (stream->pes_pid == PES_H264_PID && get_nalu_type(stream->frame) == VCL) {
-		curr_pkt_size += 6;
+	if (access_unit_needs_delimiter(stream)) {
+		curr_pkt_size += AUD_NAL_SIZE;
 	}
 
 	if (MPEGTS_PACKET_SIZE > (curr_pkt_size + stream->frame_size_bytes)) {
@@ -432,7 +1014,7 @@ void write_adaptation_field_section(ts_writer* writer) {
 	long pcr = get_current_stream(writer)->pcr;
 	int bytes_written = 0;
 
-	u_char* field = (u_char*)malloc(adapfield_size);
+	u_char field[MPEGTS_PACKET_SIZE];
 
 	field[0] = (adapfield_size - 0x01);
 
@@ -506,8 +1088,9 @@ void write_pes_header(ts_writer* writer, int adapfield_size) {
 					}
 	*/
 	int pes_header_size = writer->curr_packet_type == PES_H264 ? PES_H264_HEADER_SIZE : PES_ADTS_HEADER_SIZE;
-	u_char* pes_header = (u_char*)malloc(pes_header_size);
+	u_char pes_header[PES_H264_HEADER_SIZE];
 	long pts;
+	long dts;
 
 	// packet start code prefix (must have 24 bits, last bit = 1)
 	pes_header[0] = 0x00;
@@ -523,7 +1106,7 @@ void write_pes_header(ts_writer* writer, int adapfield_size) {
 		pes_header[5] = 0xff & aac_size;
 		pts = writer->audio_stream->pts;
 		pes_header[7] = 0x80; // Setting PTS_DTS flag to 10 (PTS only)
-		pes_header[9] = 0x20 | (0x07 & pts >> 30) | 0x01;
+		pes_header[9] = 0x20 | ((0x07 & pts >> 30) << 1) | 0x01;
 	} else {
 		pes_header[3] = DEFAULT_PES_H264_STREAM_ID;
 		pes_header[4] = 0x00;
@@ -532,14 +1115,15 @@ void write_pes_header(ts_writer* writer, int adapfield_size) {
 		pes_header[8] = 0x0a;
 
 		pts = writer->video_stream->pts;
+		dts = writer->video_stream->dts;
 
-		// DTS (= PTS while we only support baseline)
+		// DTS: the PTS unless capture timestamps reorder pictures
 		pes_header[9] = 0x30 | ((0x07 & pts >> 30) << 1) | 0x01;
-		pes_header[14] = 0x10 | ((0x07 & pts >> 30) << 1) | 0x01;
-		pes_header[15] = pts >> 22;
-		pes_header[16] = ((pts >> 15) << 1) | 0x01;
-		pes_header[17] = pts >> 7;
-		pes_header[18] = pts | 0x01;
+		pes_header[14] = 0x10 | ((0x07 & dts >> 30) << 1) | 0x01;
+		pes_header[15] = dts >> 22;
+		pes_header[16] = ((dts >> 15) << 1) | 0x01;
+		pes_header[17] = dts >> 7;
+		pes_header[18] = (dts << 1) | 0x01;
 	}
 
 	pes_header[6] = 0x80;
@@ -548,74 +1132,274 @@ void write_pes_header(ts_writer* writer, int adapfield_size) {
 	pes_header[10] = pts >> 22;
 	pes_header[11] = ((pts >> 15) << 1) | 0x01;
 	pes_header[12] = pts >> 7;
-	pes_header[13] = pts | 0x01;
+	pes_header[13] = (pts << 1) | 0x01;
 
 	write_to_ts_file(&pes_header[0], writer, pes_header_size);
-	
-	free(pes_header);
 }
 
 unsigned write_pes_payload(ts_writer* writer) {
-	u_char aud_nal_packet[6] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xf0 };
-	u_char* payload_buffer;
+	u_char aud_nal_packet[AUD_NAL_SIZE] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xf0 };
 
 	output_stream* stream = writer->curr_packet_type == PES_ADTS ? writer->audio_stream : writer->video_stream; 
-	unsigned bytes_to_write = MIN(MPEGTS_PACKET_SIZE - writer->bytes_written, stream->frame_size_bytes);
 
-	if (
-		stream->pes_pid == PES_H264_PID && 
-		(get_nalu_type(stream->frame) == VCL || get_nalu_type(stream->frame) == SPS) && 
-		stream->frame_size_bytes == stream->initial_frame_size_bytes
-	) {
-		// add access unit delimiter
-		write_to_ts_file(&aud_nal_packet[0], writer, 6);
-		bytes_to_write = MIN(MPEGTS_PACKET_SIZE - writer->bytes_written, stream->frame_size_bytes);
+	if (access_unit_needs_delimiter(stream)) {
+		write_to_ts_file(&aud_nal_packet[0], writer, AUD_NAL_SIZE);
 	}
+	unsigned bytes_to_write = MIN(MPEGTS_PACKET_SIZE - writer->bytes_written, stream->frame_size_bytes);
 	write_to_ts_file(stream->frame, writer, bytes_to_write);
 	stream->frame_size_bytes -= bytes_to_write;
 	stream->frame += bytes_to_write;
 
+	// One PES per access unit or ADTS frame
 	if (stream->frame_size_bytes <= 0) {
+		stream->pes_initialized = false;
+		stream->frame = NULL;
 		if (stream->pes_pid == PES_H264_PID) {
-			stream->frame = NULL;
+			// The next picture's timestamps decide what is interleaved before it
 			load_frame(writer);
-			if (get_nalu_type(stream->frame) == VCL || get_nalu_type(stream->frame) == SPS) {
-				stream->pes_initialized = false;
-			}
-		} else {
-			stream->pes_initialized = false;
-			stream->frame = NULL;
 		}
 	} 
 
 	return bytes_to_write;
 }
 
-void add_segment_to_playlist(ts_writer *writer) {
-	char segment_duration[32];
-	char segment_filename[32];
-
-	double vduration = (double)writer->video_stream->frames_read / VIDEO_FPS;
-	
-	sprintf(&segment_duration[0], "#EXTINF:%.3f\n", vduration);
-	fputs(&segment_duration[0], writer->hlsptr);
-	sprintf(segment_filename, "%s-%d.ts\n", OUTPUT_SEGMENT_PREFIX, writer->segment_index);
-	fputs(segment_filename, writer->hlsptr);
-	writer->segment_index += 1;
+void write_live_parts(FILE* playlist, int segment_index, const live_part* parts, int part_count) {
+	for (int i = 0; i < part_count; i++) {
+		fprintf(playlist, "#EXT-X-PART:DURATION=%.3f,URI=\"%s-%d.ts\",BYTERANGE=\"%ld@%ld\"%s\n",
+			parts[i].duration, OUTPUT_SEGMENT_PREFIX, segment_index, parts[i].size, parts[i].offset,
+			parts[i].independent ? ",INDEPENDENT=YES" : "");
+	}
+}
+
+/*
+	Rewrites the live playlist with the segments in the window. The new playlist
+	replaces the old one in a single rename, so readers never see a partial file.
+
+	With parts, the open segment is listed part by part after the closed ones,
+	followed by a hint for the part being written. Blocking reloads are left to
+	the server in front of the files
+*/
+void publish_live_playlist(ts_writer* writer, bool ended) {
+	bool parts = writer->part_duration_ms > 0;
+	FILE* tmp = fopen(HLS_PLAYLIST_TMP_FILENAME, "w");
+	if (tmp == NULL) {
+		printf("Error: cannot write %s\n", HLS_PLAYLIST_TMP_FILENAME);
+		return;
+	}
+
+	fprintf(tmp, "#EXTM3U\n#EXT-X-VERSION:%d\n#EXT-X-TARGETDURATION:%d\n", parts ? 6 : 3, writer->target_duration);
+	if (parts) {
+		// Players hold back at least three parts from the live edge
+		double part_target = writer->part_duration_ms / 1000.0;
+		fprintf(tmp, "#EXT-X-SERVER-CONTROL:PART-HOLD-BACK=%.3f\n#EXT-X-PART-INF:PART-TARGET=%.3f\n", 3 * part_target, part_target);
+	}
+	fprintf(tmp, "#EXT-X-MEDIA-SEQUENCE:%d\n", writer->window_count > 0 ? writer->window_index[0] : 0);
+	for (int i = 0; i < writer->window_count; i++) {
+		if (parts && i >= writer->window_count - LIVE_PART_SEGMENTS) {
+			write_live_parts(tmp, writer->window_index[i], writer->window_parts[i], writer->window_part_count[i]);
+		}
+		fprintf(tmp, "#EXTINF:%.3f\n%s-%d.ts\n", writer->window_duration[i], OUTPUT_SEGMENT_PREFIX, writer->window_index[i]);
+	}
+	if (ended) {
+		fputs("#EXT-X-ENDLIST\n", tmp);
+	} else if (parts) {
+		write_live_parts(tmp, writer->segment_index, writer->open_parts, writer->open_part_count);
+		fprintf(tmp, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s-%d.ts\",BYTERANGE-START=%ld\n",
+			OUTPUT_SEGMENT_PREFIX, writer->segment_index, writer->part_start);
+	}
+	fclose(tmp);
+
+#ifdef _WIN32
+	MoveFileExA(HLS_PLAYLIST_TMP_FILENAME, HLS_PLAYLIST_FILENAME, MOVEFILE_REPLACE_EXISTING);
+#else
+	rename(HLS_PLAYLIST_TMP_FILENAME, HLS_PLAYLIST_FILENAME);
+#endif
+}
+
+/*
+	Latency from the arrival of the segment's first frame, and of the data that
+	closed it, to the playlist listing it
+*/
+void report_live_latency(ts_writer* writer, int segment_index, double closed_arrival_ms) {
+	double published_ms = now_ms();
+	double first_frame_ms = published_ms - writer->segment_arrival_ms;
+	double last_frame_ms = published_ms - closed_arrival_ms;
+
+	writer->published_count += 1;
+	writer->latency_sum_ms += last_frame_ms;
+	writer->latency_max_ms = MAX(writer->latency_max_ms, last_frame_ms);
+
+	fprintf(stderr, "live: published %s-%d.ts, latency %.1f ms from its first frame, %.1f ms from its last\n",
+		OUTPUT_SEGMENT_PREFIX, segment_index, first_frame_ms, last_frame_ms);
+}
+
+// A picture loaded but not written yet starts after the ones written, else the last one written ends them
+unsigned long video_written_end_dts(const output_stream* video) {
+	bool pending = video->frame != NULL && video->frame_size_bytes > 0;
+	return pending ? video->dts : video->dts + video->frame_duration;
+}
+
+/*
+	Ends the open part at the data written so far. The segment file is flushed
+	so the byte range is readable once the playlist lists it
+*/
+void close_live_part(ts_writer* writer, double closed_arrival_ms) {
+	if (writer->part_duration_ms == 0) {
+		return;
+	}
+
+	flush_ts_output(writer);
+	fflush(writer->segptr);
+	if (writer->segment_bytes == writer->part_start) {
+		return;
+	}
+
+	if (writer->open_part_count == writer->open_part_capacity) {
+		writer->open_part_capacity = MAX(writer->open_part_capacity * 2, 16);
+		writer->open_parts = (live_part*)realloc(writer->open_parts, writer->open_part_capacity * sizeof(live_part));
+	}
+	live_part* part = &writer->open_parts[writer->open_part_count];
+	part->offset = writer->part_start;
+	part->size = writer->segment_bytes - writer->part_start;
+	if (writer->video_stream->timestamps != NULL) {
+		part->duration = (double)(video_written_end_dts(writer->video_stream) - writer->part_start_dts) / 90000;
+	} else {
+		part->duration = (double)writer->part_frames / VIDEO_FPS;
+	}
+	part->independent = writer->part_independent;
+	writer->open_part_count += 1;
+
+	double latency_ms = now_ms() - closed_arrival_ms;
+	writer->part_published_count += 1;
+	writer->part_latency_sum_ms += latency_ms;
+	writer->part_latency_max_ms = MAX(writer->part_latency_max_ms, latency_ms);
+	fprintf(stderr, "live: published part %d of %s-%d.ts%s, latency %.1f ms from its first frame, %.1f ms from its last\n",
+		writer->open_part_count - 1, OUTPUT_SEGMENT_PREFIX, writer->segment_index, part->independent ? " (independent)" : "",
+		now_ms() - writer->part_arrival_ms, latency_ms);
+
+	writer->part_start = writer->segment_bytes;
+	writer->part_frames = 0;
+}
+
+/*
+	Called as each video PES starts, which is where an access unit starts.
+	Parts end before the next picture would take them past the part target,
+	counted at the fixed rate unless the pictures have capture timestamps.
+	As for segments, a part can be independent from an SPS and IDR picture
+*/
+void update_live_part(ts_writer* writer, output_stream* stream) {
+	if (writer->part_duration_ms == 0) {
+		return;
+	}
+
+	bool part_full = stream->timestamps != NULL
+		? stream->dts + stream->frame_duration - writer->part_start_dts > (unsigned long)writer->part_duration_ms * 90
+		: (writer->part_frames + 1) * 1000 > writer->part_duration_ms * VIDEO_FPS;
+	if (writer->part_frames > 0 && part_full) {
+		close_live_part(writer, stream->frame_arrival_ms);
+		publish_live_playlist(writer, false);
+	}
+
+	if (writer->part_frames == 0) {
+		writer->part_arrival_ms = stream->frame_arrival_ms;
+		writer->part_start_dts = stream->dts;
+		writer->part_independent = access_unit_is_random_access(stream);
+	}
+	writer->part_frames += 1;
+}
+
+// Pictures written to the segment: one loaded but not written yet belongs to the next
+int video_frames_written(const output_stream* video) {
+	bool pending = video->frame != NULL && video->frame_size_bytes > 0 && (video->nal_types & NAL_SLICE_TYPES) != 0;
+	return video->frames_read - (pending ? 1 : 0);
+}
+
+/*
+	Whether the random access point just loaded opens a new segment: after
+	DEFAULT_TS_FILE_DURATION of pictures, counted at the fixed rate unless they
+	have capture timestamps
+*/
+bool segment_cut_due(const output_stream* video, unsigned long segment_start_dts) {
+	if (video->timestamps != NULL) {
+		return video->dts - segment_start_dts >= DEFAULT_TS_FILE_DURATION * 90;
+	}
+	return video_frames_written(video) >= DEFAULT_TS_FILE_DURATION * VIDEO_FPS / 1000;
+}
+
+// A picture loaded but not written yet starts the next segment, else the last one written ends this one
+double video_segment_duration(const output_stream* video, unsigned long segment_start_dts) {
+	if (video->timestamps == NULL) {
+		return (double)video_frames_written(video) / VIDEO_FPS;
+	}
+
+	return (double)(video_written_end_dts(video) - segment_start_dts) / 90000;
+}
+
+void add_segment_to_playlist(ts_writer *writer) {
+	char segment_duration[32];
+	char segment_filename[32];
+
+	double vduration = video_segment_duration(writer->video_stream, writer->segment_start_dts);
+
+	if (writer->live) {
+		if (writer->window_count == LIVE_PLAYLIST_WINDOW) {
+			free(writer->window_parts[0]);
+			memmove(&writer->window_index[0], &writer->window_index[1], (LIVE_PLAYLIST_WINDOW - 1) * sizeof(int));
+			memmove(&writer->window_duration[0], &writer->window_duration[1], (LIVE_PLAYLIST_WINDOW - 1) * sizeof(double));
+			memmove(&writer->window_parts[0], &writer->window_parts[1], (LIVE_PLAYLIST_WINDOW - 1) * sizeof(writer->window_parts[0]));
+			memmove(&writer->window_part_count[0], &writer->window_part_count[1], (LIVE_PLAYLIST_WINDOW - 1) * sizeof(int));
+			writer->window_count -= 1;
+		}
+		writer->window_index[writer->window_count] = writer->segment_index;
+		writer->window_duration[writer->window_count] = vduration;
+		// The open segment's parts go with it, and the next one starts a new array
+		writer->window_parts[writer->window_count] = writer->open_parts;
+		writer->window_part_count[writer->window_count] = writer->open_part_count;
+		writer->open_parts = NULL;
+		writer->open_part_count = 0;
+		writer->open_part_capacity = 0;
+		writer->window_count += 1;
+		// The target duration may only grow: players rely on it between reloads
+		writer->target_duration = MAX(writer->target_duration, (int)(vduration + 0.999));
+		writer->segment_index += 1;
+		return;
+	}
+	
+	sprintf(&segment_duration[0], "#EXTINF:%.3f\n", vduration);
+	fputs(&segment_duration[0], writer->hlsptr);
+	sprintf(segment_filename, "%s-%d.ts\n", OUTPUT_SEGMENT_PREFIX, writer->segment_index);
+	fputs(segment_filename, writer->hlsptr);
+	writer->segment_index += 1;
 }
 
 void init_next_ts_file(ts_writer* writer) {
 	char segment_filename[32];
 
-	add_segment_to_playlist(writer);
-	fflush(writer->hlsptr);
+	// The segment must be complete on disk before a playlist references it
+	if (writer->live) {
+		close_live_part(writer, writer->video_stream->frame_arrival_ms);
+	}
+	flush_ts_output(writer);
 	fclose(writer->segptr);
+	writer->segment_bytes = 0;
+	writer->part_start = 0;
+	add_segment_to_playlist(writer);
+	if (writer->live) {
+		publish_live_playlist(writer, false);
+		report_live_latency(writer, writer->segment_index - 1, writer->video_stream->frame_arrival_ms);
+		writer->segment_arrival_ms = writer->video_stream->frame_arrival_ms;
+	} else {
+		fflush(writer->hlsptr);
+	}
 	sprintf(segment_filename, "%s-%d.ts", OUTPUT_SEGMENT_PREFIX, writer->segment_index);
-	writer->segptr = fopen(segment_filename, "w");
+	writer->segptr = fopen(segment_filename, "wb");
 	writer->audio_stream->frames_read = 0;
-	writer->video_stream->frames_read = 0;
+	// The picture that cut the segment is the first of the next
+	writer->video_stream->frames_read -= video_frames_written(writer->video_stream);
+	writer->segment_start_dts = writer->video_stream->dts;
 	writer->last_pat_idx = -DEFAULT_PAT_INTERVAL;
 	writer->last_pmt_idx = -DEFAULT_PMT_INTERVAL;
+	writer->last_sdt_idx = -DEFAULT_SDT_INTERVAL;
 }
 
 unsigned write_pes_packet(ts_writer* writer) {
@@ -639,12 +1423,22 @@ unsigned write_pes_packet(ts_writer* writer) {
 
 	if (
 		stream->pes_pid == PES_H264_PID &&
-		(writer->video_stream->frames_read >= DEFAULT_TS_FILE_DURATION * VIDEO_FPS / 1000) &&
-		get_nalu_type(stream->frame) == SPS
+		!stream->pes_initialized &&
+		access_unit_is_random_access(stream) &&
+		segment_cut_due(writer->video_stream, writer->segment_start_dts)
 	) {
+		if (writer->memory_output != NULL) {
+			// The next segment is muxed elsewhere: stop before its first packet
+			writer->cut_reached = true;
+			return 0;
+		}
 		init_next_ts_file(writer);
 	}
 
+	if (writer->live && stream->pes_pid == PES_H264_PID && !stream->pes_initialized) {
+		update_live_part(writer, stream);
+	}
+
 	write_to_ts_file(&ts_header[0], writer, 4);
 	write_adaptation_field_section(writer);
 
@@ -658,15 +1452,25 @@ unsigned write_pes_packet(ts_writer* writer) {
 	return write_pes_payload(writer);
 }
 
+/*
+	The input is exhausted as soon as its last unit is loaded: the stream is
+	empty once that unit is written as well
+*/
+bool output_stream_empty(const output_stream* stream) {
+	return es_input_exhausted(&stream->input) && (stream->frame == NULL || stream->frame_size_bytes == 0);
+}
+
 void packet_type_to_write(ts_writer *writer) {
-	bool vstream_emtpy = (writer->video_stream->file_size == 0 && writer->video_stream->loaded_buffer_size == 0);
-	bool astream_emtpy = (writer->audio_stream->file_size == 0 && writer->audio_stream->loaded_buffer_size == 0);
+	bool vstream_emtpy = output_stream_empty(writer->video_stream);
+	bool astream_emtpy = output_stream_empty(writer->audio_stream);
 
 	if (writer->curr_packet_idx - writer->last_pat_idx >= DEFAULT_PAT_INTERVAL)
 		writer->curr_packet_type = PAT;
 	else if (writer->curr_packet_idx - writer->last_pmt_idx >= DEFAULT_PMT_INTERVAL) {
 		writer->curr_packet_type = PMT;
-	} else if (!vstream_emtpy && writer->audio_stream->pts > writer->video_stream->pts && writer->audio_stream->frame_size_bytes == 0) {
+	} else if (writer->psi->has_sdt && writer->curr_packet_idx - writer->last_sdt_idx >= DEFAULT_SDT_INTERVAL) {
+		writer->curr_packet_type = SDT;
+	} else if (!vstream_emtpy && (astream_emtpy || writer->audio_stream->pts > writer->video_stream->dts) && writer->audio_stream->frame_size_bytes == 0) {
 		writer->curr_packet_type = PES_H264;
 	} else if (!astream_emtpy) {
 		writer->curr_packet_type = PES_ADTS;
@@ -675,101 +1479,832 @@ void packet_type_to_write(ts_writer *writer) {
 	}
 }
 
-void run_writer() {
-	ts_packet_type packet_type;
+/*
+	Writes one packet. Returns false once both inputs are exhausted, or when a
+	segment muxed on its own reaches the start of the next one
+*/
+bool write_next_packet(ts_writer* writer) {
+	packet_type_to_write(writer);
 
-	FILE* h264_input = fopen(getenv("TSMUX_H264_FILE"), "r");
-	FILE* adts_input = fopen(getenv("TSMUX_ADTS_FILE"), "r");
+	if (writer->curr_packet_type == TS_UNKNOWN) {
+		return false;
+	}
 
-	char segment_filename[16]; 
-	int segment_index = 0;
-	char hls_header[64];
-	sprintf(segment_filename, "%s-%d.ts", OUTPUT_SEGMENT_PREFIX, segment_index);
-	FILE* hls = fopen(HLS_PLAYLIST_FILENAME, "w");
-	FILE* segment = fopen(segment_filename, "w");
+	writer->bytes_written = 0;
+
+	if (writer->curr_packet_type == PAT) {
+		write_pat(writer);
+	} else if (writer->curr_packet_type == PMT) {
+		write_pmt(writer);
+	} else if (writer->curr_packet_type == SDT) {
+		write_sdt(writer);
+	} else if (writer->curr_packet_type == PES_ADTS) {
+		write_pes_packet(writer);
+	} else {
+		write_pes_packet(writer);
+		if (writer->live && writer->segment_arrival_ms == 0) {
+			writer->segment_arrival_ms = writer->video_stream->frame_arrival_ms;
+		}
+	}
 
-	// Init HLS
-	sprintf(hls_header, "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%d\n", DEFAULT_TS_FILE_DURATION / 1000);
-	fputs(hls_header, hls);
+	if (writer->cut_reached) {
+		return false;
+	}
 
-	// Get file sizes
-	fseek(h264_input, 0, SEEK_END);
-	output_stream vstream = {
-		.fileptr = h264_input,
-		.file_size = ftell(h264_input),
-		.frame = NULL,
-		.frame_size_bytes = 0,
-		.initial_frame_size_bytes = 0,
-		.pes_pid = PES_H264_PID,
-		.continuity_counter = 0,
-		.pcr = INITIAL_PCR,
-		.pts = INITIAL_PCR * 2,
-		.dts = INITIAL_PCR * 2,
-		.pes_initialized = false
-	};
-	fseek(h264_input, 0, SEEK_SET);
+	finish_ts_packet(writer);
+	writer->curr_packet_idx += 1;
+	return true;
+}
 
-	fseek(adts_input, 0, SEEK_END);
-	output_stream astream = {
-		.fileptr = adts_input,
-		.file_size = ftell(adts_input),
+output_stream new_output_stream(int pes_pid) {
+	output_stream stream = {
 		.frame = NULL,
 		.frame_size_bytes = 0,
 		.initial_frame_size_bytes = 0,
-		.pes_pid = PES_ADTS_PID,
+		.pes_pid = pes_pid,
 		.continuity_counter = 0,
 		.pcr = INITIAL_PCR,
 		.pts = INITIAL_PCR * 2,
 		.dts = INITIAL_PCR * 2,
+		.frame_duration = pes_pid == PES_H264_PID ? VIDEO_FRAME_CLOCK : AUDIO_FRAME_CLOCK,
 		.pes_initialized = false
 	};
-	fseek(adts_input, 0, SEEK_SET);
+	return stream;
+}
+
+void run_writer() {
+	output_stream vstream = new_output_stream(PES_H264_PID);
+	output_stream astream = new_output_stream(PES_ADTS_PID);
+
+	bool live = getenv("TSMUX_LIVE") != NULL;
+	const char* part_ms = getenv("TSMUX_PART_MS");
+	int part_duration_ms = live ? (part_ms != NULL ? atoi(part_ms) : LIVE_PART_DURATION_MS) : 0;
+	if (part_duration_ms > 0) {
+		// A part holds at least one picture
+		part_duration_ms = MAX(part_duration_ms, 1000 / VIDEO_FPS);
+	}
+
+	es_timestamps timestamps[2];
+
+	if (!es_input_open(&vstream.input, getenv("TSMUX_H264_FILE"), live) || !es_input_open(&astream.input, getenv("TSMUX_ADTS_FILE"), live)) {
+		return;
+	}
+	if (!open_stream_timestamps(&vstream, &astream, timestamps, live)) {
+		return;
+	}
+
+	char segment_filename[16]; 
+	int segment_index = 0;
+	char hls_header[64];
+	sprintf(segment_filename, "%s-%d.ts", OUTPUT_SEGMENT_PREFIX, segment_index);
+	FILE* hls = NULL;
+	FILE* segment = fopen(segment_filename, "wb");
+
+	// Init HLS. The live playlist is written whole each time a segment closes
+	if (!live) {
+		hls = fopen(HLS_PLAYLIST_FILENAME, "w");
+		sprintf(hls_header, "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%d\n", DEFAULT_TS_FILE_DURATION / 1000);
+		fputs(hls_header, hls);
+	}
+
+	psi_packets psi;
+	build_psi_packets(&psi);
 
 	ts_writer writer = {
 		.segptr = segment,
 		.hlsptr = hls,
 		.last_pat_idx = -DEFAULT_PAT_INTERVAL,
 		.last_pmt_idx = -DEFAULT_PMT_INTERVAL,
+		.last_sdt_idx = -DEFAULT_SDT_INTERVAL,
+		.psi = &psi,
 		.audio_stream = &astream,
 		.video_stream = &vstream,
-		.segment_index = 0
+		.segment_index = 0,
+		.segment_start_dts = first_segment_start_dts(&vstream),
+		.live = live,
+		.target_duration = DEFAULT_TS_FILE_DURATION / 1000,
+		.part_duration_ms = MAX(part_duration_ms, 0)
 	};
 
 	// Write one packet per iteration
-	while (1) {
-		packet_type_to_write(&writer);
-
-		if (writer.curr_packet_type != TS_UNKNOWN) {
-			writer.bytes_written = 0;
+	while (write_next_packet(&writer));
+
+	// Finished reading files, exit writer
+	es_input_close(&vstream.input);
+	es_input_close(&astream.input);
+	es_timestamps_close(&timestamps[0]);
+	es_timestamps_close(&timestamps[1]);
+	if (writer.live) {
+		close_live_part(&writer, vstream.frame_arrival_ms);
+	}
+	flush_ts_output(&writer);
+	fclose(writer.segptr);
+	add_segment_to_playlist(&writer);
+	if (writer.live) {
+		publish_live_playlist(&writer, true);
+		report_live_latency(&writer, writer.segment_index - 1, vstream.frame_arrival_ms);
+		fprintf(stderr, "live: %d segments, latency from the last frame of a segment %.1f ms on average, %.1f ms at most\n",
+			writer.published_count, writer.latency_sum_ms / writer.published_count, writer.latency_max_ms);
+		if (writer.part_published_count > 0) {
+			fprintf(stderr, "live: %d parts, latency from the last frame of a part %.1f ms on average, %.1f ms at most\n",
+				writer.part_published_count, writer.part_latency_sum_ms / writer.part_published_count, writer.part_latency_max_ms);
+		}
+		for (int i = 0; i < writer.window_count; i++) {
+			free(writer.window_parts[i]);
 		}
+	} else {
+		fputs("#EXT-X-ENDLIST", writer.hlsptr);
+		fclose(writer.hlsptr);
+	}
+}
 
-		if (writer.curr_packet_type == PAT) {
-			write_pat(&writer);
-		} else if (writer.curr_packet_type == PMT) {
-			write_pmt(&writer);
-		} else if (writer.curr_packet_type == PES_ADTS) {
-			write_pes_packet(&writer);
-		} else if (writer.curr_packet_type == PES_H264) {
-			write_pes_packet(&writer);
-		} else {
-			// Finished reading files, exit writer
-			fclose(h264_input);
-			fclose(adts_input);
-			fclose(writer.segptr);
-			add_segment_to_playlist(&writer);
-			fputs("#EXT-X-ENDLIST", writer.hlsptr);
-			fclose(writer.hlsptr);
+/*
+	fMP4 output (TSMUX_FORMAT=fmp4): the same inputs as fragmented MP4 for HLS.
+	Access units become AVCC samples and ADTS frames raw AAC samples, and each
+	segment is one fragment holding both tracks, cut on the same rule as the TS
+	segments. Parameter sets and access unit delimiters stay out of the samples:
+	the SPS and PPS go into the init segment
+*/
+typedef struct {
+	fmp4_buffer data;
+	fmp4_sample* samples;
+	int sample_count;
+	int sample_capacity;
+	uint64_t decode_time; // of the first sample
+	uint64_t end_time;    // after the last sample
+} fmp4_fragment_track;
+
+typedef struct {
+	FILE* hlsptr;
+	int segment_index;
+	fmp4_buffer header;
+	fmp4_fragment_track video;
+	fmp4_fragment_track audio;
+
+	fmp4_buffer sps;
+	fmp4_buffer pps;
+	fmp4_audio_config audio_config;
+	bool audio_configured;
+	bool init_written;
+} fmp4_writer;
+
+void fmp4_add_sample(fmp4_fragment_track* track, uint32_t size, uint32_t duration, uint32_t flags) {
+	if (track->sample_count == track->sample_capacity) {
+		track->sample_capacity = MAX(track->sample_capacity * 2, 256);
+		track->samples = (fmp4_sample*)realloc(track->samples, track->sample_capacity * sizeof(fmp4_sample));
+	}
+	fmp4_sample* sample = &track->samples[track->sample_count++];
+	sample->size = size;
+	sample->duration = duration;
+	sample->flags = flags;
+	track->end_time += duration;
+}
 
+/*
+	Moves the ADTS frames that start before the given video time, or all of
+	them, into the fragment. The first frame that does not fit stays loaded
+*/
+void fmp4_pull_audio(fmp4_writer* writer, output_stream* astream, uint64_t until_90khz, bool all) {
+	while (true) {
+		load_stream_frame(astream);
+		if (astream->frame_size_bytes == 0) {
 			return;
 		}
 
-		write_stuffing_bytes(&writer);
-		writer.curr_packet_idx += 1;
+		if (!writer->audio_configured) {
+			writer->audio_configured = fmp4_audio_config_from_adts(astream->frame, &writer->audio_config);
+			if (!writer->audio_configured) {
+				printf("Error: unsupported ADTS sampling frequency\n");
+				return;
+			}
+		}
+		if (!all && writer->audio.end_time * 90000 / writer->audio_config.sample_rate >= until_90khz) {
+			return;
+		}
+
+		// Protection absent: 7 byte header, else 9 with the CRC. One raw data block per frame is assumed
+		int header_size = (astream->frame[1] & 0x01) ? 7 : 9;
+		uint32_t duration = ADTS_SAMPLES_PER_FRAME * ((astream->frame[6] & 0x03) + 1);
+		uint32_t size = (uint32_t)(astream->frame_size_bytes - header_size);
+
+		fmp4_put_bytes(&writer->audio.data, astream->frame + header_size, size);
+		fmp4_add_sample(&writer->audio, size, duration, FMP4_SYNC_SAMPLE_FLAGS);
+		astream->frame = NULL;
 	}
 }
 
+bool write_fmp4_segment(fmp4_writer* writer) {
+	char segment_filename[32];
+	fmp4_run runs[2] = {
+		{
+			.track_id = FMP4_VIDEO_TRACK_ID,
+			.base_decode_time = writer->video.decode_time,
+			.samples = writer->video.samples,
+			.sample_count = writer->video.sample_count,
+			.default_duration = VIDEO_FRAME_CLOCK,
+			.sample_flags = true,
+			.data_size = writer->video.data.size
+		},
+		{
+			.track_id = FMP4_AUDIO_TRACK_ID,
+			.base_decode_time = writer->audio.decode_time,
+			.samples = writer->audio.samples,
+			.sample_count = writer->audio.sample_count,
+			.default_duration = 0,
+			.sample_flags = false,
+			.data_size = writer->audio.data.size
+		}
+	};
+
+	if (!writer->init_written) {
+		fmp4_video_config video_config = {
+			.sps = writer->sps.data,
+			.sps_size = writer->sps.size,
+			.pps = writer->pps.data,
+			.pps_size = writer->pps.size,
+			.timescale = 90000
+		};
+		FILE* init = fopen(FMP4_INIT_FILENAME, "wb");
+		if (init == NULL || writer->pps.size == 0 || !fmp4_write_init(&writer->header, &video_config, writer->audio_configured ? &writer->audio_config : NULL)) {
+			printf("Error: cannot write %s from the SPS and PPS\n", FMP4_INIT_FILENAME);
+			if (init != NULL) {
+				fclose(init);
+			}
+			return false;
+		}
+		fwrite(writer->header.data, 1, writer->header.size, init);
+		fclose(init);
+		writer->init_written = true;
+	}
+
+	writer->header.size = 0;
+	fmp4_write_fragment_header(&writer->header, (uint32_t)writer->segment_index + 1, runs, writer->audio_configured ? 2 : 1);
+
+	sprintf(segment_filename, "%s-%d.m4s", OUTPUT_SEGMENT_PREFIX, writer->segment_index);
+	FILE* segment = fopen(segment_filename, "wb");
+	fwrite(writer->header.data, 1, writer->header.size, segment);
+	fwrite(writer->video.data.data, 1, writer->video.data.size, segment);
+	fwrite(writer->audio.data.data, 1, writer->audio.data.size, segment);
+	fclose(segment);
+
+	fprintf(writer->hlsptr, "#EXTINF:%.3f\n%s\n", (double)writer->video.sample_count / VIDEO_FPS, segment_filename);
+	writer->segment_index += 1;
+
+	writer->video.decode_time = writer->video.end_time;
+	writer->video.sample_count = 0;
+	writer->video.data.size = 0;
+	writer->audio.decode_time = writer->audio.end_time;
+	writer->audio.sample_count = 0;
+	writer->audio.data.size = 0;
+	return true;
+}
+
+void run_fmp4_writer() {
+	output_stream vstream = { .frame = NULL, .pes_pid = PES_H264_PID };
+	output_stream astream = { .frame = NULL, .pes_pid = PES_ADTS_PID };
+
+	if (!es_input_open(&vstream.input, getenv("TSMUX_H264_FILE"), false) || !es_input_open(&astream.input, getenv("TSMUX_ADTS_FILE"), false)) {
+		return;
+	}
+
+	fmp4_writer writer = { .hlsptr = fopen(HLS_PLAYLIST_FILENAME, "w") };
+	fprintf(writer.hlsptr, "#EXTM3U\n#EXT-X-VERSION:7\n#EXT-X-TARGETDURATION:%d\n#EXT-X-MAP:URI=\"%s\"\n",
+		DEFAULT_TS_FILE_DURATION / 1000, FMP4_INIT_FILENAME);
+
+	// The access unit being written, as AVCC
+	fmp4_buffer au = { 0 };
+	bool ok = true;
+
+	while (ok) {
+		vstream.frame = NULL;
+		load_stream_frame(&vstream);
+		if (vstream.frame_size_bytes == 0) {
+			break;
+		}
+		if ((vstream.nal_types & NAL_SLICE_TYPES) == 0) {
+			continue;
+		}
+
+		// A new segment starts at an IDR picture once the segment is long enough
+		bool sync = (vstream.nal_types & NAL_TYPE_BIT(5)) != 0;
+		if (sync && writer.video.sample_count >= DEFAULT_TS_FILE_DURATION * VIDEO_FPS / 1000) {
+			fmp4_pull_audio(&writer, &astream, writer.video.end_time, false);
+			ok = write_fmp4_segment(&writer);
+		}
+
+		const u_char* frame = vstream.frame;
+		size_t size = (size_t)vstream.frame_size_bytes;
+		size_t code = ts_scan_start_code(frame, size, 0);
+		au.size = 0;
+		while (code < size) {
+			size_t nal_start = code + 3;
+			size_t nal_end = ts_scan_nal_end(frame, size, nal_start);
+			int nal_type = nal_start < size ? frame[nal_start] & 0x1f : 0;
+			size_t nal_size = nal_end - nal_start;
+
+			if (nal_type == 7 || nal_type == 8) {
+				// The first parameter sets describe the stream
+				fmp4_buffer* parameter_set = nal_type == 7 ? &writer.sps : &writer.pps;
+				if (parameter_set->size == 0) {
+					fmp4_put_bytes(parameter_set, frame + nal_start, nal_size);
+				}
+			} else if (nal_type != 9 && nal_size > 0) {
+				fmp4_put_u32(&au, (uint32_t)nal_size);
+				fmp4_put_bytes(&au, frame + nal_start, nal_size);
+			}
+			code = ts_scan_start_code(frame, size, nal_end);
+		}
+
+		fmp4_put_bytes(&writer.video.data, au.data, au.size);
+		fmp4_add_sample(&writer.video, (uint32_t)au.size, VIDEO_FRAME_CLOCK, sync ? FMP4_SYNC_SAMPLE_FLAGS : FMP4_NON_SYNC_SAMPLE_FLAGS);
+	}
+
+	if (ok && writer.video.sample_count > 0) {
+		fmp4_pull_audio(&writer, &astream, 0, true);
+		ok = write_fmp4_segment(&writer);
+	}
+	fputs("#EXT-X-ENDLIST", writer.hlsptr);
+	fclose(writer.hlsptr);
+
+	es_input_close(&vstream.input);
+	es_input_close(&astream.input);
+	free(au.data);
+	free(writer.header.data);
+	free(writer.video.data.data);
+	free(writer.video.samples);
+	free(writer.audio.data.data);
+	free(writer.audio.samples);
+	free(writer.sps.data);
+	free(writer.pps.data);
+}
+
+/*
+	Parallel offline muxing (TSMUX_THREADS > 1).
+
+	A segment starts at the first packet of a random access point's PES, and at
+	that point the muxer state follows from the units read so far: the video
+	input sits on that access unit with its timestamps counted, and the audio
+	input is between frames, having read every frame needed to get past the
+	video dts. An index pass over the units records that seed for every
+	segment, each segment is then muxed on its own by a worker, and the
+	segments are written in order.
+
+	Continuity counters depend on every packet before, so workers start them at
+	zero and they are offset per PID when the segment is written. Each worker
+	also checks that it ends where the next seed starts; if not, the run falls
+	back to the sequential muxer, so the output is always the sequential one
+*/
+typedef struct {
+	size_t offset;       // of the next unit, in the file
+	size_t frame_offset; // of the loaded video frame
+	long frame_size;
+	unsigned nal_types;
+	bool tail;           // read from the copy of the end of the file
+	size_t units_read;
+	unsigned long pts;
+	unsigned long dts;
+	unsigned long pcr;
+	unsigned long frame_duration;
+} stream_seed;
+
+typedef struct {
+	stream_seed video;
+	stream_seed audio;
+} segment_seed;
+
+typedef struct {
+	fmp4_buffer data;
+	double duration;
+	bool ended;          // reached the end of the inputs instead of the next segment
+	segment_seed end;    // where it stopped
+	bool done;
+} segment_result;
+
+typedef struct {
+	es_input video_input; // mapped by the index pass, shared read-only
+	es_input audio_input;
+	es_timestamps timestamps[2]; // read whole by the index pass
+	bool has_timestamps[2];
+	size_t video_tail_start;
+	size_t audio_tail_start;
+
+	psi_packets psi;
+	segment_seed* seeds;
+	segment_result* results;
+	int segment_count;
+
+	int next_segment;
+	int written_count;
+	int max_ahead;
+	bool abort;
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE changed;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+#endif
+} parallel_job;
+
+void parallel_lock(parallel_job* job) {
+#ifdef _WIN32
+	EnterCriticalSection(&job->lock);
+#else
+	pthread_mutex_lock(&job->lock);
+#endif
+}
+
+void parallel_unlock(parallel_job* job) {
+#ifdef _WIN32
+	LeaveCriticalSection(&job->lock);
+#else
+	pthread_mutex_unlock(&job->lock);
+#endif
+}
+
+void parallel_wait(parallel_job* job) {
+#ifdef _WIN32
+	SleepConditionVariableCS(&job->changed, &job->lock, INFINITE);
+#else
+	pthread_cond_wait(&job->changed, &job->lock);
+#endif
+}
+
+void parallel_notify(parallel_job* job) {
+#ifdef _WIN32
+	WakeAllConditionVariable(&job->changed);
+#else
+	pthread_cond_broadcast(&job->changed);
+#endif
+}
+
+// Where the end of the file was copied to, once the input has reached it
+size_t es_input_tail_start(const es_input* input) {
+	return input->data != input->map ? input->map_size - input->capacity : (size_t)-1;
+}
+
+stream_seed stream_seed_from(const output_stream* stream, size_t tail_start) {
+	const es_input* input = &stream->input;
+	stream_seed seed = { 0 };
+	size_t base = input->data != input->map ? tail_start : 0;
+
+	seed.tail = input->data != input->map;
+	seed.offset = base + input->pos;
+	if (stream->frame != NULL && stream->frame_size_bytes > 0) {
+		seed.frame_offset = base + (size_t)(stream->frame - input->data);
+		seed.frame_size = stream->frame_size_bytes;
+		seed.nal_types = stream->nal_types;
+	}
+	seed.units_read = stream->units_read;
+	seed.pts = stream->pts;
+	seed.dts = stream->dts;
+	seed.pcr = stream->pcr;
+	seed.frame_duration = stream->frame_duration;
+	return seed;
+}
+
+bool stream_seed_equal(const stream_seed* a, const stream_seed* b) {
+	return a->offset == b->offset && a->frame_offset == b->frame_offset && a->frame_size == b->frame_size && a->nal_types == b->nal_types &&
+		a->tail == b->tail && a->units_read == b->units_read && a->pts == b->pts && a->dts == b->dts && a->pcr == b->pcr &&
+		a->frame_duration == b->frame_duration;
+}
+
+/*
+	Puts a stream where a seed was taken. The mapping is shared; the end of the
+	file is copied again, as the input did when it got there
+*/
+void output_stream_from_seed(output_stream* stream, const es_input* source, size_t tail_start, const stream_seed* seed) {
+	es_input* input = &stream->input;
+	memset(input, 0, sizeof(es_input));
+	input->map = source->map;
+	input->map_size = source->map_size;
+
+	if (!seed->tail) {
+		input->data = source->map;
+		input->size = source->map_size - ES_INPUT_PADDING;
+		input->pos = seed->offset;
+	} else {
+		size_t remaining = source->map_size - tail_start;
+		input->buffer = (u_char*)calloc(remaining + ES_INPUT_PADDING, 1);
+		memcpy(input->buffer, source->map + tail_start, remaining);
+		input->capacity = remaining;
+		input->data = input->buffer;
+		input->size = remaining;
+		input->pos = seed->offset - tail_start;
+		input->eof = true;
+	}
+
+	stream->units_read = seed->units_read;
+	stream->pts = seed->pts;
+	stream->dts = seed->dts;
+	stream->pcr = seed->pcr;
+	stream->frame_duration = seed->frame_duration;
+	if (seed->frame_size > 0) {
+		stream->frame = input->data + (seed->frame_offset - (seed->tail ? tail_start : 0));
+		stream->frame_size_bytes = seed->frame_size;
+		stream->initial_frame_size_bytes = seed->frame_size;
+		stream->nal_types = seed->nal_types;
+	}
+}
+
+/*
+	Reads every unit once to find the segment starts. Returns false when the
+	inputs cannot be mapped, which the workers need
+*/
+bool index_segments(parallel_job* job) {
+	output_stream vstream = new_output_stream(PES_H264_PID);
+	output_stream astream = new_output_stream(PES_ADTS_PID);
+	int capacity = 64;
+
+	if (!es_input_open(&vstream.input, getenv("TSMUX_H264_FILE"), false) || !es_input_open(&astream.input, getenv("TSMUX_ADTS_FILE"), false)) {
+		es_input_close(&vstream.input);
+		return false;
+	}
+	if (vstream.input.map == NULL || astream.input.map == NULL || !open_stream_timestamps(&vstream, &astream, job->timestamps, false)) {
+		es_input_close(&vstream.input);
+		es_input_close(&astream.input);
+		es_timestamps_close(&job->timestamps[0]);
+		es_timestamps_close(&job->timestamps[1]);
+		return false;
+	}
+	job->has_timestamps[0] = vstream.timestamps != NULL;
+	job->has_timestamps[1] = astream.timestamps != NULL;
+	unsigned long segment_start_dts = first_segment_start_dts(&vstream);
+	bool audio_ended = false;
+
+	// The first segment starts with the inputs
+	job->seeds = (segment_seed*)calloc(capacity, sizeof(segment_seed));
+	job->seeds[0].video = stream_seed_from(&vstream, 0);
+	job->seeds[0].audio = stream_seed_from(&astream, 0);
+	job->segment_count = 1;
+
+	while (true) {
+		vstream.frame = NULL;
+		load_stream_frame(&vstream);
+		if (vstream.frame_size_bytes == 0) {
+			break;
+		}
+		if (!access_unit_is_random_access(&vstream) || !segment_cut_due(&vstream, segment_start_dts)) {
+			continue;
+		}
+
+		// The audio is written until its pts passes the picture's dts, then the segment starts.
+		// Once it has ended, the video goes on alone and every later segment starts at the audio's end
+		while (!audio_ended && astream.pts <= vstream.dts) {
+			astream.frame = NULL;
+			load_stream_frame(&astream);
+			audio_ended = astream.frame_size_bytes == 0;
+		}
+
+		if (job->segment_count == capacity) {
+			capacity *= 2;
+			job->seeds = (segment_seed*)realloc(job->seeds, capacity * sizeof(segment_seed));
+		}
+		astream.frame = NULL;
+		job->seeds[job->segment_count].video = stream_seed_from(&vstream, es_input_tail_start(&vstream.input));
+		job->seeds[job->segment_count].audio = stream_seed_from(&astream, es_input_tail_start(&astream.input));
+		job->segment_count += 1;
+		vstream.frames_read -= video_frames_written(&vstream);
+		segment_start_dts = vstream.dts;
+	}
+
+	// The workers share the timestamps, which must not be read any further
+	for (int i = 0; i < 2; i++) {
+		while (job->has_timestamps[i] && es_timestamps_read(&job->timestamps[i]));
+	}
+
+	job->video_input = vstream.input;
+	job->audio_input = astream.input;
+	job->video_tail_start = es_input_tail_start(&vstream.input);
+	job->audio_tail_start = es_input_tail_start(&astream.input);
+	return true;
+}
+
+void mux_segment(parallel_job* job, int index) {
+	segment_result* result = &job->results[index];
+	output_stream vstream = new_output_stream(PES_H264_PID);
+	output_stream astream = new_output_stream(PES_ADTS_PID);
+	ts_writer* writer = (ts_writer*)calloc(1, sizeof(ts_writer));
+
+	output_stream_from_seed(&vstream, &job->video_input, job->video_tail_start, &job->seeds[index].video);
+	output_stream_from_seed(&astream, &job->audio_input, job->audio_tail_start, &job->seeds[index].audio);
+	if (job->has_timestamps[0]) {
+		vstream.timestamps = &job->timestamps[0];
+	}
+	if (job->has_timestamps[1]) {
+		astream.timestamps = &job->timestamps[1];
+	}
+	if (index > 0) {
+		// The access unit that opens the segment has its timestamps counted already
+		vstream.pes_initialized = false;
+		vstream.frames_read = 1;
+	}
+
+	writer->last_pat_idx = -DEFAULT_PAT_INTERVAL;
+	writer->last_pmt_idx = -DEFAULT_PMT_INTERVAL;
+	writer->last_sdt_idx = -DEFAULT_SDT_INTERVAL;
+	writer->psi = &job->psi;
+	writer->audio_stream = &astream;
+	writer->video_stream = &vstream;
+	writer->segment_index = index;
+	writer->segment_start_dts = index > 0 ? vstream.dts : first_segment_start_dts(&vstream);
+	writer->memory_output = &result->data;
+
+	if (index > 0) {
+		// The packet that cut the segment, as init_next_ts_file leaves the writer
+		writer->curr_packet_type = PES_H264;
+		write_pes_packet(writer);
+		finish_ts_packet(writer);
+		writer->curr_packet_idx += 1;
+	}
+	while (write_next_packet(writer));
+	flush_ts_output(writer);
+
+	result->duration = video_segment_duration(&vstream, writer->segment_start_dts);
+	result->ended = !writer->cut_reached;
+	result->end.video = stream_seed_from(&vstream, job->video_tail_start);
+	result->end.audio = stream_seed_from(&astream, job->audio_tail_start);
+
+	free(vstream.input.buffer);
+	free(astream.input.buffer);
+	free(writer);
+}
+
+#ifdef _WIN32
+DWORD WINAPI parallel_worker(LPVOID arg) {
+#else
+void* parallel_worker(void* arg) {
+#endif
+	parallel_job* job = (parallel_job*)arg;
+
+	parallel_lock(job);
+	while (true) {
+		// Stay a bounded number of segments ahead of the writer
+		while (!job->abort && job->next_segment < job->segment_count && job->next_segment >= job->written_count + job->max_ahead) {
+			parallel_wait(job);
+		}
+		if (job->abort || job->next_segment >= job->segment_count) {
+			break;
+		}
+		int index = job->next_segment++;
+		parallel_unlock(job);
+
+		mux_segment(job, index);
+
+		parallel_lock(job);
+		job->results[index].done = true;
+		parallel_notify(job);
+	}
+	parallel_unlock(job);
+	return 0;
+}
+
+// Adds the packets of the segments before to the continuity counters, which the segment started at zero
+void offset_continuity_counters(fmp4_buffer* segment, unsigned counts[5]) {
+	unsigned offsets[5];
+	memcpy(offsets, counts, sizeof(offsets));
+
+	for (size_t i = 0; i + MPEGTS_PACKET_SIZE <= segment->size; i += MPEGTS_PACKET_SIZE) {
+		u_char* header = segment->data + i;
+		int pid = ((header[1] & 0x1f) << 8) | header[2];
+		int counter = pid == TS_PSI_PAT_PID ? 0 : pid == PMT_PID ? 1 : pid == PES_H264_PID ? 2 : pid == PES_ADTS_PID ? 3 : 4;
+
+		header[3] = (header[3] & 0xf0) | ((header[3] + offsets[counter]) & 0x0f);
+		counts[counter] += 1;
+	}
+}
+
+/*
+	Returns false when nothing was written because the inputs are not suited,
+	or when the seeds did not hold and the sequential muxer has to run
+*/
+bool run_parallel_writer(int thread_count) {
+	parallel_job job = { .max_ahead = thread_count * PARALLEL_SEGMENTS_PER_THREAD };
+	unsigned counts[5] = { 0 };
+	bool ok = true;
+
+	if (!index_segments(&job)) {
+		return false;
+	}
+	build_psi_packets(&job.psi);
+	job.results = (segment_result*)calloc(job.segment_count, sizeof(segment_result));
+	thread_count = MIN(thread_count, job.segment_count);
+
+#ifdef _WIN32
+	HANDLE* threads = (HANDLE*)calloc(thread_count, sizeof(HANDLE));
+	InitializeCriticalSection(&job.lock);
+	InitializeConditionVariable(&job.changed);
+	for (int i = 0; i < thread_count; i++) {
+		threads[i] = CreateThread(NULL, 0, parallel_worker, &job, 0, NULL);
+	}
+#else
+	pthread_t* threads = (pthread_t*)calloc(thread_count, sizeof(pthread_t));
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.changed, NULL);
+	for (int i = 0; i < thread_count; i++) {
+		pthread_create(&threads[i], NULL, parallel_worker, &job);
+	}
+#endif
+
+	FILE* hls = fopen(HLS_PLAYLIST_FILENAME, "w");
+	fprintf(hls, "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%d\n", DEFAULT_TS_FILE_DURATION / 1000);
+
+	for (int i = 0; i < job.segment_count && ok; i++) {
+		char segment_filename[32];
+		segment_result* result = &job.results[i];
+
+		parallel_lock(&job);
+		while (!result->done) {
+			parallel_wait(&job);
+		}
+		parallel_unlock(&job);
+
+		// Each segment must end where the next one was seeded, and only the last one at the end of the inputs
+		bool last = i == job.segment_count - 1;
+		ok = last ? result->ended : !result->ended &&
+			stream_seed_equal(&result->end.video, &job.seeds[i + 1].video) &&
+			stream_seed_equal(&result->end.audio, &job.seeds[i + 1].audio);
+		if (!ok) {
+			printf("Warning: segment %d did not end where segment %d starts, muxing sequentially\n", i, i + 1);
+			break;
+		}
+
+		offset_continuity_counters(&result->data, counts);
+		sprintf(segment_filename, "%s-%d.ts", OUTPUT_SEGMENT_PREFIX, i);
+		FILE* segment = fopen(segment_filename, "wb");
+		fwrite(result->data.data, 1, result->data.size, segment);
+		fclose(segment);
+		fprintf(hls, "#EXTINF:%.3f\n%s\n", result->duration, segment_filename);
+
+		free(result->data.data);
+		result->data.data = NULL;
+		parallel_lock(&job);
+		job.written_count = i + 1;
+		parallel_notify(&job);
+		parallel_unlock(&job);
+	}
+
+	fputs("#EXT-X-ENDLIST", hls);
+	fclose(hls);
+
+	parallel_lock(&job);
+	job.abort = true;
+	parallel_notify(&job);
+	parallel_unlock(&job);
+#ifdef _WIN32
+	WaitForMultipleObjects(thread_count, threads, TRUE, INFINITE);
+	for (int i = 0; i < thread_count; i++) {
+		CloseHandle(threads[i]);
+	}
+	DeleteCriticalSection(&job.lock);
+#else
+	for (int i = 0; i < thread_count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&job.lock);
+	pthread_cond_destroy(&job.changed);
+#endif
+
+	for (int i = 0; i < job.segment_count; i++) {
+		free(job.results[i].data.data);
+	}
+	free(threads);
+	free(job.results);
+	free(job.seeds);
+	es_input_close(&job.video_input);
+	es_input_close(&job.audio_input);
+	es_timestamps_close(&job.timestamps[0]);
+	es_timestamps_close(&job.timestamps[1]);
+	return ok;
+}
+
+int cpu_count(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	return (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
 int main() {
-	run_writer();
+	const char* format = getenv("TSMUX_FORMAT");
+
+	const char* threads = getenv("TSMUX_THREADS");
+	// 0 uses every core
+	int thread_count = threads != NULL ? (atoi(threads) > 0 ? atoi(threads) : cpu_count()) : 1;
+
+	if (format != NULL && strcmp(format, "fmp4") == 0) {
+		if (getenv("TSMUX_H264_TIMESTAMPS") != NULL || getenv("TSMUX_ADTS_TIMESTAMPS") != NULL) {
+			printf("Warning: fMP4 output is timed at the fixed rates, capture timestamps are ignored\n");
+		}
+		run_fmp4_writer();
+	} else if (thread_count > 1 && getenv("TSMUX_LIVE") == NULL && run_parallel_writer(thread_count)) {
+		return 0;
+	} else {
+		run_writer();
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
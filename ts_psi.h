@@ -0,0 +1,210 @@
+#pragma once
+
+/*
+	Program specific information for MPEG-TS: PAT, PMT and SDT sections built
+	from a program description, each serialized as a whole 188 byte packet with
+	its CRC. The packets are built once; emitting one only sets its continuity
+	counter.
+
+	Every table is a single section that must fit in one packet, which holds
+	any program with a handful of streams.
+*/
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TS_PSI_PACKET_SIZE 188
+#define TS_PSI_PAT_PID 0x0000
+#define TS_PSI_SDT_PID 0x0011
+#define TS_PSI_PAT_TABLE_ID 0x00
+#define TS_PSI_PMT_TABLE_ID 0x02
+#define TS_PSI_SDT_TABLE_ID 0x42
+
+#define TS_PSI_STREAM_TYPE_H264 0x1b
+#define TS_PSI_STREAM_TYPE_ADTS 0x0f
+#define TS_PSI_SERVICE_TYPE_TV 0x01
+
+typedef struct {
+	uint16_t pid;
+	uint8_t stream_type;
+	const unsigned char* descriptors; // ES_info descriptors, or NULL
+	size_t descriptors_size;
+} ts_psi_stream;
+
+typedef struct {
+	uint16_t transport_stream_id;
+	uint16_t original_network_id; // SDT only
+	uint16_t program_number;
+	uint16_t pmt_pid;
+	uint16_t pcr_pid;
+	const ts_psi_stream* streams;
+	int stream_count;
+	const char* provider_name;    // SDT only
+	const char* service_name;     // SDT only
+} ts_psi_program;
+
+/*
+	MPEG-2 CRC32: polynomial 0x04c11db7, most significant bit first, initial
+	value 0xffffffff and no final xor. A section followed by its CRC sums to 0
+*/
+static uint32_t ts_psi_crc_table[8][256];
+static bool ts_psi_crc_ready = false;
+
+static void ts_psi_crc32_init(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i << 24;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = crc & 0x80000000 ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+		}
+		ts_psi_crc_table[0][i] = crc;
+	}
+	// Table k advances a byte followed by k zero bytes
+	for (int k = 1; k < 8; k++) {
+		for (int i = 0; i < 256; i++) {
+			uint32_t prev = ts_psi_crc_table[k - 1][i];
+			ts_psi_crc_table[k][i] = (prev << 8) ^ ts_psi_crc_table[0][prev >> 24];
+		}
+	}
+	ts_psi_crc_ready = true;
+}
+
+// Slice-by-8: eight independent lookups per 8 bytes
+static uint32_t ts_psi_crc32(const unsigned char* data, size_t size) {
+	uint32_t crc = 0xffffffff;
+	size_t i = 0;
+
+	if (!ts_psi_crc_ready) {
+		ts_psi_crc32_init();
+	}
+	for (; i + 8 <= size; i += 8) {
+		const unsigned char* p = data + i;
+		uint32_t word = crc ^ ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]);
+		crc = ts_psi_crc_table[7][word >> 24] ^ ts_psi_crc_table[6][(word >> 16) & 0xff] ^
+			ts_psi_crc_table[5][(word >> 8) & 0xff] ^ ts_psi_crc_table[4][word & 0xff] ^
+			ts_psi_crc_table[3][p[4]] ^ ts_psi_crc_table[2][p[5]] ^
+			ts_psi_crc_table[1][p[6]] ^ ts_psi_crc_table[0][p[7]];
+	}
+	for (; i < size; i++) {
+		crc = (crc << 8) ^ ts_psi_crc_table[0][(crc >> 24) ^ data[i]];
+	}
+	return crc;
+}
+
+static void ts_psi_put_u16(unsigned char* dest, unsigned value) {
+	dest[0] = (unsigned char)(value >> 8);
+	dest[1] = (unsigned char)value;
+}
+
+/*
+	Writes the packet header and the pointer field, then the section header up
+	to the table id extension; returns where the section starts
+*/
+static size_t ts_psi_begin(unsigned char* packet, uint16_t pid, uint8_t table_id, uint16_t table_id_extension) {
+	packet[0] = 0x47;
+	packet[1] = 0x40 | (unsigned char)(pid >> 8); // payload unit start
+	packet[2] = (unsigned char)pid;
+	packet[3] = 0x10;                             // payload only, continuity counter 0
+	packet[4] = 0x00;                             // the section follows the pointer field
+
+	packet[5] = table_id;
+	// Section syntax indicator; the section length is set by ts_psi_end
+	packet[6] = table_id == TS_PSI_SDT_TABLE_ID ? 0xf0 : 0xb0;
+	packet[7] = 0x00;
+	ts_psi_put_u16(packet + 8, table_id_extension);
+	packet[10] = 0xc1; // version 0, current
+	packet[11] = 0x00; // section number
+	packet[12] = 0x00; // last section number
+	return 5;
+}
+
+// Sets the section length, appends the CRC and stuffs the packet. False when the section does not fit
+static bool ts_psi_end(unsigned char* packet, size_t section_start, size_t size) {
+	if (size + 4 > TS_PSI_PACKET_SIZE) {
+		return false;
+	}
+
+	size_t section_length = size + 4 - (section_start + 3);
+	packet[section_start + 1] |= (unsigned char)(section_length >> 8);
+	packet[section_start + 2] = (unsigned char)section_length;
+
+	uint32_t crc = ts_psi_crc32(packet + section_start, size - section_start);
+	ts_psi_put_u16(packet + size, crc >> 16);
+	ts_psi_put_u16(packet + size + 2, crc & 0xffff);
+	memset(packet + size + 4, 0xff, TS_PSI_PACKET_SIZE - size - 4);
+	return true;
+}
+
+// A single program, carried by the PMT on program->pmt_pid
+static bool ts_psi_build_pat(const ts_psi_program* program, unsigned char* packet) {
+	size_t start = ts_psi_begin(packet, TS_PSI_PAT_PID, TS_PSI_PAT_TABLE_ID, program->transport_stream_id);
+	size_t size = start + 8;
+
+	ts_psi_put_u16(packet + size, program->program_number);
+	ts_psi_put_u16(packet + size + 2, 0xe000 | program->pmt_pid);
+	return ts_psi_end(packet, start, size + 4);
+}
+
+static bool ts_psi_build_pmt(const ts_psi_program* program, unsigned char* packet) {
+	size_t start = ts_psi_begin(packet, program->pmt_pid, TS_PSI_PMT_TABLE_ID, program->program_number);
+	size_t size = start + 8;
+
+	ts_psi_put_u16(packet + size, 0xe000 | program->pcr_pid);
+	ts_psi_put_u16(packet + size + 2, 0xf000); // no program descriptors
+	size += 4;
+
+	for (int i = 0; i < program->stream_count; i++) {
+		const ts_psi_stream* stream = &program->streams[i];
+		if (size + 5 + stream->descriptors_size + 4 > TS_PSI_PACKET_SIZE) {
+			return false;
+		}
+		packet[size] = stream->stream_type;
+		ts_psi_put_u16(packet + size + 1, 0xe000 | stream->pid);
+		ts_psi_put_u16(packet + size + 3, 0xf000 | (unsigned)stream->descriptors_size);
+		if (stream->descriptors_size > 0) {
+			memcpy(packet + size + 5, stream->descriptors, stream->descriptors_size);
+		}
+		size += 5 + stream->descriptors_size;
+	}
+	return ts_psi_end(packet, start, size);
+}
+
+// One service, the program, named by a service descriptor
+static bool ts_psi_build_sdt(const ts_psi_program* program, unsigned char* packet) {
+	size_t start = ts_psi_begin(packet, TS_PSI_SDT_PID, TS_PSI_SDT_TABLE_ID, program->transport_stream_id);
+	const char* provider = program->provider_name != NULL ? program->provider_name : "";
+	const char* service = program->service_name != NULL ? program->service_name : "";
+	size_t provider_size = strlen(provider);
+	size_t service_size = strlen(service);
+	size_t descriptor_size = 2 + 3 + provider_size + service_size;
+	size_t size = start + 8;
+
+	if (provider_size > 255 || service_size > 255 || size + 3 + 5 + descriptor_size + 4 > TS_PSI_PACKET_SIZE) {
+		return false;
+	}
+
+	ts_psi_put_u16(packet + size, program->original_network_id);
+	packet[size + 2] = 0xff;
+	size += 3;
+
+	ts_psi_put_u16(packet + size, program->program_number);
+	packet[size + 2] = 0xfc;                                     // no EIT
+	ts_psi_put_u16(packet + size + 3, 0x8000 | (unsigned)descriptor_size); // running, not scrambled
+	size += 5;
+
+	packet[size] = 0x48; // service descriptor
+	packet[size + 1] = (unsigned char)(descriptor_size - 2);
+	packet[size + 2] = TS_PSI_SERVICE_TYPE_TV;
+	packet[size + 3] = (unsigned char)provider_size;
+	memcpy(packet + size + 4, provider, provider_size);
+	packet[size + 4 + provider_size] = (unsigned char)service_size;
+	memcpy(packet + size + 5 + provider_size, service, service_size);
+	size += descriptor_size;
+
+	return ts_psi_end(packet, start, size);
+}
+
+static void ts_psi_set_continuity(unsigned char* packet, unsigned counter) {
+	packet[3] = (packet[3] & 0xf0) | (counter & 0x0f);
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+/*
+	Bounds-safe scanners for Annex-B start codes and ADTS syncwords.
+
+	Every scan returns the offset of the first match at or after from, or size
+	when there is none, and never reads buf[size] or beyond: a match must fit
+	entirely inside the buffer.
+
+	The SSE2/AVX2 kernels compare three shifted loads a whole register at a time
+	and fall back to the scalar reference for the last bytes, so every kernel
+	returns the same offsets.
+*/
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TS_SCAN_SSE2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define TS_SCAN_TARGET_AVX2
+#else
+#define TS_SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef enum { TS_SCAN_AUTO, TS_SCAN_SCALAR, TS_SCAN_SSE2_KERNEL, TS_SCAN_AVX2_KERNEL } ts_scan_kernel;
+
+/*
+	Scalar reference: first i >= from with buf[i] == 0, buf[i + 1] == 0 and
+	third_lo <= buf[i + 2] <= third_hi
+*/
+static size_t ts_scan_zero_pair_scalar(const unsigned char* buf, size_t size, size_t from, unsigned char third_lo, unsigned char third_hi) {
+	for (size_t i = from; i + 2 < size; i++) {
+		if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] >= third_lo && buf[i + 2] <= third_hi) {
+			return i;
+		}
+	}
+	return size;
+}
+
+// First i >= from with buf[i] == 0xff and buf[i + 1] == 0xf1
+static size_t ts_scan_adts_sync_scalar(const unsigned char* buf, size_t size, size_t from) {
+	for (size_t i = from; i + 1 < size; i++) {
+		if (buf[i] == 0xff && buf[i + 1] == 0xf1) {
+			return i;
+		}
+	}
+	return size;
+}
+
+#if TS_SCAN_SSE2
+static inline unsigned ts_scan_ctz(unsigned mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+static size_t ts_scan_zero_pair_sse2(const unsigned char* buf, size_t size, size_t from, unsigned char third_lo, unsigned char third_hi) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo = _mm_set1_epi8((char)third_lo);
+	const __m128i range = _mm_set1_epi8((char)(third_hi - third_lo));
+	size_t i = from;
+
+	// The third load ends at buf[i + 17]
+	for (; i + 18 <= size; i += 16) {
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(buf + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(buf + i + 1));
+		__m128i b2 = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(buf + i + 2)), lo);
+		__m128i third = _mm_cmpeq_epi8(_mm_min_epu8(b2, range), b2);
+		__m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)), third);
+		unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+		if (mask != 0) {
+			return i + ts_scan_ctz(mask);
+		}
+	}
+
+	return ts_scan_zero_pair_scalar(buf, size, i, third_lo, third_hi);
+}
+
+static size_t ts_scan_adts_sync_sse2(const unsigned char* buf, size_t size, size_t from) {
+	const __m128i ff = _mm_set1_epi8((char)0xff);
+	const __m128i f1 = _mm_set1_epi8((char)0xf1);
+	size_t i = from;
+
+	for (; i + 17 <= size; i += 16) {
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(buf + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(buf + i + 1));
+		__m128i hit = _mm_and_si128(_mm_cmpeq_epi8(b0, ff), _mm_cmpeq_epi8(b1, f1));
+		unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+		if (mask != 0) {
+			return i + ts_scan_ctz(mask);
+		}
+	}
+
+	return ts_scan_adts_sync_scalar(buf, size, i);
+}
+
+TS_SCAN_TARGET_AVX2 static size_t ts_scan_zero_pair_avx2(const unsigned char* buf, size_t size, size_t from, unsigned char third_lo, unsigned char third_hi) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i lo = _mm256_set1_epi8((char)third_lo);
+	const __m256i range = _mm256_set1_epi8((char)(third_hi - third_lo));
+	size_t i = from;
+
+	for (; i + 34 <= size; i += 32) {
+		__m256i b0 = _mm256_loadu_si256((const __m256i*)(buf + i));
+		__m256i b1 = _mm256_loadu_si256((const __m256i*)(buf + i + 1));
+		__m256i b2 = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(buf + i + 2)), lo);
+		__m256i third = _mm256_cmpeq_epi8(_mm256_min_epu8(b2, range), b2);
+		__m256i hit = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)), third);
+		unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+		if (mask != 0) {
+			return i + ts_scan_ctz(mask);
+		}
+	}
+
+	return ts_scan_zero_pair_sse2(buf, size, i, third_lo, third_hi);
+}
+
+TS_SCAN_TARGET_AVX2 static size_t ts_scan_adts_sync_avx2(const unsigned char* buf, size_t size, size_t from) {
+	const __m256i ff = _mm256_set1_epi8((char)0xff);
+	const __m256i f1 = _mm256_set1_epi8((char)0xf1);
+	size_t i = from;
+
+	for (; i + 33 <= size; i += 32) {
+		__m256i b0 = _mm256_loadu_si256((const __m256i*)(buf + i));
+		__m256i b1 = _mm256_loadu_si256((const __m256i*)(buf + i + 1));
+		__m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(b0, ff), _mm256_cmpeq_epi8(b1, f1));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+		if (mask != 0) {
+			return i + ts_scan_ctz(mask);
+		}
+	}
+
+	return ts_scan_adts_sync_sse2(buf, size, i);
+}
+
+// AVX2 needs both the CPU flag and the OS saving YMM state
+static bool ts_scan_has_avx2(void) {
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 1);
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+		return false;
+	}
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static ts_scan_kernel ts_scan_selected = TS_SCAN_AUTO;
+
+// TS_SCAN_AUTO picks the widest kernel the CPU supports
+static void ts_scan_set_kernel(ts_scan_kernel kernel) {
+#if TS_SCAN_SSE2
+	if (kernel == TS_SCAN_AUTO) {
+		kernel = ts_scan_has_avx2() ? TS_SCAN_AVX2_KERNEL : TS_SCAN_SSE2_KERNEL;
+	}
+#else
+	kernel = TS_SCAN_SCALAR;
+#endif
+	ts_scan_selected = kernel;
+}
+
+static size_t ts_scan_zero_pair(const unsigned char* buf, size_t size, size_t from, unsigned char third_lo, unsigned char third_hi) {
+	if (ts_scan_selected == TS_SCAN_AUTO) {
+		ts_scan_set_kernel(TS_SCAN_AUTO);
+	}
+	switch (ts_scan_selected) {
+#if TS_SCAN_SSE2
+	case TS_SCAN_AVX2_KERNEL:
+		return ts_scan_zero_pair_avx2(buf, size, from, third_lo, third_hi);
+	case TS_SCAN_SSE2_KERNEL:
+		return ts_scan_zero_pair_sse2(buf, size, from, third_lo, third_hi);
+#endif
+	default:
+		return ts_scan_zero_pair_scalar(buf, size, from, third_lo, third_hi);
+	}
+}
+
+// 00 00 01, the tail of both the 3 and 4 byte start codes
+static size_t ts_scan_start_code(const unsigned char* buf, size_t size, size_t from) {
+	return ts_scan_zero_pair(buf, size, from, 0x01, 0x01);
+}
+
+// 00 00 00 or 00 00 01: where a NAL unit ends
+static size_t ts_scan_nal_end(const unsigned char* buf, size_t size, size_t from) {
+	return ts_scan_zero_pair(buf, size, from, 0x00, 0x01);
+}
+
+static size_t ts_scan_adts_sync(const unsigned char* buf, size_t size, size_t from) {
+	if (ts_scan_selected == TS_SCAN_AUTO) {
+		ts_scan_set_kernel(TS_SCAN_AUTO);
+	}
+	switch (ts_scan_selected) {
+#if TS_SCAN_SSE2
+	case TS_SCAN_AVX2_KERNEL:
+		return ts_scan_adts_sync_avx2(buf, size, from);
+	case TS_SCAN_SSE2_KERNEL:
+		return ts_scan_adts_sync_sse2(buf, size, from);
+#endif
+	default:
+		return ts_scan_adts_sync_scalar(buf, size, from);
+	}
+}